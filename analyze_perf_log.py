@@ -0,0 +1,131 @@
+import sys
+import struct
+import argparse
+
+MAGIC = 0x4c504955
+RECORD = struct.Struct('<IHBB6I')
+PERF_SESSION = 1
+PERF_FRAME = 2
+PERF_REFRESH = 3
+PERF_HEAP = 4
+MODES = ['INIT', 'DU', 'GC16', 'GL16', 'GLR16', 'GLD16', 'DU4', 'A2', 'NONE']
+
+
+def mode_name(modes):
+    follow = modes >> 8
+    return MODES[modes & 0xff] + ('+' + MODES[follow] if follow != 8 else '')
+
+
+def unpack_area(position, size):
+    return position >> 16, position & 0xffff, size >> 16, size & 0xffff
+
+
+def read_log(path):
+    """
+    Read a performance log and return its capacity and the records that have been written, in order
+    """
+    with open(path, 'rb') as f:
+        data = f.read()
+    if len(data) < RECORD.size:
+        raise ValueError(path + ' is too short to be a performance log')
+    magic, _, _, _, record_size, capacity, *_ = RECORD.unpack_from(data, 0)
+    if magic != MAGIC or record_size != RECORD.size:
+        raise ValueError(path + ' is not a performance log')
+    records = []
+    for offset in range(RECORD.size, len(data) - RECORD.size + 1, RECORD.size):
+        time, session, kind, _, *values = RECORD.unpack_from(data, offset)
+        if kind == 0:
+            break
+        records.append((time, session, kind, values))
+    return capacity, records
+
+
+def split_sessions(records):
+    sessions = {}
+    for record in records:
+        sessions.setdefault(record[1], []).append(record)
+    return sessions
+
+
+def percentile(values, percent):
+    if not values:
+        return 0
+    values = sorted(values)
+    return values[max(0, (len(values) * percent + 99) // 100 - 1)]
+
+
+def summarize(session, records):
+    """
+    Print the totals for one session: frames, render times, refreshes by mode and the lowest heap seen
+    """
+    start = records[0][0]
+    frames = [r for r in records if r[2] == PERF_FRAME]
+    refreshes = [r for r in records if r[2] == PERF_REFRESH]
+    heaps = [r for r in records if r[2] == PERF_HEAP]
+    print('Session ' + str(session) + ': ' + str(len(records)) + ' records over ' + str((records[-1][0] - start) / 1000) + 's')
+
+    render = [r[3][2] / 1000 for r in frames]
+    drawn = [r for r in frames if unpack_area(r[3][0], r[3][1])[2] > 0]
+    print('  Frames: ' + str(len(frames)) + ', ' + str(len(drawn)) + ' with damage')
+    if frames:
+        print('  Render ms: p50 %.1f, p90 %.1f, max %.1f' % (percentile(render, 50), percentile(render, 90), max(render)))
+        last = frames[-1][3]
+        print('  Value writes: %d applied, %d coalesced, %d suppressed' % (last[3], last[4], last[5]))
+
+    by_mode = {}
+    for r in refreshes:
+        mode = mode_name(r[3][2])
+        _, _, width, height = unpack_area(r[3][0], r[3][1])
+        count, pixels, queued, busy = by_mode.get(mode, (0, 0, 0, 0))
+        by_mode[mode] = (count + 1, pixels + width * height, queued + r[3][3], busy + r[3][4])
+    for mode, (count, pixels, queued, busy) in sorted(by_mode.items()):
+        print('  Refresh %s: %d, %d px, %.0f ms busy, %.0f ms queued' % (mode, count, pixels, busy / 1000, queued / 1000))
+
+    if heaps:
+        print('  Heap: lowest free %d, lowest ever %d, smallest largest block %d, lowest PSRAM %d' % (
+            min(r[3][0] for r in heaps), min(r[3][1] for r in heaps), min(r[3][2] for r in heaps), min(r[3][3] for r in heaps)))
+
+
+def timeline(records):
+    """
+    Print every record of a session with its time since the session started
+    """
+    start = records[0][0]
+    for time, _, kind, values in records:
+        line = '%10.3f ' % ((time - start) / 1000)
+        if kind == PERF_SESSION:
+            line += 'session start, capacity ' + str(values[1])
+        elif kind == PERF_FRAME:
+            line += 'frame   %s render %.1fms' % ('%d,%d %dx%d' % unpack_area(values[0], values[1]), values[2] / 1000)
+        elif kind == PERF_REFRESH:
+            line += 'refresh %s %s queued %.0fms busy %.0fms event %d' % ('%d,%d %dx%d' % unpack_area(values[0], values[1]), mode_name(values[2]), values[3] / 1000, values[4] / 1000, values[5])
+        elif kind == PERF_HEAP:
+            line += 'heap    free %d lowest %d block %d psram %d' % tuple(values[:4])
+        else:
+            line += 'unknown record type ' + str(kind)
+        print(line)
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Summarize a performance log copied from the device SD card.')
+    parser.add_argument('log', help='the log file, normally perf.bin')
+    parser.add_argument('--session', type=int, help='only show this session')
+    parser.add_argument('--timeline', action='store_true', help='list every record as well as the summary')
+    args = parser.parse_args()
+
+    try:
+        capacity, records = read_log(args.log)
+    except ValueError as e:
+        print('Error: ' + str(e))
+        sys.exit(1)
+    print(str(len(records)) + ' of ' + str(capacity) + ' records used')
+    for session, session_records in sorted(split_sessions(records).items()):
+        if args.session is not None and session != args.session:
+            continue
+        summarize(session, session_records)
+        if args.timeline:
+            timeline(session_records)
+
+
+if __name__ == '__main__':
+    main()
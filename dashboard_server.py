@@ -0,0 +1,45 @@
+import json
+import time
+import argparse
+from http.server import BaseHTTPRequestHandler, HTTPServer
+
+requests = 0
+
+
+class DashboardHandler(BaseHTTPRequestHandler):
+    """
+    Serve a dashboard document for testing dashboard mode. The temperature changes on every
+    request and the humidity on every third one, so each refresh should only cover those labels.
+    """
+
+    def do_GET(self):
+        global requests
+        if self.path != '/dashboard.json':
+            self.send_error(404)
+            return
+        document = {
+            'room': 'Office',
+            'temperature': round(20 + (requests % 10) * 0.5, 1),
+            'humidity': 40 + requests // 3,
+            'updated': time.strftime('%H:%M'),
+            'forecast': [{'day': 'Mon', 'high': 18}, {'day': 'Tue', 'high': 21}],
+        }
+        requests += 1
+        body = json.dumps(document).encode()
+        self.send_response(200)
+        self.send_header('Content-Type', 'application/json')
+        self.send_header('Content-Length', str(len(body)))
+        self.end_headers()
+        self.wfile.write(body)
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Serve a changing dashboard document for dashboard mode.')
+    parser.add_argument('--port', type=int, default=8080)
+    args = parser.parse_args()
+    print('Serving http://0.0.0.0:' + str(args.port) + '/dashboard.json')
+    HTTPServer(('', args.port), DashboardHandler).serve_forever()
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,140 @@
+import sys
+import socket
+import struct
+import argparse
+
+SCREEN_WIDTH = 540
+SCREEN_HEIGHT = 960
+TILE_RAW = 0
+TILE_RLE = 1
+
+
+def read_pgm(path):
+    """
+    Read a binary (P5) PGM file and return its width, height and 4-bit pixels
+    """
+    with open(path, 'rb') as f:
+        data = f.read()
+    fields = []
+    pos = 0
+    while len(fields) < 4:
+        while data[pos:pos + 1].isspace():
+            pos += 1
+        if data[pos:pos + 1] == b'#':
+            pos = data.index(b'\n', pos)
+            continue
+        start = pos
+        while not data[pos:pos + 1].isspace():
+            pos += 1
+        fields.append(data[start:pos])
+    if fields[0] != b'P5' or int(fields[3]) > 255:
+        raise ValueError(path + ' is not an 8-bit binary PGM')
+    width, height = int(fields[1]), int(fields[2])
+    pixels = data[pos + 1:pos + 1 + width * height]
+    return width, height, bytes(p >> 4 for p in pixels)
+
+
+def demo_frame(index):
+    """
+    Draw a test frame: a grey background, a bar that grows each frame and a moving block
+    """
+    frame = bytearray([12]) * (SCREEN_WIDTH * SCREEN_HEIGHT)
+    bar = (index * 37) % (SCREEN_WIDTH - 40)
+    for y in range(100, 140):
+        frame[y * SCREEN_WIDTH + 20:y * SCREEN_WIDTH + 20 + bar] = bytes([3]) * bar
+    block_x = (index * 61) % (SCREEN_WIDTH - 80)
+    block_y = 300 + (index * 29) % 500
+    for y in range(block_y, block_y + 80):
+        frame[y * SCREEN_WIDTH + block_x:y * SCREEN_WIDTH + block_x + 80] = bytes([index % 16]) * 80
+    return bytes(frame)
+
+
+def crop(frame, x, y, width, height):
+    return b''.join(frame[row * SCREEN_WIDTH + x:row * SCREEN_WIDTH + x + width] for row in range(y, y + height))
+
+
+def encode_raw(pixels, width, height):
+    out = bytearray()
+    for row in range(height):
+        line = pixels[row * width:(row + 1) * width]
+        if width & 1:
+            line += b'\x00'
+        out += bytes((line[i] << 4) | line[i + 1] for i in range(0, len(line), 2))
+    return bytes(out)
+
+
+def encode_rle(pixels):
+    out = bytearray()
+    i = 0
+    while i < len(pixels):
+        value = pixels[i]
+        run = 1
+        while run < 16 and i + run < len(pixels) and pixels[i + run] == value:
+            run += 1
+        out.append(((run - 1) << 4) | value)
+        i += run
+    return bytes(out)
+
+
+def changed_tiles(previous, frame, tile_width, tile_height):
+    """
+    Yield the area of each tile that differs from the previous frame
+    """
+    for y in range(0, SCREEN_HEIGHT, tile_height):
+        height = min(tile_height, SCREEN_HEIGHT - y)
+        for x in range(0, SCREEN_WIDTH, tile_width):
+            width = min(tile_width, SCREEN_WIDTH - x)
+            if previous is None or any(previous[row * SCREEN_WIDTH + x:row * SCREEN_WIDTH + x + width] != frame[row * SCREEN_WIDTH + x:row * SCREEN_WIDTH + x + width] for row in range(y, y + height)):
+                yield x, y, width, height
+
+
+def send_frame(sock, previous, frame, tile_width, tile_height):
+    """
+    Send the tiles that changed, then the end of frame marker, and wait for the device to acknowledge it
+    """
+    tiles = 0
+    sent = 0
+    for x, y, width, height in changed_tiles(previous, frame, tile_width, tile_height):
+        pixels = crop(frame, x, y, width, height)
+        raw = encode_raw(pixels, width, height)
+        rle = encode_rle(pixels)
+        encoding, payload = (TILE_RLE, rle) if len(rle) < len(raw) else (TILE_RAW, raw)
+        message = struct.pack('<cHHHHBI', b'T', x, y, width, height, encoding, len(payload)) + payload
+        sock.sendall(message)
+        tiles += 1
+        sent += len(message)
+    sock.sendall(b'F')
+    if sock.recv(1) != b'A':
+        raise ConnectionError('device did not acknowledge the frame')
+    return tiles, sent + 1
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Send frames to a device in thin client mode, as tiles that changed since the last frame.')
+    parser.add_argument('host', help='address of the device')
+    parser.add_argument('frames', nargs='*', help='540x960 8-bit PGM files to send in order')
+    parser.add_argument('--port', type=int, default=5150)
+    parser.add_argument('--tile', type=int, nargs=2, default=[60, 32], metavar=('WIDTH', 'HEIGHT'))
+    parser.add_argument('--demo', type=int, default=0, metavar='COUNT', help='send COUNT generated test frames')
+    args = parser.parse_args()
+
+    frames = []
+    for path in args.frames:
+        width, height, pixels = read_pgm(path)
+        if (width, height) != (SCREEN_WIDTH, SCREEN_HEIGHT):
+            print('Error: ' + path + ' is ' + str(width) + 'x' + str(height))
+            sys.exit(1)
+        frames.append(pixels)
+    frames += [demo_frame(i) for i in range(args.demo)]
+
+    previous = None
+    with socket.create_connection((args.host, args.port)) as sock:
+        sock.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+        for index, frame in enumerate(frames):
+            tiles, sent = send_frame(sock, previous, frame, args.tile[0], args.tile[1])
+            print('Frame ' + str(index) + ': ' + str(tiles) + ' tiles, ' + str(sent) + ' bytes')
+            previous = frame
+
+
+if __name__ == '__main__':
+    main()
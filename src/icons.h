@@ -0,0 +1,28 @@
+// Vector icons, drawn on a 256x256 grid and scaled to any size when they are shown.
+// Each path is a list of commands: 'M' x y starts a shape, 'L' x y draws a line,
+// 'Q' cx cy x y draws a curve bent towards the control point, 'Z' closes the shape, and 0 ends the icon.
+// Shapes are filled even-odd, so a shape inside another cuts a hole in it.
+
+// 'home', vector, 256x256 grid
+const unsigned char icon_home [] PROGMEM = {
+	'M', 128, 24, 'L', 240, 120, 'L', 208, 120, 'L', 208, 232, 'L', 48, 232, 'L', 48, 120, 'L', 16, 120, 'Z',
+	'M', 104, 232, 'L', 104, 160, 'L', 152, 160, 'L', 152, 232, 'Z',
+	0
+};
+
+// 'check', vector, 256x256 grid
+const unsigned char icon_check [] PROGMEM = {
+	'M', 24, 136, 'L', 64, 96, 'L', 104, 136, 'L', 200, 40, 'L', 240, 80, 'L', 104, 216, 'Z',
+	0
+};
+
+// 'clock', vector, 256x256 grid
+const unsigned char icon_clock [] PROGMEM = {
+	'M', 240, 128, 'Q', 240, 174, 207, 207, 'Q', 174, 240, 128, 240, 'Q', 82, 240, 49, 207, 'Q', 16, 174, 16, 128,
+	'Q', 16, 82, 49, 49, 'Q', 82, 16, 128, 16, 'Q', 174, 16, 207, 49, 'Q', 240, 82, 240, 128, 'Z',
+	'M', 216, 128, 'Q', 216, 164, 190, 190, 'Q', 164, 216, 128, 216, 'Q', 92, 216, 66, 190, 'Q', 40, 164, 40, 128,
+	'Q', 40, 92, 66, 66, 'Q', 92, 40, 128, 40, 'Q', 164, 40, 190, 66, 'Q', 216, 92, 216, 128, 'Z',
+	'M', 120, 56, 'L', 136, 56, 'L', 136, 136, 'L', 120, 136, 'Z',
+	'M', 136, 120, 'L', 184, 120, 'L', 184, 136, 'L', 136, 136, 'Z',
+	0
+};
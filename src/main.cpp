@@ -3,16 +3,52 @@
 #include <M5EPD.h>
 #include "DSEG7_Classic_Mini_Regular_60.h"
 #include "frame.h"
+#include "icons.h"
 #include "SPIFFS.h"
 #include "prog_quotes.h"
 #include <WiFi.h>
+#include <HTTPClient.h>
 #include <esp_wifi.h>
+#include <atomic>
+#include <algorithm>
+#include <memory>
+#include <cassert>
+#ifndef ARDUINO
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#endif
 
 const bool debugMode = false;
 const bool debugMessageSync = false;
+const bool benchmarkMode = false;
 uint8_t *screenBuffer;
 const int screenWidth = 540;
 const int screenHeight = 960;
+// Must be a power of two.
+const uint32_t commandQueueSize = 32;
+// Thin client mode: the screen is rendered by a host and streamed in as tiles.
+const bool thinClientMode = false;
+const char *wifiSsid = "";
+const char *wifiPassword = "";
+const uint16_t thinClientPort = 5150;
+const uint32_t maxTilePayload = 16384;
+// Dashboard mode: the device wakes on a timer to fetch values and show them.
+const bool dashboardMode = false;
+const char *dashboardUrl = "http://192.168.1.2:8080/dashboard.json";
+const uint32_t dashboardPeriod = 300;
+// Performance log: frame, refresh and heap records are appended to a binary file on SD.
+const bool perfLogging = false;
+const char *perfLogPath = "/perf.bin";
+const uint32_t perfLogCapacity = 32768;
+// Counts drawn, packed, changed and refreshed pixels each frame and prints where the waste is.
+const bool overdrawAnalysis = false;
+// Counts heap allocations made while rendering and stops if a settled frame makes any.
+const bool checkFrameAllocations = false;
+// Bytes of scratch memory available to render code each frame.
+const uint32_t frameArenaSize = 8192;
+// Bytes of rasterized vector icons kept for reuse, across every size and colour shown.
+const uint32_t iconCacheSize = 32768;
 
 struct area
 {
@@ -23,1746 +59,7756 @@ struct area
 };
 
 const struct area screenArea = {0, 0, screenWidth, screenHeight};
-struct area screenUpdateRange;
 
-void debug(String msg)
+/// @brief Checks if two areas share any pixels.
+bool areasOverlap(struct area a, struct area b)
 {
-    if (debugMode)
+    return a.x < b.x + b.width && b.x < a.x + a.width && a.y < b.y + b.height && b.y < a.y + a.height;
+}
+
+/// @brief The smallest area covering both areas. An empty area adds nothing.
+struct area areaUnion(struct area a, struct area b)
+{
+    if (a.width <= 0 || a.height <= 0)
     {
-        Serial.println("[" + String(heap_caps_get_largest_free_block(MALLOC_CAP_8BIT)) + "] " + String(millis()) + ": " + msg);
-        if (debugMessageSync)
-        {
-            Serial.flush();
-        }
+        return b;
+    }
+    if (b.width <= 0 || b.height <= 0)
+    {
+        return a;
     }
+    int right = max(a.x + a.width, b.x + b.width);
+    int bottom = max(a.y + a.height, b.y + b.height);
+    int x = min(a.x, b.x);
+    int y = min(a.y, b.y);
+    return {x, y, right - x, bottom - y};
 }
 
-class UiObj
+/// @brief Checks if the inner area lies completely inside the outer area.
+bool areaContains(struct area outer, struct area inner)
+{
+    return inner.x >= outer.x && inner.y >= outer.y && inner.x + inner.width <= outer.x + outer.width && inner.y + inner.height <= outer.y + outer.height;
+}
+
+void debugPrint(const String &msg)
+{
+    Serial.println("[" + String(heap_caps_get_largest_free_block(MALLOC_CAP_8BIT)) + "] " + String(millis()) + ": " + msg);
+    if (debugMessageSync)
+    {
+        Serial.flush();
+    }
+}
+
+// The message is only built when debug mode is on, so render code can log freely without allocating.
+#define debug(msg)             \
+    do                         \
+    {                          \
+        if (debugMode)         \
+        {                      \
+            debugPrint(msg);   \
+        }                      \
+    } while (0)
+
+/**
+ * @brief A binary semaphore for handing work between tasks.
+ * @details Uses FreeRTOS on the device and the standard library elsewhere,
+ * so code built on it can be tested on a host with std::thread.
+ */
+class UiSignal
 {
 public:
-    enum objectEvents
+#ifdef ARDUINO
+    UiSignal()
     {
-        EVENT_NONE,
-        EVENT_TOUCH,
-        EVENT_DRAW,
-        EVENT_UPDATE,
-        EVENT_VISIBILITY,
-        EVENT_PARENT_CHANGE
+        this->handle = xSemaphoreCreateBinary();
     };
 
-    UiObj()
+    void give()
     {
-        this->x = 0;
-        this->y = 0;
-        this->width = 0;
-        this->height = 0;
-        this->surface = NULL;
-        this->hardwareDraw = false;
-        this->unbuffered = true;
-        this->initDefaults();
-    }
+        xSemaphoreGive(this->handle);
+    };
 
-    UiObj(int x, int y, int width, int height, bool unbuffered = false)
+    /// @brief Waits until give() is called. Several gives before a take count as one.
+    void take()
     {
-        this->init(x, y, width, height, unbuffered);
+        xSemaphoreTake(this->handle, portMAX_DELAY);
     };
 
-    void init(int x, int y, int width, int height, bool unbuffered = false)
+private:
+    SemaphoreHandle_t handle;
+#else
+    void give()
     {
-        this->x = x;
-        this->y = y;
-        this->width = width;
-        this->height = height;
-        this->surface = TFT_eSprite(NULL);
-        if (!unbuffered && width > 0 && height > 0)
-        {
-            this->surface.setColorDepth(8);
-            this->surface.createSprite(width, height, 1);
-            this->unbuffered = false;
-        }
-        else
-        {
-            this->unbuffered = true;
-        }
-        this->hardwareDraw = unbuffered;
-        this->initDefaults();
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->given = true;
+        this->condition.notify_one();
     };
 
-    /**
-     * @brief Sets the default values for the object.
-     */
-    void initDefaults()
+    /// @brief Waits until give() is called. Several gives before a take count as one.
+    void take()
     {
-        this->visible = true;
-        this->layer = LAYER_CENTRE;
-        this->updated = true;
-        this->initialised = true;
-        this->visibilityChanged = false;
-        this->parent = NULL;
-        this->newParent = false;
-        this->drawn = false;
-        this->exposed = false;
-        this->updateArea = {0, 0, 0, 0};
+        std::unique_lock<std::mutex> lock(this->mutex);
+        this->condition.wait(lock, [this]()
+                             { return this->given; });
+        this->given = false;
     };
 
-    /**
-     * @brief Create a buffer for the object.
-     *
-     * @param width The pixel width of the buffer.
-     * @param height The pixel height of the buffer.
-     */
-    void createBuffer(int width, int height)
+private:
+    std::mutex mutex;
+    std::condition_variable condition;
+    bool given = false;
+#endif
+};
+
+/// @brief Starts a task that runs until the device resets. On a host it runs as a detached std::thread.
+/// @param core The core to pin the task to. Ignored on a host.
+void uiStartTask(void (*task)(void *), const char *name, void *param, int core)
+{
+#ifdef ARDUINO
+    xTaskCreatePinnedToCore(task, name, 4096, param, 1, NULL, core);
+#else
+    std::thread(task, param).detach();
+#endif
+}
+
+/**
+ * @brief Counts heap allocations made by the UI task while rendering.
+ * @details The linker wraps malloc, calloc and realloc (see build_flags in platformio.ini),
+ * which also covers new and String. Only calls from the task that started tracking and from
+ * work pool workers count, so the refresh task and background tasks don't show up in a frame's total.
+ * Workers draw objects for the UI task, so their allocations are part of the frame.
+ */
+struct UiAllocationCounter
+{
+    std::atomic<bool> tracking{false};
+    TaskHandle_t task = NULL;
+    std::atomic<uint32_t> allocations{0};
+    std::atomic<uint32_t> bytes{0};
+    /// @brief Allocations made by layout changes, like resizing or building a surface, which are allowed.
+    std::atomic<uint32_t> expected{0};
+    /// @brief How many UiExpectedAllocations scopes are open, on any counted task.
+    std::atomic<int> allowed{0};
+
+    /// @brief Counts a work pool worker's allocations along with the UI task's. Called by the worker itself.
+    void addWorker()
     {
-        if (this->unbuffered)
+        int index = this->workerCount.fetch_add(1);
+        if (index < maxWorkers)
         {
-            this->width = width;
-            this->height = height;
-            this->surface.setColorDepth(8);
-            this->surface.createSprite(this->width, this->height, 1);
-            this->unbuffered = false;
-            this->hardwareDraw = false;
+            this->workers[index] = xTaskGetCurrentTaskHandle();
+            this->registered++;
         }
     };
 
-    /**
-     * @brief Drawing method for the object.
-     * @details This method should draw the object to the screen buffer.
-     * The property this->surface is a TFT_eSprite object that can be using to draw on.
-     * The child class must implement this.
-     */
-    virtual void draw() = 0;
-
-    /**
-     * @brief Called when the object is touched by the user.
-     *
-     * @param x The x coordinate on the object that was touched.
-     * @param y The y coordinate on the object that was touched.
-     * @return true
-     * @return false
-     */
-    virtual bool touchEvent(int x, int y) = 0;
-
-    /**
-     * @brief Finds the area on the object that has been updated and returns it.
-     * The child class must implement this.
-     * @return struct area
-     */
-    virtual struct area getUpdateArea() = 0;
+    void start()
+    {
+        this->task = xTaskGetCurrentTaskHandle();
+        this->allocations = 0;
+        this->bytes = 0;
+        this->expected = 0;
+        this->tracking = true;
+    };
 
-    /**
-     * @brief Set the parent to this object.
-     * @details The parent object is the object that contains this object.
-     * The object will be drawn to the parent object's buffer.
-     * If the parent is NULL then the object will be drawn directly to the screen.
-     * @param parent The containing object.
-     */
-    void setParent(UiObj *parent)
+    /// @return The number of allocations since start().
+    uint32_t stop()
     {
-        this->parent = parent;
-        this->newParent = true;
+        this->tracking = false;
+        return this->allocations;
     };
 
-    /**
-     * @brief Checks if an area on the parent is within the bounds of an object.
-     *
-     * @param area The area to check against the object.
-     * @return true The area is within the object.
-     * @return false The area is partially or completely outside the object.
-     */
-    virtual bool within(struct area area)
+    void count(size_t size)
     {
-        if (area.x >= this->x && area.x < this->x + this->width && area.y >= this->y && area.y < this->y + this->height)
+        if (this->tracking && this->counted(xTaskGetCurrentTaskHandle()))
         {
-            if (area.x + area.width <= this->x + this->width && area.y + area.height <= this->y + this->height)
-            {
-                return true;
-            }
-            else
+            if (this->allowed > 0)
             {
-                return false;
+                this->expected++;
+                return;
             }
-        }
-        else
-        {
-            return false;
+            this->allocations++;
+            this->bytes += size;
         }
     };
 
-    struct area childOffset(struct area area)
+private:
+    bool counted(TaskHandle_t task)
     {
-        struct area result;
-        if (this->parent == NULL)
+        if (task == this->task)
         {
-            return area;
+            return true;
         }
-        else
+        int count = this->registered.load();
+        for (int i = 0; i < count; i++)
         {
-            result.x = area.x - this->x;
-            result.y = area.y - this->y;
-            result.width = area.width;
-            result.height = area.height;
-            return result;
+            if (this->workers[i] == task)
+            {
+                return true;
+            }
         }
+        return false;
     };
 
-    /**
-     * @brief Sets the object as visible.
-     */
-    void show()
+    // Enough for the workers of a couple of pools.
+    static const int maxWorkers = 4;
+    TaskHandle_t workers[maxWorkers];
+    std::atomic<int> workerCount{0};
+    std::atomic<int> registered{0};
+};
+
+UiAllocationCounter frameAllocations;
+
+/// @brief Marks the allocations made while it exists as expected, so a frame that changes layout isn't reported.
+struct UiExpectedAllocations
+{
+    UiExpectedAllocations()
     {
-        this->visible = true;
-        this->visibilityChanged = true;
+        frameAllocations.allowed++;
     };
 
-    /**
-     * @brief  Follows the parent chain to find the top level object.
-     * @return UiObj* The top level object.
-     */
-    UiObj *topLevel()
+    ~UiExpectedAllocations()
     {
-        UiObj *obj = this;
-        while (true)
-        {
-            if (obj->parent == NULL)
-            {
-                return obj;
-            }
-            else
-            {
-                obj = obj->parent;
-            }
-        };
+        frameAllocations.allowed--;
     };
+};
 
-    struct area clip(struct area area1)
+extern "C"
+{
+    void *__real_malloc(size_t size);
+    void *__real_calloc(size_t count, size_t size);
+    void *__real_realloc(void *ptr, size_t size);
+
+    void *__wrap_malloc(size_t size)
     {
-        return area1;
+        frameAllocations.count(size);
+        return __real_malloc(size);
     }
 
-    struct area clip(struct area area1, struct area area2)
+    void *__wrap_calloc(size_t count, size_t size)
     {
-        struct area result;
-        result.x = max(area1.x, area2.x);
-        result.y = max(area1.y, area2.y);
-        result.width = min(area1.x + area1.width, area2.x + area2.width) - result.x;
-        result.height = min(area1.y + area1.height, area2.y + area2.height) - result.y;
-        return result;
-    };
+        frameAllocations.count(count * size);
+        return __real_calloc(count, size);
+    }
 
-    template <typename... Args>
-    struct area clip(struct area area1, struct area area2, Args... others)
+    void *__wrap_realloc(void *ptr, size_t size)
     {
-        return this->clip(this->clip(area1, area2), others...);
-    };
-
-    template <typename... Args>
-    struct area merge(struct area area, struct area others)
+        frameAllocations.count(size);
+        return __real_realloc(ptr, size);
+    }
+}
+/**
+ * @brief A small pool of worker tasks for splitting render work across both cores.
+ * @details The calling task always takes part, so a pool with one worker pinned to
+ * the other core runs two jobs at once. Jobs are numbered and claimed from a shared
+ * counter, so whichever task finishes first takes the next band.
+ * run() does not return until every job is finished.
+ * run() is not re-entrant: a job must not start more parallel work on the same pool.
+ */
+class UiWorkPool
+{
+public:
+    UiWorkPool()
     {
-        struct area result = this->merge(area, others);
-        result.x = min(result.x, area.x);
-        result.y = min(result.y, area.y);
-        result.width = max(result.width, area.x + area.width);
-        result.height = max(result.height, area.y + area.height);
-        return result;
+        this->workerCount = 0;
+        this->jobCount = 0;
+        this->enabled = true;
+        this->nextJob.store(0);
     };
 
-    struct area merge(struct area area)
+    /// @brief Starts the worker tasks. Without this, run() does all the work on the calling task.
+    /// @param workers The number of extra tasks to start.
+    /// @param core The core to pin the workers to.
+    void begin(int workers = 1, int core = 0)
     {
-        struct area result;
-        result.x = min(this->width, area.x);
-        result.y = min(this->height, area.y);
-        result.width = max(this->width, area.x + area.width);
-        result.height = max(this->height, area.y + area.height);
-        return result;
-    }
+        for (int i = 0; i < workers && this->workerCount < maxWorkers; i++)
+        {
+            struct worker *worker = &this->workers[this->workerCount];
+            worker->pool = this;
+            worker->start = new UiSignal();
+            worker->done = new UiSignal();
+            uiStartTask(UiWorkPool::workerTask, "uiWorker", worker, core);
+            this->workerCount++;
+        }
+    };
 
-    /// @brief Finds if two objects overlap on the screen.
-    /// @param otherObj The object to check against.
-    /// @return The overlapping area. The size (height and width) will be 0 if there is no overlap.
-    struct area overlap(UiObj *otherObj)
+    /// @brief Runs a job function for each job number, in parallel where possible.
+    /// @details The job is called through a pointer rather than copied into a std::function,
+    /// so lambdas with several captures don't cost a heap allocation on every call.
+    /// @param jobs The number of jobs.
+    /// @param job The function to run. It is called once with each number from 0 to jobs - 1.
+    /// It must not call run() or runBands() on this pool, which asserts.
+    template <typename Job>
+    void run(int jobs, const Job &job)
     {
-        struct area thisArea = this->getAbsolutePos();
-        struct area otherArea = otherObj->getAbsolutePos();
-        if (thisArea.x + thisArea.width < otherArea.x || thisArea.x > otherArea.x + otherArea.width || thisArea.y + thisArea.height < otherArea.y || thisArea.y > otherArea.y + otherArea.height)
+        if (!this->enabled || this->workerCount == 0 || jobs < 2)
         {
-            return {0, 0, 0, 0};
+            for (int i = 0; i < jobs; i++)
+            {
+                job(i);
+            }
+            return;
         }
-        else
+        // The workers are already busy with the outer jobs, so nested work would wait on itself.
+        bool nested = this->running.exchange(true);
+        assert(!nested);
+        (void)nested;
+        this->job = &UiWorkPool::callJob<Job>;
+        this->jobContext = &job;
+        this->jobCount = jobs;
+        this->nextJob.store(0);
+        for (int i = 0; i < this->workerCount; i++)
         {
-            return {max(thisArea.x, otherArea.x), max(thisArea.y, otherArea.y), min(thisArea.x + thisArea.width, otherArea.x + otherArea.width) - max(thisArea.x, otherArea.x), min(thisArea.y + thisArea.height, otherArea.y + otherArea.height) - max(thisArea.y, otherArea.y)};
+            this->workers[i].start->give();
         }
+        this->runJobs();
+        // Barrier: wait for every worker to run out of jobs.
+        for (int i = 0; i < this->workerCount; i++)
+        {
+            this->workers[i].done->take();
+        }
+        this->job = NULL;
+        this->jobContext = NULL;
+        this->running.store(false);
     };
 
-    /// @brief Find if an area overlaps with the object.
-    /// @param area The area to check, relative to the object.
-    /// @return The overlapping area. The size (height and width) will be 0 if there is no overlap.
-    struct area overlap(struct area area)
+    /// @brief Splits a number of rows into bands and runs them in parallel.
+    /// @param rows The total number of rows.
+    /// @param minRows Rows below which the work isn't worth splitting.
+    /// @param band The function to run for each band, with the first row and the row after the last.
+    template <typename Band>
+    void runBands(int rows, int minRows, const Band &band)
     {
-        struct area thisArea = this->getAbsolutePos();
-        if (thisArea.x + thisArea.width < area.x || thisArea.x > area.x + area.width || thisArea.y + thisArea.height < area.y || thisArea.y > area.y + area.height)
+        int bands = min(this->threads(), rows / max(minRows, 1));
+        if (bands < 2)
         {
-            return {0, 0, 0, 0};
-        }
-        else
-        {
-            return {max(thisArea.x, area.x), max(thisArea.y, area.y), min(thisArea.x + thisArea.width, area.x + area.width) - max(thisArea.x, area.x), min(thisArea.y + thisArea.height, area.y + area.height) - max(thisArea.y, area.y)};
+            band(0, rows);
+            return;
         }
+        // Use more bands than tasks so a slow band doesn't hold up the others.
+        bands = min(bands * 2, rows);
+        this->run(bands, [&](int i)
+                  { band(rows * i / bands, rows * (i + 1) / bands); });
     };
 
-    /// @brief Finds the position of the object relative to its parent.
-    /// @return An offset position with the parents co-ordinates added.
-    struct area offsetToParent()
+    int threads()
     {
-        if (this->parent)
-        {
-            struct area parentArea = this->parent->getArea();
-            return {this->x + parentArea.x, this->y + parentArea.y, this->width, this->height};
-        }
-        else
-        {
-            return this->getArea();
-        }
-    }
+        return this->enabled ? this->workerCount + 1 : 1;
+    };
 
-    /// @brief Finds the absolute position of an object on the screen.
-    /// @return An area struct with the X and Y co-ordinates.
-    struct area getAbsolutePos()
-    {
-        if (this->parent)
-        {
-            struct area parentArea = this->parent->getAbsolutePos();
-            return {this->x + parentArea.x, this->y + parentArea.y, this->width, this->height};
-        }
-        else
-        {
-            return this->getArea();
-        }
-    }
+public:
+    /// @brief Set to false to run everything on the calling task.
+    bool enabled;
 
-    /// @brief Called when part of an object is uncovered and its buffer needs to be rerendered to the parent.
-    /// @param xArea A struct containing the area of the object that needs to be redrawn.
-    virtual void expose(struct area xArea)
+private:
+    struct worker
     {
-        this->exposed = true;
-        this->exposeArea = xArea;
+        UiWorkPool *pool;
+        UiSignal *start;
+        UiSignal *done;
     };
 
-    void hide()
+    void runJobs()
     {
-        if (this->visible == true)
+        while (true)
         {
-            this->visible = false;
-            this->visibilityChanged = true;
-            this->topLevel()->expose(this->getArea());
+            int i = this->nextJob.fetch_add(1);
+            if (i >= this->jobCount)
+            {
+                return;
+            }
+            this->job(this->jobContext, i);
         }
     };
 
-    /// @brief Resets the flags used to render the object.
-    /// @details This function is called after the object has been rendered to reset the flags used to render the object.
-    /// This can be overridden by child classes to reset any additional flags.
-    virtual void resetStatus()
+    template <typename Job>
+    static void callJob(const void *context, int i)
     {
-        if (this->drawn)
-        {
-            this->updated = false;
-            this->drawn = false;
-            this->exposed = false;
-        }
-        this->newParent = false;
-        this->visibilityChanged = false;
+        (*(const Job *)context)(i);
     };
 
-    /// @brief  Sets the object position within it's container.
-    /// @param  x The x position of the object.
-    /// @param  y The y position of the object.
-    /// @param relative If true the position is relative to the current position.
-    void move(int x, int y, bool relative = false)
+    static void workerTask(void *param)
     {
-        if (this->parent)
-            this->parent->expose(this->getArea());
-        if (relative)
-        {
-            this->x += x;
-            this->y += y;
-        }
-        else
+        struct worker *worker = (struct worker *)param;
+        frameAllocations.addWorker();
+        while (true)
         {
-            this->x = x;
-            this->y = y;
+            worker->start->take();
+            worker->pool->runJobs();
+            worker->done->give();
         }
-        if (this->parent)
-            this->parent->expose(this->getArea());
     };
 
-    /// @brief  Checks if the object has been updated since the last render.
-    /// @details This function is used to determine if the object needs to be redrawn.
-    /// The function should be overridden by child classes to check for changes to the object.
-    /// @return True if the object has been updated.
-    virtual bool isUpdated() = 0;
+    static const int maxWorkers = 2;
+    struct worker workers[maxWorkers];
+    int workerCount;
+    int jobCount;
+    std::atomic<int> nextJob;
+    std::atomic<bool> running{false};
+    void (*job)(const void *context, int i) = NULL;
+    const void *jobContext = NULL;
+};
 
-    virtual bool visualChange()
-    {
-        return this->visibilityChanged || this->newParent || this->isUpdated() || this->exposed || (this->parent && this->parent->visibilityChanged);
-    };
-    /// @brief Converts the object properties to an area struct.
-    /// @return An area struct with the object area.
-    struct area getArea()
+UiWorkPool renderPool;
+
+/**
+ * @brief Scratch memory for the render path that is thrown away after each frame.
+ * @details Allocation just moves a pointer along a fixed block, and reset() frees
+ * everything at once, so temporary buffers never touch the general heap or fragment it.
+ * The pointer is moved atomically, so render pool jobs can allocate too.
+ * Nothing allocated here may be kept past the end of UiManager::updateDisplay().
+ */
+class UiScratchArena
+{
+public:
+    /// @brief Allocates the block. Without this, alloc() always returns NULL.
+    void begin(uint32_t size)
     {
-        struct area area;
-        area.x = this->x;
-        area.y = this->y;
-        area.width = this->width;
-        area.height = this->height;
-        return area;
+        this->memory = (uint8_t *)malloc(size);
+        this->capacity = this->memory != NULL ? size : 0;
+        this->used.store(0);
     };
 
-    /// @brief Draws and visible or changed objects to their surface.
-    /// @details This function controls the rendering pipeline for UiObj types and calls the custom draw() function if an object is changed.
-    void render()
+    /// @brief Takes some memory from the arena, aligned for any type.
+    /// @return The memory, or NULL if the arena is full. Callers must handle NULL.
+    void *alloc(uint32_t size)
     {
-        if (!this->initialised || !this->visible)
-        {
-            return;
-        }
-
-        this->getUpdateArea();
-        if (this->isUpdated())
-        {
-            debug("Drawing object: " + String((uint32_t)this) + " At: " + String(this->x) + ", " + String(this->y) + ", " + String(this->width) + ", " + String(this->height));
-            this->draw();
-        }
-        else
-        {
-            debug("Object not updated, skipping draw");
-        }
-
-        if (this->visualChange())
+        uint32_t start;
+        uint32_t current = this->used.load();
+        do
         {
-            debug("Object updated, pushing to parent");
-            if (this->parent == NULL || this->parent->hardwareDraw)
-            {
-                debug("Software draw (pushing buffer)");
-                this->getUpdateArea();
-                this->packToGrey(this->updateArea);
-                if (this->exposed)
-                {
-                    // this->packToGrey(this->exposeArea);
-                }
-                debug("Pushing canvas to screen");
-                if (updateArea.width == 0 || updateArea.height == 0)
-                {
-                    debug("Update area is 0, skipping");
-                    return;
-                }
-            }
-            else if (this->parent != NULL)
+            start = (current + alignment - 1) & ~(alignment - 1);
+            if (size > this->capacity || start > this->capacity - size)
             {
-                TFT_eSprite *parentBuffer = &(this->parent->surface);
-                debug("Software draw (copying to parent)");
-                this->copyToParent();
-            }
-            else
-            {
-                debug("Cannot draw, no parent or hardware buffer.");
+                this->overflows++;
+                return NULL;
             }
-            debug("Software draw (done)");
-        }
-        else
-        {
-            debug("Object not updated, skipping draw");
-        }
-        this->drawn = true;
+        } while (!this->used.compare_exchange_weak(current, start + size));
+        return this->memory + start;
     };
 
-    /// @brief  Copies the object's drawing buffer to the parent buffer.
-    /// @details Used for drawing objects inside containers.
-    void copyToParent()
+    /// @brief Copies part of a string into the arena and terminates it.
+    /// @return The copy, or NULL if the arena is full.
+    char *copy(const char *text, uint32_t length)
     {
-        TFT_eSprite *buffer = &this->parent->surface;
-        uint8_t *ownBuf = (uint8_t *)this->surface.frameBuffer(1);
-        debug("Source buffer: " + String((uint32_t)ownBuf) + ", Dest buffer: " + String((uint32_t)buffer->frameBuffer(1)));
-        if (buffer->frameBuffer(1) == NULL)
-        {
-            debug("Parent buffer is NULL, NOT copying");
-            return;
-        }
-        int height = min(this->height, buffer->height() - this->y);
-        int width = min(this->width, buffer->width() - this->x);
-        debug("Copying object: " + String((uint32_t)this) + " to size: " + String(width) + "x" + String(height) + " at: " + String(this->x) + ", " + String(this->y));
-        debug("Buffer size: " + String(buffer->width()) + "x" + String(buffer->height()));
-        for (int y = 0; y < height; y++)
+        char *out = (char *)this->alloc(length + 1);
+        if (out != NULL)
         {
-            memcpy((uint8_t *)buffer->frameBuffer(1) + (y + this->y) * buffer->width() + this->x, ownBuf + y * this->width, width);
+            memcpy(out, text, length);
+            out[length] = 0;
         }
+        return out;
     };
 
-    /// @brief Pack the object to the screen buffer.
-    /// @details Copies an objects 8-bit drawing buffer in the screen buffer transforming it to 4-bit greyscale.
-    void packToGrey(struct area renderArea)
+    /// @brief Frees everything allocated since the last reset.
+    /// @details Must not be called while render pool jobs are running.
+    void reset()
     {
-        debug("Render area is: " + String(renderArea.x) + ", " + String(renderArea.y) + ", " + String(renderArea.width) + ", " + String(renderArea.height));
-        // renderArea = this->clip(this->getArea(), renderArea, screenArea);
+        this->highWater = max(this->highWater, this->used.load());
+        this->used.store(0);
+    };
 
-        uint8_t *ownBuf = (uint8_t *)this->surface.frameBuffer(1);
-        uint8_t *outBuf = (uint8_t *)screenBuffer;
-        struct area absoluteRange = this->getAbsolutePos();
-        struct area topRange = this->topLevel()->updateArea;
-        if (ownBuf == NULL || outBuf == NULL)
+public:
+    uint32_t capacity = 0;
+    /// @brief The most memory in use in one frame since boot.
+    uint32_t highWater = 0;
+    /// @brief Allocations that didn't fit.
+    std::atomic<uint32_t> overflows{0};
+
+private:
+    static const uint32_t alignment = 8;
+    uint8_t *memory = NULL;
+    std::atomic<uint32_t> used{0};
+};
+
+UiScratchArena frameArena;
+
+// Pack and copy work smaller than this many rows per band stays on one core.
+const int minBandRows = 32;
+
+// Expands a byte of 1-bit pixels into eight packed 4-bit pixels, in screen buffer byte order.
+uint32_t monoLut[256];
+int monoLutInk = -1;
+int monoLutPaper = -1;
+
+/// @brief Fills monoLut for a pair of greyscale values, if it isn't already set up for them.
+/// @param ink The 4-bit value for set bits.
+/// @param paper The 4-bit value for clear bits.
+void buildMonoLut(uint8_t ink, uint8_t paper)
+{
+    if (monoLutInk == ink && monoLutPaper == paper)
+    {
+        return;
+    }
+    for (int bits = 0; bits < 256; bits++)
+    {
+        uint8_t packed[4];
+        for (int i = 0; i < 4; i++)
         {
-            return;
+            uint8_t left = (bits & (0x80 >> (i * 2))) ? ink : paper;
+            uint8_t right = (bits & (0x40 >> (i * 2))) ? ink : paper;
+            packed[i] = (left << 4) | right;
         }
+        memcpy(&monoLut[bits], packed, 4);
+    }
+    monoLutInk = ink;
+    monoLutPaper = paper;
+}
 
-        debug("Packing object: " + String((uint32_t)this) + " to size: " + String(renderArea.width) + "x" + String(renderArea.height) + " at: " + String(renderArea.x) + ", " + String(renderArea.y));
-        debug("Object size: " + String(this->width) + "x" + String(this->height));
-        debug("Position: " + String(this->x) + ", " + String(this->y));
-        debug("Screen update area: " + String(screenUpdateRange.x) + ", " + String(screenUpdateRange.y) + ", " + String(screenUpdateRange.width) + ", " + String(screenUpdateRange.height));
-        debug("Absolute area is " + String(absoluteRange.x) + ", " + String(absoluteRange.y) + ", " + String(absoluteRange.width) + ", " + String(absoluteRange.height));
-        if (this->parent)
+/// @brief Converts a 16-bit colour to the byte stored in an 8-bit sprite.
+uint8_t colour16ToByte(uint16_t colour)
+{
+    return ((colour & 0xE000) >> 8) | ((colour & 0x0700) >> 6) | ((colour & 0x0018) >> 3);
+}
+
+/// @brief How far a rounded rectangle's edge is pulled in from the side on a row.
+/// @param row The row, counted from the top of the rectangle.
+/// @param height The height of the rectangle.
+/// @param radius The corner radius.
+int roundRectInset(int row, int height, int radius)
+{
+    if (radius <= 0)
+    {
+        return 0;
+    }
+    int dy;
+    if (row < radius)
+    {
+        dy = radius - row;
+    }
+    else if (row >= height - radius)
+    {
+        dy = row - (height - radius) + 1;
+    }
+    else
+    {
+        return 0;
+    }
+    float distance = dy - 0.5f;
+    return radius - (int)(sqrtf(radius * radius - distance * distance) + 0.5f);
+}
+
+/// @brief Writes a horizontal run of one colour, clipped to the sprite.
+void fillSpan(TFT_eSprite *surface, uint8_t *buffer, int x1, int x2, int y, uint16_t colour)
+{
+    x1 = max(x1, 0);
+    x2 = min(x2, (int)surface->width());
+    if (x2 <= x1 || y < 0 || y >= surface->height())
+    {
+        return;
+    }
+    if (buffer != NULL)
+    {
+        memset(buffer + y * surface->width() + x1, colour16ToByte(colour), x2 - x1);
+    }
+    else
+    {
+        surface->drawFastHLine(x1, y, x2 - x1, colour);
+    }
+}
+
+/**
+ * @brief Draws a rounded rectangle's fill and outline in a single pass.
+ * @details Each row's spans are worked out directly from the corner radii and written
+ * as runs, so a thick outline costs the same as a thin one.
+ * 8-bit sprites are written with memset, other depths fall back to drawFastHLine.
+ * @param surface The sprite to draw on.
+ * @param rect The rectangle to draw.
+ * @param hasFill True to fill the rectangle.
+ * @param fillRadius The corner radius of the fill.
+ * @param fillColour The fill colour.
+ * @param thickness The outline thickness. 0 for no outline.
+ * @param outlineRadius The outer corner radius of the outline.
+ * @param outlineColour The outline colour.
+ */
+void drawRoundRectSpans(TFT_eSprite *surface, struct area rect, bool hasFill, int fillRadius, uint16_t fillColour, int thickness, int outlineRadius, uint16_t outlineColour)
+{
+    uint8_t *buffer = surface->getColorDepth() == 8 ? (uint8_t *)surface->frameBuffer(1) : NULL;
+    if (rect.width <= 0 || rect.height <= 0)
+    {
+        return;
+    }
+    fillRadius = min(fillRadius, min(rect.width, rect.height) / 2);
+    outlineRadius = min(outlineRadius, min(rect.width, rect.height) / 2);
+    thickness = min(thickness, (min(rect.width, rect.height) + 1) / 2);
+    int innerRadius = max(outlineRadius - thickness, 0);
+    int innerHeight = rect.height - thickness * 2;
+    for (int row = 0; row < rect.height; row++)
+    {
+        int y = rect.y + row;
+        if (hasFill)
         {
-            debug("Parent buffer size: " + String(this->parent->width) + "x" + String(this->parent->height));
-            debug("Parent buffer update area: " + String(this->parent->updateArea.x) + ", " + String(this->parent->updateArea.y) + ", " + String(this->parent->updateArea.width) + ", " + String(this->parent->updateArea.height));
+            int inset = roundRectInset(row, rect.height, fillRadius);
+            fillSpan(surface, buffer, rect.x + inset, rect.x + rect.width - inset, y, fillColour);
         }
-        else
+        if (thickness <= 0)
         {
-            debug("No parent buffer");
+            continue;
         }
-        int ownBufOffset = 0;
-        int outBufOffset = 0;
-        for (int y = 0; y < renderArea.height; y++)
+        int outer = roundRectInset(row, rect.height, outlineRadius);
+        if (row < thickness || row >= rect.height - thickness)
         {
-            ownBufOffset = ((y + renderArea.y) * this->width) + renderArea.x;
-            outBufOffset = (((y + this->y - topRange.y) * topRange.width) + this->x - topRange.x) / 2;
-            // debug("   OWN: " + String(ownBufOffset) + ", OUT: " + String(outBufOffset));
-            for (int x = 0; x < renderArea.width; x += 2)
-            {
-                outBuf[outBufOffset++] = ((ownBuf[ownBufOffset] & 0x0F) << 4) | (ownBuf[ownBufOffset + 1] & 0x0F);
-                ownBufOffset += 2;
-            }
+            fillSpan(surface, buffer, rect.x + outer, rect.x + rect.width - outer, y, outlineColour);
         }
-    };
+        else
+        {
+            int inner = thickness + roundRectInset(row - thickness, innerHeight, innerRadius);
+            fillSpan(surface, buffer, rect.x + outer, rect.x + inner, y, outlineColour);
+            fillSpan(surface, buffer, rect.x + rect.width - inner, rect.x + rect.width - outer, y, outlineColour);
+        }
+    }
+}
 
-    /// @brief Convert a 4-bit greyscale value to a 16-bit colour value
-    /// Useful for drawing with the TFT_eSprite library functions.
-    /// @param grey A four-bit greyscale value. 0 is black, 15 is white.
-    /// @return A 16-bit 565 formatted colour value.
-    uint16_t greyToColour16(int grey)
+/**
+ * @brief A block of pixels for the blit functions to read from or write to.
+ */
+struct UiPixmap
+{
+    uint8_t *data;
+    int width;
+    int height;
+    // Bits per pixel: 1, 4 or 8.
+    int bpp;
+    // Bytes from the start of one row to the next.
+    int stride;
+};
+
+/// @brief Describes a buffer with rows packed as tightly as its pixel format allows.
+UiPixmap uiPixmap(uint8_t *data, int width, int height, int bpp)
+{
+    return {data, width, height, bpp, (width * bpp + 7) / 8};
+}
+
+/**
+ * @brief Options for a blit.
+ * @details Members left out of a brace initialiser are zero, so {ink, paper} gives an opaque blit.
+ */
+struct UiBlitContext
+{
+    /// @brief Greyscale values to use for set and clear bits when reading 1-bit pixels.
+    uint8_t ink;
+    uint8_t paper;
+    /// @brief Skip source pixels equal to the key. Compared before conversion, so a 1-bit key is 0 or 1.
+    bool keyed;
+    uint8_t key;
+    /// @brief Optional 1-bit mask the size of the source. Clear bits are skipped.
+    const uint8_t *mask;
+    int maskStride;
+};
+
+template <int Bpp>
+struct UiPixelFormat;
+
+template <>
+struct UiPixelFormat<8>
+{
+    static uint8_t get(const uint8_t *row, int x)
     {
-        return (grey & 0x03) << 3 | (grey & 0x0C) << 6;
+        return row[x];
     }
+    static void set(uint8_t *row, int x, uint8_t value)
+    {
+        row[x] = value;
+    }
+};
+
+// Two pixels per byte, the left pixel in the high nibble.
+template <>
+struct UiPixelFormat<4>
+{
+    static uint8_t get(const uint8_t *row, int x)
+    {
+        return (x & 1) ? row[x >> 1] & 0x0F : row[x >> 1] >> 4;
+    }
+    static void set(uint8_t *row, int x, uint8_t value)
+    {
+        uint8_t *p = &row[x >> 1];
+        *p = (x & 1) ? (*p & 0xF0) | (value & 0x0F) : (*p & 0x0F) | (value << 4);
+    }
+};
+
+// Eight pixels per byte, the left pixel in the high bit.
+template <>
+struct UiPixelFormat<1>
+{
+    static uint8_t get(const uint8_t *row, int x)
+    {
+        return (row[x >> 3] >> (7 - (x & 7))) & 1;
+    }
+    static void set(uint8_t *row, int x, uint8_t value)
+    {
+        if (value)
+        {
+            row[x >> 3] |= 0x80 >> (x & 7);
+        }
+        else
+        {
+            row[x >> 3] &= ~(0x80 >> (x & 7));
+        }
+    }
+};
+
+template <int SrcBpp, int DstBpp>
+inline uint8_t uiConvertPixel(uint8_t value, const UiBlitContext &context)
+{
+    if (SrcBpp == 1)
+    {
+        return value ? context.ink : context.paper;
+    }
+    if (DstBpp == 4)
+    {
+        return value & 0x0F;
+    }
+    return value;
+}
+
+/// @brief Copies a run of pixels one at a time. Used for unaligned edges.
+template <int SrcBpp, int DstBpp>
+inline void uiBlitPixels(const uint8_t *src, int srcX, uint8_t *dst, int dstX, int count, const UiBlitContext &context)
+{
+    for (int i = 0; i < count; i++)
+    {
+        UiPixelFormat<DstBpp>::set(dst, dstX + i, uiConvertPixel<SrcBpp, DstBpp>(UiPixelFormat<SrcBpp>::get(src, srcX + i), context));
+    }
+}
+
+/**
+ * @brief Copies one row of pixels between two formats.
+ * @details This general version works a pixel at a time. The specialisations below
+ * handle the common format pairs in bytes or words.
+ */
+template <int SrcBpp, int DstBpp>
+struct UiBlitRow
+{
+    static void copy(const uint8_t *src, int srcX, uint8_t *dst, int dstX, int count, const UiBlitContext &context)
+    {
+        uiBlitPixels<SrcBpp, DstBpp>(src, srcX, dst, dstX, count, context);
+    }
+};
+
+template <>
+struct UiBlitRow<8, 8>
+{
+    static void copy(const uint8_t *src, int srcX, uint8_t *dst, int dstX, int count, const UiBlitContext &context)
+    {
+        memcpy(dst + dstX, src + srcX, count);
+    }
+};
+
+template <>
+struct UiBlitRow<8, 4>
+{
+    static void copy(const uint8_t *src, int srcX, uint8_t *dst, int dstX, int count, const UiBlitContext &context)
+    {
+        int i = 0;
+        if (dstX & 1)
+        {
+            UiPixelFormat<4>::set(dst, dstX, src[srcX] & 0x0F);
+            i++;
+        }
+        const uint8_t *in = src + srcX + i;
+        uint8_t *out = dst + ((dstX + i) >> 1);
+        for (; i + 1 < count; i += 2)
+        {
+            *out++ = ((in[0] & 0x0F) << 4) | (in[1] & 0x0F);
+            in += 2;
+        }
+        if (i < count)
+        {
+            UiPixelFormat<4>::set(dst, dstX + i, *in & 0x0F);
+        }
+    }
+};
+
+template <>
+struct UiBlitRow<4, 4>
+{
+    static void copy(const uint8_t *src, int srcX, uint8_t *dst, int dstX, int count, const UiBlitContext &context)
+    {
+        if ((srcX ^ dstX) & 1)
+        {
+            // The nibbles don't line up, so each pixel has to be shifted.
+            uiBlitPixels<4, 4>(src, srcX, dst, dstX, count, context);
+            return;
+        }
+        int i = 0;
+        if (dstX & 1)
+        {
+            UiPixelFormat<4>::set(dst, dstX, UiPixelFormat<4>::get(src, srcX));
+            i++;
+        }
+        int bytes = (count - i) >> 1;
+        memcpy(dst + ((dstX + i) >> 1), src + ((srcX + i) >> 1), bytes);
+        i += bytes * 2;
+        if (i < count)
+        {
+            UiPixelFormat<4>::set(dst, dstX + i, UiPixelFormat<4>::get(src, srcX + i));
+        }
+    }
+};
+
+template <>
+struct UiBlitRow<1, 4>
+{
+    // monoLut must already be built for the context's ink and paper.
+    static void copy(const uint8_t *src, int srcX, uint8_t *dst, int dstX, int count, const UiBlitContext &context)
+    {
+        int i = 0;
+        while (i < count && ((srcX + i) & 7) != 0)
+        {
+            uiBlitPixels<1, 4>(src, srcX + i, dst, dstX + i, 1, context);
+            i++;
+        }
+        if (((dstX + i) & 1) == 0)
+        {
+            const uint8_t *in = src + ((srcX + i) >> 3);
+            uint8_t *out = dst + ((dstX + i) >> 1);
+            for (; i + 8 <= count; i += 8)
+            {
+                memcpy(out, &monoLut[*in++], 4);
+                out += 4;
+            }
+        }
+        uiBlitPixels<1, 4>(src, srcX + i, dst, dstX + i, count - i, context);
+    }
+};
+
+template <>
+struct UiBlitRow<1, 8>
+{
+    static void copy(const uint8_t *src, int srcX, uint8_t *dst, int dstX, int count, const UiBlitContext &context)
+    {
+        uint8_t *out = dst + dstX;
+        int i = 0;
+        for (; i < count && ((srcX + i) & 7) != 0; i++)
+        {
+            *out++ = UiPixelFormat<1>::get(src, srcX + i) ? context.ink : context.paper;
+        }
+        const uint8_t *in = src + ((srcX + i) >> 3);
+        for (; i + 8 <= count; i += 8)
+        {
+            uint8_t bits = *in++;
+            for (int bit = 0; bit < 8; bit++)
+            {
+                *out++ = (bits & (0x80 >> bit)) ? context.ink : context.paper;
+            }
+        }
+        for (; i < count; i++)
+        {
+            *out++ = UiPixelFormat<1>::get(src, srcX + i) ? context.ink : context.paper;
+        }
+    }
+};
+
+enum uiRowCoverage
+{
+    ROW_CLEAR,
+    ROW_OPAQUE,
+    ROW_MIXED
+};
+
+/// @brief Sets each byte of the result to 0xFF where the byte of the word differs from the key, and to 0 where it matches.
+/// @details Standard zero-byte test on word ^ key, with the carries kept inside each byte so there are no false matches.
+inline uint32_t uiKeyMask(uint32_t word, uint32_t keyWord)
+{
+    uint32_t diff = word ^ keyWord;
+    uint32_t high = (((diff & 0x7F7F7F7F) + 0x7F7F7F7F) | diff) & 0x80808080;
+    return (high >> 7) * 0xFF;
+}
+
+/// @brief Checks whether a run of pixels is all the key, none of it, or a mix.
+template <int SrcBpp>
+inline int uiKeyCoverage(const uint8_t *src, int srcX, int count, uint8_t key)
+{
+    bool clear = true;
+    bool opaque = true;
+    int i = 0;
+    if (SrcBpp == 8)
+    {
+        uint32_t keyWord = key * 0x01010101u;
+        for (; i + 4 <= count && (clear || opaque); i += 4)
+        {
+            uint32_t word;
+            memcpy(&word, src + srcX + i, 4);
+            uint32_t mask = uiKeyMask(word, keyWord);
+            clear = clear && mask == 0;
+            opaque = opaque && mask == 0xFFFFFFFF;
+        }
+    }
+    for (; i < count && (clear || opaque); i++)
+    {
+        bool isKey = UiPixelFormat<SrcBpp>::get(src, srcX + i) == key;
+        clear = clear && isKey;
+        opaque = opaque && !isKey;
+    }
+    return clear ? ROW_CLEAR : (opaque ? ROW_OPAQUE : ROW_MIXED);
+}
+
+/// @brief Checks whether a run of mask bits is all clear, all set, or a mix.
+inline int uiMaskCoverage(const uint8_t *maskRow, int x, int count)
+{
+    bool clear = true;
+    bool opaque = true;
+    int i = 0;
+    for (; i < count && ((x + i) & 7) != 0; i++)
+    {
+        bool set = UiPixelFormat<1>::get(maskRow, x + i);
+        clear = clear && !set;
+        opaque = opaque && set;
+    }
+    for (; i + 8 <= count && (clear || opaque); i += 8)
+    {
+        uint8_t bits = maskRow[(x + i) >> 3];
+        clear = clear && bits == 0x00;
+        opaque = opaque && bits == 0xFF;
+    }
+    for (; i < count && (clear || opaque); i++)
+    {
+        bool set = UiPixelFormat<1>::get(maskRow, x + i);
+        clear = clear && !set;
+        opaque = opaque && set;
+    }
+    return clear ? ROW_CLEAR : (opaque ? ROW_OPAQUE : ROW_MIXED);
+}
+
+/// @brief Copies a run of pixels one at a time, skipping transparent ones.
+template <int SrcBpp, int DstBpp>
+inline void uiBlitKeyedPixels(const uint8_t *src, int srcX, uint8_t *dst, int dstX, int count, const UiBlitContext &context, const uint8_t *maskRow, int maskX)
+{
+    for (int i = 0; i < count; i++)
+    {
+        if (maskRow != NULL && !UiPixelFormat<1>::get(maskRow, maskX + i))
+        {
+            continue;
+        }
+        uint8_t value = UiPixelFormat<SrcBpp>::get(src, srcX + i);
+        if (context.keyed && value == context.key)
+        {
+            continue;
+        }
+        UiPixelFormat<DstBpp>::set(dst, dstX + i, uiConvertPixel<SrcBpp, DstBpp>(value, context));
+    }
+}
+
+/**
+ * @brief Copies one row of pixels, leaving destination pixels alone where the source is transparent.
+ * @details Only used for rows that are partly transparent. Rows that are fully opaque go through
+ * UiBlitRow instead, and fully transparent rows aren't touched at all.
+ */
+template <int SrcBpp, int DstBpp>
+struct UiBlitKeyedRow
+{
+    static void copy(const uint8_t *src, int srcX, uint8_t *dst, int dstX, int count, const UiBlitContext &context, const uint8_t *maskRow, int maskX)
+    {
+        uiBlitKeyedPixels<SrcBpp, DstBpp>(src, srcX, dst, dstX, count, context, maskRow, maskX);
+    }
+};
+
+// Blends four pixels at a time, picking source or destination bytes with a mask made from the key.
+template <>
+struct UiBlitKeyedRow<8, 8>
+{
+    static void copy(const uint8_t *src, int srcX, uint8_t *dst, int dstX, int count, const UiBlitContext &context, const uint8_t *maskRow, int maskX)
+    {
+        if (maskRow != NULL || !context.keyed)
+        {
+            uiBlitKeyedPixels<8, 8>(src, srcX, dst, dstX, count, context, maskRow, maskX);
+            return;
+        }
+        uint32_t keyWord = context.key * 0x01010101u;
+        const uint8_t *in = src + srcX;
+        uint8_t *out = dst + dstX;
+        int i = 0;
+        for (; i + 4 <= count; i += 4)
+        {
+            uint32_t word;
+            memcpy(&word, in + i, 4);
+            uint32_t mask = uiKeyMask(word, keyWord);
+            if (mask == 0)
+            {
+                continue;
+            }
+            if (mask != 0xFFFFFFFF)
+            {
+                uint32_t under;
+                memcpy(&under, out + i, 4);
+                word = (word & mask) | (under & ~mask);
+            }
+            memcpy(out + i, &word, 4);
+        }
+        uiBlitKeyedPixels<8, 8>(src, srcX + i, dst, dstX + i, count - i, context, NULL, 0);
+    }
+};
+
+/// @brief Clips a blit to both the source and destination buffers.
+/// @details Negative positions are allowed. The source area and destination position are adjusted together.
+/// @return False if nothing is left to copy.
+bool uiClipBlit(const UiPixmap &src, struct area &srcRect, const UiPixmap &dst, int &dstX, int &dstY)
+{
+    if (srcRect.x < 0)
+    {
+        dstX -= srcRect.x;
+        srcRect.width += srcRect.x;
+        srcRect.x = 0;
+    }
+    if (srcRect.y < 0)
+    {
+        dstY -= srcRect.y;
+        srcRect.height += srcRect.y;
+        srcRect.y = 0;
+    }
+    if (dstX < 0)
+    {
+        srcRect.x -= dstX;
+        srcRect.width += dstX;
+        dstX = 0;
+    }
+    if (dstY < 0)
+    {
+        srcRect.y -= dstY;
+        srcRect.height += dstY;
+        dstY = 0;
+    }
+    srcRect.width = min(srcRect.width, min(src.width - srcRect.x, dst.width - dstX));
+    srcRect.height = min(srcRect.height, min(src.height - srcRect.y, dst.height - dstY));
+    return srcRect.width > 0 && srcRect.height > 0;
+}
+
+/**
+ * @brief Copies an area of one pixmap into another, converting the pixel format.
+ * @details Rows are split into bands on the render pool when there are enough of them.
+ * With a colour key or mask, each row is checked first: fully opaque rows are copied
+ * as normal, fully transparent rows are skipped, and only the rest are blended.
+ * @param src The pixmap to copy from.
+ * @param srcRect The area of the source to copy.
+ * @param dst The pixmap to copy to.
+ * @param dstX Where the left edge of the area goes in the destination.
+ * @param dstY Where the top edge of the area goes in the destination.
+ * @param context The greyscale values for 1-bit sources, and any colour key or mask.
+ */
+template <int SrcBpp, int DstBpp>
+void uiBlit(const UiPixmap &src, struct area srcRect, const UiPixmap &dst, int dstX, int dstY, const UiBlitContext &context)
+{
+    if (!uiClipBlit(src, srcRect, dst, dstX, dstY))
+    {
+        return;
+    }
+    if (SrcBpp == 1)
+    {
+        buildMonoLut(context.ink, context.paper);
+    }
+    if (!context.keyed && context.mask == NULL)
+    {
+        renderPool.runBands(srcRect.height, minBandRows, [&](int yStart, int yEnd)
+                            {
+            for (int y = yStart; y < yEnd; y++)
+            {
+                UiBlitRow<SrcBpp, DstBpp>::copy(src.data + (srcRect.y + y) * src.stride, srcRect.x, dst.data + (dstY + y) * dst.stride, dstX, srcRect.width, context);
+            } });
+        return;
+    }
+    renderPool.runBands(srcRect.height, minBandRows, [&](int yStart, int yEnd)
+                        {
+        for (int y = yStart; y < yEnd; y++)
+        {
+            const uint8_t *srcRow = src.data + (srcRect.y + y) * src.stride;
+            uint8_t *dstRow = dst.data + (dstY + y) * dst.stride;
+            const uint8_t *maskRow = context.mask == NULL ? NULL : context.mask + (srcRect.y + y) * context.maskStride;
+            int keyCoverage = context.keyed ? uiKeyCoverage<SrcBpp>(srcRow, srcRect.x, srcRect.width, context.key) : ROW_OPAQUE;
+            int maskCoverage = maskRow != NULL ? uiMaskCoverage(maskRow, srcRect.x, srcRect.width) : ROW_OPAQUE;
+            if (keyCoverage == ROW_CLEAR || maskCoverage == ROW_CLEAR)
+            {
+                continue;
+            }
+            if (keyCoverage == ROW_OPAQUE && maskCoverage == ROW_OPAQUE)
+            {
+                UiBlitRow<SrcBpp, DstBpp>::copy(srcRow, srcRect.x, dstRow, dstX, srcRect.width, context);
+            }
+            else
+            {
+                UiBlitKeyedRow<SrcBpp, DstBpp>::copy(srcRow, srcRect.x, dstRow, dstX, srcRect.width, context, maskRow, srcRect.x);
+            }
+        } });
+}
+
+/// @brief Picks the uiBlit specialisation for two pixmaps' formats.
+/// @details There is no 1-bit destination. Only leaf widgets have 1-bit surfaces, and nothing is
+/// composited into them (see UiObj::setMonochrome), so blits to 1-bit pixmaps return false.
+/// @return False if the pair of formats isn't supported.
+bool uiBlitAny(const UiPixmap &src, struct area srcRect, const UiPixmap &dst, int dstX, int dstY, UiBlitContext context = {15, 0})
+{
+    if (src.data == NULL || dst.data == NULL)
+    {
+        return false;
+    }
+    if (src.bpp == 8 && dst.bpp == 8)
+    {
+        uiBlit<8, 8>(src, srcRect, dst, dstX, dstY, context);
+    }
+    else if (src.bpp == 8 && dst.bpp == 4)
+    {
+        uiBlit<8, 4>(src, srcRect, dst, dstX, dstY, context);
+    }
+    else if (src.bpp == 4 && dst.bpp == 4)
+    {
+        uiBlit<4, 4>(src, srcRect, dst, dstX, dstY, context);
+    }
+    else if (src.bpp == 4 && dst.bpp == 8)
+    {
+        uiBlit<4, 8>(src, srcRect, dst, dstX, dstY, context);
+    }
+    else if (src.bpp == 1 && dst.bpp == 4)
+    {
+        uiBlit<1, 4>(src, srcRect, dst, dstX, dstY, context);
+    }
+    else if (src.bpp == 1 && dst.bpp == 8)
+    {
+        uiBlit<1, 8>(src, srcRect, dst, dstX, dstY, context);
+    }
+    else
+    {
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Fills vector icon paths into 4-bit pixmaps.
+ * @details Paths use the command format described in icons.h. Curves are flattened to lines,
+ * and each pixel row is sampled on four sub-rows, each split into quarter pixels, so edges
+ * get one of 16 coverage levels blended between the paper and ink greys.
+ */
+class UiPathRaster
+{
+public:
+    /// @brief Draws a path scaled to fill a 4-bit pixmap.
+    /// @return False if the path has a command that isn't recognised.
+    bool rasterize(const uint8_t *path, const UiPixmap &dst, uint8_t ink, uint8_t paper)
+    {
+        this->edges.clear();
+        this->scaleX = dst.width / 256.0f;
+        this->scaleY = dst.height / 256.0f;
+        if (!this->buildEdges(path))
+        {
+            return false;
+        }
+        std::sort(this->edges.begin(), this->edges.end(), [](const struct edge &a, const struct edge &b)
+                  { return a.top < b.top; });
+        this->coverage.assign(dst.width, 0);
+        this->active.clear();
+        this->crossings.clear();
+        size_t next = 0;
+        for (int y = 0; y < dst.height; y++)
+        {
+            std::fill(this->coverage.begin(), this->coverage.end(), 0);
+            for (int sub = 0; sub < subSamples; sub++)
+            {
+                float sampleY = y + (sub + 0.5f) / subSamples;
+                while (next < this->edges.size() && this->edges[next].top <= sampleY)
+                {
+                    this->active.push_back(next++);
+                }
+                this->crossings.clear();
+                for (size_t i = 0; i < this->active.size();)
+                {
+                    const struct edge &edge = this->edges[this->active[i]];
+                    if (edge.bottom <= sampleY)
+                    {
+                        this->active[i] = this->active.back();
+                        this->active.pop_back();
+                        continue;
+                    }
+                    this->crossings.push_back(edge.x + (sampleY - edge.top) * edge.slope);
+                    i++;
+                }
+                std::sort(this->crossings.begin(), this->crossings.end());
+                for (size_t i = 0; i + 1 < this->crossings.size(); i += 2)
+                {
+                    this->addSpan(this->crossings[i], this->crossings[i + 1]);
+                }
+            }
+            uint8_t *row = dst.data + y * dst.stride;
+            for (int x = 0; x < dst.width; x++)
+            {
+                int level = paper * 16 + (ink - paper) * (int)this->coverage[x];
+                UiPixelFormat<4>::set(row, x, (level + 8) >> 4);
+            }
+        }
+        return true;
+    };
+
+private:
+    struct edge
+    {
+        float top;
+        float bottom;
+        // x at the top of the edge, and how far it moves per row down.
+        float x;
+        float slope;
+    };
+
+    bool buildEdges(const uint8_t *path)
+    {
+        float startX = 0;
+        float startY = 0;
+        float x = 0;
+        float y = 0;
+        while (*path != 0)
+        {
+            uint8_t command = *path++;
+            if (command == 'M')
+            {
+                this->addEdge(x, y, startX, startY);
+                x = startX = path[0] * this->scaleX;
+                y = startY = path[1] * this->scaleY;
+                path += 2;
+            }
+            else if (command == 'L')
+            {
+                float toX = path[0] * this->scaleX;
+                float toY = path[1] * this->scaleY;
+                this->addEdge(x, y, toX, toY);
+                x = toX;
+                y = toY;
+                path += 2;
+            }
+            else if (command == 'Q')
+            {
+                float controlX = path[0] * this->scaleX;
+                float controlY = path[1] * this->scaleY;
+                float toX = path[2] * this->scaleX;
+                float toY = path[3] * this->scaleY;
+                // About one line every four pixels along the curve.
+                float length = hypotf(controlX - x, controlY - y) + hypotf(toX - controlX, toY - controlY);
+                int steps = constrain((int)(length / 4) + 1, 1, 16);
+                float fromX = x;
+                float fromY = y;
+                for (int i = 1; i <= steps; i++)
+                {
+                    float t = (float)i / steps;
+                    float u = 1 - t;
+                    float curveX = u * u * fromX + 2 * u * t * controlX + t * t * toX;
+                    float curveY = u * u * fromY + 2 * u * t * controlY + t * t * toY;
+                    this->addEdge(x, y, curveX, curveY);
+                    x = curveX;
+                    y = curveY;
+                }
+                path += 4;
+            }
+            else if (command == 'Z')
+            {
+                this->addEdge(x, y, startX, startY);
+                x = startX;
+                y = startY;
+            }
+            else
+            {
+                return false;
+            }
+        }
+        this->addEdge(x, y, startX, startY);
+        return true;
+    };
+
+    void addEdge(float x0, float y0, float x1, float y1)
+    {
+        if (y0 == y1)
+        {
+            // Flat edges never cross a sample row.
+            return;
+        }
+        if (y0 > y1)
+        {
+            std::swap(x0, x1);
+            std::swap(y0, y1);
+        }
+        this->edges.push_back({y0, y1, x0, (x1 - x0) / (y1 - y0)});
+    };
+
+    /// @brief Adds one sub-row's worth of coverage between two crossings.
+    void addSpan(float from, float to)
+    {
+        int width = this->coverage.size();
+        int start = constrain((int)(from * subSamples + 0.5f), 0, width * subSamples);
+        int end = constrain((int)(to * subSamples + 0.5f), 0, width * subSamples);
+        if (start >= end)
+        {
+            return;
+        }
+        int first = start / subSamples;
+        int last = (end - 1) / subSamples;
+        if (first == last)
+        {
+            this->coverage[first] += end - start;
+            return;
+        }
+        this->coverage[first] += subSamples - start % subSamples;
+        for (int x = first + 1; x < last; x++)
+        {
+            this->coverage[x] += subSamples;
+        }
+        this->coverage[last] += end - last * subSamples;
+    };
+
+    static const int subSamples = 4;
+    float scaleX;
+    float scaleY;
+    std::vector<struct edge> edges;
+    std::vector<size_t> active;
+    std::vector<float> crossings;
+    // Hits per pixel on the current row, out of subSamples squared.
+    std::vector<uint8_t> coverage;
+};
+
+/**
+ * @brief Keeps rasterized vector icons for each size and colour they are shown at.
+ * @details An icon is only rasterized the first time it is needed at a size, and blitted from here after that.
+ * When the cache is over its size, the icons used least recently are dropped.
+ */
+class UiIconCache
+{
+public:
+    UiIconCache(uint32_t capacity)
+    {
+        this->capacity = capacity;
+    };
+
+    ~UiIconCache()
+    {
+        this->clear();
+    };
+
+    /// @brief Finds or rasterizes an icon.
+    /// @return A 4-bit pixmap of the icon, with no data if it couldn't be drawn. It stays valid until the next call.
+    UiPixmap get(const uint8_t *path, int width, int height, uint8_t ink, uint8_t paper)
+    {
+        this->clock++;
+        for (struct entry &entry : this->entries)
+        {
+            if (entry.path == path && entry.pixmap.width == width && entry.pixmap.height == height && entry.ink == ink && entry.paper == paper)
+            {
+                entry.lastUsed = this->clock;
+                this->hits++;
+                return entry.pixmap;
+            }
+        }
+        this->misses++;
+        // A miss is a new icon, size or colour on screen, so its buffer is a layout change like a label resizing.
+        UiExpectedAllocations rasterizing;
+        UiPixmap pixmap = uiPixmap(NULL, width, height, 4);
+        uint32_t bytes = pixmap.stride * height;
+        if (width <= 0 || height <= 0)
+        {
+            return pixmap;
+        }
+        while (!this->entries.empty() && this->used + bytes > this->capacity)
+        {
+            this->evict();
+        }
+        pixmap.data = new uint8_t[bytes];
+        if (!this->raster.rasterize(path, pixmap, ink, paper))
+        {
+            debug("Vector icon has an unknown command");
+            delete[] pixmap.data;
+            pixmap.data = NULL;
+            return pixmap;
+        }
+        this->entries.push_back({path, ink, paper, this->clock, pixmap});
+        this->used += bytes;
+        return pixmap;
+    };
+
+    void clear()
+    {
+        for (struct entry &entry : this->entries)
+        {
+            delete[] entry.pixmap.data;
+        }
+        this->entries.clear();
+        this->used = 0;
+    };
+
+    uint32_t capacity;
+    uint32_t used = 0;
+    uint32_t hits = 0;
+    uint32_t misses = 0;
+
+private:
+    struct entry
+    {
+        const uint8_t *path;
+        uint8_t ink;
+        uint8_t paper;
+        uint32_t lastUsed;
+        UiPixmap pixmap;
+    };
+
+    void evict()
+    {
+        size_t oldest = 0;
+        for (size_t i = 1; i < this->entries.size(); i++)
+        {
+            if (this->entries[i].lastUsed < this->entries[oldest].lastUsed)
+            {
+                oldest = i;
+            }
+        }
+        this->used -= this->entries[oldest].pixmap.stride * this->entries[oldest].pixmap.height;
+        delete[] this->entries[oldest].pixmap.data;
+        this->entries.erase(this->entries.begin() + oldest);
+    };
+
+    UiPathRaster raster;
+    std::vector<struct entry> entries;
+    uint32_t clock = 0;
+};
+
+UiIconCache iconCache(iconCacheSize);
+
+/// @brief Counts of property writes, to see how much redrawing the equality checks save.
+struct UiUpdateCounters
+{
+    // Writes that matched the current value and were dropped.
+    uint32_t suppressed;
+    // Writes overwritten by a later write in the same frame.
+    uint32_t coalesced;
+    // Writes that reached their observers.
+    uint32_t applied;
+    // show(), hide() and move() calls that left the object as it was.
+    uint32_t redundant;
+};
+
+UiUpdateCounters updateCounters = {0, 0, 0, 0};
+
+class UiObj;
+
+/**
+ * @brief Measures how much of the rendering and refreshing each frame actually changed the panel.
+ * @details Each frame counts the pixels widgets draw on their surfaces, the pixels packed into the screen
+ * buffer, the packed pixels that differ from what the panel already shows, and the pixels refreshed.
+ * Overdraw is reported as two ratios, the pixels drawn for each pixel refreshed and the pixels packed
+ * for each pixel refreshed, which are both 1.0 when every refreshed pixel is drawn and packed once.
+ * Wasted refresh is the share of refreshed pixels that didn't change.
+ * The panel image is kept in a 4-bit shadow copy of the screen, which costs about 250KB, so this is
+ * only switched on for analysis. Pixels refreshed for the first time count as changed.
+ */
+class UiOverdrawStats
+{
+public:
+    UiOverdrawStats()
+    {
+        this->enabled = false;
+        this->shadow = NULL;
+        this->known = NULL;
+        this->frames = 0;
+        this->drawn = 0;
+        this->packed = 0;
+        this->changed = 0;
+        this->refreshed = 0;
+        this->beginFrame();
+    };
+
+    /// @brief Allocates the shadow image and starts counting.
+    bool begin()
+    {
+        this->shadow = (uint8_t *)calloc(screenWidth * screenHeight / 2, 1);
+        this->known = (uint8_t *)calloc(screenWidth * screenHeight / 8, 1);
+        this->enabled = this->shadow != NULL && this->known != NULL;
+        return this->enabled;
+    };
+
+    void beginFrame()
+    {
+        this->widgets.clear();
+        this->frameDrawn = 0;
+        this->framePacked = 0;
+    };
+
+    void addDrawn(UiObj *obj, struct area rect, uint32_t pixels)
+    {
+        this->widget(obj, rect).drawn += pixels;
+        this->frameDrawn += pixels;
+    };
+
+    void addPacked(UiObj *obj, struct area rect, uint32_t pixels)
+    {
+        this->widget(obj, rect).packed += pixels;
+        this->framePacked += pixels;
+    };
+
+    /// @brief Compares the packed update area with the panel image, then records it as the new panel image.
+    /// @param updateArea The screen area being refreshed.
+    /// @param pixels The packed 4-bit pixels for the area.
+    void endFrame(struct area updateArea, const uint8_t *pixels)
+    {
+        uint32_t frameChanged = this->countChanged(updateArea, updateArea, pixels);
+        for (struct widgetStats &widget : this->widgets)
+        {
+            widget.changed = this->countChanged(widget.rect, updateArea, pixels);
+        }
+        for (int y = 0; y < updateArea.height; y++)
+        {
+            for (int x = 0; x < updateArea.width; x++)
+            {
+                int screenX = updateArea.x + x;
+                int screenY = updateArea.y + y;
+                UiPixelFormat<4>::set(this->shadow, screenY * screenWidth + screenX, UiPixelFormat<4>::get(pixels, y * updateArea.width + x));
+                UiPixelFormat<1>::set(this->known, screenY * screenWidth + screenX, 1);
+            }
+        }
+        uint32_t frameRefreshed = updateArea.width * updateArea.height;
+        this->frames++;
+        this->drawn += this->frameDrawn;
+        this->packed += this->framePacked;
+        this->changed += frameChanged;
+        this->refreshed += frameRefreshed;
+        Serial.println("Overdraw: drawn " + String(this->frameDrawn) + ", packed " + String(this->framePacked) + ", changed " + String(frameChanged) + ", refreshed " + String(frameRefreshed) + ", drawn per refreshed " + ratio(this->frameDrawn, frameRefreshed) + ", packed per refreshed " + ratio(this->framePacked, frameRefreshed) + ", wasted refresh " + ratio(frameRefreshed - frameChanged, frameRefreshed));
+        std::sort(this->widgets.begin(), this->widgets.end(), [](const struct widgetStats &a, const struct widgetStats &b)
+                  { return a.drawn - min(a.drawn, a.changed) > b.drawn - min(b.drawn, b.changed); });
+        for (size_t i = 0; i < this->widgets.size() && i < maxReported; i++)
+        {
+            struct widgetStats &widget = this->widgets[i];
+            char line[100];
+            snprintf(line, sizeof(line), "  %p %dx%d at %d, %d: drawn %u, packed %u, changed %u", (void *)widget.obj, widget.rect.width, widget.rect.height, widget.rect.x, widget.rect.y, (unsigned)widget.drawn, (unsigned)widget.packed, (unsigned)widget.changed);
+            Serial.println(line);
+        }
+        this->beginFrame();
+    };
+
+    /// @brief Prints the totals since counting started.
+    void report(Print &out)
+    {
+        char line[120];
+        snprintf(line, sizeof(line), "Overdraw over %u frames: drawn %llu, packed %llu, changed %llu, refreshed %llu", (unsigned)this->frames, (unsigned long long)this->drawn, (unsigned long long)this->packed, (unsigned long long)this->changed, (unsigned long long)this->refreshed);
+        out.println(line);
+        out.println("Drawn per refreshed " + ratio(this->drawn, this->refreshed) + ", packed per refreshed " + ratio(this->packed, this->refreshed) + ", wasted refresh " + ratio(this->refreshed - this->changed, this->refreshed));
+    };
+
+    /// @return The pixels drawn for each pixel refreshed since counting started, or 0 before the first refresh.
+    double drawnRatio()
+    {
+        return this->refreshed == 0 ? 0 : (double)this->drawn / this->refreshed;
+    };
+
+    /// @return The pixels packed for each pixel refreshed since counting started, or 0 before the first refresh.
+    double packedRatio()
+    {
+        return this->refreshed == 0 ? 0 : (double)this->packed / this->refreshed;
+    };
+
+public:
+    bool enabled;
+    // Totals since counting started.
+    uint32_t frames;
+    uint64_t drawn;
+    uint64_t packed;
+    uint64_t changed;
+    uint64_t refreshed;
+
+private:
+    struct widgetStats
+    {
+        UiObj *obj;
+        // The object's area on the screen.
+        struct area rect;
+        uint32_t drawn;
+        uint32_t packed;
+        uint32_t changed;
+    };
+
+    static String ratio(uint64_t part, uint64_t whole)
+    {
+        return whole == 0 ? String("-") : String((double)part / whole, 2);
+    };
+
+    struct widgetStats &widget(UiObj *obj, struct area rect)
+    {
+        for (struct widgetStats &widget : this->widgets)
+        {
+            if (widget.obj == obj)
+            {
+                return widget;
+            }
+        }
+        this->widgets.push_back({obj, rect, 0, 0, 0});
+        return this->widgets.back();
+    };
+
+    /// @brief Counts the pixels in a screen area that differ from the panel image.
+    uint32_t countChanged(struct area rect, struct area updateArea, const uint8_t *pixels)
+    {
+        int left = max(rect.x, updateArea.x);
+        int top = max(rect.y, updateArea.y);
+        int right = min(rect.x + rect.width, updateArea.x + updateArea.width);
+        int bottom = min(rect.y + rect.height, updateArea.y + updateArea.height);
+        uint32_t count = 0;
+        for (int y = top; y < bottom; y++)
+        {
+            for (int x = left; x < right; x++)
+            {
+                int index = y * screenWidth + x;
+                bool known = UiPixelFormat<1>::get(this->known, index);
+                if (!known || UiPixelFormat<4>::get(this->shadow, index) != UiPixelFormat<4>::get(pixels, (y - updateArea.y) * updateArea.width + x - updateArea.x))
+                {
+                    count++;
+                }
+            }
+        }
+        return count;
+    };
+
+    static const size_t maxReported = 5;
+    uint8_t *shadow;
+    // One bit per pixel, in screen order with no row padding, set once the pixel has been refreshed.
+    uint8_t *known;
+    std::vector<struct widgetStats> widgets;
+    uint32_t frameDrawn;
+    uint32_t framePacked;
+};
+
+UiOverdrawStats overdrawStats;
+
+/**
+ * @brief Something that holds changes until the next frame.
+ * @details Values register themselves when written, and the manager flushes them all before rendering.
+ */
+class UiPendingValue
+{
+public:
+    virtual ~UiPendingValue(){};
+
+    /// @brief Passes every value written since the last frame to its observers.
+    /// @details Called by UiManager::updateDisplay(), on the UI task.
+    static void flushAll()
+    {
+        // Observers may write to other values, which are flushed in a further pass. Observers that
+        // keep writing back to each other would never settle, so what is left after the last pass
+        // waits for the next frame.
+        for (int pass = 0; pass < maxPasses && !pending.empty(); pass++)
+        {
+            std::vector<UiPendingValue *> values;
+            values.swap(pending);
+            for (UiPendingValue *value : values)
+            {
+                value->flush();
+            }
+        }
+    };
+
+    static const int maxPasses = 4;
+
+protected:
+    virtual void flush() = 0;
+    static std::vector<UiPendingValue *> pending;
+};
+
+std::vector<UiPendingValue *> UiPendingValue::pending;
+
+/**
+ * @brief An observable value that widgets can be bound to.
+ * @details Writing a value equal to the current one does nothing. Other writes are held until the
+ * next frame, so several writes in one frame reach observers once, with the last value.
+ * Only use from the UI task; other tasks should post to UiManager::commands.
+ */
+template <typename T>
+class UiValue : public UiPendingValue
+{
+public:
+    UiValue(T value = T())
+    {
+        this->value = value;
+        this->next = value;
+        this->dirty = false;
+    };
+
+    ~UiValue()
+    {
+        if (this->dirty)
+        {
+            pending.erase(std::remove(pending.begin(), pending.end(), this), pending.end());
+        }
+    };
+
+    /// @brief The value observers have been given.
+    const T &get()
+    {
+        return this->value;
+    };
+
+    void set(const T &value)
+    {
+        if (value == (this->dirty ? this->next : this->value))
+        {
+            updateCounters.suppressed++;
+            return;
+        }
+        if (this->dirty)
+        {
+            updateCounters.coalesced++;
+        }
+        else
+        {
+            this->dirty = true;
+            pending.push_back(this);
+        }
+        this->next = value;
+    };
+
+    UiValue<T> &operator=(const T &value)
+    {
+        this->set(value);
+        return *this;
+    };
+
+    /// @brief Calls the observer with the current value now, and with each new value once per frame.
+    void observe(std::function<void(const T &)> observer)
+    {
+        this->observers.push_back(observer);
+        observer(this->value);
+    };
+
+protected:
+    void flush() override
+    {
+        this->dirty = false;
+        if (this->next == this->value)
+        {
+            // Changed and changed back within the frame.
+            updateCounters.suppressed++;
+            return;
+        }
+        this->value = this->next;
+        updateCounters.applied++;
+        for (std::function<void(const T &)> &observer : this->observers)
+        {
+            observer(this->value);
+        }
+    };
+
+private:
+    T value;
+    T next;
+    bool dirty;
+    std::vector<std::function<void(const T &)>> observers;
+};
+
+class UiObj
+{
+public:
+    enum objectEvents
+    {
+        EVENT_NONE,
+        EVENT_TOUCH,
+        EVENT_DRAW,
+        EVENT_UPDATE,
+        EVENT_VISIBILITY,
+        EVENT_PARENT_CHANGE
+    };
+
+    UiObj()
+    {
+        this->x = 0;
+        this->y = 0;
+        this->width = 0;
+        this->height = 0;
+        this->surface = NULL;
+        this->hardwareDraw = false;
+        this->unbuffered = true;
+        this->initDefaults();
+    }
+
+    UiObj(int x, int y, int width, int height, bool unbuffered = false)
+    {
+        this->init(x, y, width, height, unbuffered);
+    };
+
+    // The surface frees its own buffer.
+    virtual ~UiObj(){};
+
+    void init(int x, int y, int width, int height, bool unbuffered = false)
+    {
+        this->x = x;
+        this->y = y;
+        this->width = width;
+        this->height = height;
+        this->surface = TFT_eSprite(NULL);
+        if (!unbuffered && width > 0 && height > 0)
+        {
+            this->surface.setColorDepth(this->surfaceDepth());
+            this->surface.createSprite(width, height, 1);
+            this->unbuffered = false;
+        }
+        else
+        {
+            this->unbuffered = true;
+        }
+        this->hardwareDraw = unbuffered;
+        this->initDefaults();
+    };
+
+    /**
+     * @brief Sets the default values for the object.
+     */
+    void initDefaults()
+    {
+        this->visible = true;
+        this->layer = LAYER_CENTRE;
+        this->updated = true;
+        this->initialised = true;
+        this->visibilityChanged = false;
+        this->parent = NULL;
+        this->newParent = false;
+        this->drawn = false;
+        this->exposed = false;
+        this->updateArea = {0, 0, 0, 0};
+    };
+
+    /**
+     * @brief Create a buffer for the object.
+     *
+     * @param width The pixel width of the buffer.
+     * @param height The pixel height of the buffer.
+     */
+    void createBuffer(int width, int height)
+    {
+        if (this->unbuffered)
+        {
+            this->width = width;
+            this->height = height;
+            this->surface.setColorDepth(this->surfaceDepth());
+            this->surface.createSprite(this->width, this->height, 1);
+            this->unbuffered = false;
+            this->hardwareDraw = false;
+        }
+    };
+
+    /**
+     * @brief Lets the parent show through wherever the object's surface is the key colour.
+     * @details Used for non-rectangular objects, like rounded buttons, so their corners don't cover what's behind them.
+     * The key is compared with the surface's raw pixels: a 4-bit grey for 8-bit surfaces, or 0 (paper) and 1 (ink) for 1-bit ones.
+     * @param transparent True to skip pixels matching the key when compositing.
+     * @param key The pixel value to treat as see-through.
+     */
+    void setTransparent(bool transparent, uint8_t key = 0)
+    {
+        this->transparent = transparent;
+        this->colourKey = key;
+        this->updated = true;
+    };
+
+    /// @brief Sets a 1-bit mask to composite the object through, or NULL for none.
+    /// @details The mask is one bit per surface pixel, left pixel in the high bit, with rows padded to whole bytes.
+    /// Clear bits are see-through. The caller owns the mask, which must outlive the object or be removed first.
+    void setMask(const uint8_t *mask)
+    {
+        this->mask = mask;
+        this->updated = true;
+    };
+
+    /// @brief The options for compositing this object's surface.
+    UiBlitContext blitContext()
+    {
+        return {this->monoInk, this->monoPaper, this->transparent, this->colourKey, this->mask, (this->width + 7) / 8};
+    };
+
+    /// @brief The bits per pixel of the object's surface.
+    int surfaceDepth()
+    {
+        return this->monochrome ? 1 : 8;
+    };
+
+    /// @brief Switches the object between an 8-bit and a 1-bit surface.
+    /// @details A 1-bit surface uses an eighth of the memory, and is expanded to greyscale when packed.
+    /// Anything drawn in colour 0 becomes the paper colour, and any other colour becomes the ink colour.
+    /// Only leaf widgets can be monochrome: frames composite their children in greyscale, so they refuse.
+    /// @param monochrome True to use a 1-bit surface.
+    /// @param ink The 4-bit greyscale value for drawn pixels.
+    /// @param paper The 4-bit greyscale value for background pixels.
+    /// @return False if the object can't use a 1-bit surface.
+    virtual bool setMonochrome(bool monochrome, uint8_t ink = 15, uint8_t paper = 0)
+    {
+        this->monoInk = ink & 0x0F;
+        this->monoPaper = paper & 0x0F;
+        if (this->monochrome != monochrome)
+        {
+            this->monochrome = monochrome;
+            if (!this->unbuffered)
+            {
+                this->surface.deleteSprite();
+                this->surface.setColorDepth(this->surfaceDepth());
+                this->surface.createSprite(this->width, this->height, 1);
+            }
+        }
+        this->updated = true;
+        return true;
+    };
+
+    /**
+     * @brief Drawing method for the object.
+     * @details This method should draw the object to the screen buffer.
+     * The property this->surface is a TFT_eSprite object that can be using to draw on.
+     * The child class must implement this.
+     */
+    virtual void draw() = 0;
+
+    /**
+     * @brief Called when the object is touched by the user.
+     *
+     * @param x The x coordinate on the object that was touched.
+     * @param y The y coordinate on the object that was touched.
+     * @return true
+     * @return false
+     */
+    virtual bool touchEvent(int x, int y) = 0;
+
+    /**
+     * @brief Finds the area on the object that has been updated and returns it.
+     * The child class must implement this.
+     * @return struct area
+     */
+    virtual struct area getUpdateArea() = 0;
+
+    /**
+     * @brief Set the parent to this object.
+     * @details The parent object is the object that contains this object.
+     * The object will be drawn to the parent object's buffer.
+     * If the parent is NULL then the object will be drawn directly to the screen.
+     * @param parent The containing object.
+     */
+    void setParent(UiObj *parent)
+    {
+        this->parent = parent;
+        this->newParent = true;
+    };
+
+    /**
+     * @brief Checks if an area on the parent is within the bounds of an object.
+     *
+     * @param area The area to check against the object.
+     * @return true The area is within the object.
+     * @return false The area is partially or completely outside the object.
+     */
+    virtual bool within(struct area area)
+    {
+        if (area.x >= this->x && area.x < this->x + this->width && area.y >= this->y && area.y < this->y + this->height)
+        {
+            if (area.x + area.width <= this->x + this->width && area.y + area.height <= this->y + this->height)
+            {
+                return true;
+            }
+            else
+            {
+                return false;
+            }
+        }
+        else
+        {
+            return false;
+        }
+    };
+
+    struct area childOffset(struct area area)
+    {
+        struct area result;
+        if (this->parent == NULL)
+        {
+            return area;
+        }
+        else
+        {
+            result.x = area.x - this->x;
+            result.y = area.y - this->y;
+            result.width = area.width;
+            result.height = area.height;
+            return result;
+        }
+    };
+
+    /**
+     * @brief Sets the object as visible.
+     */
+    void show()
+    {
+        if (this->visible && !this->visibilityChanged)
+        {
+            updateCounters.redundant++;
+            return;
+        }
+        this->visible = true;
+        this->visibilityChanged = true;
+    };
+
+    /**
+     * @brief  Follows the parent chain to find the top level object.
+     * @return UiObj* The top level object.
+     */
+    UiObj *topLevel()
+    {
+        UiObj *obj = this;
+        while (true)
+        {
+            if (obj->parent == NULL)
+            {
+                return obj;
+            }
+            else
+            {
+                obj = obj->parent;
+            }
+        };
+    };
+
+    struct area clip(struct area area1)
+    {
+        return area1;
+    }
+
+    struct area clip(struct area area1, struct area area2)
+    {
+        struct area result;
+        result.x = max(area1.x, area2.x);
+        result.y = max(area1.y, area2.y);
+        result.width = min(area1.x + area1.width, area2.x + area2.width) - result.x;
+        result.height = min(area1.y + area1.height, area2.y + area2.height) - result.y;
+        return result;
+    };
+
+    template <typename... Args>
+    struct area clip(struct area area1, struct area area2, Args... others)
+    {
+        return this->clip(this->clip(area1, area2), others...);
+    };
+
+    template <typename... Args>
+    struct area merge(struct area area, struct area others)
+    {
+        struct area result = this->merge(area, others);
+        result.x = min(result.x, area.x);
+        result.y = min(result.y, area.y);
+        result.width = max(result.width, area.x + area.width);
+        result.height = max(result.height, area.y + area.height);
+        return result;
+    };
+
+    struct area merge(struct area area)
+    {
+        struct area result;
+        result.x = min(this->width, area.x);
+        result.y = min(this->height, area.y);
+        result.width = max(this->width, area.x + area.width);
+        result.height = max(this->height, area.y + area.height);
+        return result;
+    }
+
+    /// @brief Finds if two objects overlap on the screen.
+    /// @param otherObj The object to check against.
+    /// @return The overlapping area. The size (height and width) will be 0 if there is no overlap.
+    struct area overlap(UiObj *otherObj)
+    {
+        struct area thisArea = this->getAbsolutePos();
+        struct area otherArea = otherObj->getAbsolutePos();
+        if (thisArea.x + thisArea.width < otherArea.x || thisArea.x > otherArea.x + otherArea.width || thisArea.y + thisArea.height < otherArea.y || thisArea.y > otherArea.y + otherArea.height)
+        {
+            return {0, 0, 0, 0};
+        }
+        else
+        {
+            return {max(thisArea.x, otherArea.x), max(thisArea.y, otherArea.y), min(thisArea.x + thisArea.width, otherArea.x + otherArea.width) - max(thisArea.x, otherArea.x), min(thisArea.y + thisArea.height, otherArea.y + otherArea.height) - max(thisArea.y, otherArea.y)};
+        }
+    };
+
+    /// @brief Find if an area overlaps with the object.
+    /// @param area The area to check, relative to the object.
+    /// @return The overlapping area. The size (height and width) will be 0 if there is no overlap.
+    struct area overlap(struct area area)
+    {
+        struct area thisArea = this->getAbsolutePos();
+        if (thisArea.x + thisArea.width < area.x || thisArea.x > area.x + area.width || thisArea.y + thisArea.height < area.y || thisArea.y > area.y + area.height)
+        {
+            return {0, 0, 0, 0};
+        }
+        else
+        {
+            return {max(thisArea.x, area.x), max(thisArea.y, area.y), min(thisArea.x + thisArea.width, area.x + area.width) - max(thisArea.x, area.x), min(thisArea.y + thisArea.height, area.y + area.height) - max(thisArea.y, area.y)};
+        }
+    };
+
+    /// @brief Finds the position of the object relative to its parent.
+    /// @return An offset position with the parents co-ordinates added.
+    struct area offsetToParent()
+    {
+        if (this->parent)
+        {
+            struct area parentArea = this->parent->getArea();
+            return {this->x + parentArea.x, this->y + parentArea.y, this->width, this->height};
+        }
+        else
+        {
+            return this->getArea();
+        }
+    }
+
+    /// @brief Finds the absolute position of an object on the screen.
+    /// @return An area struct with the X and Y co-ordinates.
+    struct area getAbsolutePos()
+    {
+        if (this->parent)
+        {
+            struct area parentArea = this->parent->getAbsolutePos();
+            return {this->x + parentArea.x, this->y + parentArea.y, this->width, this->height};
+        }
+        else
+        {
+            return this->getArea();
+        }
+    }
+
+    /// @brief Called when part of an object is uncovered and its buffer needs to be rerendered to the parent.
+    /// @param xArea A struct containing the area of the object that needs to be redrawn.
+    virtual void expose(struct area xArea)
+    {
+        this->exposed = true;
+        this->exposeArea = xArea;
+    };
+
+    /// @brief Shows or hides the object as a value changes.
+    /// @details The object must outlive the value.
+    void bindVisible(UiValue<bool> &value)
+    {
+        value.observe([this](const bool &visible)
+                      {
+            if (visible)
+            {
+                this->show();
+            }
+            else
+            {
+                this->hide();
+            } });
+    };
+
+    void hide()
+    {
+        if (this->visible == true)
+        {
+            this->visible = false;
+            this->visibilityChanged = true;
+            this->topLevel()->expose(this->getArea());
+        }
+        else
+        {
+            updateCounters.redundant++;
+        }
+    };
+
+    /// @brief Resets the flags used to render the object.
+    /// @details This function is called after the object has been rendered to reset the flags used to render the object.
+    /// This can be overridden by child classes to reset any additional flags.
+    virtual void resetStatus()
+    {
+        if (this->drawn)
+        {
+            this->updated = false;
+            this->drawn = false;
+            this->exposed = false;
+        }
+        this->newParent = false;
+        this->visibilityChanged = false;
+    };
+
+    /// @brief Marks an area of the object to be redrawn on the next update.
+    /// @details Containers use this to learn about space their children no longer cover.
+    /// @param area The area, relative to the object.
+    virtual void damage(struct area area){};
+
+    /// @brief Applies changes to the object's size before the update area is worked out.
+    /// @details UiManager::updateDisplay() calls it once on the whole tree; frames pass it on to their children.
+    virtual void layout(){};
+
+    /// @brief Marks the object to be drawn and composited again from scratch on the next update.
+    virtual void invalidate()
+    {
+        this->updated = true;
+        this->visibilityChanged = true;
+    };
+
+    /// @brief  Sets the object position within it's container.
+    /// @param  x The x position of the object.
+    /// @param  y The y position of the object.
+    /// @param relative If true the position is relative to the current position.
+    void move(int x, int y, bool relative = false)
+    {
+        if (relative ? x == 0 && y == 0 : x == this->x && y == this->y)
+        {
+            updateCounters.redundant++;
+            return;
+        }
+        if (this->parent)
+            this->parent->damage(this->getArea());
+        if (relative)
+        {
+            this->x += x;
+            this->y += y;
+        }
+        else
+        {
+            this->x = x;
+            this->y = y;
+        }
+        if (this->parent)
+            this->parent->damage(this->getArea());
+    };
+
+    /// @brief  Checks if the object has been updated since the last render.
+    /// @details This function is used to determine if the object needs to be redrawn.
+    /// The function should be overridden by child classes to check for changes to the object.
+    /// @return True if the object has been updated.
+    virtual bool isUpdated() = 0;
+
+    virtual bool visualChange()
+    {
+        return this->visibilityChanged || this->newParent || this->isUpdated() || this->exposed || (this->parent && this->parent->visibilityChanged);
+    };
+    /// @brief Checks if something else changed underneath or around this object, so it must be composited again.
+    /// @details A software parent clears its surface before drawing its children, so they all have to be copied back.
+    /// For a hardware parent, anything overlapping the screen update area has to be packed again,
+    /// otherwise a transparent sibling would be blended over whatever was left in the screen buffer.
+    bool underDamage()
+    {
+        if (this->parent == NULL)
+        {
+            return false;
+        }
+        if (!this->parent->hardwareDraw)
+        {
+            return true;
+        }
+        return areasOverlap(this->getAbsolutePos(), this->topLevel()->updateArea);
+    };
+
+    /// @brief Converts the object properties to an area struct.
+    /// @return An area struct with the object area.
+    struct area getArea()
+    {
+        struct area area;
+        area.x = this->x;
+        area.y = this->y;
+        area.width = this->width;
+        area.height = this->height;
+        return area;
+    };
+
+    /// @brief Draws and visible or changed objects to their surface.
+    /// @details This function controls the rendering pipeline for UiObj types and calls the custom draw() function if an object is changed.
+    void render()
+    {
+        if (!this->initialised || !this->visible)
+        {
+            return;
+        }
+
+        this->getUpdateArea();
+        if (this->procedural)
+        {
+            if (this->visualChange() || this->underDamage())
+            {
+                debug("Composing procedural object");
+                this->compose();
+            }
+            this->drawn = true;
+            return;
+        }
+
+        if (this->isUpdated() && this->predrawn)
+        {
+            debug("Object already drawn by the render pool");
+            this->predrawn = false;
+        }
+        else if (this->isUpdated())
+        {
+            debug("Drawing object: " + String((uint32_t)this) + " At: " + String(this->x) + ", " + String(this->y) + ", " + String(this->width) + ", " + String(this->height));
+            this->draw();
+        }
+        else
+        {
+            debug("Object not updated, skipping draw");
+        }
+        if (overdrawStats.enabled && this->isUpdated() && !this->unbuffered)
+        {
+            // Only the part inside the screen update area can reach the panel.
+            struct area drawnArea = this->overlap(this->topLevel()->updateArea);
+            overdrawStats.addDrawn(this, this->getAbsolutePos(), drawnArea.width * drawnArea.height);
+        }
+
+        if (this->visualChange() || this->underDamage())
+        {
+            debug("Object updated, pushing to parent");
+            if (this->parent == NULL || this->parent->hardwareDraw)
+            {
+                debug("Software draw (pushing buffer)");
+                this->getUpdateArea();
+                // A child's whole surface is packed, so any part of it inside the screen update area is current.
+                struct area packArea = {0, 0, this->width, this->height};
+                this->packToGrey(this->parent == NULL ? this->updateArea : packArea);
+                if (this->exposed)
+                {
+                    // this->packToGrey(this->exposeArea);
+                }
+                debug("Pushing canvas to screen");
+                if (updateArea.width == 0 || updateArea.height == 0)
+                {
+                    debug("Update area is 0, skipping");
+                    return;
+                }
+            }
+            else if (this->parent != NULL)
+            {
+                TFT_eSprite *parentBuffer = &(this->parent->surface);
+                debug("Software draw (copying to parent)");
+                this->copyToParent();
+            }
+            else
+            {
+                debug("Cannot draw, no parent or hardware buffer.");
+            }
+            debug("Software draw (done)");
+        }
+        else
+        {
+            debug("Object not updated, skipping draw");
+        }
+        this->drawn = true;
+    };
+
+    /// @brief Draws a procedural object straight into its parent.
+    /// @details Only called for objects with procedural set, which have no surface of their own.
+    virtual void compose(){};
+
+    /// @brief  Copies the object's drawing buffer to the parent buffer.
+    /// @details Used for drawing objects inside containers.
+    void copyToParent()
+    {
+        TFT_eSprite *buffer = &this->parent->surface;
+        uint8_t *ownBuf = (uint8_t *)this->surface.frameBuffer(1);
+        debug("Source buffer: " + String((uint32_t)ownBuf) + ", Dest buffer: " + String((uint32_t)buffer->frameBuffer(1)));
+        if (buffer->frameBuffer(1) == NULL)
+        {
+            debug("Parent buffer is NULL, NOT copying");
+            return;
+        }
+        debug("Copying object: " + String((uint32_t)this) + " to size: " + String(this->width) + "x" + String(this->height) + " at: " + String(this->x) + ", " + String(this->y));
+        debug("Buffer size: " + String(buffer->width()) + "x" + String(buffer->height()));
+        UiPixmap src = this->pixmap();
+        UiPixmap dst = this->parent->pixmap();
+        if (!uiBlitAny(src, {0, 0, this->width, this->height}, dst, this->x, this->y, this->blitContext()))
+        {
+            debug("Can't copy " + String(src.bpp) + "-bit object to " + String(dst.bpp) + "-bit parent");
+        }
+    };
+
+    /// @brief Describes the object's surface for the blit functions.
+    UiPixmap pixmap()
+    {
+        return uiPixmap((uint8_t *)this->surface.frameBuffer(1), this->surface.width(), this->surface.height(), this->surfaceDepth());
+    };
+
+    /// @brief Pack the object to the screen buffer.
+    /// @details Copies an objects 8-bit drawing buffer in the screen buffer transforming it to 4-bit greyscale.
+    /// The screen buffer holds the top level object's update area, and anything outside it is clipped.
+    /// @param renderArea The area of the object to pack, relative to the object.
+    void packToGrey(struct area renderArea)
+    {
+        debug("Render area is: " + String(renderArea.x) + ", " + String(renderArea.y) + ", " + String(renderArea.width) + ", " + String(renderArea.height));
+
+        uint8_t *ownBuf = (uint8_t *)this->surface.frameBuffer(1);
+        uint8_t *outBuf = (uint8_t *)screenBuffer;
+        struct area absoluteRange = this->getAbsolutePos();
+        struct area topRange = this->topLevel()->updateArea;
+        if (ownBuf == NULL || outBuf == NULL)
+        {
+            return;
+        }
+
+        debug("Packing object: " + String((uint32_t)this) + " to size: " + String(renderArea.width) + "x" + String(renderArea.height) + " at: " + String(renderArea.x) + ", " + String(renderArea.y));
+        debug("Object size: " + String(this->width) + "x" + String(this->height));
+        debug("Position: " + String(this->x) + ", " + String(this->y));
+        debug("Screen update area: " + String(topRange.x) + ", " + String(topRange.y) + ", " + String(topRange.width) + ", " + String(topRange.height));
+        debug("Absolute area is " + String(absoluteRange.x) + ", " + String(absoluteRange.y) + ", " + String(absoluteRange.width) + ", " + String(absoluteRange.height));
+        UiPixmap dst = uiPixmap(outBuf, topRange.width, topRange.height, 4);
+        int dstX = absoluteRange.x + renderArea.x - topRange.x;
+        int dstY = absoluteRange.y + renderArea.y - topRange.y;
+        if (overdrawStats.enabled)
+        {
+            struct area clipped = renderArea;
+            int clippedX = dstX;
+            int clippedY = dstY;
+            if (uiClipBlit(this->pixmap(), clipped, dst, clippedX, clippedY))
+            {
+                overdrawStats.addPacked(this, absoluteRange, clipped.width * clipped.height);
+            }
+        }
+        uiBlitAny(this->pixmap(), renderArea, dst, dstX, dstY, this->blitContext());
+    };
+
+    /// @brief Convert a 4-bit greyscale value to a 16-bit colour value
+    /// Useful for drawing with the TFT_eSprite library functions.
+    /// @param grey A four-bit greyscale value. 0 is black, 15 is white.
+    /// @return A 16-bit 565 formatted colour value.
+    static uint16_t greyToColour16(int grey)
+    {
+        return (grey & 0x03) << 3 | (grey & 0x0C) << 6;
+    }
+
+public:
+    enum layer_t
+    {
+        LAYER_BG,
+        LAYER_LOWER,
+        LAYER_CENTRE,
+        LAYER_UPPER,
+        LAYER_TOP,
+        LAYER_OVERLAY
+    };
+    int x;
+    int y;
+    int width;
+    int height;
+    UiObj *parent = NULL;
+    TFT_eSprite surface = NULL;
+    bool updated = false;
+    bool exposed = false;
+    bool hardwareDraw = false;
+    bool unbuffered = true;
+    bool visible = true;
+    bool initialised = false;
+    bool visibilityChanged = false;
+    bool newParent = false;
+    bool drawn = false;
+    /// @brief Set to false if draw() touches anything other than this object's own surface.
+    bool threadSafeDraw = true;
+    bool predrawn = false;
+    /// @brief True if the object has no buffer and is drawn by compose() instead.
+    bool procedural = false;
+    /// @brief True if getUpdateArea() reports only the changed part of the object, rather than all of it.
+    bool partialDamage = false;
+    bool monochrome = false;
+    uint8_t monoInk = 15;
+    uint8_t monoPaper = 0;
+    bool transparent = false;
+    uint8_t colourKey = 0;
+    const uint8_t *mask = NULL;
+    enum layer_t layer = LAYER_CENTRE;
+    struct area updateArea;
+    struct area exposeArea;
+};
+
+/// @brief Measures part of a string with a sprite's current font.
+/// @details The string is cut in place for the measurement and put back afterwards.
+int uiSpanWidth(TFT_eSprite &surface, char *text, int start, int end)
+{
+    char next = text[end];
+    text[end] = 0;
+    int width = surface.textWidth(text + start);
+    text[end] = next;
+    return width;
+}
+
+/// @brief Finds where a wrapped line starting at offset ends.
+/// @details A line ends at a newline, or at the last space that lets it fit the width.
+/// A word wider than the width is split, so every line but an empty one takes at least one character.
+/// @param surface The sprite whose font measures the text.
+/// @param text Text that can be cut in place while it's measured.
+/// @param length The length of the text.
+/// @param offset The index of the first character of the line.
+/// @param width The width to fit the line in, in pixels.
+/// @return The index after the last character of the line.
+int uiLineLimit(TFT_eSprite &surface, char *text, int length, int offset, int width)
+{
+    int lineEnd = offset;
+    while (lineEnd < length && text[lineEnd] != '\n')
+    {
+        lineEnd++;
+    }
+
+    while (lineEnd - offset > 1 && uiSpanWidth(surface, text, offset, lineEnd) > width)
+    {
+        int wordStart = lineEnd;
+        do
+        {
+            wordStart--;
+        } while (text[wordStart] != ' ' && wordStart > offset);
+        lineEnd = wordStart > offset ? wordStart : lineEnd - 1;
+    }
+    return lineEnd;
+}
+
+/**
+ * @brief How a label looks: its fill, outline, text and padding.
+ * @details Styles are shared and never change once shared. A label holds a pointer to one,
+ * and its setters move it to the shared style with the new values, creating that style if no
+ * other label uses it yet. So all the buttons on a screen hold one copy of their style between
+ * them, and a label that differs from its neighbours costs one more style, not one per field.
+ * A new UiStyle has the default label look; change its fields and pass it to UiLabel::setStyle().
+ */
+struct UiStyle
+{
+    enum hAlign
+    {
+        ALIGN_LEFT,
+        ALIGN_CENTRE,
+        ALIGN_RIGHT
+    };
+
+    enum vAlign
+    {
+        ALIGN_TOP,
+        ALIGN_MIDDLE,
+        ALIGN_BOTTOM
+    };
+
+    UiStyle()
+    {
+        this->font = NULL;
+        this->lineSpacing = 0.5;
+        this->fillColour = 0;
+        this->outlineColour = UiObj::greyToColour16(1);
+        this->textColour = UiObj::greyToColour16(15);
+        this->outlineThickness = 10;
+        this->borderRoundingRadius = 0;
+        this->fillRoundingRadius = 0;
+        this->xPad = 10;
+        this->yPad = 10;
+        this->textSize = 3;
+        this->hasOutline = true;
+        this->hasFill = false;
+        this->borderRounded = false;
+        this->fillRounded = false;
+        this->customFont = false;
+        this->hAlignment = ALIGN_CENTRE;
+        this->vAlignment = ALIGN_MIDDLE;
+    };
+
+    bool sameAs(const UiStyle &other) const
+    {
+        return this->font == other.font && this->lineSpacing == other.lineSpacing && this->fillColour == other.fillColour && this->outlineColour == other.outlineColour && this->textColour == other.textColour && this->outlineThickness == other.outlineThickness && this->borderRoundingRadius == other.borderRoundingRadius && this->fillRoundingRadius == other.fillRoundingRadius && this->xPad == other.xPad && this->yPad == other.yPad && this->textSize == other.textSize && this->hasOutline == other.hasOutline && this->hasFill == other.hasFill && this->borderRounded == other.borderRounded && this->fillRounded == other.fillRounded && this->customFont == other.customFont && this->hAlignment == other.hAlignment && this->vAlignment == other.vAlignment;
+    };
+
+    /// @brief Finds or creates the shared style with the same values, and takes a reference to it.
+    /// @details Must only be called from the UI task.
+    static const UiStyle *share(const UiStyle &style)
+    {
+        for (UiStyle *shared : UiStyle::shared)
+        {
+            if (shared == &style || shared->sameAs(style))
+            {
+                shared->users++;
+                return shared;
+            }
+        }
+        UiStyle *shared = new UiStyle(style);
+        shared->users = 1;
+        UiStyle::shared.push_back(shared);
+        return shared;
+    };
+
+    /// @brief Drops a reference to a shared style, deleting it once nothing uses it.
+    static void release(const UiStyle *style)
+    {
+        if (style == NULL || --style->users > 0)
+        {
+            return;
+        }
+        UiStyle::shared.erase(std::find(UiStyle::shared.begin(), UiStyle::shared.end(), style));
+        delete style;
+    };
+
+    /// @brief The number of different styles in use.
+    static int count()
+    {
+        return UiStyle::shared.size();
+    };
+
+    /// @brief The style labels start with.
+    static const UiStyle *label()
+    {
+        static const UiStyle *style = UiStyle::share(UiStyle());
+        return style;
+    };
+
+    /// @brief The style buttons start with: a thinner rounded outline and a rounded fill.
+    static const UiStyle *button()
+    {
+        static const UiStyle *style = NULL;
+        if (style == NULL)
+        {
+            UiStyle button;
+            button.outlineThickness = 5;
+            button.borderRoundingRadius = 5;
+            button.hasFill = true;
+            button.fillColour = UiObj::greyToColour16(2);
+            button.fillRounded = true;
+            button.fillRoundingRadius = 5;
+            style = UiStyle::share(button);
+        }
+        return style;
+    };
+
+    /// @brief The style frames start with.
+    static const UiStyle *frame()
+    {
+        static const UiStyle *style = NULL;
+        if (style == NULL)
+        {
+            UiStyle frame;
+            frame.outlineColour = UiObj::greyToColour16(10);
+            frame.outlineThickness = 2;
+            frame.borderRounded = true;
+            frame.borderRoundingRadius = 10;
+            frame.fillRoundingRadius = 10;
+            style = UiStyle::share(frame);
+        }
+        return style;
+    };
+
+public:
+    GFXfont *font;
+    float lineSpacing;
+    uint16_t fillColour;
+    uint16_t outlineColour;
+    uint16_t textColour;
+    uint16_t outlineThickness;
+    uint16_t borderRoundingRadius;
+    uint16_t fillRoundingRadius;
+    uint16_t xPad;
+    uint16_t yPad;
+    // A byte, as TFT_eSprite::setTextSize() takes a uint8_t.
+    uint8_t textSize;
+    bool hasOutline : 1;
+    bool hasFill : 1;
+    bool borderRounded : 1;
+    bool fillRounded : 1;
+    bool customFont : 1;
+    uint8_t hAlignment : 2;
+    uint8_t vAlignment : 2;
+
+private:
+    // The number of labels using a shared style. The built in styles keep one reference forever.
+    mutable uint16_t users = 0;
+    static std::vector<UiStyle *> shared;
+};
+
+std::vector<UiStyle *> UiStyle::shared;
+
+/**
+ * @brief A simple label object.
+ * @details A simple label object. Can be used to display text on the screen.
+ * A number of formatting options are available.
+ */
+
+class UiLabel : public UiObj
+{
+public:
+    UiLabel(int x, int y, int width, int height, String text, bool unbuffered = false) : UiObj()
+    {
+        this->init(x, y, width, height, text, unbuffered);
+    };
+
+    UiLabel(int x, int y, String text) : UiObj()
+    {
+        this->init(x, y, text);
+    };
+
+    void init(int x, int y, String text)
+    {
+        UiObj::init(x, y, 0, 0);
+        this->surface = TFT_eSprite(NULL);
+        this->surface.setTextSize(3);
+        int width = this->surface.textWidth(text);
+        int height = this->surface.fontHeight(1);
+        this->init(x, y, 0, 0, text);
+        this->autosize = true;
+        this->autoResize(true);
+    };
+
+    UiLabel() : UiObj()
+    {
+        // Set here too, so the setters can be used before init().
+        this->useStyle(*UiStyle::label());
+        this->initialised = false;
+        this->autosize = false;
+        this->resizeNeeded = false;
+        this->hasPreRender = false;
+    };
+
+    ~UiLabel()
+    {
+        UiStyle::release(this->style);
+    };
+
+    // Copies would share the style and the surface buffer without owning them.
+    UiLabel(const UiLabel &) = delete;
+    UiLabel &operator=(const UiLabel &) = delete;
+
+    void init(int x, int y, int width, int height, String text, bool unbuffered = false)
+    {
+        UiObj::init(x, y, width, height, unbuffered);
+        this->text = text;
+        this->useStyle(*UiStyle::label());
+        this->initialised = true;
+        this->autosize = false;
+        this->resizeNeeded = false;
+        this->hasPreRender = false;
+        this->updated = true;
+    };
+
+    /// @brief Gives the label a new look.
+    /// @details The label shares the style with every other label that has the same values, so it can
+    /// be a temporary. Setters like setFill() change a label's look without affecting any other label.
+    void setStyle(const UiStyle &style)
+    {
+        if (this->style->sameAs(style))
+        {
+            updateCounters.suppressed++;
+            return;
+        }
+        this->useStyle(style);
+        this->resizeNeeded = true;
+        this->updated = true;
+    };
+
+    bool isUpdated() override
+    {
+        return this->updated;
+    };
+
+    /// @brief Resizes an autosized label to fit new text, so the parent damages the right area.
+    void layout() override
+    {
+        if (!this->autosize || !this->resizeNeeded || this->unbuffered)
+        {
+            return;
+        }
+        struct area before = this->getArea();
+        this->autoResize();
+        if (this->parent != NULL && (before.width > this->width || before.height > this->height))
+        {
+            this->parent->damage(before);
+        }
+    };
+
+    struct area getUpdateArea() override
+    {
+        debug("UiLabel::getUpdateArea()");
+        this->updateArea.x = 0;
+        this->updateArea.y = 0;
+        this->updateArea.width = this->width;
+        this->updateArea.height = this->height;
+        return this->updateArea;
+    };
+
+    void draw() override
+    {
+        if (!this->initialised)
+        {
+            return;
+        }
+
+        if (this->hasPreRender)
+        {
+            this->hasPreRender = false;
+            return;
+        }
+
+        if (this->autosize && this->resizeNeeded)
+        {
+            if (width == 0 || height == 0)
+            {
+                this->autoResize(true);
+            }
+            this->autoResize();
+        }
+        this->surface.fillSprite(this->greyToColour16(0));
+        this->drawFill();
+        this->drawText();
+        this->drawOutline();
+    };
+
+    void drawText()
+    {
+        struct area textArea;
+        if (this->text == "")
+        {
+            return;
+        }
+
+        if (this->style->customFont)
+        {
+            surface.setFreeFont(this->style->font);
+        }
+        else
+        {
+            surface.setTextSize(this->style->textSize);
+        }
+        surface.setTextColor(this->style->textColour);
+        surface.setTextDatum(TL_DATUM);
+        textArea = this->getTextPos();
+        if (this->surface.textWidth(this->text) > this->width - this->style->xPad * 2)
+        {
+            this->drawMultilineText(textArea);
+        }
+        else
+        {
+            surface.drawString(this->text, textArea.x, textArea.y);
+        }
+    };
+
+    void drawMultilineText(struct area textArea)
+    {
+        int lineStart = 0;
+        int lineEnd = 0;
+        int lineY = 0;
+        int lineHeight = this->surface.fontHeight(1);
+        int length = this->text.length();
+        std::unique_ptr<char[]> overflow;
+        char *text = this->scratchText(overflow);
+
+        lineHeight += lineHeight * this->style->lineSpacing;
+        debug("UiLabel::drawMultilineText()");
+        while (lineStart < length)
+        {
+            lineEnd = this->lineLimit(text, length, lineStart);
+            char next = text[lineEnd];
+            text[lineEnd] = 0;
+            textArea.x = this->getTextHPos(text + lineStart);
+            this->surface.drawString(text + lineStart, textArea.x, textArea.y + lineY);
+            text[lineEnd] = next;
+            lineY += lineHeight;
+            lineStart = next == '\n' ? lineEnd + 1 : lineEnd;
+        }
+    };
+
+    /// @brief Copies the text to scratch memory, where lines can be cut out in place without building Strings.
+    /// @details The copy comes from the frame arena and is gone after the frame. If the arena is full, it comes
+    /// from the heap instead and is freed with the overflow pointer.
+    char *scratchText(std::unique_ptr<char[]> &overflow)
+    {
+        char *scratch = frameArena.copy(this->text.c_str(), this->text.length());
+        if (scratch == NULL)
+        {
+            overflow.reset(new char[this->text.length() + 1]);
+            scratch = overflow.get();
+            memcpy(scratch, this->text.c_str(), this->text.length() + 1);
+        }
+        return scratch;
+    };
+
+    /// @brief Finds where the line starting at offset ends, wrapping at the label's text area.
+    /// @param text A scratch copy of the text, from scratchText().
+    /// @param length The length of the text.
+    /// @param offset The index of the first character of the line.
+    /// @return The index after the last character of the line.
+    int lineLimit(char *text, int length, int offset)
+    {
+        int textAreaWidth = this->width - this->style->xPad * 2 - this->style->outlineThickness * 2;
+        return uiLineLimit(this->surface, text, length, offset, textAreaWidth);
+    };
+
+    int getTextHPos(const char *text)
+    {
+        int textWidth = this->surface.textWidth(text);
+        int textAreaWidth = this->width - this->style->xPad * 2 - this->style->outlineThickness * 2;
+
+        if (textWidth > textAreaWidth)
+        {
+            return this->style->xPad + this->style->outlineThickness;
+        }
+
+        if (this->style->hAlignment == UiStyle::ALIGN_LEFT)
+        {
+            return this->style->xPad + this->style->outlineThickness;
+        }
+        else if (this->style->hAlignment == UiStyle::ALIGN_CENTRE)
+        {
+            return this->width / 2 - textWidth / 2;
+        }
+        else if (this->style->hAlignment == UiStyle::ALIGN_RIGHT)
+        {
+            return this->width - textWidth - this->style->xPad - this->style->outlineThickness;
+        }
+        return 0;
+    };
+
+    struct area getTextPos()
+    {
+        struct area pos;
+        int textAreaWidth = this->width - this->style->xPad * 2 - this->style->outlineThickness * 2;
+        pos.width = this->surface.textWidth(this->text);
+        pos.height = this->surface.fontHeight(1);
+
+        if (pos.width > textAreaWidth)
+        {
+            pos.height = this->getMultilineHeight();
+            pos.width = textAreaWidth;
+        }
+        else
+        {
+            pos.height = this->surface.fontHeight(1);
+        }
+
+        if (this->style->hAlignment == UiStyle::ALIGN_LEFT)
+        {
+            pos.x = this->style->xPad + this->style->outlineThickness;
+        }
+        else if (this->style->hAlignment == UiStyle::ALIGN_CENTRE)
+        {
+            pos.x = this->width / 2 - pos.width / 2;
+        }
+        else if (this->style->hAlignment == UiStyle::ALIGN_RIGHT)
+        {
+            pos.x = this->width - pos.width - this->style->xPad - this->style->outlineThickness;
+        }
+
+        if (this->style->vAlignment == UiStyle::ALIGN_TOP)
+        {
+            pos.y = this->style->yPad + this->style->outlineThickness;
+        }
+        else if (this->style->vAlignment == UiStyle::ALIGN_MIDDLE)
+        {
+            pos.y = this->height / 2 - pos.height / 2 + 1;
+        }
+        else if (this->style->vAlignment == UiStyle::ALIGN_BOTTOM)
+        {
+            pos.y = this->height - pos.height - this->style->yPad - this->style->outlineThickness;
+        }
+        return pos;
+    }
+
+    int getMultilineHeight()
+    {
+        int lineStart = 0;
+        int lineEnd;
+        int height = 0;
+        int fontHeight = this->surface.fontHeight(1);
+        int lineHeight = fontHeight + fontHeight * this->style->lineSpacing;
+        int length = this->text.length();
+        std::unique_ptr<char[]> overflow;
+        char *text = this->scratchText(overflow);
+
+        while (lineStart < length)
+        {
+            lineEnd = this->lineLimit(text, length, lineStart);
+            height += lineHeight;
+            lineStart = text[lineEnd] == '\n' ? lineEnd + 1 : lineEnd;
+        }
+        height -= fontHeight * this->style->lineSpacing;
+        return height;
+    };
+
+    /// @brief The corner radius used for the outline.
+    int outlineRadius()
+    {
+        if (this->style->fillRounded)
+        {
+            return this->style->fillRoundingRadius;
+        }
+        return this->style->borderRounded ? this->style->borderRoundingRadius : 0;
+    };
+
+    void drawFill()
+    {
+        if (this->style->hasFill)
+        {
+            drawRoundRectSpans(&this->surface, {0, 0, this->width, this->height}, true, this->style->fillRounded ? this->style->fillRoundingRadius : 0, this->style->fillColour, 0, 0, 0);
+        }
+    };
+
+    void drawOutline()
+    {
+        if (this->style->hasOutline)
+        {
+            drawRoundRectSpans(&this->surface, {0, 0, this->width, this->height}, false, 0, 0, this->style->outlineThickness, this->outlineRadius(), this->style->outlineColour);
+        }
+    };
+
+    void setOutline(uint16_t colour, uint16_t thickness, uint16_t roundingRadius = 0)
+    {
+        if (thickness > 0 ? this->style->hasOutline && this->style->outlineColour == this->greyToColour16(colour) && this->style->outlineThickness == thickness && this->style->borderRounded == (roundingRadius > 0) && (roundingRadius == 0 || this->style->borderRoundingRadius == roundingRadius) : !this->style->hasOutline)
+        {
+            updateCounters.suppressed++;
+            return;
+        }
+        UiStyle style = *this->style;
+        if (thickness > 0)
+        {
+            style.hasOutline = true;
+            style.outlineColour = this->greyToColour16(colour);
+            style.outlineThickness = thickness;
+            if (roundingRadius > 0)
+            {
+                style.borderRounded = true;
+                style.borderRoundingRadius = roundingRadius;
+            }
+            else
+            {
+                style.borderRounded = false;
+            }
+        }
+        else
+        {
+            style.hasOutline = false;
+        }
+        this->useStyle(style);
+        this->resizeNeeded = true;
+        this->updated = true;
+    };
+
+    void setTextColour(uint16_t colour)
+    {
+        if (this->style->textColour == this->greyToColour16(colour))
+        {
+            updateCounters.suppressed++;
+            return;
+        }
+        UiStyle style = *this->style;
+        style.textColour = this->greyToColour16(colour);
+        this->useStyle(style);
+        this->updated = true;
+    };
+
+    void setTextSize(int size)
+    {
+        // Styles keep the size in a byte.
+        size = constrain(size, 1, 255);
+        if (this->style->textSize == size)
+        {
+            updateCounters.suppressed++;
+            return;
+        }
+        UiStyle style = *this->style;
+        style.textSize = size;
+        this->useStyle(style);
+        this->resizeNeeded = true;
+        this->updated = true;
+    };
+
+    void setFill(uint16_t colour, uint16_t roundingRadius = 0)
+    {
+        if (this->style->hasFill && this->style->fillColour == this->greyToColour16(colour) && this->style->fillRounded == (roundingRadius > 0) && (roundingRadius == 0 || this->style->fillRoundingRadius == roundingRadius))
+        {
+            updateCounters.suppressed++;
+            return;
+        }
+        UiStyle style = *this->style;
+        style.hasFill = true;
+        style.fillColour = this->greyToColour16(colour);
+        if (roundingRadius > 0)
+        {
+            style.fillRounded = true;
+            style.fillRoundingRadius = roundingRadius;
+        }
+        else
+        {
+            style.fillRounded = false;
+        }
+        this->useStyle(style);
+        this->updated = true;
+    };
+
+    void noFill()
+    {
+        if (!this->style->hasFill)
+        {
+            updateCounters.suppressed++;
+            return;
+        }
+        UiStyle style = *this->style;
+        style.hasFill = false;
+        this->useStyle(style);
+        this->resizeNeeded = true;
+        this->updated = true;
+    };
+
+    void noBorder()
+    {
+        if (!this->style->hasOutline)
+        {
+            updateCounters.suppressed++;
+            return;
+        }
+        UiStyle style = *this->style;
+        style.hasOutline = false;
+        this->useStyle(style);
+        this->resizeNeeded = true;
+        this->updated = true;
+    };
+
+    void setText(String text)
+    {
+        if (text == this->text)
+        {
+            updateCounters.suppressed++;
+            return;
+        }
+        this->text = text;
+        this->resizeNeeded = true;
+        this->updated = true;
+    };
+
+    void setFont(GFXfont *font)
+    {
+        if (this->style->customFont && this->style->font == font)
+        {
+            updateCounters.suppressed++;
+            return;
+        }
+        UiStyle style = *this->style;
+        style.customFont = true;
+        style.font = font;
+        this->useStyle(style);
+        this->resizeNeeded = true;
+        this->updated = true;
+    };
+
+    /// @brief Shows a value as the label's text, updating it once per frame when the value changes.
+    /// @details The label must outlive the value.
+    void bindText(UiValue<String> &value, String prefix = "", String suffix = "")
+    {
+        value.observe([this, prefix, suffix](const String &text)
+                      { this->setText(prefix + text + suffix); });
+    };
+
+    void preRender()
+    {
+        if (!this->initialised)
+        {
+            return;
+        }
+        this->draw();
+        this->hasPreRender = true;
+    };
+
+    void autoResize(bool init = false)
+    {
+        this->autosize = true;
+        this->resizeNeeded = false;
+        if (this->style->customFont)
+        {
+            surface.setFreeFont(this->style->font);
+        }
+        else
+        {
+            surface.setTextSize(this->style->textSize);
+        }
+        width = this->surface.textWidth(this->text) + this->style->xPad * 2 + this->style->outlineThickness * 2;
+        height = this->surface.fontHeight(1) + this->style->yPad * 2 + this->style->outlineThickness * 2;
+
+        if (init)
+        {
+            this->createBuffer(width, height);
+        }
+        else
+        {
+            this->resize(width, height);
+        }
+        this->updated = true;
+    };
+
+    void resize(int width, int height)
+    {
+        UiExpectedAllocations resizing;
+        this->width = width;
+        this->height = height;
+        this->surface.deleteSprite();
+        this->surface.createSprite(width, height, 1);
+        this->updated = true;
+    };
+
+    void defaultFont()
+    {
+        UiStyle style = *this->style;
+        style.customFont = false;
+        this->useStyle(style);
+        this->resizeNeeded = true;
+        this->updated = true;
+    };
+
+    void setPadding(int xPad, int yPad)
+    {
+        UiStyle style = *this->style;
+        style.xPad = xPad;
+        style.yPad = yPad;
+        this->useStyle(style);
+        this->resizeNeeded = true;
+    };
+
+    bool touchEvent(int x, int y) override
+    {
+        return false;
+    }
+
+protected:
+    /// @brief Moves the label to the shared copy of a style, without marking it for redrawing.
+    void useStyle(const UiStyle &style)
+    {
+        const UiStyle *shared = UiStyle::share(style);
+        UiStyle::release(this->style);
+        this->style = shared;
+    };
+
+public:
+    String text;
+    /// @brief The label's look. Use setStyle() or the setters to change it.
+    const UiStyle *style = NULL;
+    bool initialised;
+    bool autosize : 1;
+    bool resizeNeeded : 1;
+    bool hasPreRender : 1;
+};
+
+class UiFrame : public UiLabel
+{
+public:
+    UiFrame(int x, int y, int width, int height, bool hwFrame = false, M5EPD_Canvas *hwSurface = NULL) : UiLabel()
+    {
+        UiFrame::init(x, y, width, height, hwFrame, hwSurface);
+    };
+
+    UiFrame() : UiLabel()
+    {
+        this->initialised = false;
+    };
+
+    void init(int x, int y, int width, int height, bool hwFrame = false, M5EPD_Canvas *hwSurface = NULL)
+    {
+        this->initialised = true;
+        this->hwFrame = hwFrame;
+        this->hwSurface = hwSurface;
+        // A lazy frame gets its buffer when its contents are built.
+        if (!hwFrame && !this->lazy)
+        {
+            UiLabel::init(x, y, width, height, "", false);
+        }
+        else
+        {
+            UiLabel::init(x, y, width, height, "", true);
+        }
+        this->hardwareDraw = hwFrame;
+        // Drawing a frame renders its children into its surface, which may use the render pool itself.
+        this->threadSafeDraw = false;
+        this->backgroundColour = this->greyToColour16(1);
+        this->useStyle(*UiStyle::frame());
+        this->resizeNeeded = true;
+    };
+
+    /// @brief Frames always keep an 8-bit surface, because their children are composited into it.
+    /// @return False if asked for a 1-bit surface.
+    bool setMonochrome(bool monochrome, uint8_t ink = 15, uint8_t paper = 0) override
+    {
+        if (monochrome)
+        {
+            debug("Frames can't use a 1-bit surface");
+            return false;
+        }
+        return UiObj::setMonochrome(false, ink, paper);
+    };
+
+    void add(UiObj *obj)
+    {
+        this->objects.push_back(obj);
+        obj->setParent(this);
+        this->itemsChanged = true;
+    };
+
+    /// @brief Takes an object out of the frame, without deleting it.
+    /// @details The area it covered is redrawn on the next update.
+    void remove(UiObj *obj)
+    {
+        std::vector<UiObj *>::iterator it = std::find(this->objects.begin(), this->objects.end(), obj);
+        if (it == this->objects.end())
+        {
+            return;
+        }
+        this->objects.erase(it);
+        if (obj->visible)
+        {
+            this->damage(obj->getArea());
+        }
+        obj->parent = NULL;
+        this->itemsChanged = true;
+    };
+
+    void damage(struct area area) override
+    {
+        this->uncoveredAreas.push_back(area);
+        this->itemsChanged = true;
+    };
+
+    void resetStatus() override
+    {
+        if (this->drawn)
+        {
+            this->itemsChanged = false;
+            this->uncoveredAreas.clear();
+        }
+        UiObj::resetStatus();
+        for (UiObj *obj : this->objects)
+        {
+            obj->resetStatus();
+        }
+    };
+
+    void invalidate() override
+    {
+        UiObj::invalidate();
+        for (UiObj *obj : this->objects)
+        {
+            obj->invalidate();
+        }
+    };
+
+    /// @brief Builds the frame's children and buffer only when they are needed.
+    /// @details buildContents() runs on the first update the frame is visible for, or when materialize()
+    /// is called. Once the frame has been hidden for releaseAfter milliseconds, its children and buffer
+    /// are deleted again, until it is next shown. A lazy frame owns its children.
+    /// @param releaseAfter How long to keep the contents while hidden, or 0 to keep them once built.
+    /// Calling it before init() saves allocating the buffer at all.
+    void setLazy(unsigned long releaseAfter = 0)
+    {
+        this->lazy = true;
+        this->releaseAfter = releaseAfter;
+        if (!this->initialised)
+        {
+            this->materialized = false;
+        }
+        else if (this->objects.empty())
+        {
+            if (!this->hwFrame)
+            {
+                this->surface.deleteSprite();
+                this->unbuffered = true;
+            }
+            this->materialized = false;
+        }
+    };
+
+    /// @brief Builds a lazy frame's contents now, if they aren't already built.
+    void materialize()
+    {
+        if (!this->lazy || this->materialized)
+        {
+            return;
+        }
+        debug("Building lazy frame contents");
+        UiExpectedAllocations building;
+        if (!this->hwFrame)
+        {
+            this->createBuffer(this->width, this->height);
+        }
+        this->materialized = true;
+        this->buildContents();
+        this->updated = true;
+    };
+
+    /// @brief Deletes a hidden lazy frame's children and buffer.
+    void release()
+    {
+        if (!this->lazy || !this->materialized || this->visible)
+        {
+            return;
+        }
+        debug("Releasing lazy frame contents");
+        this->releaseContents();
+        for (UiObj *obj : this->objects)
+        {
+            delete obj;
+        }
+        this->objects.clear();
+        this->predrawObjects.clear();
+        if (!this->hwFrame)
+        {
+            this->surface.deleteSprite();
+            this->unbuffered = true;
+        }
+        this->materialized = false;
+    };
+
+    void layout() override
+    {
+        UiLabel::layout();
+        if (this->lazy && this->visible)
+        {
+            this->hiddenSince = 0;
+            this->materialize();
+        }
+        else if (this->lazy && this->materialized && this->releaseAfter > 0)
+        {
+            if (this->hiddenSince == 0)
+            {
+                this->hiddenSince = max(millis(), 1UL);
+            }
+            else if (millis() - this->hiddenSince >= this->releaseAfter)
+            {
+                this->release();
+            }
+        }
+        // Children of nested frames are laid out before the top level works out its update area,
+        // otherwise damage from a resized label would only reach this frame after the screen area was fixed.
+        for (UiObj *obj : this->objects)
+        {
+            obj->layout();
+        }
+    };
+
+    virtual ~UiFrame()
+    {
+        if (this->lazy)
+        {
+            for (UiObj *obj : this->objects)
+            {
+                delete obj;
+            }
+        }
+    };
+
+protected:
+    /// @brief Adds a lazy frame's children. Called when the frame is first needed.
+    virtual void buildContents(){};
+
+    /// @brief Forgets any pointers to a lazy frame's children, just before they are deleted.
+    virtual void releaseContents(){};
+
+public:
+
+    bool isUpdated() override
+    {
+        if (!this->initialised)
+        {
+            debug("Frame not updated (uninitialised)");
+            return false;
+        }
+
+        if (this->itemsChanged || this->visibilityChanged || this->newParent || this->updated)
+        {
+            // debug("Frame updated");
+            return true;
+        }
+
+        for (UiObj *obj : this->objects)
+        {
+            if (this->isObjectChanged(obj))
+            {
+                // debug("Frame updated");
+                return true;
+            }
+        }
+        // debug("Frame not updated");
+        return false;
+    };
+
+    bool isObjectChanged(UiObj *obj)
+    {
+        if (obj->initialised && ((obj->isUpdated() && obj->visible) || obj->visibilityChanged || obj->newParent))
+        {
+            return true;
+        }
+        return false;
+    };
+
+    bool withinArea(struct area checkArea, UiObj *obj)
+    {
+        if (obj->x >= checkArea.x && obj->x + obj->width <= checkArea.x + checkArea.width && obj->y >= checkArea.y && obj->y + obj->height <= checkArea.y + checkArea.height)
+        {
+            return true;
+        }
+        return false;
+    };
+
+    bool overlaps(UiObj *obj1, UiObj *obj2)
+    {
+        if (obj1->x + obj1->width < obj2->x || obj1->x > obj2->x + obj2->width || obj1->y + obj1->height < obj2->y || obj1->y > obj2->y + obj2->height)
+        {
+            return false;
+        }
+        return true;
+    };
+
+    struct area getUpdateArea()
+    {
+        debug("Getting frame update area");
+        if (!this->initialised)
+        {
+            return {0, 0, 0, 0};
+        }
+
+        if (!isUpdated())
+        {
+            this->updateArea = {0, 0, 0, 0};
+            return this->updateArea;
+        }
+
+        // A hidden object's area is part of the update below, and whatever it uncovers
+        // is composited again by render(), so siblings under it don't need redrawing.
+        this->updateArea = {0, 0, 0, 0};
+
+        // The frame's own fill or outline changed.
+        if (this->visibilityChanged || this->updated)
+        {
+            this->updateArea = {0, 0, this->width, this->height};
+            return this->updateArea;
+        }
+
+        for (UiObj *obj : this->objects)
+        {
+            // debug("Object position: [" + String(obj->x) + ", " + String(obj->y) + ", " + String(obj->width) + ", " + String(obj->height) + "]");
+            // debug("Object status: [" + String(obj->initialised) + ", " + String(obj->isUpdated()) + ", " + String(obj->visible) + ", " + String(obj->visibilityChanged) + ", " + String(obj->newParent) + "]");
+            if (isObjectChanged(obj))
+            {
+                struct area damage = obj->getArea();
+                if (obj->partialDamage && !obj->visibilityChanged && !obj->newParent)
+                {
+                    struct area changed = obj->getUpdateArea();
+                    damage = {obj->x + changed.x, obj->y + changed.y, changed.width, changed.height};
+                }
+                this->updateArea = areaUnion(this->updateArea, damage);
+            }
+        }
+        for (struct area uncovered : this->uncoveredAreas)
+        {
+            this->updateArea = areaUnion(this->updateArea, uncovered);
+        }
+        // Children may hang over the edges of the frame.
+        int right = min(this->updateArea.x + this->updateArea.width, this->width);
+        int bottom = min(this->updateArea.y + this->updateArea.height, this->height);
+        this->updateArea.x = max(this->updateArea.x, 0);
+        this->updateArea.y = max(this->updateArea.y, 0);
+        this->updateArea.width = max(right - this->updateArea.x, 0);
+        this->updateArea.height = max(bottom - this->updateArea.y, 0);
+        debug("Frame size: " + String(this->width) + ", " + String(this->height));
+
+        if (this->hwFrame)
+        {
+            // A hardware frame must be a multiple of 4 pixels wide.
+            this->updateArea.width = ((this->updateArea.width + 3) >> 2) << 2;
+            if (this->updateArea.x + this->updateArea.width > this->width)
+            {
+                this->updateArea.x = max(this->width - this->updateArea.width, 0);
+            }
+        }
+        debug("Frame update area: " + String(this->updateArea.x) + ", " + String(this->updateArea.y) + ", " + String(this->updateArea.width) + ", " + String(this->updateArea.height));
+        return this->updateArea;
+    }
+
+    void draw()
+    {
+        if (!this->initialised)
+        {
+            return;
+        }
+
+        if (this->hwFrame)
+        {
+            debug("Drawing frame (H/W)");
+        }
+        else
+        {
+            debug("Drawing frame (S/W)");
+        }
+        this->getUpdateArea();
+        if (visibilityChanged)
+        {
+            this->surface.fillSprite(this->backgroundColour);
+        }
+        UiLabel::draw();
+        this->predrawChildren();
+        for (int layer = 0; layer <= UiObj::LAYER_OVERLAY; layer++)
+        {
+            // debug("Drawing layer " + String(layer));
+            for (UiObj *obj : this->objects)
+            {
+                if (obj->visible && obj->layer == layer)
+                { // && this->isObjectChanged(obj)) {
+                    // debug("Drawing object from parent: " + String((uint32_t)obj->parent));
+                    obj->render();
+                }
+            }
+        }
+        this->drawOutline();
+        debug("Done.");
+    };
+
+    /// @brief Draws changed children to their own surfaces in parallel.
+    /// @details Children with their own buffers don't share any memory while drawing,
+    /// so they are handed to the render pool. Copying them to this frame still happens
+    /// in paint order when render() is called on each one.
+    void predrawChildren()
+    {
+        if (renderPool.threads() < 2)
+        {
+            return;
+        }
+        this->predrawObjects.clear();
+        for (UiObj *obj : this->objects)
+        {
+            if (obj->initialised && obj->visible && obj->threadSafeDraw && !obj->unbuffered && obj->isUpdated())
+            {
+                this->predrawObjects.push_back(obj);
+            }
+        }
+        if (this->predrawObjects.size() < 2)
+        {
+            return;
+        }
+        debug("Drawing " + String(this->predrawObjects.size()) + " objects in parallel");
+        renderPool.run(this->predrawObjects.size(), [this](int i)
+                       {
+            UiObj *obj = this->predrawObjects[i];
+            obj->draw();
+            obj->predrawn = true; });
+    };
+
+    void expose(struct area xArea) override
+    {
+        if (this->hwFrame || this->parent == NULL)
+        {
+            for (UiObj *obj : this->objects)
+            {
+                if (obj->visible && this->withinArea(xArea, obj))
+                {
+                    obj->expose(obj->childOffset(xArea));
+                }
+            }
+        }
+        else
+        {
+            UiObj::expose(xArea);
+        }
+    };
+
+    bool touchEvent(int x, int y)
+    {
+        if (!this->initialised)
+        {
+            return false;
+        }
+
+        debug("Frame touch event: " + String(x) + ", " + String(y));
+        for (int layer = UiObj::LAYER_OVERLAY; layer >= 0; layer--)
+        {
+            for (UiObj *obj : this->objects)
+            {
+                if (obj->layer == layer && obj->visible && obj->layer == layer && x >= obj->x && x <= obj->x + obj->width && y >= obj->y && y <= obj->y + obj->height)
+                {
+                    return obj->touchEvent(x - obj->x, y - obj->y);
+                }
+            }
+        }
+        debug("Not matching any object");
+        return false;
+    };
+
+public:
+    std::vector<UiObj *> objects;
+    std::vector<UiObj *> predrawObjects;
+    // Areas left by objects removed, moved or shrunk since the last update.
+    std::vector<struct area> uncoveredAreas;
+    bool lazy = false;
+    // False while a lazy frame's contents haven't been built.
+    bool materialized = true;
+    unsigned long releaseAfter = 0;
+    unsigned long hiddenSince = 0;
+    bool initialised;
+    bool hwFrame;
+    bool itemsChanged;
+    M5EPD_Canvas *hwSurface;
+    uint16_t backgroundColour;
+    uint16_t borderColour;
+};
+
+/**
+ * @brief A button control with a callback function.
+ * @details This class is a button control with a callback function.
+ * It inherits from UiLabel, so all formatting is available.
+ */
+class UiButton : public UiLabel
+{
+public:
+    enum buttonEvent
+    {
+        BUTTON_PRESSED = 100,
+        BUTTON_RELEASED,
+        BUTTON_HOLD,
+        BUTTON_DOUBLE_TAP,
+    };
+
+    UiButton(int x, int y, String text, bool (*callback)(UiButton *, int)) : UiLabel(x, y, text)
+    {
+        this->useStdFunction = false;
+        this->callback = callback;
+        this->useStyle(*UiStyle::button());
+        this->borderColour = 15;
+        // Let the parent show through the rounded corners.
+        this->setTransparent(true);
+    };
+
+    UiButton(int x, int y, String text, std::function<bool(UiButton *, int)> callback) : UiLabel(x, y, text)
+    {
+        this->useStdFunction = true;
+        this->callback = NULL;
+        this->stdCallback = callback;
+        this->useStyle(*UiStyle::button());
+        this->borderColour = 15;
+        // Let the parent show through the rounded corners.
+        this->setTransparent(true);
+    };
+
+    void init(int x, int y, String text, bool (*callback)(UiButton *, int))
+    {
+        UiLabel::init(x, y, text);
+        this->callback = callback;
+    };
+
+    void setOutline(uint16_t colour, uint16_t thickness, uint16_t roundingRadius)
+    {
+        UiStyle style = *this->style;
+        style.hasOutline = true;
+        style.outlineThickness = thickness;
+        style.borderRoundingRadius = roundingRadius;
+        this->useStyle(style);
+        this->borderColour = colour;
+        this->updated = true;
+    };
+
+    UiButton() : UiLabel()
+    {
+        this->useStdFunction = false;
+        this->callback = NULL;
+    };
+
+    bool touchEvent(int x, int y) override
+    {
+        if (!this->initialised || (this->useStdFunction ? !this->stdCallback : this->callback == NULL))
+        {
+            return false;
+        }
+        else
+        {
+            if (this->useStdFunction)
+            {
+                return this->stdCallback(this, BUTTON_RELEASED);
+            }
+            else
+            {
+                return this->callback(this, BUTTON_RELEASED);
+            }
+        }
+    };
+
+public:
+    bool (*callback)(UiButton *, int);
+    std::function<bool(UiButton *, int)> stdCallback;
+    int borderColour;
+
+private:
+    bool useStdFunction;
+};
+
+class UiImage : public UiObj
+{
+public:
+    UiImage(int x, int y, int width, int height, uint8_t *bitmap) : UiObj(x, y, width, height)
+    {
+        this->image = bitmap;
+        this->initialised = true;
+        this->backgroundColour = this->greyToColour16(0);
+        this->updated = true;
+    };
+
+    UiImage() : UiObj()
+    {
+        this->initialised = false;
+    };
+
+    bool isUpdated() override
+    {
+        return this->updated;
+    };
+
+    struct area getUpdateArea() override
+    {
+        this->updateArea.x = 0;
+        this->updateArea.y = 0;
+        this->updateArea.width = this->width;
+        this->updateArea.height = this->height;
+        return this->updateArea;
+    };
+
+    void draw() override
+    {
+        if (!this->initialised)
+        {
+            return;
+        }
+        this->surface.fillScreen(this->backgroundColour);
+        this->surface.drawBitmap(0, 0, this->image, this->width, this->height, this->greyToColour16(15));
+    };
+
+    bool touchEvent(int x, int y) override
+    {
+        return false;
+    };
+
+public:
+    uint8_t *image;
+    bool initialised;
+    uint16_t backgroundColour;
+};
+
+/**
+ * @brief A vector icon drawn at the object's size.
+ * @details The icon has no buffer of its own. It is rasterized into the icon cache the first time it's shown
+ * at a size and in a pair of colours, and blitted from there into the parent when the parent is composited.
+ * Use setTransparent(true, paper) to let the parent show through the paper.
+ */
+class UiVectorImage : public UiObj
+{
+public:
+    /// @param path An icon in the format described in icons.h. It must outlive the object.
+    UiVectorImage(int x, int y, int width, int height, const uint8_t *path) : UiObj(x, y, width, height, true)
+    {
+        this->path = path;
+        this->procedural = true;
+        this->hardwareDraw = false;
+        this->updated = true;
+    };
+
+    void setIcon(const uint8_t *path)
+    {
+        if (path == this->path)
+        {
+            updateCounters.suppressed++;
+            return;
+        }
+        this->path = path;
+        this->updated = true;
+    };
+
+    /// @param ink The 4-bit greyscale value for the icon.
+    /// @param paper The 4-bit greyscale value behind it.
+    void setColours(uint8_t ink, uint8_t paper)
+    {
+        if ((ink & 0x0F) == this->ink && (paper & 0x0F) == this->paper)
+        {
+            updateCounters.suppressed++;
+            return;
+        }
+        this->ink = ink & 0x0F;
+        this->paper = paper & 0x0F;
+        this->updated = true;
+    };
+
+    /// @brief Changes the size the icon is drawn at.
+    void setSize(int width, int height)
+    {
+        if (width == this->width && height == this->height)
+        {
+            updateCounters.suppressed++;
+            return;
+        }
+        struct area before = this->getArea();
+        this->width = width;
+        this->height = height;
+        if (this->parent != NULL && (before.width > width || before.height > height))
+        {
+            this->parent->damage(before);
+        }
+        this->updated = true;
+    };
+
+    bool isUpdated() override
+    {
+        return this->updated;
+    };
+
+    struct area getUpdateArea() override
+    {
+        this->updateArea = {0, 0, this->width, this->height};
+        return this->updateArea;
+    };
+
+    void draw() override{};
+
+    bool touchEvent(int x, int y) override
+    {
+        return false;
+    };
+
+    void compose() override
+    {
+        if (this->parent == NULL || this->path == NULL)
+        {
+            return;
+        }
+        UiPixmap icon = iconCache.get(this->path, this->width, this->height, this->ink, this->paper);
+        if (this->parent->hardwareDraw)
+        {
+            struct area topRange = this->topLevel()->updateArea;
+            struct area pos = this->getAbsolutePos();
+            UiPixmap dst = uiPixmap(screenBuffer, topRange.width, topRange.height, 4);
+            uiBlitAny(icon, {0, 0, this->width, this->height}, dst, pos.x - topRange.x, pos.y - topRange.y, this->blitContext());
+        }
+        else
+        {
+            uiBlitAny(icon, {0, 0, this->width, this->height}, this->parent->pixmap(), this->x, this->y, this->blitContext());
+        }
+    };
+
+private:
+    const uint8_t *path;
+    uint8_t ink = 15;
+    uint8_t paper = 0;
+};
+
+/**
+ * @brief A plain shape with no buffer of its own.
+ * @details Fills, borders and separator lines are worked out row by row when the parent is composited,
+ * and written straight into the parent's surface, or the screen buffer for a hardware frame.
+ * Only the part inside the area being updated is written.
+ */
+class UiShape : public UiObj
+{
+public:
+    enum shapeType
+    {
+        SHAPE_FILL,
+        SHAPE_BORDER,
+        SHAPE_HLINE,
+        SHAPE_VLINE
+    };
+
+    UiShape(int x, int y, int width, int height, enum shapeType shape, uint8_t colour, int thickness = 1) : UiObj(x, y, width, height, true)
+    {
+        this->shape = shape;
+        this->colour = colour & 0x0F;
+        this->thickness = thickness;
+        this->procedural = true;
+        this->hardwareDraw = false;
+        this->updated = true;
+    };
+
+    bool isUpdated() override
+    {
+        return this->updated;
+    };
+
+    struct area getUpdateArea() override
+    {
+        this->updateArea = {0, 0, this->width, this->height};
+        return this->updateArea;
+    };
+
+    void draw() override{};
+
+    bool touchEvent(int x, int y) override
+    {
+        return false;
+    };
+
+    void setColour(uint8_t colour)
+    {
+        this->colour = colour & 0x0F;
+        this->updated = true;
+    };
+
+    void setThickness(int thickness)
+    {
+        this->thickness = thickness;
+        this->updated = true;
+    };
+
+    /// @brief Finds the runs of pixels the shape covers on a row.
+    /// @param row The row, relative to the shape.
+    /// @param spans Receives up to two [start, end) pairs.
+    /// @return The number of spans.
+    int rowSpans(int row, int spans[4])
+    {
+        int t = min(this->thickness, min(this->width, this->height));
+        switch (this->shape)
+        {
+        case SHAPE_FILL:
+            spans[0] = 0;
+            spans[1] = this->width;
+            return 1;
+        case SHAPE_BORDER:
+            if (row < t || row >= this->height - t)
+            {
+                spans[0] = 0;
+                spans[1] = this->width;
+                return 1;
+            }
+            spans[0] = 0;
+            spans[1] = t;
+            spans[2] = this->width - t;
+            spans[3] = this->width;
+            return 2;
+        case SHAPE_HLINE:
+            if (row < (this->height - t) / 2 || row >= (this->height - t) / 2 + t)
+            {
+                return 0;
+            }
+            spans[0] = 0;
+            spans[1] = this->width;
+            return 1;
+        case SHAPE_VLINE:
+            spans[0] = (this->width - t) / 2;
+            spans[1] = spans[0] + t;
+            return 1;
+        }
+        return 0;
+    };
+
+    void compose() override
+    {
+        if (this->parent == NULL)
+        {
+            return;
+        }
+        if (this->parent->hardwareDraw)
+        {
+            struct area topRange = this->topLevel()->updateArea;
+            struct area pos = this->getAbsolutePos();
+            this->composeGrey(screenBuffer, topRange, pos, this->clip(pos, topRange));
+        }
+        else
+        {
+            // A software parent clears its whole surface before drawing its children, so all of the shape is needed.
+            struct area parentArea = {0, 0, this->parent->width, this->parent->height};
+            this->composeSurface(&this->parent->surface, this->clip(this->getArea(), parentArea));
+        }
+    };
+
+private:
+    /// @brief Writes the shape into an 8-bit (or 1-bit) sprite.
+    /// @param clipArea The area of the sprite to write, in the sprite's co-ordinates.
+    void composeSurface(TFT_eSprite *surface, struct area clipArea)
+    {
+        uint8_t *buffer = surface->getColorDepth() == 8 ? (uint8_t *)surface->frameBuffer(1) : NULL;
+        uint16_t colour16 = this->greyToColour16(this->colour);
+        int spans[4];
+        for (int y = clipArea.y; y < clipArea.y + clipArea.height; y++)
+        {
+            int count = this->rowSpans(y - this->y, spans);
+            for (int i = 0; i < count; i++)
+            {
+                int x1 = max(spans[i * 2] + this->x, clipArea.x);
+                int x2 = min(spans[i * 2 + 1] + this->x, clipArea.x + clipArea.width);
+                fillSpan(surface, buffer, x1, x2, y, colour16);
+            }
+        }
+    };
+
+    /// @brief Writes the shape into the packed 4-bit screen buffer.
+    /// @param buffer The screen buffer, laid out to cover topRange.
+    /// @param topRange The screen area the buffer covers.
+    /// @param pos The shape's position on the screen.
+    /// @param clipArea The screen area to write.
+    void composeGrey(uint8_t *buffer, struct area topRange, struct area pos, struct area clipArea)
+    {
+        if (buffer == NULL)
+        {
+            return;
+        }
+        int spans[4];
+        uint8_t both = (this->colour << 4) | this->colour;
+        for (int y = clipArea.y; y < clipArea.y + clipArea.height; y++)
+        {
+            int count = this->rowSpans(y - pos.y, spans);
+            int rowStart = (y - topRange.y) * topRange.width - topRange.x;
+            for (int i = 0; i < count; i++)
+            {
+                int x1 = max(spans[i * 2] + pos.x, clipArea.x);
+                int x2 = min(spans[i * 2 + 1] + pos.x, clipArea.x + clipArea.width);
+                if (x2 <= x1)
+                {
+                    continue;
+                }
+                int first = rowStart + x1;
+                int last = rowStart + x2;
+                if (first & 1)
+                {
+                    buffer[first / 2] = (buffer[first / 2] & 0xF0) | this->colour;
+                    first++;
+                }
+                if (last & 1 && last > first)
+                {
+                    buffer[last / 2] = (buffer[last / 2] & 0x0F) | (this->colour << 4);
+                    last--;
+                }
+                if (last > first)
+                {
+                    memset(buffer + first / 2, both, (last - first) / 2);
+                }
+            }
+        }
+    };
+
+public:
+    enum shapeType shape;
+    uint8_t colour;
+    int thickness;
+};
+
+/**
+ * @brief A table of text cells with no widget or buffer per cell.
+ * @details Each column keeps one word per row pointing into a shared text pool, and a byte
+ * per row for colours once any of its cells has been given some. Cells are drawn one at a time
+ * into a single cell-sized sprite when the parent is composited, and copied straight into the
+ * parent's surface or the screen buffer, so memory depends on the text held rather than the
+ * grid's size on screen. Changing a cell damages only that cell's rectangle.
+ * The parent must be a hardware frame or have an 8-bit surface.
+ */
+class UiGrid : public UiObj
+{
+public:
+    /// @param x The position of the grid in its parent.
+    /// @param y The position of the grid in its parent.
+    /// @param columns The number of columns.
+    /// @param rows The number of rows.
+    /// @param columnWidth The starting width of every column. Use setColumnWidth() to change one.
+    /// @param rowHeight The height of every row.
+    UiGrid(int x, int y, int columns, int rows, int columnWidth, int rowHeight) : UiObj(x, y, columns * columnWidth, rows * rowHeight, true)
+    {
+        this->rows = rows;
+        this->rowHeight = rowHeight;
+        this->columns.resize(columns);
+        for (int i = 0; i < columns; i++)
+        {
+            this->columns[i].x = i * columnWidth;
+            this->columns[i].width = columnWidth;
+        }
+        this->procedural = true;
+        this->partialDamage = true;
+        this->hardwareDraw = false;
+        this->updated = true;
+        this->dirty = {0, 0, this->width, this->height};
+    };
+
+    ~UiGrid()
+    {
+        this->cell.deleteSprite();
+    };
+
+    /// @brief Sets the text of a cell. Text longer than 255 characters is cut short.
+    void setCell(int column, int row, const char *text)
+    {
+        if (!this->inGrid(column, row))
+        {
+            return;
+        }
+        struct column &col = this->columns[column];
+        if (col.cells.empty())
+        {
+            if (text[0] == 0)
+            {
+                return;
+            }
+            col.cells.assign(this->rows, 0);
+        }
+        uint32_t entry = col.cells[row];
+        uint32_t offset = entry >> 8;
+        uint32_t oldLength = entry & 0xFF;
+        uint32_t length = min((uint32_t)strlen(text), (uint32_t)255);
+        if (length == oldLength && memcmp(&this->text[offset], text, length) == 0)
+        {
+            updateCounters.suppressed++;
+            return;
+        }
+        if (length <= oldLength)
+        {
+            // Shorter text fits where the old text was.
+            memcpy(&this->text[offset], text, length);
+            this->wasted += oldLength - length;
+        }
+        else
+        {
+            offset = this->text.size();
+            this->text.insert(this->text.end(), text, text + length);
+            this->wasted += oldLength;
+        }
+        col.cells[row] = offset << 8 | length;
+        if (this->wasted > 256 && this->wasted > this->text.size() / 2)
+        {
+            this->compact();
+        }
+        this->damageCell(column, row);
+    };
+
+    void setCell(int column, int row, const String &text)
+    {
+        this->setCell(column, row, text.c_str());
+    };
+
+    /// @return A copy of a cell's text.
+    String getCell(int column, int row)
+    {
+        if (!this->inGrid(column, row) || this->columns[column].cells.empty())
+        {
+            return "";
+        }
+        uint32_t entry = this->columns[column].cells[row];
+        String text;
+        text.reserve(entry & 0xFF);
+        for (uint32_t i = 0; i < (entry & 0xFF); i++)
+        {
+            text += this->text[(entry >> 8) + i];
+        }
+        return text;
+    };
+
+    /// @brief Sets a cell's colours, for highlighting it.
+    /// @param ink The 4-bit greyscale value for the text.
+    /// @param paper The 4-bit greyscale value for the background.
+    void setCellColours(int column, int row, uint8_t ink, uint8_t paper)
+    {
+        if (!this->inGrid(column, row))
+        {
+            return;
+        }
+        struct column &col = this->columns[column];
+        uint8_t colours = (paper & 0x0F) << 4 | (ink & 0x0F);
+        if (col.colours.empty())
+        {
+            if (colours == this->colours)
+            {
+                return;
+            }
+            col.colours.assign(this->rows, this->colours);
+        }
+        if (col.colours[row] == colours)
+        {
+            updateCounters.suppressed++;
+            return;
+        }
+        col.colours[row] = colours;
+        this->damageCell(column, row);
+    };
+
+    /// @brief Sets the colours of every cell that hasn't been given its own, and of the lines between cells.
+    void setColours(uint8_t ink, uint8_t paper, uint8_t line)
+    {
+        this->colours = (paper & 0x0F) << 4 | (ink & 0x0F);
+        this->lineColour = line & 0x0F;
+        for (struct column &col : this->columns)
+        {
+            col.colours.clear();
+        }
+        this->damageAll();
+    };
+
+    /// @brief Changes a column's width, which moves the columns to its right and resizes the grid.
+    void setColumnWidth(int column, int width)
+    {
+        if (column < 0 || column >= (int)this->columns.size() || this->columns[column].width == width)
+        {
+            return;
+        }
+        struct area before = this->getArea();
+        this->columns[column].width = width;
+        for (size_t i = column + 1; i < this->columns.size(); i++)
+        {
+            this->columns[i].x = this->columns[i - 1].x + this->columns[i - 1].width;
+        }
+        this->width = this->columns.back().x + this->columns.back().width;
+        if (this->parent != NULL && before.width > this->width)
+        {
+            this->parent->damage(before);
+        }
+        this->damageAll();
+    };
+
+    /// @param align How text sits in each of the column's cells.
+    void setColumnAlignment(int column, enum UiStyle::hAlign align)
+    {
+        if (column >= 0 && column < (int)this->columns.size())
+        {
+            this->columns[column].align = align;
+            this->damageAll();
+        }
+    };
+
+    void setTextSize(int size)
+    {
+        this->textSize = size;
+        this->damageAll();
+    };
+
+    /// @brief Finds the cell at a point in the grid.
+    /// @return False if the point is outside every cell.
+    bool cellAt(int x, int y, int &column, int &row)
+    {
+        if (x < 0 || y < 0 || x >= this->width || y >= this->height)
+        {
+            return false;
+        }
+        row = y / this->rowHeight;
+        column = this->columnAt(x);
+        return true;
+    };
+
+    /// @brief The area a cell covers, relative to the grid.
+    struct area cellArea(int column, int row)
+    {
+        return {this->columns[column].x, row * this->rowHeight, this->columns[column].width, this->rowHeight};
+    };
+
+    bool isUpdated() override
+    {
+        return this->updated;
+    };
+
+    struct area getUpdateArea() override
+    {
+        this->updateArea = this->dirty;
+        return this->updateArea;
+    };
+
+    void draw() override{};
+
+    void resetStatus() override
+    {
+        if (this->drawn)
+        {
+            this->dirty = {0, 0, 0, 0};
+        }
+        UiObj::resetStatus();
+    };
+
+    bool touchEvent(int x, int y) override
+    {
+        int column;
+        int row;
+        if (!this->callback || !this->cellAt(x, y, column, row))
+        {
+            return false;
+        }
+        return this->callback(this, column, row);
+    };
+
+    void compose() override
+    {
+        if (this->parent == NULL)
+        {
+            return;
+        }
+        if (this->parent->hardwareDraw)
+        {
+            struct area topRange = this->topLevel()->updateArea;
+            struct area pos = this->getAbsolutePos();
+            struct area clipArea = this->clip(pos, topRange);
+            UiPixmap dst = uiPixmap(screenBuffer, topRange.width, topRange.height, 4);
+            this->composeCells(dst, pos.x - topRange.x, pos.y - topRange.y, {clipArea.x - pos.x, clipArea.y - pos.y, clipArea.width, clipArea.height});
+        }
+        else
+        {
+            // A software parent clears its whole surface before drawing its children, so every cell is needed.
+            struct area parentArea = {-this->x, -this->y, this->parent->width, this->parent->height};
+            this->composeCells(this->parent->pixmap(), this->x, this->y, this->clip({0, 0, this->width, this->height}, parentArea));
+        }
+    };
+
+public:
+    /// @brief Called with the column and row of a touched cell.
+    std::function<bool(UiGrid *, int, int)> callback;
+
+private:
+    struct column
+    {
+        uint16_t x;
+        uint16_t width;
+        uint8_t align = UiStyle::ALIGN_CENTRE;
+        // Per row: the offset of the text in the pool, shifted up 8 bits, and its length. Empty until a cell is set.
+        std::vector<uint32_t> cells;
+        // Per row: paper in the high nibble and ink in the low one. Empty until a cell is given its own colours.
+        std::vector<uint8_t> colours;
+    };
+
+    bool inGrid(int column, int row)
+    {
+        return column >= 0 && column < (int)this->columns.size() && row >= 0 && row < this->rows;
+    };
+
+    int columnAt(int x)
+    {
+        int first = 0;
+        int last = this->columns.size() - 1;
+        while (first < last)
+        {
+            int middle = (first + last + 1) / 2;
+            if (this->columns[middle].x <= x)
+            {
+                first = middle;
+            }
+            else
+            {
+                last = middle - 1;
+            }
+        }
+        return first;
+    };
+
+    void damageCell(int column, int row)
+    {
+        this->dirty = areaUnion(this->dirty, this->cellArea(column, row));
+        this->updated = true;
+    };
+
+    void damageAll()
+    {
+        this->dirty = {0, 0, this->width, this->height};
+        this->updated = true;
+    };
+
+    /// @brief Rebuilds the text pool without the space left by replaced text.
+    void compact()
+    {
+        std::vector<char> text;
+        text.reserve(this->text.size() - this->wasted);
+        for (struct column &col : this->columns)
+        {
+            for (uint32_t &entry : col.cells)
+            {
+                uint32_t offset = text.size();
+                text.insert(text.end(), this->text.begin() + (entry >> 8), this->text.begin() + (entry >> 8) + (entry & 0xFF));
+                entry = offset << 8 | (entry & 0xFF);
+            }
+        }
+        this->text.swap(text);
+        this->wasted = 0;
+    };
+
+    /// @brief Draws the cells inside an area into a pixmap.
+    /// @param dst The pixmap to draw into.
+    /// @param originX Where the grid's left edge is in the pixmap.
+    /// @param originY Where the grid's top edge is in the pixmap.
+    /// @param clipArea The part of the grid to draw, relative to the grid.
+    void composeCells(const UiPixmap &dst, int originX, int originY, struct area clipArea)
+    {
+        if (dst.data == NULL || clipArea.width <= 0 || clipArea.height <= 0)
+        {
+            return;
+        }
+        int firstRow = clipArea.y / this->rowHeight;
+        int lastRow = min((clipArea.y + clipArea.height - 1) / this->rowHeight, this->rows - 1);
+        int firstColumn = this->columnAt(clipArea.x);
+        int lastColumn = this->columnAt(clipArea.x + clipArea.width - 1);
+        for (int row = firstRow; row <= lastRow; row++)
+        {
+            for (int column = firstColumn; column <= lastColumn; column++)
+            {
+                struct area cellArea = this->cellArea(column, row);
+                struct area visible = this->clip(cellArea, clipArea);
+                if (visible.width <= 0 || visible.height <= 0 || !this->drawCell(column, row))
+                {
+                    continue;
+                }
+                struct area srcRect = {visible.x - cellArea.x, visible.y - cellArea.y, visible.width, visible.height};
+                uiBlitAny(this->cellPixmap(), srcRect, dst, originX + visible.x, originY + visible.y);
+            }
+        }
+    };
+
+    UiPixmap cellPixmap()
+    {
+        return uiPixmap((uint8_t *)this->cell.frameBuffer(1), this->cell.width(), this->cell.height(), 8);
+    };
+
+    /// @brief Draws one cell into the top left of the cell sprite.
+    /// @return False if there's no memory for the sprite.
+    bool drawCell(int column, int row)
+    {
+        const struct column &col = this->columns[column];
+        int width = col.width;
+        if (this->cell.width() < width || this->cell.height() != this->rowHeight)
+        {
+            // Only the first draw and a wider column or new row height get here, so it's a layout change.
+            UiExpectedAllocations resizing;
+            int widest = 0;
+            for (const struct column &c : this->columns)
+            {
+                widest = max(widest, (int)c.width);
+            }
+            this->cell.deleteSprite();
+            this->cell.setColorDepth(8);
+            this->cell.createSprite(widest, this->rowHeight, 1);
+        }
+        if (this->cell.frameBuffer(1) == NULL)
+        {
+            return false;
+        }
+        uint8_t colours = col.colours.empty() ? this->colours : col.colours[row];
+        this->cell.fillRect(0, 0, width, this->rowHeight, this->greyToColour16(colours >> 4));
+
+        uint32_t entry = col.cells.empty() ? 0 : col.cells[row];
+        if ((entry & 0xFF) > 0)
+        {
+            char text[256];
+            memcpy(text, &this->text[entry >> 8], entry & 0xFF);
+            text[entry & 0xFF] = 0;
+            this->cell.setTextSize(this->textSize);
+            this->cell.setTextColor(this->greyToColour16(colours & 0x0F));
+            this->cell.setTextDatum(TL_DATUM);
+            int textWidth = this->cell.textWidth(text);
+            int textX = cellPadding;
+            if (col.align == UiStyle::ALIGN_CENTRE)
+            {
+                textX = (width - textWidth) / 2;
+            }
+            else if (col.align == UiStyle::ALIGN_RIGHT)
+            {
+                textX = width - textWidth - cellPadding;
+            }
+            this->cell.drawString(text, textX, (this->rowHeight - this->cell.fontHeight(1)) / 2);
+        }
+
+        // Each cell draws the lines on its right and bottom edges, and the outer cells the grid's border.
+        uint16_t line = this->greyToColour16(this->lineColour);
+        this->cell.drawFastVLine(width - 1, 0, this->rowHeight, line);
+        this->cell.drawFastHLine(0, this->rowHeight - 1, width, line);
+        if (column == 0)
+        {
+            this->cell.drawFastVLine(0, 0, this->rowHeight, line);
+        }
+        if (row == 0)
+        {
+            this->cell.drawFastHLine(0, 0, width, line);
+        }
+        return true;
+    };
+
+    static const int cellPadding = 4;
+    std::vector<struct column> columns;
+    // The text of every cell, one after another with no terminators.
+    std::vector<char> text;
+    // Bytes of the pool no longer used by any cell.
+    uint32_t wasted = 0;
+    int rows;
+    int rowHeight;
+    int textSize = 2;
+    uint8_t colours = 0x0F;
+    uint8_t lineColour = 8;
+    TFT_eSprite cell = NULL;
+    // The part of the grid changed since the last update.
+    struct area dirty;
+};
+
+/**
+ * @brief A line chart of the most recent samples of a value.
+ * @details Samples go into a ring buffer holding one screen's worth. Each new sample is drawn as
+ * one line segment onto what is already in the surface, and only that segment's box is damaged.
+ * When the plot is full, it scrolls left by scrollStep samples at once by moving the existing rows
+ * of pixels, so the whole plot is only refreshed once every scrollStep samples.
+ * The axis is scaled to fit the samples, and the whole chart is only drawn again when a sample
+ * falls outside it, or a scroll leaves samples that fit a different scale.
+ */
+class UiChart : public UiObj
+{
+public:
+    /// @param spacing The horizontal distance between samples, in pixels.
+    UiChart(int x, int y, int width, int height, int spacing = 2) : UiObj(x, y, width, height)
+    {
+        this->spacing = max(spacing, 1);
+        this->plot = {labelWidth, 0, max(width - labelWidth, 1), height};
+        this->capacity = this->plot.width / this->spacing + 1;
+        this->samples = new float[this->capacity];
+        this->scrollStep = max(this->capacity / 4, 1);
+        this->partialDamage = true;
+        this->fullRedraw = true;
+        this->dirty = {0, 0, width, height};
+        this->updated = true;
+    };
+
+    ~UiChart()
+    {
+        delete[] this->samples;
+    };
+
+    /// @brief Adds a sample at the right of the chart.
+    void append(float value)
+    {
+        if (this->count == this->capacity)
+        {
+            this->scroll(min(this->scrollStep, this->count));
+        }
+        this->samples[(this->first + this->count) % this->capacity] = value;
+        this->count++;
+        if (this->autoscale && (value < this->axisMin || value > this->axisMax))
+        {
+            this->fullRedraw = true;
+        }
+        if (this->fullRedraw)
+        {
+            this->dirty = {0, 0, this->width, this->height};
+        }
+        else if (this->count > 1)
+        {
+            int y0 = this->sampleY(this->sample(this->count - 2));
+            int y1 = this->sampleY(value);
+            struct area segment = {this->sampleX(this->count - 2), min(y0, y1), this->spacing + 1, abs(y1 - y0) + 1};
+            this->dirty = areaUnion(this->dirty, segment);
+        }
+        else
+        {
+            this->dirty = areaUnion(this->dirty, {this->sampleX(0), this->sampleY(value), 1, 1});
+        }
+        this->updated = true;
+    };
+
+    /// @brief Fixes the axis range, instead of fitting it to the samples.
+    void setRange(float min, float max)
+    {
+        this->autoscale = false;
+        this->axisMin = min;
+        this->axisMax = max > min ? max : min + 1;
+        this->redraw();
+    };
+
+    /// @brief Fits the axis range to the samples from now on.
+    void setAutoscale()
+    {
+        this->autoscale = true;
+        this->redraw();
+    };
+
+    /// @brief Sets how many samples the chart moves left when it is full.
+    /// @details Larger steps mean fewer full refreshes, but less history on screen just after a scroll.
+    void setScrollStep(int samples)
+    {
+        this->scrollStep = constrain(samples, 1, this->capacity);
+    };
+
+    /// @brief Removes every sample.
+    void clear()
+    {
+        this->count = 0;
+        this->first = 0;
+        this->redraw();
+    };
+
+    /// @return A sample, where 0 is the oldest on screen.
+    float sample(int index)
+    {
+        return this->samples[(this->first + index) % this->capacity];
+    };
+
+    int samplesShown()
+    {
+        return this->count;
+    };
+
+    bool isUpdated() override
+    {
+        return this->updated;
+    };
+
+    struct area getUpdateArea() override
+    {
+        this->updateArea = this->dirty;
+        return this->updateArea;
+    };
+
+    void draw() override
+    {
+        if (this->fullRedraw)
+        {
+            this->drawAll();
+            return;
+        }
+        if (this->pendingScroll > 0)
+        {
+            this->shiftPlot(this->pendingScroll * this->spacing);
+            this->pendingScroll = 0;
+        }
+        uint16_t ink = this->greyToColour16(this->lineColour);
+        for (int i = max(this->drawnCount, 1); i < this->count; i++)
+        {
+            this->surface.drawLine(this->sampleX(i - 1), this->sampleY(this->sample(i - 1)), this->sampleX(i), this->sampleY(this->sample(i)), ink);
+        }
+        if (this->drawnCount == 0 && this->count == 1)
+        {
+            this->surface.drawPixel(this->sampleX(0), this->sampleY(this->sample(0)), ink);
+        }
+        this->drawnCount = this->count;
+    };
+
+    void resetStatus() override
+    {
+        if (this->drawn)
+        {
+            this->dirty = {0, 0, 0, 0};
+        }
+        UiObj::resetStatus();
+    };
+
+    bool touchEvent(int x, int y) override
+    {
+        return false;
+    };
+
+public:
+    uint8_t lineColour = 15;
+    uint8_t axisColour = 8;
+
+private:
+    /// @brief Drops the oldest samples and moves what's drawn of the rest to the left.
+    void scroll(int samples)
+    {
+        this->first = (this->first + samples) % this->capacity;
+        this->count -= samples;
+        this->dirty = areaUnion(this->dirty, this->plot);
+        if (!this->fullRedraw && this->drawnCount >= samples && this->surfaceDepth() == 8)
+        {
+            this->drawnCount -= samples;
+            this->pendingScroll += samples;
+        }
+        else
+        {
+            this->fullRedraw = true;
+        }
+        if (this->autoscale)
+        {
+            float fitMin;
+            float fitMax;
+            this->fitRange(fitMin, fitMax);
+            if (fitMin != this->axisMin || fitMax != this->axisMax)
+            {
+                this->fullRedraw = true;
+            }
+        }
+    };
+
+    void redraw()
+    {
+        this->fullRedraw = true;
+        this->dirty = {0, 0, this->width, this->height};
+        this->updated = true;
+    };
+
+    /// @brief Moves the plot's pixels left, clearing the columns uncovered on the right.
+    void shiftPlot(int pixels)
+    {
+        uint8_t *buffer = (uint8_t *)this->surface.frameBuffer(1);
+        if (buffer == NULL)
+        {
+            return;
+        }
+        pixels = min(pixels, this->plot.width);
+        for (int y = this->plot.y; y < this->plot.y + this->plot.height; y++)
+        {
+            uint8_t *row = buffer + y * this->width + this->plot.x;
+            memmove(row, row + pixels, this->plot.width - pixels);
+        }
+        int right = this->plot.x + this->plot.width - pixels;
+        uint16_t axis = this->greyToColour16(this->axisColour);
+        this->surface.fillRect(right, this->plot.y, pixels, this->plot.height, this->greyToColour16(0));
+        // Put back the axis lines where they moved or were cleared, and the start of the line over them.
+        this->surface.drawFastVLine(this->plot.x, this->plot.y, this->plot.height, axis);
+        this->surface.drawFastHLine(right, this->plot.y + this->plot.height - 1, pixels, axis);
+        uint16_t ink = this->greyToColour16(this->lineColour);
+        if (this->drawnCount > 1)
+        {
+            this->surface.drawLine(this->sampleX(0), this->sampleY(this->sample(0)), this->sampleX(1), this->sampleY(this->sample(1)), ink);
+        }
+        else if (this->drawnCount == 1)
+        {
+            this->surface.drawPixel(this->sampleX(0), this->sampleY(this->sample(0)), ink);
+        }
+    };
+
+    /// @brief Works out a range with round numbers at each end that holds every sample shown.
+    void fitRange(float &fitMin, float &fitMax)
+    {
+        if (this->count == 0)
+        {
+            fitMin = 0;
+            fitMax = 1;
+            return;
+        }
+        float low = this->sample(0);
+        float high = low;
+        for (int i = 1; i < this->count; i++)
+        {
+            low = min(low, this->sample(i));
+            high = max(high, this->sample(i));
+        }
+        if (high - low < 1e-6)
+        {
+            low -= 1;
+            high += 1;
+        }
+        // A 1, 2 or 5 step that splits the range into about four parts.
+        float step = powf(10, floorf(log10f((high - low) / 4)));
+        if ((high - low) / step > 20)
+        {
+            step *= 5;
+        }
+        else if ((high - low) / step > 8)
+        {
+            step *= 2;
+        }
+        fitMin = floorf(low / step) * step;
+        fitMax = ceilf(high / step) * step;
+    };
+
+    void drawAll()
+    {
+        if (this->autoscale)
+        {
+            this->fitRange(this->axisMin, this->axisMax);
+        }
+        this->surface.fillSprite(this->greyToColour16(0));
+        uint16_t axis = this->greyToColour16(this->axisColour);
+        this->surface.drawFastVLine(this->plot.x, this->plot.y, this->plot.height, axis);
+        this->surface.drawFastHLine(this->plot.x, this->plot.y + this->plot.height - 1, this->plot.width, axis);
+
+        char text[16];
+        float range = this->axisMax - this->axisMin;
+        int decimals = range >= 10 ? 0 : (range >= 1 ? 1 : 2);
+        this->surface.setTextSize(1);
+        this->surface.setTextColor(axis);
+        this->surface.setTextDatum(TL_DATUM);
+        snprintf(text, sizeof(text), "%.*f", decimals, this->axisMax);
+        this->surface.drawString(text, 0, this->plot.y);
+        snprintf(text, sizeof(text), "%.*f", decimals, this->axisMin);
+        this->surface.drawString(text, 0, this->plot.y + this->plot.height - this->surface.fontHeight(1));
+
+        this->drawnCount = 0;
+        this->pendingScroll = 0;
+        this->fullRedraw = false;
+        this->draw();
+    };
+
+    int sampleX(int index)
+    {
+        return this->plot.x + index * this->spacing;
+    };
+
+    int sampleY(float value)
+    {
+        float position = (value - this->axisMin) / (this->axisMax - this->axisMin);
+        int y = this->plot.y + this->plot.height - 1 - (int)(position * (this->plot.height - 1));
+        return constrain(y, this->plot.y, this->plot.y + this->plot.height - 1);
+    };
+
+    // Room on the left for the axis labels.
+    static const int labelWidth = 40;
+    float *samples;
+    int capacity;
+    // The ring buffer index of the oldest sample shown.
+    int first = 0;
+    int count = 0;
+    int spacing;
+    int scrollStep;
+    // Samples, from the oldest, that are already drawn in the surface where they belong.
+    int drawnCount = 0;
+    // Samples the drawn pixels still have to move left by.
+    int pendingScroll = 0;
+    bool fullRedraw;
+    bool autoscale = true;
+    float axisMin = 0;
+    float axisMax = 1;
+    struct area plot;
+    // The part of the chart changed since the last update.
+    struct area dirty;
+};
+
+/**
+ * @brief A scrolling log of text lines.
+ * @details Text is wrapped as it is appended, and each wrapped line goes into a fixed ring of
+ * line slots, so the text is never laid out again. New lines are drawn below the ones already
+ * in the surface, and only the box of their text is damaged. When every row is used, the log
+ * scrolls up by scrollStep lines at once by moving the rows of pixels, so the whole area is only
+ * refreshed once every scrollStep lines. Lines appended between updates are drawn together, and
+ * lines that scroll away before an update are never drawn at all.
+ */
+class UiConsole : public UiObj
+{
+public:
+    /// @param textSize The size of the default font, which sets the height of each row.
+    UiConsole(int x, int y, int width, int height, int textSize = 2) : UiObj(x, y, width, height)
+    {
+        this->textSize = textSize;
+        this->surface.setTextSize(textSize);
+        this->lineHeight = max(this->surface.fontHeight(1), 1);
+        this->rows = max(height / this->lineHeight, 1);
+        this->lineText = new char[this->rows * lineSlot];
+        this->scrollStep = max(this->rows / 2, 1);
+        this->partialDamage = true;
+        this->fullRedraw = true;
+        this->dirty = {0, 0, width, height};
+        this->updated = true;
+    };
+
+    ~UiConsole()
+    {
+        delete[] this->lineText;
+    };
+
+    /// @brief Adds text below the last line, wrapped to the width of the console.
+    /// @details Each newline starts a new line, and lines longer than 127 characters are wrapped even if they'd fit.
+    void append(const char *text)
+    {
+        int length = strlen(text);
+        int start = 0;
+        int textWidth = this->width - padding * 2;
+        this->surface.setTextSize(this->textSize);
+        do
+        {
+            char *line = this->nextLine();
+            int take = 0;
+            while (start + take < length && take < lineSlot - 1 && text[start + take] != '\n')
+            {
+                take++;
+            }
+            memcpy(line, text + start, take);
+            line[take] = 0;
+            int end = uiLineLimit(this->surface, line, take, 0, textWidth);
+            line[end] = 0;
+            start += end;
+            if (start < length && (text[start] == '\n' || text[start] == ' '))
+            {
+                start++;
+            }
+            if (!this->fullRedraw && end > 0)
+            {
+                struct area lineArea = {padding, (this->count - 1) * this->lineHeight, min(this->surface.textWidth(line), textWidth), this->lineHeight};
+                this->dirty = areaUnion(this->dirty, lineArea);
+            }
+        } while (start < length);
+        this->updated = true;
+    };
+
+    void append(const String &text)
+    {
+        this->append(text.c_str());
+    };
+
+    /// @brief Sets how many lines the console moves up when it is full.
+    /// @details A step of a whole screen clears the console and starts again at the top.
+    void setScrollStep(int lines)
+    {
+        this->scrollStep = constrain(lines, 1, this->rows);
+    };
+
+    void setColours(uint8_t ink, uint8_t paper)
+    {
+        this->ink = ink & 0x0F;
+        this->paper = paper & 0x0F;
+        this->redraw();
+    };
+
+    /// @brief Removes every line.
+    void clear()
+    {
+        this->first = 0;
+        this->count = 0;
+        this->redraw();
+    };
+
+    /// @return A wrapped line, where 0 is the top line on screen.
+    const char *line(int index)
+    {
+        return this->slot(index);
+    };
+
+    int lines()
+    {
+        return this->count;
+    };
+
+    bool isUpdated() override
+    {
+        return this->updated;
+    };
+
+    struct area getUpdateArea() override
+    {
+        this->updateArea = this->dirty;
+        return this->updateArea;
+    };
+
+    void draw() override
+    {
+        if (this->fullRedraw)
+        {
+            this->surface.fillSprite(this->greyToColour16(this->paper));
+            this->drawnCount = 0;
+            this->pendingScroll = 0;
+            this->fullRedraw = false;
+        }
+        if (this->pendingScroll > 0)
+        {
+            this->shiftRows(this->pendingScroll * this->lineHeight);
+            this->pendingScroll = 0;
+        }
+        this->surface.setTextSize(this->textSize);
+        this->surface.setTextColor(this->greyToColour16(this->ink));
+        this->surface.setTextDatum(TL_DATUM);
+        for (int i = this->drawnCount; i < this->count; i++)
+        {
+            this->surface.drawString(this->slot(i), padding, i * this->lineHeight);
+        }
+        this->drawnCount = this->count;
+    };
+
+    void resetStatus() override
+    {
+        if (this->drawn)
+        {
+            this->dirty = {0, 0, 0, 0};
+        }
+        UiObj::resetStatus();
+    };
+
+    bool touchEvent(int x, int y) override
+    {
+        return false;
+    };
+
+private:
+    char *slot(int index)
+    {
+        return this->lineText + ((this->first + index) % this->rows) * lineSlot;
+    };
+
+    /// @brief Claims the slot for a new line at the bottom, scrolling first if every row is used.
+    char *nextLine()
+    {
+        if (this->count == this->rows)
+        {
+            this->scroll(min(this->scrollStep, this->count));
+        }
+        this->count++;
+        return this->slot(this->count - 1);
+    };
+
+    /// @brief Drops the top lines and moves what's drawn of the rest up.
+    void scroll(int lines)
+    {
+        this->first = (this->first + lines) % this->rows;
+        this->count -= lines;
+        this->dirty = {0, 0, this->width, this->height};
+        if (!this->fullRedraw && this->drawnCount >= lines && this->surfaceDepth() == 8)
+        {
+            this->drawnCount -= lines;
+            this->pendingScroll += lines;
+        }
+        else
+        {
+            // Nothing drawn is still on screen, so clearing is cheaper than moving.
+            this->fullRedraw = true;
+        }
+    };
+
+    void redraw()
+    {
+        this->fullRedraw = true;
+        this->dirty = {0, 0, this->width, this->height};
+        this->updated = true;
+    };
+
+    /// @brief Moves the surface's pixels up, clearing the rows uncovered at the bottom.
+    void shiftRows(int pixels)
+    {
+        uint8_t *buffer = (uint8_t *)this->surface.frameBuffer(1);
+        if (buffer == NULL)
+        {
+            return;
+        }
+        pixels = min(pixels, this->height);
+        // Rows are the full width of the surface, so the whole move is one copy.
+        memmove(buffer, buffer + pixels * this->width, (this->height - pixels) * this->width);
+        this->surface.fillRect(0, this->height - pixels, this->width, pixels, this->greyToColour16(this->paper));
+    };
+
+    static const int padding = 4;
+    // Bytes per line slot, including the terminator.
+    static const int lineSlot = 128;
+    char *lineText;
+    int rows;
+    int lineHeight;
+    int textSize;
+    // The slot index of the top line on screen.
+    int first = 0;
+    int count = 0;
+    int scrollStep;
+    uint8_t ink = 15;
+    uint8_t paper = 0;
+    // Lines, from the top, that are already drawn in the surface where they belong.
+    int drawnCount = 0;
+    // Lines the drawn pixels still have to move up by.
+    int pendingScroll = 0;
+    bool fullRedraw;
+    // The part of the console changed since the last update.
+    struct area dirty;
+};
+
+/**
+ * @brief A surface whose pixels are rendered somewhere else and sent in as tiles.
+ * @details Used for thin client mode, where a host composes the screen and only sends the tiles that changed.
+ * Each tile is decoded straight into the surface and added to the damaged area,
+ * so only the changed part of the screen is packed and refreshed.
+ */
+class UiRemoteSurface : public UiObj
+{
+public:
+    enum tileEncoding
+    {
+        // 4 bits per pixel, rows padded to whole bytes, left pixel in the high nibble.
+        TILE_RAW,
+        // One byte per run: the high nibble is the run length minus one, the low nibble the grey value.
+        // Runs carry on from one row of the tile to the next.
+        TILE_RLE
+    };
+
+    UiRemoteSurface(int x, int y, int width, int height) : UiObj(x, y, width, height)
+    {
+        this->partialDamage = true;
+        this->surface.fillSprite(this->greyToColour16(15));
+        this->damage = {0, 0, width, height};
+    };
+
+    /**
+     * @brief Decodes a tile into the surface.
+     * @details The tile isn't drawn until commit() is called at the end of its frame.
+     * @param rect Where the tile goes, relative to the surface.
+     * @param encoding How the payload is encoded.
+     * @param payload The encoded pixels.
+     * @param length The number of bytes in the payload.
+     * @return False if the tile is outside the surface or the payload doesn't match its size.
+     */
+    bool putTile(struct area rect, uint8_t encoding, const uint8_t *payload, size_t length)
+    {
+        struct area bounds = {0, 0, this->width, this->height};
+        uint8_t *pixels = (uint8_t *)this->surface.frameBuffer(1);
+        if (pixels == NULL || rect.width <= 0 || rect.height <= 0 || !areaContains(bounds, rect))
+        {
+            debug("Tile outside remote surface");
+            return false;
+        }
+        if (encoding == TILE_RAW)
+        {
+            UiPixmap tile = uiPixmap((uint8_t *)payload, rect.width, rect.height, 4);
+            if (length != (size_t)(tile.stride * rect.height))
+            {
+                debug("Raw tile is " + String(length) + " bytes, expected " + String(tile.stride * rect.height));
+                return false;
+            }
+            uiBlitAny(tile, {0, 0, rect.width, rect.height}, this->pixmap(), rect.x, rect.y);
+        }
+        else if (encoding == TILE_RLE)
+        {
+            if (!this->decodeRle(rect, pixels, payload, length))
+            {
+                debug("RLE tile doesn't cover " + String(rect.width) + "x" + String(rect.height));
+                return false;
+            }
+        }
+        else
+        {
+            debug("Unknown tile encoding " + String(encoding));
+            return false;
+        }
+        this->pending = areaUnion(this->pending, rect);
+        return true;
+    };
+
+    /// @brief Marks the tiles received since the last call to be drawn, once their whole frame has arrived.
+    void commit()
+    {
+        if (this->pending.width == 0 || this->pending.height == 0)
+        {
+            return;
+        }
+        this->damage = areaUnion(this->damage, this->pending);
+        this->pending = {0, 0, 0, 0};
+        this->updated = true;
+    };
+
+    bool isUpdated() override
+    {
+        return this->updated;
+    };
+
+    struct area getUpdateArea() override
+    {
+        this->updateArea = this->damage;
+        return this->updateArea;
+    };
+
+    // The tiles are already in the surface.
+    void draw() override{};
+
+    void resetStatus() override
+    {
+        if (this->drawn)
+        {
+            this->damage = {0, 0, 0, 0};
+        }
+        UiObj::resetStatus();
+    };
+
+    bool touchEvent(int x, int y) override
+    {
+        return false;
+    };
+
+private:
+    bool decodeRle(struct area rect, uint8_t *pixels, const uint8_t *payload, size_t length)
+    {
+        int stride = this->surface.width();
+        int column = 0;
+        int row = 0;
+        for (size_t i = 0; i < length; i++)
+        {
+            int run = (payload[i] >> 4) + 1;
+            uint8_t value = payload[i] & 0x0F;
+            while (run > 0)
+            {
+                if (row >= rect.height)
+                {
+                    return false;
+                }
+                int count = min(run, rect.width - column);
+                memset(pixels + (rect.y + row) * stride + rect.x + column, value, count);
+                run -= count;
+                column += count;
+                if (column == rect.width)
+                {
+                    column = 0;
+                    row++;
+                }
+            }
+        }
+        return row == rect.height && column == 0;
+    };
+
+public:
+    struct area damage;
+
+private:
+    // Tiles written into the surface whose frame hasn't finished yet.
+    struct area pending = {0, 0, 0, 0};
+};
+
+class UiTextBox
+{
+    // TODO
+};
+
+class UiIcon : public UiFrame
+{
+public:
+    /// @details The image and label aren't created until the icon is first shown.
+    UiIcon(int x, int y, int width, int height, uint8_t *bitmap, String text, bool (*callback)(UiObj *, int)) : UiFrame()
+    {
+        this->setLazy();
+        UiFrame::init(x, y, width, height);
+        this->image = NULL;
+        this->label = NULL;
+        this->bitmap = bitmap;
+        this->caption = text;
+        this->callback = callback;
+    };
+
+    /// @brief Creates a square icon from a vector icon, which is rasterized at the icon's size.
+    /// @param path An icon in the format described in icons.h. It must outlive the icon.
+    UiIcon(int x, int y, int size, const uint8_t *path, String text, bool (*callback)(UiObj *, int)) : UiFrame()
+    {
+        this->setLazy();
+        UiFrame::init(x, y, size, size);
+        this->image = NULL;
+        this->label = NULL;
+        this->bitmap = NULL;
+        this->path = path;
+        this->caption = text;
+        this->callback = callback;
+    };
+
+    UiIcon() : UiFrame()
+    {
+        this->image = NULL;
+        this->label = NULL;
+        this->bitmap = NULL;
+    };
+
+    bool touchEvent(int x, int y) override
+    {
+        if (!this->initialised || this->callback == NULL)
+        {
+            return false;
+        }
+        else
+        {
+            return this->callback(this, 1);
+        }
+    };
+
+protected:
+    void buildContents() override
+    {
+        if (this->path != NULL)
+        {
+            this->vectorImage = new UiVectorImage(0, 0, this->width, this->height, this->path);
+            this->add(this->vectorImage);
+        }
+        else
+        {
+            this->image = new UiImage(0, 0, this->width, this->height, this->bitmap);
+            this->add(this->image);
+        }
+        this->label = new UiLabel(0, this->height, this->caption);
+        this->add(this->label);
+    };
+
+    void releaseContents() override
+    {
+        this->image = NULL;
+        this->vectorImage = NULL;
+        this->label = NULL;
+    };
 
 public:
-    enum layer_t
+    // NULL until the icon is first shown.
+    UiLabel *label;
+    // Only one of these is used, depending on which kind of image the icon was created with.
+    UiImage *image;
+    UiVectorImage *vectorImage = NULL;
+    bool (*callback)(UiObj *, int);
+
+private:
+    uint8_t *bitmap;
+    const uint8_t *path = NULL;
+    String caption;
+};
+
+class UiHwImage : public UiObj
+{
+public:
+    UiHwImage(int x, int y, int width, int height, String filename, M5EPD_Canvas *surface) : UiObj()
+    {
+        if (!SD.exists(filename))
+        {
+            Serial.println("File not found: " + filename);
+            this->initialised = false;
+            return;
+        }
+        File imgFile = SD.open(filename, FILE_READ);
+        if (!imgFile)
+        {
+            Serial.println("Failed to open file: " + filename);
+            this->initialised = false;
+            return;
+        }
+
+        this->imgBuffer = (uint8_t *)calloc(imgFile.size(), 1);
+        imgFile.read(this->imgBuffer, imgFile.size());
+
+        this->x = x;
+        this->y = y;
+        this->width = width;
+        this->height = height;
+        this->filename = filename;
+        this->initialised = true;
+        this->hardwareDraw = true;
+        this->hwsurface = surface;
+        SD.open(filename, FILE_READ);
+    };
+
+    UiHwImage() : UiObj()
+    {
+        this->initialised = false;
+    };
+
+    bool isUpdated() override
+    {
+        return false;
+    };
+
+    struct area getUpdateArea() override
+    {
+        return {0, 0, 0, 0};
+    };
+
+    void draw()
+    {
+        if (!this->initialised)
+        {
+            return;
+        }
+
+        String fileExt = this->getFileExtension(this->filename);
+        bool isUrl = this->isWebUrl(this->filename);
+
+        if (isUrl)
+        {
+            if (fileExt == "png")
+            {
+                this->hwsurface->drawPngUrl(this->filename.c_str(), this->x, this->y, this->width, this->height);
+            }
+            else if (fileExt == "jpg" || fileExt == "jpeg")
+            {
+                this->hwsurface->drawJpgUrl(this->filename.c_str(), this->x, this->y, this->width, this->height);
+            }
+            else
+            {
+                Serial.println("Unsupported file extension: " + fileExt);
+            }
+        }
+        else
+        {
+            if (fileExt == "png")
+            {
+                this->hwsurface->drawPngFile(SD, this->filename.c_str(), this->x, this->y, this->width, this->height);
+            }
+            else if (fileExt == "jpg" || fileExt == "jpeg")
+            {
+                this->hwsurface->drawJpgFile(SD, this->filename.c_str(), this->x, this->y, this->width, this->height);
+            }
+            else if (fileExt == "bmp")
+            {
+                this->hwsurface->drawBmpFile(SD, this->filename.c_str(), this->x, this->y);
+            }
+            else
+            {
+                Serial.println("Unsupported file extension: " + fileExt);
+            }
+        }
+    };
+
+    String getFileExtension(String filename)
+    {
+        int dotIndex = filename.lastIndexOf('.');
+        if (dotIndex == -1)
+        {
+            return "";
+        }
+        else
+        {
+            return filename.substring(dotIndex + 1);
+        }
+    };
+
+    bool isWebUrl(String filename)
+    {
+        if (filename.startsWith("http://") || filename.startsWith("https://"))
+        {
+            return true;
+        }
+        else
+        {
+            return false;
+        }
+    };
+
+    bool touchEvent(int x, int y) override
+    {
+        return false;
+    };
+
+public:
+    bool initialised;
+    String filename;
+    uint16_t backgroundColour;
+    M5EPD_Canvas *hwsurface;
+    uint8_t *imgBuffer;
+};
+
+class UiModal : public UiFrame
+{
+public:
+    /// @details The dialog's buffer and controls are only built the first time it is shown,
+    /// and are released after it has been hidden for releaseDelay milliseconds.
+    UiModal() : UiFrame()
+    {
+        this->setLazy(releaseDelay);
+        UiFrame::init(50, 200, 400, 300);
+        this->setOutline(15, 4, 10);
+        this->result = -1;
+        this->initialised = true;
+        this->hide();
+        this->layer = LAYER_OVERLAY;
+    };
+
+    UiModal(int x, int y, int width, int height) : UiFrame(x, y, width, height)
+    {
+        this->setOutline(15, 4, 10);
+        this->setLazy(releaseDelay);
+        this->initialised = true;
+        this->result = -1;
+        this->hide();
+    };
+
+    void msgbox(String title, String message)
+    {
+        debug("Modal object: " + String((uint32_t)this));
+        this->materialize();
+        this->titlebar->setText(title);
+        this->content->setText(message);
+        this->cancelButton->hide();
+        this->okButton->show();
+        this->okButton->move((this->width - this->okButton->width - 10) / 2, this->height - this->okButton->height - 10);
+        this->result = -1;
+        this->show();
+    };
+
+    void confirm(String title, String message)
+    {
+        debug("Modal object: " + String((uint32_t)this));
+        this->materialize();
+        this->titlebar->setText(title);
+        this->content->setText(message);
+        this->cancelButton->show();
+        this->okButton->show();
+        this->cancelButton->move(this->width / 2, this->height - this->okButton->height - 10);
+        this->okButton->move(this->width / 4, this->height - this->okButton->height - 10);
+        this->result = -1;
+        this->show();
+    };
+
+    static const unsigned long releaseDelay = 30000;
+
+protected:
+    void buildContents() override
+    {
+        this->titlebar = new UiLabel(0, 0, this->width, 30, "");
+        this->titlebar->setOutline(15, 4, 10);
+        this->closeButtonCallback = std::bind(&UiModal::closePressed, this, std::placeholders::_1, std::placeholders::_2);
+        this->okButtonCallback = std::bind(&UiModal::okPressed, this, std::placeholders::_1, std::placeholders::_2);
+        this->cancelButtonCallback = std::bind(&UiModal::cancelPressed, this, std::placeholders::_1, std::placeholders::_2);
+        this->closeButton = new UiButton(this->width - 50, 0, "X", closeButtonCallback);
+        this->okButton = new UiButton(100, this->height - 100, "OK", okButtonCallback);
+        this->cancelButton = new UiButton(this->width - 100, this->height - 100, "Cancel", cancelButtonCallback);
+        this->content = new UiLabel(0, 30, this->width, this->height - 30 - this->okButton->height, "");
+        this->content->noBorder();
+        this->add(this->closeButton);
+        this->add(this->titlebar);
+        this->add(this->content);
+        this->add(this->okButton);
+        this->add(this->cancelButton);
+        this->cancelButton->preRender();
+        this->okButton->preRender();
+    }
+
+    void releaseContents() override
+    {
+        this->titlebar = NULL;
+        this->content = NULL;
+        this->closeButton = NULL;
+        this->okButton = NULL;
+        this->cancelButton = NULL;
+    };
+
+private:
+    bool closePressed(UiObj *obj, int event)
+    {
+        this->result = 0;
+        this->hide();
+        return true;
+    };
+
+    bool okPressed(UiObj *obj, int event)
+    {
+        this->result = 0;
+        this->hide();
+        return true;
+    };
+
+    bool cancelPressed(UiObj *obj, int event)
     {
-        LAYER_BG,
-        LAYER_LOWER,
-        LAYER_CENTRE,
-        LAYER_UPPER,
-        LAYER_TOP,
-        LAYER_OVERLAY
+        this->result = 1;
+        this->hide();
+        return true;
     };
-    int x;
-    int y;
-    int width;
-    int height;
-    UiObj *parent = NULL;
-    TFT_eSprite surface = NULL;
-    bool updated = false;
-    bool exposed = false;
-    bool hardwareDraw = false;
-    bool unbuffered = true;
-    bool visible = true;
-    bool initialised = false;
-    bool visibilityChanged = false;
-    bool newParent = false;
-    bool drawn = false;
-    enum layer_t layer = LAYER_CENTRE;
-    struct area updateArea;
-    struct area exposeArea;
+
+public:
+    int result;
+    bool initialised;
+
+private:
+    UiLabel *titlebar;
+    UiLabel *content;
+    UiButton *closeButton;
+    UiButton *okButton;
+    UiButton *cancelButton;
+    std::function<bool(UiObj *, int)> closeButtonCallback;
+    std::function<bool(UiObj *, int)> okButtonCallback;
+    std::function<bool(UiObj *, int)> cancelButtonCallback;
 };
 
 /**
- * @brief A simple label object.
- * @details A simple label object. Can be used to display text on the screen.
- * A number of formatting options are available.
+ * @brief A description of a widget, for building screens with UiTree.
+ * @details Nodes are cheap to make and throw away: describing the whole screen again
+ * on every change is fine, as only the differences reach the real widgets.
+ * Use uiLabel(), uiButton() and uiFrame() to make them.
  */
-
-class UiLabel : public UiObj
+struct UiNode
 {
-public:
-    enum hAlign
+    enum nodeType
     {
-        ALIGN_LEFT,
-        ALIGN_CENTRE,
-        ALIGN_RIGHT
+        NODE_LABEL,
+        NODE_BUTTON,
+        NODE_FRAME
     };
 
-    enum vAlign
+    enum nodeType type;
+    /// @brief Identifies the widget between rebuilds. Must be unique among its siblings.
+    String key;
+    int x;
+    int y;
+    // A width of 0 sizes a label to its text.
+    int width;
+    int height;
+    String text;
+    int textSize;
+    bool visible;
+    enum UiObj::layer_t layer;
+    std::function<bool(UiButton *, int)> callback;
+    std::vector<UiNode> children;
+
+    UiNode &hidden(bool hidden = true)
     {
-        ALIGN_TOP,
-        ALIGN_MIDDLE,
-        ALIGN_BOTTOM
+        this->visible = !hidden;
+        return *this;
     };
 
-    UiLabel(int x, int y, int width, int height, String text, bool unbuffered = false) : UiObj()
+    UiNode &size(int textSize)
     {
-        this->init(x, y, width, height, text, unbuffered);
+        this->textSize = textSize;
+        return *this;
     };
 
-    UiLabel(int x, int y, String text) : UiObj()
+    UiNode &onLayer(enum UiObj::layer_t layer)
     {
-        this->init(x, y, text);
+        this->layer = layer;
+        return *this;
     };
+};
 
-    void init(int x, int y, String text)
+UiNode uiNode(enum UiNode::nodeType type, String key, int x, int y, int width, int height, String text)
+{
+    UiNode node;
+    node.type = type;
+    node.key = key;
+    node.x = x;
+    node.y = y;
+    node.width = width;
+    node.height = height;
+    node.text = text;
+    node.textSize = 3;
+    node.visible = true;
+    node.layer = UiObj::LAYER_CENTRE;
+    return node;
+}
+
+/// @brief Describes a label sized to its text.
+UiNode uiLabel(String key, int x, int y, String text)
+{
+    return uiNode(UiNode::NODE_LABEL, key, x, y, 0, 0, text);
+}
+
+/// @brief Describes a label with a fixed size.
+UiNode uiLabel(String key, int x, int y, int width, int height, String text)
+{
+    return uiNode(UiNode::NODE_LABEL, key, x, y, width, height, text);
+}
+
+UiNode uiButton(String key, int x, int y, String text, std::function<bool(UiButton *, int)> callback)
+{
+    UiNode node = uiNode(UiNode::NODE_BUTTON, key, x, y, 0, 0, text);
+    node.callback = callback;
+    return node;
+}
+
+UiNode uiFrame(String key, int x, int y, int width, int height, std::vector<UiNode> children)
+{
+    UiNode node = uiNode(UiNode::NODE_FRAME, key, x, y, width, height, "");
+    node.children = children;
+    return node;
+}
+
+/**
+ * @brief Keeps a frame's children in step with a list of UiNode descriptions.
+ * @details Each update() matches the new nodes to the widgets it made last time by key.
+ * Matching widgets only get the setter calls for properties that differ, so unchanged widgets
+ * keep their buffers and cause no redraw. Widgets without a node are removed and deleted,
+ * and nodes without a widget are created. A node whose type changes gets a new widget.
+ * The widgets are kept in the frame in the order of their nodes, so later nodes draw over earlier ones.
+ * The tree owns the widgets it creates; don't add or remove them by hand.
+ */
+class UiTree
+{
+public:
+    UiTree(UiFrame *root)
     {
-        UiObj::init(x, y, 0, 0);
-        this->surface = TFT_eSprite(NULL);
-        this->surface.setTextSize(3);
-        int width = this->surface.textWidth(text);
-        int height = this->surface.fontHeight(1);
-        this->init(x, y, 0, 0, text);
-        this->autosize = true;
-        this->autoResize(true);
+        this->root = root;
     };
 
-    UiLabel() : UiObj()
+    ~UiTree()
     {
-        this->initialised = false;
+        this->update(std::vector<UiNode>());
     };
 
-    void init(int x, int y, int width, int height, String text, bool unbuffered = false)
+    void update(const std::vector<UiNode> &nodes)
     {
-        UiObj::init(x, y, width, height, unbuffered);
-        this->text = text;
-        this->hasOutline = false;
-        this->hasFill = false;
-        this->textColour = this->greyToColour16(15);
-        this->textSize = 3;
-        this->customFont = false;
-        this->initialised = true;
-        this->autosize = false;
-        this->resizeNeeded = false;
-        this->xPad = 10;
-        this->yPad = 10;
-        this->setOutline(1, 10);
-        this->hasPreRender = false;
-        this->updated = true;
-        this->vAlignment = ALIGN_MIDDLE;
-        this->hAlignment = ALIGN_CENTRE;
-        this->lineSpacing = 0.5;
+        this->reconcile(this->root, this->mounted, nodes);
     };
 
-    bool isUpdated() override
+public:
+    uint32_t created = 0;
+    uint32_t removed = 0;
+    uint32_t changed = 0;
+    uint32_t unchanged = 0;
+
+private:
+    struct mount
     {
-        return this->updated;
+        String key;
+        enum UiNode::nodeType type;
+        UiObj *obj;
+        std::vector<struct mount> children;
     };
 
-    struct area getUpdateArea() override
+    void reconcile(UiFrame *container, std::vector<struct mount> &mounts, const std::vector<UiNode> &nodes)
     {
-        debug("UiLabel::getUpdateArea()");
-        this->updateArea.x = 0;
-        this->updateArea.y = 0;
-        this->updateArea.width = this->width;
-        this->updateArea.height = this->height;
-        return this->updateArea;
+        std::vector<struct mount> next;
+        next.reserve(nodes.size());
+        for (const UiNode &node : nodes)
+        {
+            struct mount *match = NULL;
+            for (struct mount &mount : mounts)
+            {
+                if (mount.obj != NULL && mount.type == node.type && mount.key == node.key)
+                {
+                    match = &mount;
+                    break;
+                }
+            }
+            if (match == NULL)
+            {
+                next.push_back(this->create(container, node));
+                continue;
+            }
+            next.push_back(std::move(*match));
+            match->obj = NULL;
+            this->patch(container, next.back(), node);
+        }
+        for (struct mount &mount : mounts)
+        {
+            if (mount.obj != NULL)
+            {
+                container->remove(mount.obj);
+                this->destroy(mount);
+            }
+        }
+        this->reorder(container, next);
+        mounts.swap(next);
     };
 
-    void draw() override
+    /// @brief Puts the container's objects in the order of their nodes, so later nodes draw over earlier ones.
+    /// @details Objects the tree didn't make keep their places. An object that changes place is damaged,
+    /// as what it covers or is covered by may change.
+    void reorder(UiFrame *container, const std::vector<struct mount> &mounts)
     {
-        if (!this->initialised)
+        size_t index = 0;
+        for (size_t i = 0; i < container->objects.size(); i++)
         {
-            return;
+            UiObj *obj = container->objects[i];
+            bool mounted = false;
+            for (const struct mount &mount : mounts)
+            {
+                if (mount.obj == obj)
+                {
+                    mounted = true;
+                    break;
+                }
+            }
+            if (!mounted)
+            {
+                continue;
+            }
+            UiObj *wanted = mounts[index++].obj;
+            if (wanted != obj)
+            {
+                container->objects[i] = wanted;
+                if (wanted->visible)
+                {
+                    container->damage(wanted->getArea());
+                }
+            }
         }
+    };
 
-        if (this->hasPreRender)
+    struct mount create(UiFrame *container, const UiNode &node)
+    {
+        struct mount mount;
+        mount.key = node.key;
+        mount.type = node.type;
+        if (node.type == UiNode::NODE_FRAME)
         {
-            this->hasPreRender = false;
-            return;
+            UiFrame *frame = new UiFrame(node.x, node.y, node.width, node.height);
+            this->reconcile(frame, mount.children, node.children);
+            mount.obj = frame;
         }
-
-        if (this->autosize && this->resizeNeeded)
+        else
         {
-            if (width == 0 || height == 0)
+            UiLabel *label;
+            if (node.type == UiNode::NODE_BUTTON)
             {
-                this->autoResize(true);
+                label = new UiButton(node.x, node.y, node.text, node.callback);
             }
-            this->autoResize();
+            else if (node.width > 0)
+            {
+                label = new UiLabel(node.x, node.y, node.width, node.height, node.text);
+            }
+            else
+            {
+                label = new UiLabel(node.x, node.y, node.text);
+            }
+            label->setTextSize(node.textSize);
+            mount.obj = label;
         }
-        this->surface.fillSprite(this->greyToColour16(0));
-        this->drawFill();
-        this->drawText();
-        this->drawOutline();
+        mount.obj->layer = node.layer;
+        container->add(mount.obj);
+        if (!node.visible)
+        {
+            mount.obj->hide();
+        }
+        this->created++;
+        return mount;
     };
 
-    void drawText()
+    void patch(UiFrame *container, struct mount &mount, const UiNode &node)
     {
-        struct area textArea;
-        if (this->text == "")
+        UiObj *obj = mount.obj;
+        bool changed = false;
+        if (obj->x != node.x || obj->y != node.y)
         {
-            return;
+            obj->move(node.x, node.y);
+            changed = true;
         }
-
-        if (this->customFont)
+        if (obj->layer != node.layer)
         {
-            surface.setFreeFont(this->font);
+            obj->layer = node.layer;
+            container->damage(obj->getArea());
+            changed = true;
+        }
+        if (node.type == UiNode::NODE_FRAME)
+        {
+            UiFrame *frame = (UiFrame *)obj;
+            if (frame->width != node.width || frame->height != node.height)
+            {
+                // Damage the old area, which the frame may no longer cover.
+                container->damage(frame->getArea());
+                frame->resize(node.width, node.height);
+                changed = true;
+            }
+            this->reconcile(frame, mount.children, node.children);
         }
         else
         {
-            surface.setTextSize(this->textSize);
+            UiLabel *label = (UiLabel *)obj;
+            if (label->text != node.text)
+            {
+                label->setText(node.text);
+                changed = true;
+            }
+            if (label->style->textSize != node.textSize)
+            {
+                label->setTextSize(node.textSize);
+                changed = true;
+            }
+            if (node.type == UiNode::NODE_LABEL && node.width > 0 && (label->width != node.width || label->height != node.height))
+            {
+                container->damage(label->getArea());
+                label->resize(node.width, node.height);
+                changed = true;
+            }
+            if (node.type == UiNode::NODE_BUTTON)
+            {
+                // Callbacks can't be compared, and swapping one doesn't change what's drawn.
+                ((UiButton *)label)->stdCallback = node.callback;
+            }
+        }
+        if (obj->visible != node.visible)
+        {
+            if (node.visible)
+            {
+                obj->show();
+            }
+            else
+            {
+                obj->hide();
+            }
+            changed = true;
         }
-        surface.setTextColor(this->textColour);
-        surface.setTextDatum(TL_DATUM);
-        textArea = this->getTextPos();
-        if (this->surface.textWidth(this->text) > this->width - this->xPad * 2)
+        if (changed)
         {
-            this->drawMultilineText(textArea);
+            this->changed++;
         }
         else
         {
-            surface.drawString(this->text, textArea.x, textArea.y);
+            this->unchanged++;
+        }
+    };
+
+    void destroy(struct mount &mount)
+    {
+        for (struct mount &child : mount.children)
+        {
+            this->destroy(child);
+        }
+        delete mount.obj;
+        mount.obj = NULL;
+        this->removed++;
+    };
+
+    UiFrame *root;
+    std::vector<struct mount> mounted;
+};
+
+/**
+ * @brief A widget change posted to the UI from another task.
+ * @details Commands are applied on the UI task by UiManager::processCommands(),
+ * so widgets are never touched while they are being rendered.
+ */
+struct UiCommand
+{
+    enum commandType
+    {
+        CMD_NONE,
+        CMD_SET_TEXT,
+        CMD_SHOW,
+        CMD_HIDE,
+        CMD_MOVE,
+        CMD_INVALIDATE,
+        CMD_CALL
+    };
+
+    enum commandType type = CMD_NONE;
+    UiObj *target = NULL;
+    UiLabel *label = NULL;
+    int x = 0;
+    int y = 0;
+    String text;
+    std::function<void()> call;
+};
+
+/**
+ * @brief A lock-free multiple producer, single consumer queue of UiCommands.
+ * @details Any FreeRTOS task may post commands. Only the UI task may take them.
+ * Each slot holds a sequence number which tells producers and the consumer who owns it,
+ * so posting never blocks and never disables interrupts.
+ * If the queue is full the command is dropped and counted.
+ */
+class UiCommandQueue
+{
+public:
+    UiCommandQueue()
+    {
+        for (uint32_t i = 0; i < commandQueueSize; i++)
+        {
+            this->slots[i].sequence.store(i, std::memory_order_relaxed);
+        }
+        this->head.store(0, std::memory_order_relaxed);
+        this->tail = 0;
+        this->dropped.store(0, std::memory_order_relaxed);
+    };
+
+    /// @brief Adds a command to the queue. Safe to call from any task.
+    /// @param command The command to copy into the queue.
+    /// @return False if the queue was full and the command was dropped.
+    bool post(const UiCommand &command)
+    {
+        struct slot *slot;
+        uint32_t pos = this->head.load(std::memory_order_relaxed);
+        while (true)
+        {
+            slot = &this->slots[pos & (commandQueueSize - 1)];
+            uint32_t sequence = slot->sequence.load(std::memory_order_acquire);
+            int32_t diff = (int32_t)(sequence - pos);
+            if (diff == 0)
+            {
+                if (this->head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                {
+                    break;
+                }
+            }
+            else if (diff < 0)
+            {
+                this->dropped.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+            else
+            {
+                pos = this->head.load(std::memory_order_relaxed);
+            }
+        }
+        slot->command = command;
+        slot->sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    };
+
+    /// @brief Takes the oldest command from the queue. Must only be called from the UI task.
+    /// @param command Receives the command.
+    /// @return False if the queue is empty.
+    bool take(UiCommand &command)
+    {
+        struct slot *slot = &this->slots[this->tail & (commandQueueSize - 1)];
+        uint32_t sequence = slot->sequence.load(std::memory_order_acquire);
+        if ((int32_t)(sequence - (this->tail + 1)) < 0)
+        {
+            return false;
         }
+        command = std::move(slot->command);
+        slot->command = UiCommand();
+        slot->sequence.store(this->tail + commandQueueSize, std::memory_order_release);
+        this->tail++;
+        return true;
+    };
+
+    /// @brief Checks if there are commands waiting. Must only be called from the UI task.
+    bool pending()
+    {
+        struct slot *slot = &this->slots[this->tail & (commandQueueSize - 1)];
+        return (int32_t)(slot->sequence.load(std::memory_order_acquire) - (this->tail + 1)) >= 0;
+    };
+
+    /// @brief Registers a task that posts commands, so the UI task doesn't light sleep while it runs.
+    /// @details Light sleep freezes every task, so a registered task could otherwise only post after the next touch.
+    void addProducer()
+    {
+        this->producers.fetch_add(1);
     };
 
-    void drawMultilineText(struct area textArea)
+    /// @brief Removes a task registered with addProducer().
+    void removeProducer()
     {
-        int lineCount = 0;
-        int lineStart = 0;
-        int lineEnd = 0;
-        int lineLength = 0;
-        int lineY = 0;
-        int lineX = 0;
-        int lineHeight = this->surface.fontHeight(1);
-        int lineWidth = 0;
-        int textAreaWidth = this->width - this->xPad * 2 - this->outlineThickness * 2;
+        this->producers.fetch_sub(1);
+    };
 
-        lineHeight += lineHeight * this->lineSpacing;
-        debug("UiLabel::drawMultilineText()");
-        debug("textAreaWidth: " + String(textAreaWidth));
-        while (lineEnd < this->text.length())
-        {
-            lineEnd = this->lineLimit(this->text, lineStart);
-            textArea.x = this->getTextHPos(this->text.substring(lineStart, lineEnd));
-            this->surface.drawString(this->text.substring(lineStart, lineEnd), textArea.x, textArea.y + lineY);
-            lineY += lineHeight;
-            lineLength = lineEnd - lineStart;
-            lineCount++;
-            lineStart = lineEnd;
-        }
+    /// @brief Checks if any task that posts commands is registered.
+    bool hasProducers()
+    {
+        return this->producers.load() > 0;
     };
 
-    int lineLimit(String text, int offset)
+    bool postText(UiLabel *label, String text)
     {
-        int lineStart = offset;
-        int lineEnd = text.indexOf('\n');
-        int lineWidth = 0;
-        int textAreaWidth = this->width - this->xPad * 2 - this->outlineThickness * 2;
+        UiCommand command;
+        command.type = UiCommand::CMD_SET_TEXT;
+        command.label = label;
+        command.text = text;
+        return this->post(command);
+    };
 
-        if (lineEnd == -1)
-        {
-            lineEnd = text.length();
-        }
+    bool postShow(UiObj *obj)
+    {
+        UiCommand command;
+        command.type = UiCommand::CMD_SHOW;
+        command.target = obj;
+        return this->post(command);
+    };
 
-        while (true)
-        {
-            lineWidth = this->surface.textWidth(text.substring(lineStart, lineEnd));
-            if (lineWidth <= textAreaWidth || lineEnd - lineStart <= 1)
-            {
-                break;
-            }
-            do
-            {
-                lineEnd--;
-            } while (text.charAt(lineEnd) != ' ' && lineEnd > lineStart);
-        }
-        return lineEnd;
+    bool postHide(UiObj *obj)
+    {
+        UiCommand command;
+        command.type = UiCommand::CMD_HIDE;
+        command.target = obj;
+        return this->post(command);
     };
 
-    int getTextHPos(String text)
+    bool postMove(UiObj *obj, int x, int y)
     {
-        int textWidth = this->surface.textWidth(text);
-        int textAreaWidth = this->width - this->xPad * 2 - this->outlineThickness * 2;
+        UiCommand command;
+        command.type = UiCommand::CMD_MOVE;
+        command.target = obj;
+        command.x = x;
+        command.y = y;
+        return this->post(command);
+    };
 
-        if (textWidth > textAreaWidth)
-        {
-            return this->xPad + this->outlineThickness;
-        }
+    bool postInvalidate(UiObj *obj)
+    {
+        UiCommand command;
+        command.type = UiCommand::CMD_INVALIDATE;
+        command.target = obj;
+        return this->post(command);
+    };
 
-        if (this->hAlignment == ALIGN_LEFT)
-        {
-            return this->xPad + this->outlineThickness;
-        }
-        else if (this->hAlignment == ALIGN_CENTRE)
-        {
-            return this->width / 2 - textWidth / 2;
-        }
-        else if (this->hAlignment == ALIGN_RIGHT)
-        {
-            return this->width - textWidth - this->xPad - this->outlineThickness;
-        }
-        return 0;
+    /// @brief Runs a function on the UI task. Use for changes not covered by the other commands.
+    bool postCall(std::function<void()> call)
+    {
+        UiCommand command;
+        command.type = UiCommand::CMD_CALL;
+        command.call = call;
+        return this->post(command);
     };
 
-    struct area getTextPos()
+public:
+    std::atomic<uint32_t> dropped;
+
+private:
+    std::atomic<int> producers{0};
+    struct slot
     {
-        struct area pos;
-        int textAreaWidth = this->width - this->xPad * 2 - this->outlineThickness * 2;
-        pos.width = this->surface.textWidth(this->text);
-        pos.height = this->surface.fontHeight(1);
+        std::atomic<uint32_t> sequence;
+        UiCommand command;
+    };
+    struct slot slots[commandQueueSize];
+    std::atomic<uint32_t> head;
+    uint32_t tail;
+};
 
-        if (pos.width > textAreaWidth)
-        {
-            pos.height = this->getMultilineHeight();
-            pos.width = textAreaWidth;
-        }
-        else
-        {
-            pos.height = this->surface.fontHeight(1);
-        }
+/// @brief The time each waveform takes to run on the M5Paper panel, in microseconds, indexed by update mode.
+/// @details The controller doesn't report when an area is finished, so these are measured estimates.
+const unsigned long epdModeDurations[UPDATE_MODE_NONE + 1] = {
+    2000000, // UPDATE_MODE_INIT
+    260000,  // UPDATE_MODE_DU
+    450000,  // UPDATE_MODE_GC16
+    450000,  // UPDATE_MODE_GL16
+    450000,  // UPDATE_MODE_GLR16
+    450000,  // UPDATE_MODE_GLD16
+    290000,  // UPDATE_MODE_DU4
+    120000,  // UPDATE_MODE_A2
+    0,       // UPDATE_MODE_NONE
+};
 
-        if (this->hAlignment == ALIGN_LEFT)
-        {
-            pos.x = this->xPad + this->outlineThickness;
-        }
-        else if (this->hAlignment == ALIGN_CENTRE)
-        {
-            pos.x = this->width / 2 - pos.width / 2;
-        }
-        else if (this->hAlignment == ALIGN_RIGHT)
-        {
-            pos.x = this->width - pos.width - this->xPad - this->outlineThickness;
-        }
+/**
+ * @brief A timing model of the IT8951 EPD controller.
+ * @details Stands in for M5.EPD so refresh strategies can be compared without a panel.
+ * It models the time taken to send pixels over SPI, how long each waveform runs,
+ * how many areas the controller can refresh at once, and the controller's busy state.
+ * While a simulator is active, uiMicros() and uiDelay() run on a virtual clock:
+ * real time still passes for the CPU work, but waiting on the panel only moves the clock forward.
+ */
+class UiEpdSimulator
+{
+public:
+    UiEpdSimulator()
+    {
+        this->bytesPerMs = 1000;
+        this->commandTime = 200;
+        this->maxAreas = 16;
+        // M5EPD checks AFSR before each update, which waits for every running area.
+        this->waitForAllAreas = true;
+        this->offset = 0;
+        memcpy(this->durations, epdModeDurations, sizeof(this->durations));
+        this->resetStats();
+    };
 
-        if (this->vAlignment == ALIGN_TOP)
-        {
-            pos.y = this->yPad + this->outlineThickness;
-        }
-        else if (this->vAlignment == ALIGN_MIDDLE)
-        {
-            pos.y = this->height / 2 - pos.height / 2 + 1;
-        }
-        else if (this->vAlignment == ALIGN_BOTTOM)
-        {
-            pos.y = this->height - pos.height - this->yPad - this->outlineThickness;
-        }
-        return pos;
-    }
+    void resetStats()
+    {
+        this->bytesSent = 0;
+        this->transferTime = 0;
+        this->refreshCount = 0;
+        this->pixelsRefreshed = 0;
+        this->refreshTime = 0;
+        this->waitTime = 0;
+    };
 
-    int getMultilineHeight()
+    /// @brief The time on the virtual clock in microseconds.
+    unsigned long now()
     {
-        int lineWidth;
-        int lineStart = 0;
-        int lineEnd;
-        int height = 0;
-        int fontHeight = this->surface.fontHeight(1);
-        int lineHeight = fontHeight + fontHeight * this->lineSpacing;
+        return micros() + this->offset;
+    };
 
-        while (true)
-        {
-            if (lineStart >= this->text.length())
-            {
-                break;
-            }
-            lineEnd = this->lineLimit(this->text, lineStart);
-            height += lineHeight;
-            lineStart = lineEnd;
-        }
-        height -= fontHeight * this->lineSpacing;
-        return height;
+    /// @brief Moves the virtual clock forward without waiting.
+    void advance(unsigned long us)
+    {
+        this->offset += us;
     };
 
-    void drawFill()
+    void waitUntil(unsigned long time)
     {
-        if (this->hasFill)
+        unsigned long current = this->now();
+        if ((long)(time - current) > 0)
         {
-            if (this->fillRounded)
-            {
-                this->surface.fillRoundRect(0, 0, width, height, this->fillRoundingRadius, this->fillColour);
-            }
-            else
-            {
-                this->surface.fillRect(0, 0, width, height, this->fillColour);
-            }
+            this->waitTime += time - current;
+            this->advance(time - current);
         }
     };
 
-    void drawOutline()
+    m5epd_err_t WritePartGram4bpp(uint16_t x, uint16_t y, uint16_t w, uint16_t h, const uint8_t *gram)
+    {
+        unsigned long bytes = (unsigned long)w * h / 2;
+        unsigned long time = this->commandTime + bytes * 1000 / this->bytesPerMs;
+        this->advance(time);
+        this->bytesSent += bytes;
+        this->transferTime += time;
+        return M5EPD_OK;
+    };
+
+    m5epd_err_t UpdateArea(uint16_t x, uint16_t y, uint16_t w, uint16_t h, m5epd_update_mode_t mode)
     {
-        if (this->hasOutline)
+        struct area area = {x, y, w, h};
+        this->retire();
+        while (!this->areas.empty())
         {
-            for (int i = 0; i < this->outlineThickness; i++)
+            bool blocked = this->waitForAllAreas || (int)this->areas.size() >= this->maxAreas;
+            unsigned long firstEnd = this->areas[0].end;
+            for (struct activeArea &active : this->areas)
             {
-                if (this->fillRounded)
+                if (areasOverlap(active.area, area))
                 {
-                    this->surface.drawRoundRect(i, i, width - i * 2, height - i * 2, this->fillRoundingRadius, this->outlineColour);
+                    blocked = true;
                 }
-                else
+                if ((long)(active.end - firstEnd) < 0)
                 {
-                    this->surface.drawRect(i, i, width - i * 2, height - i * 2, this->outlineColour);
+                    firstEnd = active.end;
                 }
-                this->surface.drawRoundRect(i, i, width - i * 2, height - i * 2, 10, this->outlineColour);
             }
+            if (!blocked)
+            {
+                break;
+            }
+            this->waitUntil(firstEnd);
+            this->retire();
         }
+        this->advance(this->commandTime);
+        unsigned long duration = this->durations[mode];
+        this->areas.push_back({area, this->now() + duration});
+        this->refreshCount++;
+        this->pixelsRefreshed += (unsigned long)w * h;
+        this->refreshTime += duration;
+        return M5EPD_OK;
     };
 
-    void setOutline(uint16_t colour, uint16_t thickness, uint16_t roundingRadius = 0)
+    bool busy()
     {
-        if (thickness > 0)
+        this->retire();
+        return !this->areas.empty();
+    };
+
+    /// @brief Prints the totals collected since the last resetStats().
+    void report(String name)
+    {
+        Serial.println("EPD sim [" + name + "]: " + String(this->refreshCount) + " refreshes, " + String(this->pixelsRefreshed) + " px, " + String(this->bytesSent) + " bytes sent in " + String(this->transferTime / 1000) + "ms, waveforms " + String(this->refreshTime / 1000) + "ms, waited " + String(this->waitTime / 1000) + "ms");
+    };
+
+public:
+    unsigned long bytesPerMs;
+    unsigned long commandTime;
+    int maxAreas;
+    bool waitForAllAreas;
+    unsigned long durations[UPDATE_MODE_NONE + 1];
+    unsigned long bytesSent;
+    unsigned long transferTime;
+    unsigned long refreshCount;
+    unsigned long pixelsRefreshed;
+    unsigned long refreshTime;
+    unsigned long waitTime;
+
+private:
+    struct activeArea
+    {
+        struct area area;
+        unsigned long end;
+    };
+
+    void retire()
+    {
+        unsigned long current = this->now();
+        for (size_t i = 0; i < this->areas.size();)
         {
-            this->hasOutline = true;
-            this->outlineColour = this->greyToColour16(colour);
-            this->outlineThickness = thickness;
-            if (roundingRadius > 0)
+            if ((long)(current - this->areas[i].end) >= 0)
             {
-                this->borderRounded = true;
-                this->borderRoundingRadius = roundingRadius;
+                this->areas.erase(this->areas.begin() + i);
             }
             else
             {
-                this->borderRounded = false;
+                i++;
             }
         }
-        else
-        {
-            this->hasOutline = false;
-        }
-        this->resizeNeeded = true;
-        this->updated = true;
     };
 
-    void setTextColour(uint16_t colour)
+    unsigned long offset;
+    std::vector<struct activeArea> areas;
+};
+
+UiEpdSimulator *epdSimulator = NULL;
+
+/// @brief The time in microseconds, from the simulator's virtual clock if one is active.
+unsigned long uiMicros()
+{
+    if (epdSimulator != NULL)
     {
-        this->textColour = this->greyToColour16(colour);
-        this->updated = true;
+        return epdSimulator->now();
+    }
+    return micros();
+}
+
+/// @brief Waits for a number of milliseconds, or moves the virtual clock on if the simulator is active.
+void uiDelay(unsigned long ms)
+{
+    if (epdSimulator != NULL)
+    {
+        epdSimulator->advance(ms * 1000);
+        return;
+    }
+    delay(ms);
+}
+
+/**
+ * @brief A histogram of durations with a fixed amount of memory.
+ * @details Buckets grow exponentially, four to each power of two, from 64us up to about 50s,
+ * so percentiles are accurate to within a quarter of their value. Longer samples share the last bucket.
+ */
+class UiLatencyHistogram
+{
+public:
+    UiLatencyHistogram()
+    {
+        this->reset();
     };
 
-    void setTextSize(int size)
+    void reset()
     {
-        this->textSize = size;
-        this->resizeNeeded = true;
-        this->updated = true;
+        memset(this->buckets, 0, sizeof(this->buckets));
+        this->count = 0;
+        this->longest = 0;
     };
 
-    void setFill(uint16_t colour, uint16_t roundingRadius = 0)
+    void record(unsigned long us)
     {
-        this->hasFill = true;
-        this->fillColour = this->greyToColour16(colour);
-        if (roundingRadius > 0)
+        this->buckets[bucketFor(us)]++;
+        this->count++;
+        this->longest = us > this->longest ? us : this->longest;
+    };
+
+    /// @brief The duration that the given percentage of samples were at or below.
+    /// @param percent The percentile, from 0 to 100.
+    /// @return The upper bound of the bucket holding that sample, in microseconds, or 0 if there are no samples.
+    unsigned long percentile(int percent)
+    {
+        if (this->count == 0)
         {
-            this->fillRounded = true;
-            this->fillRoundingRadius = roundingRadius;
+            return 0;
         }
-        else
+        uint32_t target = max((uint32_t)1, (uint32_t)((this->count * (uint64_t)percent + 99) / 100));
+        uint32_t seen = 0;
+        for (int i = 0; i < bucketCount; i++)
         {
-            this->fillRounded = false;
+            seen += this->buckets[i];
+            if (seen >= target)
+            {
+                // The last bucket has no upper bound.
+                return i == bucketCount - 1 ? this->longest : min(upperBound(i), this->longest);
+            }
         }
-        this->updated = true;
+        return this->longest;
     };
 
-    void noFill()
+public:
+    static const int bucketCount = 80;
+    uint32_t count;
+    unsigned long longest;
+
+private:
+    static int bucketFor(unsigned long us)
     {
-        this->hasFill = false;
-        this->resizeNeeded = true;
-        this->updated = true;
+        if (us < 64)
+        {
+            return 0;
+        }
+        int power = 31 - __builtin_clz((uint32_t)us);
+        int index = (power - 6) * 4 + ((us >> (power - 2)) & 3) + 1;
+        return min(index, bucketCount - 1);
     };
 
-    void noBorder()
+    static unsigned long upperBound(int index)
     {
-        this->hasOutline = false;
-        this->resizeNeeded = true;
-        this->updated = true;
+        if (index == 0)
+        {
+            return 64;
+        }
+        int power = (index - 1) / 4 + 6;
+        return (unsigned long)(5 + (index - 1) % 4) << (power - 2);
     };
 
-    void setText(String text)
+    uint32_t buckets[bucketCount];
+};
+
+/**
+ * @brief Times each stage from a touch to the panel finishing its refresh.
+ * @details A touch starts an event, and each later stage is recorded against the event's ID as the time
+ * since the touch. Only one event is active in the UI task at a time: it is handed to the refresh job
+ * when the display is updated. A refresh merged into a newer one is reported with the newer event.
+ */
+class UiLatencyTrace
+{
+public:
+    enum stage_t
     {
-        this->text = text;
-        this->resizeNeeded = true;
-        this->updated = true;
+        STAGE_TOUCH,
+        STAGE_DISPATCH,
+        STAGE_INVALIDATE,
+        STAGE_RENDER_START,
+        STAGE_RENDER_END,
+        STAGE_TRANSFER,
+        STAGE_REFRESH_START,
+        // Estimated: the panel doesn't report the end of a refresh, so this is when its waveform time runs out.
+        STAGE_REFRESH_END,
+        STAGE_COUNT
     };
 
-    void setFont(GFXfont *font)
+    UiLatencyTrace()
     {
-        this->customFont = true;
-        this->font = font;
-        this->resizeNeeded = true;
-        this->updated = true;
+        this->nextId = 1;
+        this->active = 0;
+        memset(this->inFlight, 0, sizeof(this->inFlight));
     };
 
-    void preRender()
+    /// @brief Starts a new event.
+    /// @param touchTime When the touch was sampled, from uiMicros(). The touch stage is the time from then until now.
+    /// @return The event's ID, which is also made the active event.
+    uint32_t begin(unsigned long touchTime)
     {
-        if (!this->initialised)
-        {
-            return;
-        }
-        this->draw();
-        this->hasPreRender = true;
+        uint32_t id = this->nextId++;
+        struct event &event = this->inFlight[id % maxInFlight];
+        event.id = id;
+        event.start = touchTime;
+        this->active = id;
+        this->stages[STAGE_TOUCH].record(uiMicros() - touchTime);
+        return id;
     };
 
-    void autoResize(bool init = false)
+    /// @brief Records that an event reached a stage. Unknown or finished events are ignored.
+    void mark(uint32_t id, enum stage_t stage)
     {
-        this->autosize = true;
-        this->resizeNeeded = false;
-        if (this->customFont)
+        if (id == 0)
+        {
+            return;
+        }
+        struct event &event = this->inFlight[id % maxInFlight];
+        if (event.id != id)
         {
-            surface.setFreeFont(this->font);
+            return;
         }
-        else
+        this->stages[stage].record(uiMicros() - event.start);
+        if (stage == STAGE_REFRESH_END)
         {
-            surface.setTextSize(this->textSize);
+            event.id = 0;
         }
-        width = this->surface.textWidth(this->text) + this->xPad * 2 + this->outlineThickness * 2;
-        height = this->surface.fontHeight(1) + this->yPad * 2 + this->outlineThickness * 2;
+    };
 
-        if (init)
+    /// @brief Ends an event that didn't lead to a refresh.
+    void cancel(uint32_t id)
+    {
+        if (this->active == id)
         {
-            this->createBuffer(width, height);
+            this->active = 0;
         }
-        else
+        struct event &event = this->inFlight[id % maxInFlight];
+        if (event.id == id)
         {
-            this->resize(width, height);
+            event.id = 0;
         }
-        this->updated = true;
     };
 
-    void resize(int width, int height)
+    UiLatencyHistogram &histogram(enum stage_t stage)
     {
-        this->width = width;
-        this->height = height;
-        this->surface.deleteSprite();
-        this->surface.createSprite(width, height, 1);
-        this->updated = true;
+        return this->stages[stage];
     };
 
-    void defaultFont()
+    void reset()
     {
-        this->customFont = false;
-        this->resizeNeeded = true;
-        this->updated = true;
+        for (UiLatencyHistogram &histogram : this->stages)
+        {
+            histogram.reset();
+        }
     };
 
-    void setPadding(int xPad, int yPad)
+    /// @brief Prints a table of each stage's percentiles, in milliseconds since the touch.
+    void dump(Print &out)
     {
-        this->xPad = xPad;
-        this->yPad = yPad;
-        this->resizeNeeded = true;
+        static const char *names[STAGE_COUNT] = {"touch", "dispatch", "invalidate", "render start", "render end", "transfer", "refresh start", "refresh end*"};
+        out.println("stage          count     p50     p90     p99     max");
+        for (int i = 0; i < STAGE_COUNT; i++)
+        {
+            UiLatencyHistogram &histogram = this->stages[i];
+            char line[80];
+            snprintf(line, sizeof(line), "%-13s %6u %7.1f %7.1f %7.1f %7.1f", names[i], (unsigned)histogram.count, histogram.percentile(50) / 1000.0, histogram.percentile(90) / 1000.0, histogram.percentile(99) / 1000.0, histogram.longest / 1000.0);
+            out.println(line);
+        }
+        out.println("* estimated from the waveform time");
     };
 
-    bool touchEvent(int x, int y) override
+    /// @brief Appends the table to a file, such as one on the SD card.
+    /// @return False if the file couldn't be opened.
+    bool dump(fs::FS &fs, const char *path)
     {
-        return false;
-    }
+        File file = fs.open(path, FILE_APPEND);
+        if (!file)
+        {
+            return false;
+        }
+        this->dump(file);
+        file.close();
+        return true;
+    };
 
 public:
-    String text;
-    bool initialised;
-    bool hasOutline;
-    bool hasFill;
-    bool borderRounded;
-    bool fillRounded;
-    bool customFont;
-    bool autosize;
-    bool resizeNeeded;
-    uint16_t borderRoundingRadius;
-    uint16_t fillRoundingRadius;
-    uint16_t outlineColour;
-    uint16_t outlineThickness;
-    uint16_t fillColour;
-    uint16_t textColour;
-    uint16_t textSize;
-    uint16_t textAlignment;
-    uint16_t xPad;
-    uint16_t yPad;
-    GFXfont *font;
-    bool hasPreRender;
-    enum vAlign vAlignment;
-    enum hAlign hAlignment;
-    float lineSpacing;
+    /// @brief The event being handled by the UI task, or 0 for none.
+    uint32_t active;
+
+private:
+    struct event
+    {
+        uint32_t id;
+        unsigned long start;
+    };
+
+    // Events still waiting for their refresh to finish, by ID.
+    static const int maxInFlight = 8;
+    struct event inFlight[maxInFlight];
+    uint32_t nextId;
+    UiLatencyHistogram stages[STAGE_COUNT];
 };
 
-class UiFrame : public UiLabel
+UiLatencyTrace latencyTrace;
+
+/**
+ * @brief A fixed-size record in the performance log.
+ * @details What the values hold depends on the type. Areas are packed into two values as
+ * x << 16 | y and width << 16 | height.
+ * - PERF_SESSION: the record size and the log capacity.
+ * - PERF_FRAME: the update area, the render time in microseconds, and the running totals of applied,
+ *   coalesced and suppressed value writes.
+ * - PERF_REFRESH: the area, the first mode | the second mode << 8, the time spent queued and the time
+ *   from sending the pixels to the last waveform finishing, both in microseconds, and the latency trace event.
+ * - PERF_HEAP: free internal heap, the lowest it has been, the largest free block and free PSRAM.
+ */
+struct UiPerfRecord
+{
+    uint32_t time;
+    uint16_t session;
+    uint8_t type;
+    uint8_t reserved;
+    uint32_t values[6];
+};
+
+/**
+ * @brief Appends binary performance records to a preallocated file, so logging has little effect on timing.
+ * @details The file is a header followed by room for a fixed number of records, filled with zeros when
+ * the file is created so the card never has to grow it. Records are collected in RAM and written in one
+ * block when the buffer fills, when the oldest one has waited too long, and before powering off.
+ * Each boot starts a new session after the last record in the file. When the file is full, new records
+ * are counted and dropped. analyze_perf_log.py reads the file on a computer.
+ */
+class UiPerfLog
 {
 public:
-    UiFrame(int x, int y, int width, int height, bool hwFrame = false, M5EPD_Canvas *hwSurface = NULL) : UiLabel()
+    enum record_type_t
     {
-        UiFrame::init(x, y, width, height, hwFrame, hwSurface);
+        PERF_EMPTY,
+        PERF_SESSION,
+        PERF_FRAME,
+        PERF_REFRESH,
+        PERF_HEAP
     };
 
-    UiFrame() : UiLabel()
+    UiPerfLog()
     {
-        this->initialised = false;
+        this->buffer = NULL;
+        this->buffered = 0;
+        this->capacity = 0;
+        this->next = 0;
+        this->session = 0;
+        this->dropped = 0;
+        this->written = 0;
+        this->lastHeap = 0;
+        this->firstBuffered = 0;
     };
 
-    void init(int x, int y, int width, int height, bool hwFrame = false, M5EPD_Canvas *hwSurface = NULL)
+    /// @brief Opens the log, creating it if it doesn't exist, and starts a new session.
+    /// @param fs The file system holding the log, normally SD.
+    /// @param path The path of the log file.
+    /// @param capacity The number of records the file holds. An existing file keeps its own capacity.
+    /// @return False if the log couldn't be opened, in which case nothing is logged.
+    bool begin(fs::FS &fs, const char *path, uint32_t capacity)
     {
-        this->initialised = true;
-        this->hwFrame = hwFrame;
-        this->hwSurface = hwSurface;
-        if (!hwFrame)
+        this->buffer = (struct UiPerfRecord *)malloc(bufferSize * sizeof(struct UiPerfRecord));
+        if (this->buffer == NULL)
         {
-            UiLabel::init(x, y, width, height, "", false);
+            return false;
+        }
+        struct UiPerfRecord header;
+        this->file = fs.open(path, "r+");
+        if (!this->file || this->file.read((uint8_t *)&header, sizeof(header)) != sizeof(header) || header.time != magic || header.values[0] != sizeof(struct UiPerfRecord))
+        {
+            this->file.close();
+            if (!this->create(fs, path, capacity))
+            {
+                debug("Couldn't create performance log " + String(path));
+                free(this->buffer);
+                this->buffer = NULL;
+                return false;
+            }
         }
         else
         {
-            UiLabel::init(x, y, width, height, "", true);
+            this->capacity = header.values[1];
         }
-        this->hardwareDraw = hwFrame;
-        this->backgroundColour = this->greyToColour16(1);
-        this->setOutline(10, 2, 10);
-        this->fillRoundingRadius = 10;
+        this->next = this->findEnd();
+        struct UiPerfRecord last;
+        this->session = this->next > 0 && this->readRecord(this->next - 1, last) ? last.session + 1 : 1;
+        debug("Performance log session " + String(this->session) + " starting at record " + String(this->next) + " of " + String(this->capacity));
+        uint32_t values[6] = {sizeof(struct UiPerfRecord), this->capacity};
+        this->add(PERF_SESSION, values);
+        this->logHeap();
+        return true;
     };
 
-    void add(UiObj *obj)
+    bool enabled()
     {
-        this->objects.push_back(obj);
-        obj->setParent(this);
-        this->itemsChanged = true;
+        return this->buffer != NULL;
     };
 
-    void resetStatus() override
+    /// @brief Adds a record to the buffer, writing the buffer out if it is full.
+    void add(enum record_type_t type, const uint32_t values[6])
     {
-        if (this->drawn)
+        if (!this->enabled())
         {
-            this->itemsChanged = false;
+            return;
         }
-        UiObj::resetStatus();
-        for (UiObj *obj : this->objects)
+        if (this->buffered == 0)
         {
-            obj->resetStatus();
+            this->firstBuffered = uiMicros();
+        }
+        struct UiPerfRecord &record = this->buffer[this->buffered++];
+        record.time = epdSimulator != NULL ? uiMicros() / 1000 : millis();
+        record.session = this->session;
+        record.type = type;
+        record.reserved = 0;
+        memcpy(record.values, values, sizeof(record.values));
+        if (this->buffered == bufferSize)
+        {
+            this->flush();
         }
     };
 
-    bool isUpdated() override
+    void logFrame(struct area area, unsigned long renderTime)
     {
-        if (!this->initialised)
+        uint32_t values[6] = {packArea(area, true), packArea(area, false), (uint32_t)renderTime, updateCounters.applied, updateCounters.coalesced, updateCounters.suppressed};
+        this->add(PERF_FRAME, values);
+    };
+
+    void logRefresh(struct area area, m5epd_update_mode_t mode, m5epd_update_mode_t followMode, unsigned long queued, unsigned long duration, uint32_t event)
+    {
+        uint32_t values[6] = {packArea(area, true), packArea(area, false), (uint32_t)mode | (uint32_t)followMode << 8, (uint32_t)queued, (uint32_t)duration, event};
+        this->add(PERF_REFRESH, values);
+    };
+
+    void logHeap()
+    {
+        uint32_t values[6] = {heap_caps_get_free_size(MALLOC_CAP_INTERNAL), heap_caps_get_minimum_free_size(MALLOC_CAP_INTERNAL), heap_caps_get_largest_free_block(MALLOC_CAP_8BIT), heap_caps_get_free_size(MALLOC_CAP_SPIRAM)};
+        this->add(PERF_HEAP, values);
+        this->lastHeap = uiMicros();
+    };
+
+    /// @brief Takes a heap snapshot and writes out old records when they are due. Call this regularly.
+    void poll()
+    {
+        if (!this->enabled())
         {
-            debug("Frame not updated (uninitialised)");
-            return false;
+            return;
         }
-
-        if (this->itemsChanged || this->visibilityChanged || this->newParent)
+        if (uiMicros() - this->lastHeap >= heapPeriod)
         {
-            // debug("Frame updated");
-            return true;
+            this->logHeap();
         }
-
-        for (UiObj *obj : this->objects)
+        if (this->buffered > 0 && uiMicros() - this->firstBuffered >= flushPeriod)
         {
-            if (this->isObjectChanged(obj))
-            {
-                // debug("Frame updated");
-                return true;
-            }
+            this->flush();
         }
-        // debug("Frame not updated");
-        return false;
     };
 
-    bool isObjectChanged(UiObj *obj)
+    /// @brief Writes the buffered records to the file in one block.
+    void flush()
     {
-        if (obj->initialised && ((obj->isUpdated() && obj->visible) || obj->visibilityChanged || obj->newParent))
+        if (!this->enabled() || this->buffered == 0)
         {
-            return true;
+            return;
         }
-        return false;
-    };
-
-    bool withinArea(struct area checkArea, UiObj *obj)
-    {
-        if (obj->x >= checkArea.x && obj->x + obj->width <= checkArea.x + checkArea.width && obj->y >= checkArea.y && obj->y + obj->height <= checkArea.y + checkArea.height)
+        uint32_t count = min(this->buffered, this->capacity - this->next);
+        if (count > 0)
         {
-            return true;
+            this->file.seek(recordOffset(this->next));
+            this->file.write((const uint8_t *)this->buffer, count * sizeof(struct UiPerfRecord));
+            this->file.flush();
+            this->next += count;
+            this->written += count;
         }
-        return false;
+        this->dropped += this->buffered - count;
+        this->buffered = 0;
     };
 
-    bool overlaps(UiObj *obj1, UiObj *obj2)
+private:
+    static uint32_t packArea(struct area area, bool position)
     {
-        if (obj1->x + obj1->width < obj2->x || obj1->x > obj2->x + obj2->width || obj1->y + obj1->height < obj2->y || obj1->y > obj2->y + obj2->height)
-        {
-            return false;
-        }
-        return true;
+        return position ? (uint32_t)area.x << 16 | (uint16_t)area.y : (uint32_t)area.width << 16 | (uint16_t)area.height;
     };
 
-    void updateBelow(UiObj *obj)
+    static uint32_t recordOffset(uint32_t index)
     {
-        for (UiObj *child : this->objects)
-        {
-            if (this->overlaps(obj, child))
-            {
-                child->visibilityChanged = true;
-            }
-        }
+        // The header takes the place of one record.
+        return (index + 1) * sizeof(struct UiPerfRecord);
     };
 
-    struct area getUpdateArea()
+    bool create(fs::FS &fs, const char *path, uint32_t capacity)
     {
-        debug("Getting frame update area");
-        if (!this->initialised)
+        this->file = fs.open(path, FILE_WRITE);
+        if (!this->file)
         {
-            return {0, 0, 0, 0};
+            return false;
         }
-
-        if (!isUpdated())
+        struct UiPerfRecord header;
+        memset(&header, 0, sizeof(header));
+        header.time = magic;
+        header.values[0] = sizeof(struct UiPerfRecord);
+        header.values[1] = capacity;
+        this->file.write((const uint8_t *)&header, sizeof(header));
+        memset(this->buffer, 0, bufferSize * sizeof(struct UiPerfRecord));
+        for (uint32_t i = 0; i < capacity; i += bufferSize)
         {
-            this->updateArea = {0, 0, 0, 0};
-            return this->updateArea;
+            uint32_t count = min((uint32_t)bufferSize, capacity - i);
+            if (this->file.write((const uint8_t *)this->buffer, count * sizeof(struct UiPerfRecord)) != count * sizeof(struct UiPerfRecord))
+            {
+                this->file.close();
+                return false;
+            }
         }
+        this->file.close();
+        this->file = fs.open(path, "r+");
+        this->capacity = capacity;
+        return (bool)this->file;
+    };
 
-        this->updateArea = {-1, -1, 0, 0};
+    bool readRecord(uint32_t index, struct UiPerfRecord &record)
+    {
+        return this->file.seek(recordOffset(index)) && this->file.read((uint8_t *)&record, sizeof(record)) == sizeof(record);
+    };
 
-        for (UiObj *obj : this->objects)
+    /// @brief Finds the first unused record. Records are only ever appended, so a binary search is enough.
+    uint32_t findEnd()
+    {
+        uint32_t low = 0;
+        uint32_t high = this->capacity;
+        while (low < high)
         {
-            if (obj->initialised && obj->visibilityChanged && !obj->visible)
+            uint32_t middle = low + (high - low) / 2;
+            struct UiPerfRecord record;
+            if (this->readRecord(middle, record) && record.type != PERF_EMPTY)
+            {
+                low = middle + 1;
+            }
+            else
             {
-                this->updateBelow(obj);
+                high = middle;
             }
         }
+        return low;
+    };
 
-        if (this->visibilityChanged)
-        {
-            this->updateArea = {0, 0, this->width, this->height};
-            return this->updateArea;
-        }
+public:
+    uint32_t capacity;
+    uint16_t session;
+    // Records written to the file and records lost because the file was full, this session.
+    uint32_t written;
+    uint32_t dropped;
 
-        for (UiObj *obj : this->objects)
-        {
-            // debug("Object position: [" + String(obj->x) + ", " + String(obj->y) + ", " + String(obj->width) + ", " + String(obj->height) + "]");
-            // debug("Object status: [" + String(obj->initialised) + ", " + String(obj->isUpdated()) + ", " + String(obj->visible) + ", " + String(obj->visibilityChanged) + ", " + String(obj->newParent) + "]");
-            if (isObjectChanged(obj))
-            {
-                if (this->updateArea.x == -1)
-                {
-                    this->updateArea.x = obj->x;
-                }
-                else
-                {
-                    this->updateArea.x = min(this->updateArea.x, obj->x);
-                }
+private:
+    // 'UIPL', stored in the header's time field.
+    static const uint32_t magic = 0x4c504955;
+    static const uint32_t bufferSize = 128;
+    static const unsigned long heapPeriod = 10000000;
+    static const unsigned long flushPeriod = 60000000;
+    File file;
+    struct UiPerfRecord *buffer;
+    uint32_t buffered;
+    uint32_t next;
+    unsigned long lastHeap;
+    unsigned long firstBuffered;
+};
 
-                if (this->updateArea.y == -1)
-                {
-                    this->updateArea.y = obj->y;
-                }
-                else
-                {
-                    this->updateArea.y = min(this->updateArea.y, obj->y);
-                }
+UiPerfLog perfLog;
 
-                this->updateArea.width = max(this->updateArea.width, obj->width + obj->x - this->updateArea.x);
-                this->updateArea.height = max(this->updateArea.height, obj->height + obj->y - this->updateArea.y);
-            }
-        }
-        if (this->updateArea.x < 0 || this->updateArea.y < 0)
-        {
-            this->updateArea.x = 0;
-            this->updateArea.y = 0;
-        }
-        debug("Frame size: " + String(this->width) + ", " + String(this->height));
+/**
+ * @brief A panel refresh waiting for, or running on, the EPD controller.
+ */
+struct UiRefreshJob
+{
+    struct area area;
+    m5epd_update_mode_t modes[2];
+    int modeCount;
+    // The index of the running mode, or -1 if the job hasn't started.
+    int stage;
+    unsigned long stageEnd;
+    // A copy of the packed 4-bit pixels, kept until the job starts.
+    uint8_t *pixels;
+    // The latency trace event that caused the refresh, or 0.
+    uint32_t event;
+    unsigned long submitted;
+    unsigned long started;
+};
 
-        if (this->hwFrame)
-        {
-            // A hardware frame must be a multiple of 4 pixels wide.
-            this->updateArea.width = ((this->updateArea.width + 3) >> 2) << 2;
-        }
-        debug("Frame update area: " + String(this->updateArea.x) + ", " + String(this->updateArea.y) + ", " + String(this->updateArea.width) + ", " + String(this->updateArea.height));
-        return this->updateArea;
-    }
+/**
+ * @brief Schedules partial refreshes so that refreshes of separate areas can run at the same time.
+ * @details The IT8951 runs each area update on its own LUT engine, so refreshes that don't overlap
+ * don't need to wait for each other. A refresh that overlaps one already running is held, with a copy
+ * of its pixels, until that area is finished. A held refresh that is completely covered by a newer one
+ * is dropped, and a newer refresh inside the last held one is merged into it.
+ * The controller doesn't report when an area is finished, so the time each waveform takes is estimated
+ * (see epdModeDurations, or the simulator's own durations when it is active).
+ *
+ * On the M5Paper the refreshes don't really overlap. M5EPD's UpdateArea() checks the controller's
+ * AFSR register first, and busy-waits until every running area has finished, so updates are
+ * serialised on the hardware. There the queue only saves work: covered refreshes are dropped and
+ * small ones merged, and submit() returns while the panel is still busy. Refreshes only run
+ * together with a driver that skips the AFSR wait (UiEpdSimulator::waitForAllAreas models both).
+ */
+class UiRefreshQueue
+{
+public:
+    UiRefreshQueue()
+    {
+        this->maxActive = 4;
+        this->started = 0;
+        this->queued = 0;
+        this->merged = 0;
+    };
 
-    void draw()
+    /// @brief Sends pixels to the controller and refreshes the area as soon as it is free.
+    /// @details With M5EPD, starting a refresh blocks until every running area has finished.
+    /// @param area The area of the screen to update.
+    /// @param pixels The packed 4-bit pixels for the area. They are copied if the refresh has to wait.
+    /// @param mode The waveform to use.
+    /// @param followMode A second waveform to run once the first finishes, or UPDATE_MODE_NONE.
+    void submit(struct area area, const uint8_t *pixels, m5epd_update_mode_t mode, m5epd_update_mode_t followMode = UPDATE_MODE_NONE)
     {
-        if (!this->initialised)
+        this->poll();
+        UiRefreshJob job;
+        job.area = area;
+        job.modes[0] = mode;
+        job.modes[1] = followMode;
+        job.modeCount = followMode == UPDATE_MODE_NONE ? 1 : 2;
+        job.stage = -1;
+        job.stageEnd = 0;
+        job.pixels = NULL;
+        job.event = latencyTrace.active;
+        job.submitted = uiMicros();
+        job.started = 0;
+
+        if (this->mergePending(job, pixels))
         {
             return;
         }
 
-        if (this->hwFrame)
+        if (this->canStart(this->jobs.size(), area))
         {
-            debug("Drawing frame (H/W)");
+            this->start(job, pixels);
         }
         else
         {
-            debug("Drawing frame (S/W)");
+            debug("Refresh overlaps a running refresh, queueing");
+            int size = area.width * area.height / 2;
+            job.pixels = (uint8_t *)malloc(size);
+            if (job.pixels == NULL)
+            {
+                debug("No memory to queue refresh, waiting instead");
+                this->waitIdle();
+                this->start(job, pixels);
+                this->jobs.push_back(job);
+                return;
+            }
+            memcpy(job.pixels, pixels, size);
+            this->queued++;
         }
-        this->getUpdateArea();
-        if (visibilityChanged)
+        this->jobs.push_back(job);
+    };
+
+    /// @brief Moves running refreshes on to their next waveform and starts any that were waiting.
+    void poll()
+    {
+        unsigned long now = uiMicros();
+        for (size_t i = 0; i < this->jobs.size();)
         {
-            this->surface.fillSprite(this->backgroundColour);
+            UiRefreshJob &job = this->jobs[i];
+            if (job.stage >= 0 && (long)(now - job.stageEnd) >= 0)
+            {
+                job.stage++;
+                if (job.stage >= job.modeCount)
+                {
+                    latencyTrace.mark(job.event, UiLatencyTrace::STAGE_REFRESH_END);
+                    perfLog.logRefresh(job.area, job.modes[0], job.modes[1], job.started - job.submitted, now - job.started, job.event);
+                    this->jobs.erase(this->jobs.begin() + i);
+                    continue;
+                }
+                this->startStage(job);
+            }
+            i++;
         }
-        UiLabel::draw();
-        for (int layer = 0; layer <= UiObj::LAYER_OVERLAY; layer++)
+
+        for (size_t i = 0; i < this->jobs.size(); i++)
         {
-            // debug("Drawing layer " + String(layer));
-            for (UiObj *obj : this->objects)
+            UiRefreshJob &job = this->jobs[i];
+            if (job.stage < 0 && this->canStart(i, job.area))
             {
-                if (obj->visible && obj->layer == layer)
-                { // && this->isObjectChanged(obj)) {
-                    // debug("Drawing object from parent: " + String((uint32_t)obj->parent));
-                    obj->render();
-                }
+                this->start(job, job.pixels);
+                free(job.pixels);
+                job.pixels = NULL;
             }
         }
-        this->drawOutline();
-        debug("Done.");
     };
 
-    void expose(struct area xArea) override
+    bool idle()
     {
-        if (this->hwFrame || this->parent == NULL)
+        return this->jobs.empty();
+    };
+
+    /// @brief Blocks until every refresh has finished.
+    void waitIdle()
+    {
+        while (true)
         {
-            for (UiObj *obj : this->objects)
+            this->poll();
+            if (this->idle())
             {
-                if (obj->visible && this->withinArea(xArea, obj))
-                {
-                    obj->expose(obj->childOffset(xArea));
-                }
+                return;
             }
+            uiDelay(5);
         }
-        else
+    };
+
+    int activeCount()
+    {
+        int count = 0;
+        for (UiRefreshJob &job : this->jobs)
         {
-            UiObj::expose(xArea);
+            if (job.stage >= 0)
+            {
+                count++;
+            }
         }
+        return count;
     };
 
-    bool touchEvent(int x, int y)
+private:
+    /// @brief Checks if a refresh can start without disturbing any refresh before it.
+    /// @param index The position of the job in the queue. Only earlier jobs are checked.
+    /// @param area The area of the job.
+    bool canStart(size_t index, struct area area)
     {
-        if (!this->initialised)
+        int active = 0;
+        for (size_t i = 0; i < this->jobs.size(); i++)
         {
-            return false;
+            UiRefreshJob &other = this->jobs[i];
+            if (other.stage >= 0)
+            {
+                active++;
+            }
+            if ((other.stage >= 0 || i < index) && areasOverlap(other.area, area))
+            {
+                return false;
+            }
         }
+        return active < this->maxActive;
+    };
 
-        debug("Frame touch event: " + String(x) + ", " + String(y));
-        for (int layer = UiObj::LAYER_OVERLAY; layer >= 0; layer--)
+    /// @brief Folds a new refresh into a waiting one with the same modes.
+    /// @return True if the new refresh no longer needs its own job.
+    bool mergePending(UiRefreshJob &job, const uint8_t *pixels)
+    {
+        for (int i = this->jobs.size() - 1; i >= 0; i--)
         {
-            for (UiObj *obj : this->objects)
+            UiRefreshJob &other = this->jobs[i];
+            if (other.stage >= 0 || !areasOverlap(other.area, job.area))
             {
-                if (obj->layer == layer && obj->visible && obj->layer == layer && x >= obj->x && x <= obj->x + obj->width && y >= obj->y && y <= obj->y + obj->height)
+                continue;
+            }
+            bool sameModes = other.modeCount == job.modeCount && other.modes[0] == job.modes[0] && other.modes[1] == job.modes[1];
+            if (sameModes && areaContains(job.area, other.area))
+            {
+                // The new pixels replace all of the old ones.
+                free(other.pixels);
+                this->jobs.erase(this->jobs.begin() + i);
+                this->merged++;
+                continue;
+            }
+            if (sameModes && areaContains(other.area, job.area) && ((job.area.x - other.area.x) & 1) == 0)
+            {
+                other.event = job.event != 0 ? job.event : other.event;
+                int offset = (job.area.x - other.area.x) / 2;
+                for (int y = 0; y < job.area.height; y++)
                 {
-                    return obj->touchEvent(x - obj->x, y - obj->y);
+                    memcpy(other.pixels + (y + job.area.y - other.area.y) * other.area.width / 2 + offset, pixels + y * job.area.width / 2, job.area.width / 2);
                 }
+                this->merged++;
+                return true;
             }
+            // Only the newest overlapping job can be merged into without reordering pixels.
+            return false;
         }
-        debug("Not matching any object");
         return false;
     };
 
-public:
-    std::vector<UiObj *> objects;
-    bool initialised;
-    bool hwFrame;
-    bool itemsChanged;
-    M5EPD_Canvas *hwSurface;
-    uint16_t backgroundColour;
-    uint16_t borderColour;
-};
-
-/**
- * @brief A button control with a callback function.
- * @details This class is a button control with a callback function.
- * It inherits from UiLabel, so all formatting is available.
- */
-class UiButton : public UiLabel
-{
-public:
-    enum buttonEvent
+    void start(UiRefreshJob &job, const uint8_t *pixels)
     {
-        BUTTON_PRESSED = 100,
-        BUTTON_RELEASED,
-        BUTTON_HOLD,
-        BUTTON_DOUBLE_TAP,
+        job.started = uiMicros();
+        debug("Writing PARTGRAM4pp to display area: " + String(job.area.x) + ", " + String(job.area.y) + ", " + String(job.area.width) + ", " + String(job.area.height));
+        if (epdSimulator != NULL)
+        {
+            epdSimulator->WritePartGram4bpp(job.area.x, job.area.y, job.area.width, job.area.height, pixels);
+        }
+        else
+        {
+            M5.EPD.WritePartGram4bpp(job.area.x, job.area.y, job.area.width, job.area.height, pixels);
+        }
+        latencyTrace.mark(job.event, UiLatencyTrace::STAGE_TRANSFER);
+        job.stage = 0;
+        this->startStage(job);
+        latencyTrace.mark(job.event, UiLatencyTrace::STAGE_REFRESH_START);
+        this->started++;
     };
 
-    UiButton(int x, int y, String text, bool (*callback)(UiButton *, int)) : UiLabel(x, y, text)
+    void startStage(UiRefreshJob &job)
     {
-        this->useStdFunction = false;
-        this->callback = callback;
-        this->setOutline(15, 5, 5);
-        this->setFill(2, 5);
+        debug("Running partial refresh on area " + String(job.area.x) + ", " + String(job.area.y) + ", " + String(job.area.width) + ", " + String(job.area.height));
+        if (epdSimulator != NULL)
+        {
+            epdSimulator->UpdateArea(job.area.x, job.area.y, job.area.width, job.area.height, job.modes[job.stage]);
+            job.stageEnd = uiMicros() + epdSimulator->durations[job.modes[job.stage]];
+        }
+        else
+        {
+            M5.EPD.UpdateArea(job.area.x, job.area.y, job.area.width, job.area.height, job.modes[job.stage]);
+            job.stageEnd = uiMicros() + epdModeDurations[job.modes[job.stage]];
+        }
     };
 
-    UiButton(int x, int y, String text, std::function<bool(UiButton *, int)> callback) : UiLabel(x, y, text)
-    {
-        this->useStdFunction = true;
-        this->stdCallback = callback;
-        this->setOutline(15, 5, 5);
-        this->setFill(2, 5);
-    };
+public:
+    // The number of areas the controller may refresh at once.
+    int maxActive;
+    uint32_t started;
+    uint32_t queued;
+    uint32_t merged;
 
-    void init(int x, int y, String text, bool (*callback)(UiButton *, int))
+private:
+    std::vector<UiRefreshJob> jobs;
+};
+
+/**
+ * @brief Receives tiles from a host over TCP and writes them into a UiRemoteSurface.
+ * @details The stream is a sequence of messages, with numbers in little endian:
+ * - 'T', x, y, width, height (16 bits each), encoding (8 bits), payload length (32 bits), payload.
+ * - 'F' marks the end of a frame. Its tiles are only drawn once it arrives. The server replies with 'A'
+ *   once the frame's refresh has run (see acknowledge()), so the host keeps pace with the panel.
+ *
+ * Reading never blocks: poll() takes whatever has arrived and keeps partial messages for next time.
+ * Only one host is served at a time.
+ */
+class UiTileServer
+{
+public:
+    UiTileServer(uint16_t port) : server(port)
     {
-        UiLabel::init(x, y, text);
-        this->callback = callback;
+        this->target = NULL;
+        this->payload = NULL;
+        this->resetStream();
     };
 
-    void setOutline(uint16_t colour, uint16_t thickness, uint16_t roundingRadius)
+    ~UiTileServer()
     {
-        this->hasOutline = true;
-        this->borderColour = colour;
-        this->outlineThickness = thickness;
-        this->borderRoundingRadius = roundingRadius;
-        this->updated = true;
+        free(this->payload);
     };
 
-    UiButton() : UiLabel()
+    /// @brief Starts listening for a host.
+    /// @param target The surface to write tiles into.
+    void begin(UiRemoteSurface *target)
     {
-        this->callback = NULL;
+        this->target = target;
+        if (this->payload == NULL)
+        {
+            this->payload = (uint8_t *)malloc(maxTilePayload);
+        }
+        this->server.begin();
+        this->server.setNoDelay(true);
     };
 
-    bool touchEvent(int x, int y) override
+    /// @brief Reads and applies any tiles that have arrived.
+    /// @details Must be called from the UI task. Several frames arriving together are drawn as one.
+    /// @return The number of frames finished since the last call.
+    int poll()
     {
-        if (!this->initialised || this->callback == NULL)
+        if (this->target == NULL || this->payload == NULL || !this->acceptClient())
         {
-            return false;
+            return 0;
         }
-        else
+        int finished = 0;
+        while (this->client.available() > 0)
         {
-            if (this->useStdFunction)
+            if (!this->readingPayload)
             {
-                return this->stdCallback(this, BUTTON_RELEASED);
+                if (this->headerRead == 0)
+                {
+                    int type = this->client.read();
+                    if (type == 'F')
+                    {
+                        this->target->commit();
+                        this->unacknowledged++;
+                        this->frames++;
+                        finished++;
+                        continue;
+                    }
+                    if (type != 'T')
+                    {
+                        this->dropClient("Unknown tile message " + String(type));
+                        return finished;
+                    }
+                    this->header[this->headerRead++] = type;
+                    continue;
+                }
+                int read = this->client.read(this->header + this->headerRead, tileHeaderSize - this->headerRead);
+                if (read <= 0)
+                {
+                    break;
+                }
+                this->headerRead += read;
+                if (this->headerRead == tileHeaderSize && !this->startPayload())
+                {
+                    return finished;
+                }
+                continue;
             }
-            else
+            int read = this->client.read(this->payload + this->payloadRead, this->payloadLength - this->payloadRead);
+            if (read <= 0)
             {
-                return this->callback(this, BUTTON_RELEASED);
+                break;
+            }
+            this->payloadRead += read;
+            if (this->payloadRead == this->payloadLength)
+            {
+                this->finishTile();
             }
         }
+        return finished;
     };
 
-public:
-    bool (*callback)(UiButton *, int);
-    std::function<bool(UiButton *, int)> stdCallback;
-    int borderColour;
+    /// @brief Acknowledges the frames finished so far, so the host sends the next one.
+    /// @details Call once the refresh showing them has run, so the host keeps pace with the panel.
+    void acknowledge()
+    {
+        if (this->unacknowledged == 0 || !this->client.connected())
+        {
+            this->unacknowledged = 0;
+            return;
+        }
+        uint8_t ack = 'A';
+        for (; this->unacknowledged > 0; this->unacknowledged--)
+        {
+            this->client.write(&ack, 1);
+        }
+    };
 
 private:
-    bool useStdFunction;
-};
+    static const int tileHeaderSize = 14;
 
-class UiImage : public UiObj
-{
-public:
-    UiImage(int x, int y, int width, int height, uint8_t *bitmap) : UiObj(x, y, width, height)
+    bool acceptClient()
     {
-        this->image = bitmap;
-        this->initialised = true;
-        this->backgroundColour = this->greyToColour16(0);
-        this->updated = true;
+        if (this->client.connected())
+        {
+            return true;
+        }
+        if (this->client)
+        {
+            debug("Tile host disconnected");
+            this->client.stop();
+        }
+        this->client = this->server.available();
+        if (!this->client)
+        {
+            return false;
+        }
+        debug("Tile host connected");
+        this->client.setNoDelay(true);
+        this->resetStream();
+        return true;
     };
 
-    UiImage() : UiObj()
+    void dropClient(String reason)
     {
-        this->initialised = false;
+        debug(reason + ", dropping tile host");
+        this->client.stop();
+        this->resetStream();
     };
 
-    bool isUpdated() override
+    void resetStream()
     {
-        return this->updated;
+        this->unacknowledged = 0;
+        this->headerRead = 0;
+        this->readingPayload = false;
+        this->payloadRead = 0;
+        this->payloadLength = 0;
     };
 
-    struct area getUpdateArea() override
+    uint16_t headerWord(int offset)
     {
-        this->updateArea.x = this->x;
-        this->updateArea.y = this->y;
-        this->updateArea.width = this->width;
-        this->updateArea.height = this->height;
-        return this->updateArea;
+        return this->header[offset] | (this->header[offset + 1] << 8);
     };
 
-    void draw() override
+    bool startPayload()
     {
-        if (!this->initialised)
+        this->tileArea = {this->headerWord(1), this->headerWord(3), this->headerWord(5), this->headerWord(7)};
+        this->tileEncoding = this->header[9];
+        this->payloadLength = this->header[10] | (this->header[11] << 8) | (this->header[12] << 16) | ((uint32_t)this->header[13] << 24);
+        if (this->payloadLength > maxTilePayload)
         {
-            return;
+            this->dropClient("Tile payload of " + String(this->payloadLength) + " bytes is too big");
+            return false;
         }
-        this->surface.fillScreen(this->backgroundColour);
-        Serial.println("Frame buffer: " + String((uint32_t)this->surface.frameBuffer(1)));
-        this->surface.drawBitmap(0, 0, this->image, this->width, this->height, this->greyToColour16(15));
+        this->readingPayload = true;
+        this->payloadRead = 0;
+        if (this->payloadLength == 0)
+        {
+            this->finishTile();
+        }
+        return true;
     };
 
-    bool touchEvent(int x, int y) override
+    void finishTile()
     {
-        return false;
+        if (this->target->putTile(this->tileArea, this->tileEncoding, this->payload, this->payloadLength))
+        {
+            this->tiles++;
+            this->bytes += tileHeaderSize + this->payloadLength;
+        }
+        else
+        {
+            this->rejected++;
+        }
+        this->headerRead = 0;
+        this->readingPayload = false;
     };
 
 public:
-    uint8_t *image;
-    bool initialised;
-    uint16_t backgroundColour;
-};
+    uint32_t frames = 0;
+    uint32_t tiles = 0;
+    uint32_t rejected = 0;
+    uint32_t bytes = 0;
 
-class UiTextBox
-{
-    // TODO
+private:
+    WiFiServer server;
+    WiFiClient client;
+    UiRemoteSurface *target;
+    uint8_t header[tileHeaderSize];
+    int headerRead;
+    bool readingPayload;
+    uint8_t *payload;
+    uint32_t payloadRead;
+    uint32_t payloadLength;
+    struct area tileArea;
+    uint8_t tileEncoding;
+    // Frames drawn but not yet acknowledged to the host.
+    uint32_t unacknowledged;
 };
 
-class UiIcon : public UiFrame
+/**
+ * @brief A JSON parser that reports each value as it is read, without building a document.
+ * @details Text can be fed in chunks of any size, split anywhere. Each string, number, true,
+ * false or null is passed to the callback with a flat path: object keys and array indexes
+ * joined with dots, so {"rooms": [{"temp": 21}]} gives "rooms.0.temp" = "21".
+ * Only the current path and one token are held in memory. Longer tokens are truncated.
+ */
+class UiJsonStream
 {
 public:
-    UiIcon(int x, int y, int width, int height, uint8_t *bitmap, String text, bool (*callback)(UiObj *, int)) : UiFrame(x, y, width, height)
+    UiJsonStream(std::function<void(const String &, const String &)> onValue)
     {
-        this->image = new UiImage(0, 0, width, height, bitmap);
-        this->label = new UiLabel(0, height, text);
-        this->callback = callback;
-        this->add(image);
-        this->add(label);
+        this->onValue = onValue;
+        this->reset();
     };
 
-    UiIcon() : UiFrame()
+    void reset()
     {
-        this->image = NULL;
-        this->label = NULL;
+        this->state = JSON_VALUE;
+        this->depth = 0;
+        this->path = "";
+        this->token = "";
+        this->bytes = 0;
     };
 
-    bool touchEvent(int x, int y) override
+    /// @brief Parses the next chunk of the document.
+    /// @return False once the document is found to be malformed. The rest is ignored.
+    bool feed(const char *data, size_t length)
     {
-        if (!this->initialised || this->callback == NULL)
-        {
-            return false;
-        }
-        else
+        for (size_t i = 0; i < length && this->state != JSON_ERROR; i++)
         {
-            return this->callback(this, 1);
+            this->feedChar(data[i]);
+            this->bytes++;
         }
+        return this->state != JSON_ERROR;
     };
 
-public:
-    UiLabel *label;
-    UiImage *image;
-    bool (*callback)(UiObj *, int);
-};
-
-class UiHwImage : public UiObj
-{
-public:
-    UiHwImage(int x, int y, int width, int height, String filename, M5EPD_Canvas *surface) : UiObj()
+    /// @brief Tells the parser the document has ended.
+    /// @details A number, true, false or null at the top level has no closing character,
+    /// so it is only reported, and the document done, once the end is known.
+    void finish()
     {
-        if (!SD.exists(filename))
-        {
-            Serial.println("File not found: " + filename);
-            this->initialised = false;
-            return;
-        }
-        File imgFile = SD.open(filename, FILE_READ);
-        if (!imgFile)
+        if (this->state == JSON_LITERAL && this->depth == 0)
         {
-            Serial.println("Failed to open file: " + filename);
-            this->initialised = false;
-            return;
+            this->onValue(this->path, this->token);
+            this->endValue();
         }
-
-        this->imgBuffer = (uint8_t *)calloc(imgFile.size(), 1);
-        imgFile.read(this->imgBuffer, imgFile.size());
-
-        this->x = x;
-        this->y = y;
-        this->width = width;
-        this->height = height;
-        this->filename = filename;
-        this->initialised = true;
-        this->hardwareDraw = true;
-        this->hwsurface = surface;
-        SD.open(filename, FILE_READ);
     };
 
-    UiHwImage() : UiObj()
+    /// @brief True once a whole document has been read.
+    bool done()
     {
-        this->initialised = false;
+        return this->state == JSON_DONE;
     };
 
-    bool isUpdated() override
+    bool failed()
     {
-        return false;
+        return this->state == JSON_ERROR;
     };
 
-    struct area getUpdateArea() override
+public:
+    uint32_t bytes;
+
+private:
+    enum jsonState
     {
-        return {0, 0, 0, 0};
+        JSON_VALUE,
+        JSON_KEY,
+        JSON_COLON,
+        JSON_AFTER_VALUE,
+        JSON_STRING,
+        JSON_ESCAPE,
+        JSON_UNICODE,
+        JSON_LITERAL,
+        JSON_DONE,
+        JSON_ERROR
     };
 
-    void draw()
+    struct level
     {
-        if (!this->initialised)
-        {
-            return;
-        }
+        bool array;
+        bool empty;
+        int index;
+        // The length of the container's own path, which its members' paths start with.
+        unsigned int pathLength;
+    };
 
-        String fileExt = this->getFileExtension(this->filename);
-        bool isUrl = this->isWebUrl(this->filename);
+    static const int maxDepth = 8;
+    static const unsigned int maxToken = 128;
 
-        if (isUrl)
+    void feedChar(char c)
+    {
+        switch (this->state)
         {
-            if (fileExt == "png")
+        case JSON_STRING:
+            if (c == '\\')
             {
-                this->hwsurface->drawPngUrl(this->filename.c_str(), this->x, this->y, this->width, this->height);
+                this->state = JSON_ESCAPE;
             }
-            else if (fileExt == "jpg" || fileExt == "jpeg")
+            else if (c == '"')
             {
-                this->hwsurface->drawJpgUrl(this->filename.c_str(), this->x, this->y, this->width, this->height);
+                this->endString();
             }
             else
             {
-                Serial.println("Unsupported file extension: " + fileExt);
+                this->append(c);
+            }
+            return;
+        case JSON_ESCAPE:
+            this->state = JSON_STRING;
+            switch (c)
+            {
+            case 'b':
+                this->append('\b');
+                break;
+            case 'f':
+                this->append('\f');
+                break;
+            case 'n':
+                this->append('\n');
+                break;
+            case 'r':
+                this->append('\r');
+                break;
+            case 't':
+                this->append('\t');
+                break;
+            case 'u':
+                this->state = JSON_UNICODE;
+                this->unicode = 0;
+                this->unicodeDigits = 0;
+                break;
+            default:
+                this->append(c);
+            }
+            return;
+        case JSON_UNICODE:
+            this->readUnicode(c);
+            return;
+        case JSON_LITERAL:
+            if (isalnum(c) || c == '.' || c == '-' || c == '+')
+            {
+                this->append(c);
+                return;
             }
+            this->onValue(this->path, this->token);
+            this->endValue();
+            // The character after a literal still needs reading.
+            break;
+        default:
+            break;
         }
-        else
+
+        if (isspace(c))
         {
-            if (fileExt == "png")
+            return;
+        }
+        switch (this->state)
+        {
+        case JSON_VALUE:
+            this->beginValue(c);
+            break;
+        case JSON_KEY:
+            if (c == '"')
             {
-                this->hwsurface->drawPngFile(SD, this->filename.c_str(), this->x, this->y, this->width, this->height);
+                this->beginString(true);
             }
-            else if (fileExt == "jpg" || fileExt == "jpeg")
+            else if (c == '}' && this->levels[this->depth - 1].empty)
             {
-                this->hwsurface->drawJpgFile(SD, this->filename.c_str(), this->x, this->y, this->width, this->height);
+                this->endContainer(c);
             }
-            else if (fileExt == "bmp")
+            else
             {
-                this->hwsurface->drawBmpFile(SD, this->filename.c_str(), this->x, this->y);
+                this->state = JSON_ERROR;
+            }
+            break;
+        case JSON_COLON:
+            this->state = c == ':' ? JSON_VALUE : JSON_ERROR;
+            break;
+        case JSON_AFTER_VALUE:
+            if (c == ',')
+            {
+                struct level &top = this->levels[this->depth - 1];
+                top.index++;
+                this->state = top.array ? JSON_VALUE : JSON_KEY;
             }
             else
             {
-                Serial.println("Unsupported file extension: " + fileExt);
+                this->endContainer(c);
             }
+            break;
+        default:
+            // Anything but whitespace after the document is an error.
+            this->state = JSON_ERROR;
         }
     };
 
-    String getFileExtension(String filename)
+    void beginValue(char c)
     {
-        int dotIndex = filename.lastIndexOf('.');
-        if (dotIndex == -1)
+        if (this->depth > 0 && this->levels[this->depth - 1].array)
         {
-            return "";
+            struct level &top = this->levels[this->depth - 1];
+            if (c == ']' && top.empty)
+            {
+                this->endContainer(c);
+                return;
+            }
+            top.empty = false;
+            this->setMemberPath(String(top.index));
+        }
+        if (c == '{' || c == '[')
+        {
+            if (this->depth == maxDepth)
+            {
+                this->state = JSON_ERROR;
+                return;
+            }
+            this->levels[this->depth++] = {c == '[', true, 0, this->path.length()};
+            this->state = c == '[' ? JSON_VALUE : JSON_KEY;
+        }
+        else if (c == '"')
+        {
+            this->beginString(false);
+        }
+        else if (c == '-' || isdigit(c) || c == 't' || c == 'f' || c == 'n')
+        {
+            this->token = "";
+            this->append(c);
+            this->state = JSON_LITERAL;
         }
         else
         {
-            return filename.substring(dotIndex + 1);
+            this->state = JSON_ERROR;
+        }
+    };
+
+    void beginString(bool key)
+    {
+        this->token = "";
+        this->readingKey = key;
+        this->state = JSON_STRING;
+    };
+
+    void endString()
+    {
+        if (this->readingKey)
+        {
+            this->levels[this->depth - 1].empty = false;
+            this->setMemberPath(this->token);
+            this->state = JSON_COLON;
+            return;
+        }
+        this->onValue(this->path, this->token);
+        this->endValue();
+    };
+
+    void endContainer(char c)
+    {
+        if (this->depth == 0 || c != (this->levels[this->depth - 1].array ? ']' : '}'))
+        {
+            this->state = JSON_ERROR;
+            return;
+        }
+        this->depth--;
+        this->path.remove(this->levels[this->depth].pathLength);
+        this->endValue();
+    };
+
+    void endValue()
+    {
+        this->state = this->depth == 0 ? JSON_DONE : JSON_AFTER_VALUE;
+    };
+
+    // Replaces the last part of the path with the key or index of the next member.
+    void setMemberPath(const String &name)
+    {
+        unsigned int base = this->levels[this->depth - 1].pathLength;
+        this->path.remove(base);
+        if (base > 0)
+        {
+            this->path += '.';
+        }
+        this->path += name;
+    };
+
+    void append(char c)
+    {
+        if (this->token.length() < maxToken)
+        {
+            this->token += c;
         }
     };
 
-    bool isWebUrl(String filename)
+    void readUnicode(char c)
     {
-        if (filename.startsWith("http://") || filename.startsWith("https://"))
+        if (!isxdigit(c))
         {
-            return true;
+            this->state = JSON_ERROR;
+            return;
+        }
+        this->unicode = (this->unicode << 4) | (isdigit(c) ? c - '0' : (tolower(c) - 'a' + 10));
+        if (++this->unicodeDigits < 4)
+        {
+            return;
+        }
+        // Written as UTF-8. Surrogate pairs are kept as two separate characters.
+        if (this->unicode < 0x80)
+        {
+            this->append(this->unicode);
+        }
+        else if (this->unicode < 0x800)
+        {
+            this->append(0xC0 | (this->unicode >> 6));
+            this->append(0x80 | (this->unicode & 0x3F));
         }
         else
         {
-            return false;
+            this->append(0xE0 | (this->unicode >> 12));
+            this->append(0x80 | ((this->unicode >> 6) & 0x3F));
+            this->append(0x80 | (this->unicode & 0x3F));
         }
+        this->state = JSON_STRING;
     };
 
-    bool touchEvent(int x, int y) override
-    {
-        return false;
-    };
-
-public:
-    bool initialised;
-    String filename;
-    uint16_t backgroundColour;
-    M5EPD_Canvas *hwsurface;
-    uint8_t *imgBuffer;
+    std::function<void(const String &, const String &)> onValue;
+    enum jsonState state;
+    struct level levels[maxDepth];
+    int depth;
+    String path;
+    String token;
+    bool readingKey;
+    uint16_t unicode;
+    int unicodeDigits;
 };
 
-class UiModal : public UiFrame
+/**
+ * @brief Fetches a JSON document on a timer and shows the values in bound labels.
+ * @details The data model is flat: one entry per bound path, holding the last value shown.
+ * After each fetch, only labels whose value actually changed are given new text,
+ * so the refresh that follows covers just those labels.
+ */
+class UiDashboard
 {
 public:
-    UiModal() : UiFrame()
+    UiDashboard(String url, uint32_t periodSeconds) : parser([this](const String &path, const String &value)
+                                                             { this->setValue(path, value); })
     {
-        UiFrame::init(50, 200, 400, 300);
-        this->createElements();
-        this->result = -1;
-        this->initialised = true;
-        this->hide();
-        this->layer = LAYER_OVERLAY;
+        this->url = url;
+        this->periodSeconds = periodSeconds;
+        this->lastFetch = 0;
+        this->fetched = false;
     };
 
-    UiModal(int x, int y, int width, int height) : UiFrame(x, y, width, height)
+    /// @brief Shows the value at a path in a label.
+    /// @param path The flat path of the value, like "weather.temp" or "rooms.0.name".
+    /// @param label The label to show it in.
+    /// @param prefix Text to show before the value.
+    /// @param suffix Text to show after the value.
+    void bind(String path, UiLabel *label, String prefix = "", String suffix = "")
     {
-        this->createElements();
-        this->initialised = true;
-        this->result = -1;
-        this->hide();
+        struct binding binding;
+        binding.path = path;
+        binding.label = label;
+        binding.prefix = prefix;
+        binding.suffix = suffix;
+        binding.seen = false;
+        this->bindings.push_back(binding);
     };
 
-    void msgbox(String title, String message)
+    /// @brief True if it's time to fetch the document again.
+    bool due()
     {
-        debug("Modal object: " + String((uint32_t)this));
-        this->titlebar->setText(title);
-        this->content->setText(message);
-        this->cancelButton->hide();
-        this->okButton->show();
-        this->okButton->move((this->width - this->okButton->width - 10) / 2, this->height - this->okButton->height - 10);
-        this->result = -1;
-        this->show();
+        return !this->fetched || millis() - this->lastFetch >= this->periodSeconds * 1000;
     };
 
-    void confirm(String title, String message)
+    uint32_t secondsUntilDue()
     {
-        debug("Modal object: " + String((uint32_t)this));
-        this->titlebar->setText(title);
-        this->content->setText(message);
-        this->cancelButton->show();
-        this->okButton->show();
-        this->cancelButton->move(this->width / 2, this->height - this->okButton->height - 10);
-        this->okButton->move(this->width / 4, this->height - this->okButton->height - 10);
-        this->result = -1;
-        this->show();
+        if (this->due())
+        {
+            return 0;
+        }
+        return this->periodSeconds - (millis() - this->lastFetch) / 1000;
     };
 
-private:
-    void createElements()
+    /**
+     * @brief Fetches the document and updates the labels whose values changed.
+     * @details WiFi must already be connected. Labels keep their old values if the fetch fails.
+     * @return The number of labels changed, or -1 if the document couldn't be fetched or parsed.
+     */
+    int update()
     {
-        this->setOutline(15, 4, 10);
-        this->titlebar = new UiLabel(0, 0, this->width, 30, "");
-        this->titlebar->setOutline(15, 4, 10);
-        this->closeButtonCallback = std::bind(&UiModal::closePressed, this, std::placeholders::_1, std::placeholders::_2);
-        this->okButtonCallback = std::bind(&UiModal::okPressed, this, std::placeholders::_1, std::placeholders::_2);
-        this->cancelButtonCallback = std::bind(&UiModal::cancelPressed, this, std::placeholders::_1, std::placeholders::_2);
-        this->closeButton = new UiButton(this->width - 50, 0, "X", closeButtonCallback);
-        this->okButton = new UiButton(100, this->height - 100, "OK", okButtonCallback);
-        this->cancelButton = new UiButton(this->width - 100, this->height - 100, "Cancel", cancelButtonCallback);
-        this->content = new UiLabel(0, 30, this->width, this->height - 30 - this->okButton->height, "");
-        this->content->noBorder();
-        this->add(this->closeButton);
-        this->add(this->titlebar);
-        this->add(this->content);
-        this->add(this->okButton);
-        this->add(this->cancelButton);
-        this->cancelButton->preRender();
-        this->okButton->preRender();
-    }
+        this->lastFetch = millis();
+        this->fetched = true;
+        this->parser.reset();
+        for (struct binding &binding : this->bindings)
+        {
+            binding.seen = false;
+        }
 
-    bool closePressed(UiObj *obj, int event)
-    {
-        this->result = 0;
-        this->hide();
-        return true;
+        HTTPClient http;
+        // HTTP/1.0 keeps the body free of chunk headers, so it can go straight to the parser.
+        http.useHTTP10(true);
+        http.begin(this->url);
+        int status = http.GET();
+        if (status != HTTP_CODE_OK)
+        {
+            debug("Dashboard fetch failed: " + String(status));
+            http.end();
+            return -1;
+        }
+        WiFiClient *stream = http.getStreamPtr();
+        char buffer[256];
+        unsigned long start = millis();
+        while (!this->parser.done() && !this->parser.failed() && millis() - start < 10000)
+        {
+            int available = stream->available();
+            if (available > 0)
+            {
+                int read = stream->read((uint8_t *)buffer, min(available, (int)sizeof(buffer)));
+                this->parser.feed(buffer, max(read, 0));
+            }
+            else if (!stream->connected())
+            {
+                this->parser.finish();
+                break;
+            }
+            else
+            {
+                delay(1);
+            }
+        }
+        http.end();
+        if (!this->parser.done())
+        {
+            debug("Dashboard document incomplete after " + String(this->parser.bytes) + " bytes");
+            return -1;
+        }
+        return this->applyChanges();
     };
 
-    bool okPressed(UiObj *obj, int event)
+    /// @brief Shows any values that differ from what the labels already show.
+    /// @return The number of labels changed.
+    int applyChanges()
     {
-        this->result = 0;
-        this->hide();
-        return true;
+        int changed = 0;
+        for (struct binding &binding : this->bindings)
+        {
+            if (binding.seen && binding.next != binding.value)
+            {
+                binding.value = binding.next;
+                binding.label->setText(binding.prefix + binding.value + binding.suffix);
+                changed++;
+            }
+        }
+        return changed;
     };
 
-    bool cancelPressed(UiObj *obj, int event)
+public:
+    UiJsonStream parser;
+
+private:
+    struct binding
     {
-        this->result = 1;
-        this->hide();
-        return true;
+        String path;
+        // The value the label shows, and the value read by the current fetch.
+        String value;
+        String next;
+        bool seen;
+        UiLabel *label;
+        String prefix;
+        String suffix;
     };
 
-public:
-    int result;
-    bool initialised;
+    void setValue(const String &path, const String &value)
+    {
+        for (struct binding &binding : this->bindings)
+        {
+            if (binding.path == path)
+            {
+                binding.next = value;
+                binding.seen = true;
+            }
+        }
+    };
 
-private:
-    UiLabel *titlebar;
-    UiLabel *content;
-    UiButton *closeButton;
-    UiButton *okButton;
-    UiButton *cancelButton;
-    std::function<bool(UiObj *, int)> closeButtonCallback;
-    std::function<bool(UiObj *, int)> okButtonCallback;
-    std::function<bool(UiObj *, int)> cancelButtonCallback;
+    String url;
+    uint32_t periodSeconds;
+    unsigned long lastFetch;
+    bool fetched;
+    std::vector<struct binding> bindings;
 };
 
 class UiManager : public UiFrame
@@ -1771,6 +7817,10 @@ public:
     UiManager(M5EPD_Canvas *parentSurface) : UiFrame()
     {
         this->parentSurface = parentSurface;
+        if (frameArena.capacity == 0)
+        {
+            frameArena.begin(frameArenaSize);
+        }
         UiFrame::init(0, 0, parentSurface->width(), parentSurface->height(), true, parentSurface);
         this->setOutline(0, 0);
         this->modal = NULL;
@@ -1802,23 +7852,99 @@ public:
         this->modal->confirm(title, message);
     };
 
+    /// @brief Applies all commands posted by other tasks since the last frame.
+    /// @details Must be called from the UI task, before rendering.
+    /// @return The number of commands applied.
+    int processCommands()
+    {
+        UiCommand command;
+        int count = 0;
+        while (this->commands.take(command))
+        {
+            switch (command.type)
+            {
+            case UiCommand::CMD_SET_TEXT:
+                command.label->setText(command.text);
+                break;
+            case UiCommand::CMD_SHOW:
+                command.target->show();
+                break;
+            case UiCommand::CMD_HIDE:
+                command.target->hide();
+                break;
+            case UiCommand::CMD_MOVE:
+                command.target->move(command.x, command.y);
+                break;
+            case UiCommand::CMD_INVALIDATE:
+                command.target->invalidate();
+                break;
+            case UiCommand::CMD_CALL:
+                command.call();
+                break;
+            default:
+                break;
+            }
+            count++;
+        }
+        if (count > 0)
+        {
+            debug("Applied " + String(count) + " queued commands");
+        }
+        return count;
+    };
+
     void updateDisplay()
     {
+        UiPendingValue::flushAll();
+        debug("Value writes: " + String(updateCounters.applied) + " applied, " + String(updateCounters.coalesced) + " coalesced, " + String(updateCounters.suppressed) + " suppressed, " + String(updateCounters.redundant) + " redundant show/hide/move calls");
+        uint32_t event = latencyTrace.active;
+        latencyTrace.mark(event, UiLatencyTrace::STAGE_RENDER_START);
+        unsigned long renderStart = uiMicros();
+        if (checkFrameAllocations)
+        {
+            frameAllocations.start();
+        }
+        // One layout pass over the whole tree, so resized children have damaged their frames before any update area is worked out.
+        this->layout();
         this->getUpdateArea();
         this->render();
+        if (checkFrameAllocations)
+        {
+            this->checkAllocations();
+        }
+        // Nothing allocated from the arena outlives the render.
+        frameArena.reset();
+        perfLog.logFrame(this->updateArea, uiMicros() - renderStart);
+        latencyTrace.mark(event, UiLatencyTrace::STAGE_RENDER_END);
         if (updateArea.height == 0 || updateArea.width == 0)
         {
             debug("No update area, skipping update.");
+            latencyTrace.cancel(event);
+            overdrawStats.beginFrame();
             return;
         }
-        debug("Writing PARTGRAM4pp to display area: " + String(this->updateArea.x) + ", " + String(this->updateArea.y) + ", " + String(this->updateArea.width) + ", " + String(this->updateArea.height));
-        M5.EPD.WritePartGram4bpp(this->updateArea.x, this->updateArea.y, this->updateArea.width, this->updateArea.height, screenBuffer);
-        debug("Running partial refresh on area " + String(this->updateArea.x) + ", " + String(this->updateArea.y) + ", " + String(this->updateArea.width) + ", " + String(this->updateArea.height));
-        M5.EPD.UpdateArea(updateArea.x, updateArea.y, updateArea.width, updateArea.height, UPDATE_MODE_INIT);
-        delay(100);
-        M5.EPD.UpdateArea(this->updateArea.x, this->updateArea.y, this->updateArea.width, this->updateArea.height, UPDATE_MODE_GC16);
-        debug("Partial refresh complete");
-        this->lastDisplayUpdate = micros();
+        if (overdrawStats.enabled)
+        {
+            overdrawStats.endFrame(this->updateArea, screenBuffer);
+        }
+        this->refreshQueue.submit(this->updateArea, screenBuffer, UPDATE_MODE_INIT, UPDATE_MODE_GC16);
+        // The refresh job carries the event from here.
+        latencyTrace.active = 0;
+        debug("Partial refresh submitted");
+        this->lastDisplayUpdate = uiMicros();
+    };
+
+    /// @brief Reports heap allocations made while rendering, once the first few frames have set up their buffers.
+    void checkAllocations()
+    {
+        uint32_t count = frameAllocations.stop();
+        this->renderedFrames++;
+        if (count == 0 || this->renderedFrames <= allocationWarmupFrames)
+        {
+            return;
+        }
+        Serial.println("Frame " + String(this->renderedFrames) + " made " + String(count) + " heap allocations (" + String(frameAllocations.bytes.load()) + " bytes) while rendering");
+        assert(count == 0);
     };
 
     bool touchEvent(int x, int y) override
@@ -1840,17 +7966,27 @@ public:
         }
     };
 
-    void sleepUntilTouch()
+    /// @brief Sleeps until the screen is touched.
+    /// @param timeoutSeconds Wake up after this long even if there's no touch. 0 waits for a touch only.
+    void sleepUntilTouch(uint32_t timeoutSeconds = 0)
     {
         esp_sleep_enable_ext0_wakeup(GPIO_NUM_36, LOW);
+        if (timeoutSeconds > 0)
+        {
+            esp_sleep_enable_timer_wakeup((uint64_t)timeoutSeconds * 1000000);
+        }
+        else
+        {
+            esp_sleep_disable_wakeup_source(ESP_SLEEP_WAKEUP_TIMER);
+        }
         M5.disableEXTPower();
         // M5.disableEPDPower();
         WiFi.setSleep(WIFI_PS_NONE);
         esp_wifi_stop();
-        if (micros() - lastDisplayUpdate < 500000)
+        if (!this->refreshQueue.idle())
         {
-            debug("Waiting for EPD to draw. Sleeping for 500ms");
-            delay(500);
+            debug("Waiting for EPD to finish refreshing");
+            this->refreshQueue.waitIdle();
         }
         M5.disableEPDPower();
         gpio_hold_en((gpio_num_t)M5EPD_MAIN_PWR_PIN);
@@ -1863,9 +7999,16 @@ public:
 public:
     UiModal *modal = NULL;
     unsigned long lastDisplayUpdate = 0;
+    UiCommandQueue commands;
+    UiRefreshQueue refreshQueue;
+    UiTileServer *tileServer = NULL;
+    UiDashboard *dashboard = NULL;
 
 private:
+    // Frames that may still be growing lists and buffers before the allocation check starts.
+    static const uint32_t allocationWarmupFrames = 4;
     M5EPD_Canvas *parentSurface = NULL;
+    uint32_t renderedFrames = 0;
 };
 
 M5EPD_Canvas *canvas = nullptr;
@@ -1913,17 +8056,288 @@ bool setQuote(UiButton *btn, int event)
     return false;
 }
 
+/// @brief Runs a function a number of times and prints the average time taken.
+/// @return The average time in microseconds.
+unsigned long benchmark(String name, int runs, std::function<void()> func)
+{
+    unsigned long start = micros();
+    for (int i = 0; i < runs; i++)
+    {
+        func();
+    }
+    unsigned long average = (micros() - start) / runs;
+    Serial.println("Benchmark " + name + ": " + String(average) + "us");
+    return average;
+}
+
+/// @brief Times the render pipeline stages and prints the results over Serial.
+void runBenchmarks(UiManager *ui, UiObj *fullScreenObj)
+{
+    ui->updateArea = screenArea;
+    fullScreenObj->getUpdateArea();
+    renderPool.enabled = false;
+    unsigned long single = benchmark("full screen pack (1 core)", 10, [&]()
+                                     { fullScreenObj->packToGrey(screenArea); });
+    renderPool.enabled = true;
+    unsigned long dual = benchmark("full screen pack (" + String(renderPool.threads()) + " tasks)", 10, [&]()
+                                   { fullScreenObj->packToGrey(screenArea); });
+    Serial.println("Pack speedup: " + String((float)single / max(dual, 1UL)) + "x");
+    // Composing and packing every object, which is what a full screen change costs.
+    auto redraw = [&]()
+    {
+        ui->invalidate();
+        ui->getUpdateArea();
+        ui->render();
+        ui->resetStatus();
+    };
+    renderPool.enabled = false;
+    single = benchmark("full screen redraw (1 core)", 5, redraw);
+    renderPool.enabled = true;
+    dual = benchmark("full screen redraw (" + String(renderPool.threads()) + " tasks)", 5, redraw);
+    Serial.println("Redraw speedup: " + String((float)single / max(dual, 1UL)) + "x");
+    ui->updateArea = screenArea;
+
+    UiLabel label(0, 0, screenWidth, screenHeight / 2, "Benchmark");
+    label.draw();
+    label.getUpdateArea();
+    benchmark("half screen pack (8-bit)", 10, [&]()
+              { label.packToGrey(label.updateArea); });
+    label.setMonochrome(true);
+    label.draw();
+    benchmark("half screen pack (1-bit)", 10, [&]()
+              { label.packToGrey(label.updateArea); });
+    label.setMonochrome(false);
+
+    UiPixmap screen = uiPixmap(screenBuffer, screenWidth, screenHeight, 4);
+    UiPixmap full = fullScreenObj->pixmap();
+    benchmark("blit 8->4 full screen, odd x", 10, [&]()
+              { uiBlitAny(full, screenArea, screen, 1, 0); });
+    benchmark("blit 8->8 half screen", 10, [&]()
+              { uiBlitAny(full, screenArea, label.pixmap(), 0, 0); });
+    UiBlitContext keyed = {15, 0, true, 0};
+    benchmark("blit 8->8 half screen, colour keyed", 10, [&]()
+              { uiBlitAny(full, screenArea, label.pixmap(), 0, 0, keyed); });
+
+    uint16_t colour = label.greyToColour16(15);
+    int thickness = 10;
+    benchmark("10px outline (ring loop)", 10, [&]()
+              {
+        for (int i = 0; i < thickness; i++)
+        {
+            label.surface.drawRoundRect(i, i, label.width - i * 2, label.height - i * 2, 10, colour);
+            label.surface.drawRoundRect(i, i, label.width - i * 2, label.height - i * 2, 10, colour);
+        } });
+    benchmark("10px outline (spans)", 10, [&]()
+              { drawRoundRectSpans(&label.surface, label.getArea(), false, 0, 0, thickness, 10, colour); });
+    // Boot cost of a manager: its dialog is lazy, and the eager case builds it straight away as the constructor used to.
+    size_t freeBefore = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+    unsigned long start = micros();
+    UiManager *lazyUi = new UiManager(canvas);
+    unsigned long lazyTime = micros() - start;
+    size_t lazySize = freeBefore - heap_caps_get_free_size(MALLOC_CAP_8BIT);
+    delete lazyUi->modal;
+    delete lazyUi;
+    freeBefore = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+    start = micros();
+    UiManager *eagerUi = new UiManager(canvas);
+    eagerUi->modal->materialize();
+    unsigned long eagerTime = micros() - start;
+    size_t eagerSize = freeBefore - heap_caps_get_free_size(MALLOC_CAP_8BIT);
+    delete eagerUi->modal;
+    delete eagerUi;
+    Serial.println("Manager construction: lazy " + String(lazyTime) + "us and " + String(lazySize) + " bytes, eager " + String(eagerTime) + "us and " + String(eagerSize) + " bytes");
+
+    // Unbuffered, so only the objects themselves are counted.
+    const int styledCount = 200;
+    UiLabel *styled[styledCount];
+    freeBefore = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+    for (int i = 0; i < styledCount; i++)
+    {
+        styled[i] = new UiLabel(0, 0, 100, 40, "", true);
+        styled[i]->setFill(i % 4);
+    }
+    size_t styledSize = freeBefore - heap_caps_get_free_size(MALLOC_CAP_8BIT);
+    Serial.println(String(styledCount) + " labels in 4 fills: " + String(styledSize / styledCount) + " bytes each, " + String(UiStyle::count()) + " styles of " + String(sizeof(UiStyle)) + " bytes in use");
+    for (int i = 0; i < styledCount; i++)
+    {
+        delete styled[i];
+    }
+
+    freeBefore = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+    UiGrid *grid = new UiGrid(0, 0, 50, 50, 10, 18);
+    for (int column = 0; column < 50; column++)
+    {
+        for (int row = 0; row < 50; row++)
+        {
+            grid->setCell(column, row, String(column * 50 + row));
+        }
+    }
+    size_t gridSize = freeBefore - heap_caps_get_free_size(MALLOC_CAP_8BIT);
+    Serial.println("50x50 grid of numbers: " + String(gridSize) + " bytes, an 8-bit surface would be " + String(grid->width * grid->height) + " bytes");
+    delete grid;
+
+    UiChart chart(0, 0, 440, 200);
+    chart.setRange(-1, 1);
+    uint64_t damaged = 0;
+    int appended = 0;
+    benchmark("chart append and draw", 500, [&]()
+              {
+        chart.append(sin(appended++ * 0.05));
+        struct area changed = chart.getUpdateArea();
+        damaged += changed.width * changed.height;
+        chart.draw();
+        chart.drawn = true;
+        chart.resetStatus(); });
+    Serial.println("Chart samples damaged " + String((uint32_t)(damaged / appended)) + " px each on average, the whole chart is " + String(chart.width * chart.height) + " px");
+
+    UiConsole console(0, 0, 440, 320);
+    damaged = 0;
+    appended = 0;
+    benchmark("console append and draw", 500, [&]()
+              {
+        console.append("Message " + String(appended++));
+        struct area changed = console.getUpdateArea();
+        damaged += changed.width * changed.height;
+        console.draw();
+        console.drawn = true;
+        console.resetStatus(); });
+    Serial.println("Console lines damaged " + String((uint32_t)(damaged / appended)) + " px each on average, the whole console is " + String(console.width * console.height) + " px");
+
+    iconCache.clear();
+    benchmark("vector icon rasterize 96x96", 10, [&]()
+              {
+        iconCache.clear();
+        iconCache.get(icon_clock, 96, 96, 15, 0); });
+    UiPixmap icon = iconCache.get(icon_clock, 96, 96, 15, 0);
+    benchmark("vector icon from cache and blit 96x96", 10, [&]()
+              { uiBlitAny(iconCache.get(icon_clock, 96, 96, 15, 0), {0, 0, 96, 96}, label.pixmap(), 0, 0); });
+    Serial.println("Clock icon: " + String(sizeof(icon_clock)) + " bytes in flash, " + String(icon.stride * icon.height) + " bytes cached at 96x96, a 96x96 8-bit bitmap would be " + String(96 * 96) + " bytes");
+}
+
+/// @brief Passes a touch to the UI and updates the display if anything changed, tracing its latency.
+/// @param touchTime When the touch was sampled, from uiMicros().
+void dispatchTouch(UiManager *ui, int x, int y, unsigned long touchTime)
+{
+    uint32_t event = latencyTrace.begin(touchTime);
+    latencyTrace.mark(event, UiLatencyTrace::STAGE_DISPATCH);
+    if (ui->touchEvent(x, y))
+    {
+        latencyTrace.mark(event, UiLatencyTrace::STAGE_INVALIDATE);
+        ui->updateDisplay();
+    }
+    else
+    {
+        latencyTrace.cancel(event);
+    }
+}
+
+/// @brief Connects to the configured WiFi network.
+/// @return False if it didn't connect within the timeout.
+bool connectWifi(unsigned long timeoutMs = 15000)
+{
+    if (WiFi.status() == WL_CONNECTED)
+    {
+        return true;
+    }
+    // sleepUntilTouch() stops the WiFi driver, and WiFi.mode() only starts it again if the mode changes.
+    WiFi.mode(WIFI_OFF);
+    WiFi.mode(WIFI_STA);
+    WiFi.begin(wifiSsid, wifiPassword);
+    unsigned long start = millis();
+    while (WiFi.status() != WL_CONNECTED && millis() - start < timeoutMs)
+    {
+        delay(100);
+    }
+    return WiFi.status() == WL_CONNECTED;
+}
+
+/// @brief Hands the screen over to a host that renders it and sends the changes as tiles.
+void startThinClient(UiManager *ui)
+{
+    if (!connectWifi())
+    {
+        ui->msgbox("Thin client", "Couldn't connect to " + String(wifiSsid));
+        return;
+    }
+    UiRemoteSurface *remote = new UiRemoteSurface(0, 0, screenWidth, screenHeight);
+    remote->layer = UiObj::LAYER_TOP;
+    ui->add(remote);
+    ui->tileServer = new UiTileServer(thinClientPort);
+    ui->tileServer->begin(remote);
+    Serial.println("Waiting for tiles on " + WiFi.localIP().toString() + ":" + String(thinClientPort));
+}
+
+/**
+ * @brief Builds a simple dashboard and binds its labels to the fetched document.
+ * @details The document is expected to look like
+ * {"room": "Office", "temperature": 21.5, "humidity": 40, "updated": "12:30"}.
+ */
+void startDashboard(UiManager *ui)
+{
+    UiLabel *room = new UiLabel(40, 60, 460, 120, "");
+    UiLabel *temperature = new UiLabel(40, 220, 460, 200, "");
+    UiLabel *humidity = new UiLabel(40, 460, 460, 120, "");
+    UiLabel *updated = new UiLabel(40, 820, 460, 80, "");
+    temperature->setTextSize(6);
+    updated->setTextSize(2);
+    ui->add(room);
+    ui->add(temperature);
+    ui->add(humidity);
+    ui->add(updated);
+    ui->dashboard = new UiDashboard(dashboardUrl, dashboardPeriod);
+    ui->dashboard->bind("room", room);
+    ui->dashboard->bind("temperature", temperature, "", " C");
+    ui->dashboard->bind("humidity", humidity, "Humidity ", "%");
+    ui->dashboard->bind("updated", updated, "Updated ");
+}
+
+/// @brief Fetches the dashboard document and refreshes the labels that changed.
+void refreshDashboard(UiManager *ui)
+{
+    if (!connectWifi())
+    {
+        debug("No WiFi, dashboard not updated");
+        return;
+    }
+    int changed = ui->dashboard->update();
+    ui->updateDisplay();
+    Serial.println("Dashboard: " + String(ui->dashboard->parser.bytes) + " bytes parsed, " + String(changed) + " labels changed, refresh " + String(ui->updateArea.width) + "x" + String(ui->updateArea.height) + " at " + String(ui->updateArea.x) + ", " + String(ui->updateArea.y));
+    ui->resetStatus();
+}
+
 void setup()
 {
     screenBuffer = (uint8_t *)calloc(540, 960 / 2);
     M5.begin();
+    // The loop task runs on core 1, so the render worker gets core 0.
+    renderPool.begin(1, 0);
     M5.EPD.SetRotation(90);
     M5.EPD.Clear(true);
     M5.TP.SetRotation(90);
     M5.RTC.begin();
+    if (perfLogging && !perfLog.begin(SD, perfLogPath, perfLogCapacity))
+    {
+        Serial.println("Couldn't open performance log " + String(perfLogPath));
+    }
+    if (overdrawAnalysis && !overdrawStats.begin())
+    {
+        Serial.println("No memory for overdraw analysis");
+    }
     canvas = new M5EPD_Canvas(&M5.EPD);
     canvas->createCanvas(540, 960);
     mainUi = new UiManager(canvas);
+    if (thinClientMode)
+    {
+        startThinClient(mainUi);
+        mainUi->updateDisplay();
+        return;
+    }
+    if (dashboardMode)
+    {
+        startDashboard(mainUi);
+        mainUi->updateDisplay();
+        return;
+    }
 
     UiImage *bg = new UiImage(0, 0, 540, 960, (uint8_t *)epd_bitmap_frame_2);
     mainUi->add(bg);
@@ -1951,11 +8365,16 @@ void setup()
     // frame->add(btn3);
     // mainUi->add((UiObj*) frame);
     mainUi->updateDisplay();
+    if (benchmarkMode)
+    {
+        runBenchmarks(mainUi, bg);
+    }
     // label1->setText("Label updated!");
 }
 
 void powerOff()
 {
+    perfLog.flush();
     M5.EPD.Clear(true);
     M5.shutdown();
 }
@@ -1969,7 +8388,27 @@ void processEvents(UiManager *ui)
     static unsigned long touchEnd = 0;
 
     M5.update();
+    ui->refreshQueue.poll();
+    perfLog.poll();
     ui->resetStatus();
+    if (ui->processCommands() > 0)
+    {
+        ui->updateDisplay();
+        ui->resetStatus();
+    }
+    if (ui->tileServer != NULL && ui->tileServer->poll() > 0)
+    {
+        ui->updateDisplay();
+        ui->resetStatus();
+    }
+    if (ui->tileServer != NULL && ui->refreshQueue.idle())
+    {
+        ui->tileServer->acknowledge();
+    }
+    if (ui->dashboard != NULL && ui->dashboard->due())
+    {
+        refreshDashboard(ui);
+    }
     while (M5.TP.avaliable())
     {
         if (M5.TP.isFingerUp())
@@ -1983,10 +8422,7 @@ void processEvents(UiManager *ui)
                     continue;
                 }
                 debug("Touch event at " + String(tp.x) + ", " + String(tp.y));
-                if (ui->touchEvent(tp.x, tp.y))
-                {
-                    ui->updateDisplay();
-                }
+                dispatchTouch(ui, tp.x, tp.y, touchStart);
                 touchEnd = micros();
                 lastTp.x = tp.x;
                 lastTp.y = tp.y;
@@ -2001,18 +8437,45 @@ void processEvents(UiManager *ui)
                 continue;
             }
             fingerDown = true;
-            touchStart = micros();
+            // The latency trace starts from here, when the finger was first read.
+            touchStart = uiMicros();
         }
     }
 
     M5.update();
+    if (M5.BtnL.wasPressed())
+    {
+        latencyTrace.dump(Serial);
+        if (overdrawStats.enabled)
+        {
+            overdrawStats.report(Serial);
+        }
+    }
+    if (M5.BtnR.wasPressed() && !latencyTrace.dump(SD, "/latency.txt"))
+    {
+        debug("Couldn't write latency trace to SD");
+    }
     if (M5.BtnP.wasPressed())
     {
         powerOff();
     }
+    else if (ui->commands.pending())
+    {
+        debug("Commands waiting, not sleeping");
+    }
+    else if (ui->commands.hasProducers())
+    {
+        // Light sleep would freeze the tasks that post commands, so just give them time to post more.
+        delay(10);
+    }
+    else if (ui->tileServer != NULL)
+    {
+        // Light sleep would turn WiFi off, so just give the host time to send more tiles.
+        delay(10);
+    }
     else
     {
-        ui->sleepUntilTouch();
+        ui->sleepUntilTouch(ui->dashboard != NULL ? max(ui->dashboard->secondsUntilDue(), (uint32_t)1) : 0);
     }
 }
 
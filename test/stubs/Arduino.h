@@ -0,0 +1,108 @@
+#pragma once
+// Host stand-in for the Arduino core: String, Serial, timing and heap functions.
+#include <string>
+#include <cstdint>
+#include <cstring>
+#include <cstdlib>
+#include <cstdio>
+#include <cstdarg>
+#include <cmath>
+#include <functional>
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#define PROGMEM
+#define IRAM_ATTR
+using std::min; using std::max;
+#define constrain(amt, low, high) ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+class String {
+public:
+    std::string s;
+    String() {}
+    String(const char *c) : s(c ? c : "") {}
+    String(const std::string &c) : s(c) {}
+    String(char c) : s(1, c) {}
+    String(int v) : s(std::to_string(v)) {}
+    String(unsigned int v) : s(std::to_string(v)) {}
+    String(long v) : s(std::to_string(v)) {}
+    String(unsigned long v) : s(std::to_string(v)) {}
+    String(long long v) : s(std::to_string(v)) {}
+    String(unsigned long long v) : s(std::to_string(v)) {}
+    String(float v, int d = 2) { char b[32]; snprintf(b, 32, "%.*f", d, v); s = b; }
+    String(double v, int d = 2) { char b[32]; snprintf(b, 32, "%.*f", d, v); s = b; }
+    unsigned int length() const { return s.size(); }
+    const char *c_str() const { return s.c_str(); }
+    String substring(unsigned a) const { return a >= s.size() ? String() : String(s.substr(a)); }
+    String substring(unsigned a, unsigned b) const { if (a > s.size()) return String(); return String(s.substr(a, b > a ? b - a : 0)); }
+    int indexOf(char c, unsigned from = 0) const { auto p = s.find(c, from); return p == std::string::npos ? -1 : (int)p; }
+    int indexOf(const String &c, unsigned from = 0) const { auto p = s.find(c.s, from); return p == std::string::npos ? -1 : (int)p; }
+    int lastIndexOf(char c) const { auto p = s.rfind(c); return p == std::string::npos ? -1 : (int)p; }
+    char charAt(unsigned i) const { return i < s.size() ? s[i] : 0; }
+    char operator[](unsigned i) const { return charAt(i); }
+    bool startsWith(const String &p) const { return s.rfind(p.s, 0) == 0; }
+    bool endsWith(const String &p) const { return s.size() >= p.s.size() && s.compare(s.size() - p.s.size(), p.s.size(), p.s) == 0; }
+    bool operator==(const String &o) const { return s == o.s; }
+    bool operator!=(const String &o) const { return s != o.s; }
+    bool operator==(const char *o) const { return s == o; }
+    bool operator!=(const char *o) const { return s != o; }
+    String &operator+=(const String &o) { s += o.s; return *this; }
+    String &operator+=(const char *o) { s += o; return *this; }
+    String &operator+=(char o) { s += o; return *this; }
+    bool reserve(unsigned n) { s.reserve(n); return true; }
+    long toInt() const { return atol(s.c_str()); }
+    float toFloat() const { return atof(s.c_str()); }
+    void trim() {}
+    bool concat(const char *p, unsigned n) { s.append(p, n); return true; }
+    bool concat(char c) { s += c; return true; }
+    bool concat(const String &o) { s += o.s; return true; }
+    void remove(unsigned i) { if (i < s.size()) s.erase(i); }
+    void remove(unsigned i, unsigned n) { if (i < s.size()) s.erase(i, n); }
+    bool isEmpty() const { return s.empty(); }
+};
+inline String operator+(const String &a, const String &b) { return String(a.s + b.s); }
+inline String operator+(const String &a, const char *b) { return String(a.s + b); }
+inline String operator+(const char *a, const String &b) { return String(a + b.s); }
+inline String operator+(const String &a, char b) { return String(a.s + b); }
+struct Print {
+    virtual size_t write(const uint8_t *b, size_t n) = 0;
+    size_t print(const String &s) { return write((const uint8_t *)s.c_str(), s.length()); }
+    size_t println(const String &s) { return print(s) + write((const uint8_t *)"\n", 1); }
+    size_t print(const char *s) { return write((const uint8_t *)s, strlen(s)); }
+    size_t println(const char *s) { return print(s) + write((const uint8_t *)"\n", 1); }
+    virtual ~Print() {}
+};
+struct HardwareSerial : Print {
+    void println(const String &s) { printf("%s\n", s.c_str()); }
+    void println() { printf("\n"); }
+    void print(const String &s) { printf("%s", s.c_str()); }
+    void printf(const char *f, ...) __attribute__((format(printf, 2, 3)));
+    void flush() {}
+    void begin(int) {}
+    size_t write(const uint8_t *b, size_t n) { return fwrite(b, 1, n, stdout); }
+};
+inline void HardwareSerial::printf(const char *f, ...) { va_list a; va_start(a, f); vprintf(f, a); va_end(a); }
+extern HardwareSerial Serial;
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long);
+void delayMicroseconds(unsigned int);
+long random(long);
+long random(long, long);
+void yield();
+#define MALLOC_CAP_8BIT 1
+#define MALLOC_CAP_SPIRAM 2
+#define MALLOC_CAP_DEFAULT 4
+#define MALLOC_CAP_INTERNAL 8
+inline size_t heap_caps_get_largest_free_block(int) { return 100000; }
+inline size_t heap_caps_get_free_size(int) { return 100000; }
+inline void *heap_caps_malloc(size_t n, int) { return malloc(n); }
+inline void *ps_malloc(size_t n) { return malloc(n); }
+inline void *ps_calloc(size_t n, size_t m) { return calloc(n, m); }
+inline size_t ESP_getFreeHeap() { return 100000; }
+struct EspClass { size_t getFreeHeap() { return 100000; } size_t getFreePsram() { return 1000000; } };
+extern EspClass ESP;
+
+#include "freertos_host.h"
+inline size_t heap_caps_get_minimum_free_size(int) { return 90000; }
@@ -0,0 +1,14 @@
+#pragma once
+// Host stand-in for HTTPClient: a plain HTTP/1.0 GET over a loopback socket.
+#include <WiFi.h>
+#define HTTP_CODE_OK 200
+class HTTPClient
+{
+public:
+    void useHTTP10(bool) {}
+    bool begin(String url);
+    int GET();
+    WiFiClient *getStreamPtr() { return &client; }
+    void end() { client.stop(); }
+    String host, path; int port = 80; WiFiClient client;
+};
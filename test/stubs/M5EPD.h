@@ -0,0 +1,191 @@
+#pragma once
+// Host stand-in for M5EPD: an 8-bit sprite that really draws, and a panel, touch and RTC that do nothing.
+#include <Arduino.h>
+struct GFXglyph { uint16_t bitmapOffset; uint8_t width, height, xAdvance; int8_t xOffset, yOffset; };
+struct GFXfont { uint8_t *bitmap; GFXglyph *glyph; uint8_t first, last, yAdvance; };
+#define TL_DATUM 0
+#define MC_DATUM 4
+class TFT_eSPI {};
+class TFT_eSprite
+{
+public:
+    TFT_eSprite(TFT_eSPI *t = nullptr) {}
+    void setColorDepth(int b) { bpp = b; }
+    int getColorDepth() { return bpp; }
+    void *createSprite(int w, int h, int f = 1)
+    {
+        iw = w; ih = h;
+        if (bpp == 1) { bw = (w + 7) & ~7; img = (uint8_t *)calloc(bw * h / 8 + 1, 1); }
+        else { bw = w; img = (uint8_t *)calloc(w * h + 1, 1); }
+        created = true; return img;
+    }
+    void deleteSprite() { free(img); img = nullptr; created = false; }
+    bool created = false;
+    void *frameBuffer(int) { return img; }
+    int width() { return iw; }
+    int height() { return ih; }
+    uint8_t c8(uint32_t c) { return ((c & 0xE000) >> 8) | ((c & 0x0700) >> 6) | ((c & 0x0018) >> 3); }
+    void drawPixel(int x, int y, uint32_t c)
+    {
+        if (!img || x < 0 || y < 0 || x >= iw || y >= ih) return;
+        if (bpp == 1) { uint8_t *p = img + (x + y * bw) / 8; if (c) *p |= 0x80 >> (x & 7); else *p &= ~(0x80 >> (x & 7)); }
+        else img[x + y * iw] = c8(c);
+    }
+    uint16_t readPixel(int x, int y) { if (bpp == 1) return (img[(x + y * bw) / 8] >> (7 - (x & 7))) & 1; return img[x + y * iw]; }
+    void fillRect(int x, int y, int w, int h, uint32_t c) { for (int j = y; j < y + h; j++) for (int i = x; i < x + w; i++) drawPixel(i, j, c); }
+    void fillSprite(uint32_t c) { fillRect(0, 0, iw, ih, c); }
+    void fillScreen(uint32_t c) { fillSprite(c); }
+    void drawRect(int x, int y, int w, int h, uint32_t c) { fillRect(x, y, w, 1, c); fillRect(x, y + h - 1, w, 1, c); fillRect(x, y, 1, h, c); fillRect(x + w - 1, y, 1, h, c); }
+    void drawFastHLine(int x, int y, int w, uint32_t c) { fillRect(x, y, w, 1, c); }
+    void drawFastVLine(int x, int y, int h, uint32_t c) { fillRect(x, y, 1, h, c); }
+    void drawLine(int x0, int y0, int x1, int y1, uint32_t c) { int n = std::max(abs(x1 - x0), abs(y1 - y0)); for (int i = 0; i <= n; i++) drawPixel(x0 + (n ? (x1 - x0) * i / n : 0), y0 + (n ? (y1 - y0) * i / n : 0), c); }
+    void drawRoundRect(int x, int y, int w, int h, int r, uint32_t c) { drawRect(x, y, w, h, c); }
+    void fillRoundRect(int x, int y, int w, int h, int r, uint32_t c) { fillRect(x, y, w, h, c); }
+    void drawCircle(int x, int y, int r, uint32_t c) {}
+    void fillCircle(int x, int y, int r, uint32_t c) { fillRect(x - r, y - r, 2 * r + 1, 2 * r + 1, c); }
+    void drawBitmap(int x, int y, const uint8_t *b, int w, int h, uint32_t c) { for (int j = 0; j < h; j++) for (int i = 0; i < w; i++) if (b[(j * ((w + 7) / 8)) + i / 8] & (0x80 >> (i & 7))) drawPixel(x + i, y + j, c); }
+    void setTextSize(int s) { ts = s; font = nullptr; }
+    void setFreeFont(const GFXfont *f) { font = f; }
+    void setTextFont(int) {}
+    void setTextColor(uint32_t c) { tc = c; }
+    void setTextColor(uint32_t c, uint32_t) { tc = c; }
+    void setTextDatum(int) {}
+    void setTextWrap(bool) {}
+    int textWidth(const String &s) { return s.length() * 6 * ts; }
+    int textWidth(const char *s) { return strlen(s) * 6 * ts; }
+    int fontHeight(int f = 1) { return 8 * ts; }
+    int drawString(const String &s, int x, int y) { fillRect(x, y, textWidth(s), fontHeight(), tc); return textWidth(s); }
+    int drawString(const char *s, int x, int y) { fillRect(x, y, textWidth(s), fontHeight(), tc); return textWidth(s); }
+    int drawChar(uint16_t ch, int x, int y) { fillRect(x, y, 6 * ts, fontHeight(), tc); return 6 * ts; }
+    void pushImage(int x, int y, int w, int h, const uint8_t *d) {}
+    int bpp = 16, iw = 0, ih = 0, bw = 0, ts = 1; uint32_t tc = 0; const GFXfont *font = nullptr;
+    uint8_t *img = nullptr;
+};
+enum m5epd_update_mode_t { UPDATE_MODE_INIT = 0, UPDATE_MODE_DU = 1, UPDATE_MODE_GC16 = 2, UPDATE_MODE_GL16 = 3, UPDATE_MODE_GLR16 = 4, UPDATE_MODE_GLD16 = 5, UPDATE_MODE_DU4 = 6, UPDATE_MODE_A2 = 7, UPDATE_MODE_NONE = 8 };
+typedef int m5epd_err_t;
+#define M5EPD_OK 0
+class File : public Print
+{
+public:
+    FILE *f = nullptr;
+    operator bool() { return f != nullptr; }
+    size_t size() { long p = ftell(f); fseek(f, 0, SEEK_END); long s = ftell(f); fseek(f, p, SEEK_SET); return s; }
+    size_t read(uint8_t *b, size_t n) { return fread(b, 1, n, f); }
+    int read() { return fgetc(f); }
+    int available() { long p = ftell(f); return (int)(size() - p); }
+    size_t write(const uint8_t *b, size_t n) { return fwrite(b, 1, n, f); }
+    bool seek(uint32_t p) { return fseek(f, p, SEEK_SET) == 0; }
+    size_t position() { return ftell(f); }
+    void flush() { fflush(f); }
+    void close() { if (f) fclose(f); f = nullptr; }
+};
+#define FILE_READ "r"
+#define FILE_WRITE "w"
+#define FILE_APPEND "a"
+namespace fs { struct FS { virtual File open(const String &p, const char *m = "r") = 0; }; }
+typedef fs::FS fs_FS;
+class SDClass : public fs::FS
+{
+public:
+    bool exists(const String &p) { FILE *f = fopen(p.c_str(), "r"); if (f) fclose(f); return f; }
+    File open(const String &p, const char *m = "r") { File f; f.f = fopen(p.c_str(), (String(m) == "r+") ? "r+b" : m); return f; }
+    bool remove(const String &p) { return ::remove(p.c_str()) == 0; }
+};
+extern SDClass SD;
+class M5EPD_Canvas : public TFT_eSprite
+{
+public:
+    M5EPD_Canvas(void *d) {}
+    void createCanvas(int w, int h) { bpp = 8; createSprite(w, h); }
+    bool drawPngUrl(const char *, int, int, int, int) { return true; }
+    bool drawJpgUrl(const char *, int, int, int, int) { return true; }
+    bool drawPngFile(fs_FS &, const char *, int, int, int, int) { return true; }
+    bool drawJpgFile(fs_FS &, const char *, int, int, int, int) { return true; }
+    bool drawBmpFile(fs_FS &, const char *, int, int) { return true; }
+    void pushCanvas(int, int, m5epd_update_mode_t) {}
+};
+// Records the pixel writes and refreshes sent to the controller while recording is set,
+// so tests can check what reached the panel.
+struct M5EPD_Driver
+{
+    struct Call
+    {
+        char type; // 'W' for WritePartGram4bpp, 'U' for UpdateArea.
+        uint16_t x, y, w, h;
+        m5epd_update_mode_t mode;
+        std::vector<uint8_t> pixels;
+    };
+    std::vector<Call> calls;
+    bool recording = false;
+    m5epd_err_t WritePartGram4bpp(uint16_t x, uint16_t y, uint16_t w, uint16_t h, const uint8_t *gram)
+    {
+        if (recording)
+            calls.push_back({'W', x, y, w, h, UPDATE_MODE_NONE, std::vector<uint8_t>(gram, gram + w * h / 2)});
+        return 0;
+    }
+    m5epd_err_t UpdateArea(uint16_t x, uint16_t y, uint16_t w, uint16_t h, m5epd_update_mode_t mode)
+    {
+        if (recording)
+            calls.push_back({'U', x, y, w, h, mode, std::vector<uint8_t>()});
+        return 0;
+    }
+    m5epd_err_t UpdateFull(m5epd_update_mode_t mode) { return 0; }
+    m5epd_err_t Clear(bool init = false) { return 0; }
+    m5epd_err_t SetRotation(uint16_t r) { return 0; }
+    m5epd_err_t CheckAFSR() { return 0; }
+};
+struct tp_finger_t { uint16_t x, y, size, id; };
+struct GT911
+{
+    bool avaliable() { return false; }
+    bool isFingerUp() { return true; }
+    void update() {}
+    tp_finger_t readFinger(int) { return {0, 0, 0, 0}; }
+    void SetRotation(int) {}
+    uint8_t getFingerNum() { return 0; }
+};
+struct Button { bool wasPressed() { return false; } };
+struct rtc_time_t { int8_t hour, min, sec; };
+struct rtc_date_t { int8_t week; int8_t mon, day; int16_t year; };
+struct BM8563
+{
+    void begin() {}
+    void getTime(rtc_time_t *t) { *t = {12, 0, 0}; }
+    void getDate(rtc_date_t *d) { *d = {0, 1, 1, 2026}; }
+    int setAlarmIRQ(int s) { return s; }
+    void clearIRQ() {}
+};
+struct M5EPD
+{
+    M5EPD_Driver EPD;
+    GT911 TP;
+    Button BtnP, BtnL, BtnR;
+    BM8563 RTC;
+    void begin(bool = true, bool = true, bool = true, bool = true, bool = true) {}
+    void update() {}
+    void shutdown() {}
+    int shutdown(int) { return 0; }
+    void disableEXTPower() {}
+    void enableEXTPower() {}
+    void disableEPDPower() {}
+    void enableEPDPower() {}
+    void disableMainPower() {}
+    uint32_t getBatteryVoltage() { return 4000; }
+};
+extern M5EPD M5;
+#define GPIO_NUM_36 36
+typedef int gpio_num_t;
+#define M5EPD_MAIN_PWR_PIN 2
+#define LOW 0
+#define HIGH 1
+inline void esp_sleep_enable_ext0_wakeup(int, int) {}
+inline void esp_sleep_enable_timer_wakeup(uint64_t) {}
+inline void esp_light_sleep_start() {}
+inline void esp_deep_sleep_start() {}
+inline void gpio_hold_en(gpio_num_t) {}
+inline void gpio_hold_dis(gpio_num_t) {}
+typedef int esp_sleep_wakeup_cause_t;
+#define ESP_SLEEP_WAKEUP_TIMER 4
+#define ESP_SLEEP_WAKEUP_EXT0 2
+inline esp_sleep_wakeup_cause_t esp_sleep_get_wakeup_cause() { return 0; }
+inline void esp_sleep_disable_wakeup_source(int) {}
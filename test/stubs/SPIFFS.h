@@ -0,0 +1,2 @@
+#pragma once
+// Host stand-in for SPIFFS, which the sketch includes but doesn't use.
@@ -0,0 +1,44 @@
+#pragma once
+// Host stand-in for the ESP32 WiFi library. Clients and servers are loopback TCP sockets (see host.h).
+#include <Arduino.h>
+#define WIFI_PS_NONE 0
+#define WL_CONNECTED 3
+class WiFiClient
+{
+public:
+    int fd = -1;
+    bool connect(const char *host, uint16_t port);
+    int available();
+    int read();
+    int read(uint8_t *b, size_t n);
+    size_t write(const uint8_t *b, size_t n);
+    bool connected();
+    void stop();
+    void setNoDelay(bool) {}
+    operator bool() { return fd >= 0; }
+};
+class WiFiServer
+{
+public:
+    WiFiServer(uint16_t port) : port(port) {}
+    void begin();
+    WiFiClient available();
+    WiFiClient accept() { return available(); }
+    void stop();
+    void setNoDelay(bool) {}
+    uint16_t port; int fd = -1;
+};
+struct IPAddress { String toString() { return String("127.0.0.1"); } };
+class WiFiClass
+{
+public:
+    IPAddress localIP() { return IPAddress(); }
+    void setSleep(int) {}
+    int begin(const char *, const char *) { return 0; }
+    int status() { return WL_CONNECTED; }
+    void disconnect(bool = false) {}
+    int mode(int) { return 0; }
+};
+extern WiFiClass WiFi;
+#define WIFI_STA 1
+#define WIFI_OFF 0
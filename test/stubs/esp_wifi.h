@@ -0,0 +1,4 @@
+#pragma once
+// Host stand-in for the ESP-IDF WiFi driver.
+inline int esp_wifi_stop() { return 0; }
+inline int esp_wifi_start() { return 0; }
@@ -0,0 +1,32 @@
+#pragma once
+// Host stand-in for the FreeRTOS task and semaphore calls, built on std::thread.
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+typedef void *TaskHandle_t;
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef unsigned int TickType_t;
+#define pdTRUE 1
+#define pdFALSE 0
+#define pdPASS 1
+#define portMAX_DELAY 0xffffffff
+#define pdMS_TO_TICKS(x) (x)
+#define portTICK_PERIOD_MS 1
+#define tskNO_AFFINITY -1
+struct StubSem { std::mutex m; std::condition_variable cv; int count = 0; int max = 1; };
+typedef StubSem *SemaphoreHandle_t;
+inline SemaphoreHandle_t xSemaphoreCreateBinary() { return new StubSem(); }
+inline SemaphoreHandle_t xSemaphoreCreateCounting(int mx, int init) { auto s = new StubSem(); s->max = mx; s->count = init; return s; }
+inline SemaphoreHandle_t xSemaphoreCreateMutex() { auto s = new StubSem(); s->count = 1; return s; }
+inline BaseType_t xSemaphoreGive(SemaphoreHandle_t s) { std::lock_guard<std::mutex> l(s->m); if (s->count < s->max) s->count++; s->cv.notify_one(); return pdTRUE; }
+inline BaseType_t xSemaphoreTake(SemaphoreHandle_t s, TickType_t) { std::unique_lock<std::mutex> l(s->m); s->cv.wait(l, [&]{ return s->count > 0; }); s->count--; return pdTRUE; }
+inline BaseType_t xTaskCreatePinnedToCore(void (*fn)(void *), const char *, int, void *arg, int, TaskHandle_t *h, int) { std::thread(fn, arg).detach(); if (h) *h = (void *)1; return pdPASS; }
+inline BaseType_t xTaskCreate(void (*fn)(void *), const char *, int, void *arg, int, TaskHandle_t *h) { std::thread(fn, arg).detach(); if (h) *h = (void *)1; return pdPASS; }
+inline void vTaskDelay(TickType_t t) { std::this_thread::sleep_for(std::chrono::milliseconds(t)); }
+inline void vTaskDelete(TaskHandle_t) {}
+inline int xPortGetCoreID() { return 1; }
+// Each thread gets its own handle, as each task does on the device.
+inline TaskHandle_t xTaskGetCurrentTaskHandle() { static thread_local char task; return &task; }
+inline void xTaskNotifyGive(TaskHandle_t) {}
+inline uint32_t ulTaskNotifyTake(BaseType_t, TickType_t) { return 1; }
@@ -0,0 +1,178 @@
+#pragma once
+// Definitions for the host stand-ins. Include once per test, after src/main.cpp.
+// millis() and micros() run on a fake clock: each micros() call moves it on by 1us,
+// and delay() moves it on without waiting, so timing tests are repeatable.
+#include <Arduino.h>
+#include <M5EPD.h>
+#include <WiFi.h>
+#include <HTTPClient.h>
+#include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <poll.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string>
+#include <new>
+
+HardwareSerial Serial;
+EspClass ESP;
+M5EPD M5;
+SDClass SD;
+WiFiClass WiFi;
+
+static unsigned long long hostMicros = 0;
+unsigned long millis() { return hostMicros / 1000; }
+unsigned long micros() { return ++hostMicros; }
+void delay(unsigned long ms) { hostMicros += ms * 1000ULL; }
+void delayMicroseconds(unsigned int us) { hostMicros += us; }
+long random(long n) { return rand() % n; }
+long random(long a, long b) { return a + rand() % (b - a); }
+void yield() {}
+
+// On the device new goes through the wrapped malloc, so frame allocation counts include it.
+// libstdc++ calls malloc from outside this build, so route new through it here.
+void *operator new(size_t size)
+{
+    void *p = malloc(size);
+    if (p == NULL)
+        throw std::bad_alloc();
+    return p;
+}
+void *operator new[](size_t size) { return operator new(size); }
+void operator delete(void *p) noexcept { free(p); }
+void operator delete[](void *p) noexcept { free(p); }
+
+bool WiFiClient::connect(const char *host, uint16_t port)
+{
+    this->fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    inet_pton(AF_INET, host, &address.sin_addr);
+    if (::connect(this->fd, (sockaddr *)&address, sizeof address) < 0)
+    {
+        ::close(this->fd);
+        this->fd = -1;
+        return false;
+    }
+    return true;
+}
+
+int WiFiClient::available()
+{
+    if (this->fd < 0)
+        return 0;
+    int n = 0;
+    ioctl(this->fd, FIONREAD, &n);
+    if (n == 0)
+    {
+        // delay() doesn't wait, so give the other end a moment to send before reporting nothing.
+        pollfd ready = {this->fd, POLLIN, 0};
+        poll(&ready, 1, 1);
+        ioctl(this->fd, FIONREAD, &n);
+    }
+    if (n == 0)
+    {
+        char c;
+        if (recv(this->fd, &c, 1, MSG_PEEK | MSG_DONTWAIT) == 0)
+        {
+            // The other end closed the connection.
+            ::close(this->fd);
+            this->fd = -1;
+        }
+    }
+    return n;
+}
+
+int WiFiClient::read()
+{
+    uint8_t c;
+    return this->read(&c, 1) == 1 ? c : -1;
+}
+
+int WiFiClient::read(uint8_t *buffer, size_t size)
+{
+    if (this->fd < 0)
+        return -1;
+    return recv(this->fd, buffer, size, MSG_DONTWAIT);
+}
+
+size_t WiFiClient::write(const uint8_t *buffer, size_t size)
+{
+    if (this->fd < 0)
+        return 0;
+    return send(this->fd, buffer, size, MSG_NOSIGNAL);
+}
+
+bool WiFiClient::connected()
+{
+    this->available();
+    return this->fd >= 0;
+}
+
+void WiFiClient::stop()
+{
+    if (this->fd >= 0)
+        ::close(this->fd);
+    this->fd = -1;
+}
+
+void WiFiServer::begin()
+{
+    this->fd = socket(AF_INET, SOCK_STREAM, 0);
+    int one = 1;
+    setsockopt(this->fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof one);
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(this->port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    bind(this->fd, (sockaddr *)&address, sizeof address);
+    listen(this->fd, 1);
+    fcntl(this->fd, F_SETFL, O_NONBLOCK);
+}
+
+WiFiClient WiFiServer::available()
+{
+    WiFiClient client;
+    client.fd = ::accept(this->fd, NULL, NULL);
+    return client;
+}
+
+void WiFiServer::stop()
+{
+    ::close(this->fd);
+}
+
+bool HTTPClient::begin(String url)
+{
+    // Only http://host:port/path URLs are supported.
+    std::string text = url.c_str();
+    text = text.substr(7);
+    size_t slash = text.find('/');
+    std::string hostPort = text.substr(0, slash);
+    size_t colon = hostPort.find(':');
+    this->path = text.substr(slash).c_str();
+    this->host = hostPort.substr(0, colon).c_str();
+    this->port = colon == std::string::npos ? 80 : atoi(hostPort.substr(colon + 1).c_str());
+    return true;
+}
+
+int HTTPClient::GET()
+{
+    if (!this->client.connect(this->host.c_str(), this->port))
+        return -1;
+    std::string request = "GET " + std::string(this->path.c_str()) + " HTTP/1.0\r\nHost: " + this->host.c_str() + "\r\n\r\n";
+    this->client.write((const uint8_t *)request.data(), request.size());
+    // Read the headers, leaving the body in the stream.
+    std::string head;
+    char c;
+    while (head.find("\r\n\r\n") == std::string::npos)
+    {
+        if (recv(this->client.fd, &c, 1, 0) != 1)
+            return -1;
+        head += c;
+    }
+    return atoi(head.c_str() + 9);
+}
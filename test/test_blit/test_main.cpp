@@ -0,0 +1,176 @@
+// Host tests for uiBlitAny(), checked pixel by pixel against a plain reference copy.
+#include <unity.h>
+#include "../../src/main.cpp"
+#include "host.h"
+
+static const int formats[6][2] = {{8, 8}, {8, 4}, {4, 4}, {4, 8}, {1, 4}, {1, 8}};
+
+static int getPixel(const UiPixmap &pixmap, int x, int y)
+{
+    const uint8_t *row = pixmap.data + y * pixmap.stride;
+    if (pixmap.bpp == 8)
+        return UiPixelFormat<8>::get(row, x);
+    if (pixmap.bpp == 4)
+        return UiPixelFormat<4>::get(row, x);
+    return UiPixelFormat<1>::get(row, x);
+}
+
+static void setPixel(const UiPixmap &pixmap, int x, int y, uint8_t value)
+{
+    uint8_t *row = pixmap.data + y * pixmap.stride;
+    if (pixmap.bpp == 8)
+        UiPixelFormat<8>::set(row, x, value);
+    else
+        UiPixelFormat<4>::set(row, x, value);
+}
+
+/// @brief Copies one pixel at a time, clipping each pixel on its own.
+static void referenceBlit(const UiPixmap &src, struct area rect, const UiPixmap &dst, int dstX, int dstY, const UiBlitContext &context)
+{
+    for (int y = 0; y < rect.height; y++)
+    {
+        for (int x = 0; x < rect.width; x++)
+        {
+            int sx = rect.x + x;
+            int sy = rect.y + y;
+            int tx = dstX + x;
+            int ty = dstY + y;
+            if (sx < 0 || sy < 0 || sx >= src.width || sy >= src.height || tx < 0 || ty < 0 || tx >= dst.width || ty >= dst.height)
+                continue;
+            int value = getPixel(src, sx, sy);
+            if (context.keyed && value == context.key)
+                continue;
+            if (context.mask != NULL && !UiPixelFormat<1>::get(context.mask + sy * context.maskStride, sx))
+                continue;
+            if (src.bpp == 1)
+                value = value ? context.ink : context.paper;
+            else if (dst.bpp == 4)
+                value &= 0x0F;
+            setPixel(dst, tx, ty, value);
+        }
+    }
+}
+
+static void fillRandom(std::vector<uint8_t> &buffer)
+{
+    for (uint8_t &b : buffer)
+        b = rand();
+}
+
+/// @brief Blits with uiBlitAny() and the reference, and checks that the whole destination buffer matches.
+static bool blitMatches(UiPixmap src, struct area rect, UiPixmap dst, int dstX, int dstY, UiBlitContext context, std::vector<uint8_t> &dstBuffer)
+{
+    std::vector<uint8_t> expected = dstBuffer;
+    UiPixmap reference = dst;
+    reference.data = expected.data();
+    referenceBlit(src, rect, reference, dstX, dstY, context);
+    TEST_ASSERT_TRUE(uiBlitAny(src, rect, dst, dstX, dstY, context));
+    return expected == dstBuffer;
+}
+
+/// Every source and destination width up to 7, with every clip of a two-row blit: odd and even edges, and areas hanging off either side.
+void test_exhaustive_small_blits()
+{
+    std::vector<uint8_t> srcBuffer(64);
+    std::vector<uint8_t> dstBuffer(64);
+    char message[160];
+    for (int f = 0; f < 6; f++)
+    {
+        for (int srcWidth = 1; srcWidth <= 7; srcWidth++)
+        {
+            for (int dstWidth = 1; dstWidth <= 7; dstWidth++)
+            {
+                for (int rectX = -2; rectX <= srcWidth; rectX++)
+                {
+                    for (int rectWidth = 0; rectWidth <= srcWidth + 2; rectWidth++)
+                    {
+                        for (int dstX = -3; dstX <= dstWidth; dstX++)
+                        {
+                            fillRandom(srcBuffer);
+                            fillRandom(dstBuffer);
+                            UiPixmap src = uiPixmap(srcBuffer.data(), srcWidth, 2, formats[f][0]);
+                            UiPixmap dst = uiPixmap(dstBuffer.data(), dstWidth, 2, formats[f][1]);
+                            UiBlitContext context = {(uint8_t)(rand() % 16), (uint8_t)(rand() % 16)};
+                            if (!blitMatches(src, {rectX, 0, rectWidth, 2}, dst, dstX, rand() % 3 - 1, context, dstBuffer))
+                            {
+                                snprintf(message, sizeof message, "%d->%d source width %d, destination width %d, rect x %d width %d, destination x %d", formats[f][0], formats[f][1], srcWidth, dstWidth, rectX, rectWidth, dstX);
+                                TEST_FAIL_MESSAGE(message);
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+/// Larger random blits with padded strides, several rows and, half the time, a colour key or mask.
+void test_random_blits()
+{
+    std::vector<uint8_t> srcBuffer(100 * 24);
+    std::vector<uint8_t> dstBuffer(100 * 24);
+    std::vector<uint8_t> maskBuffer(16 * 24);
+    char message[160];
+    for (int f = 0; f < 6; f++)
+    {
+        for (int i = 0; i < 3000; i++)
+        {
+            fillRandom(srcBuffer);
+            fillRandom(dstBuffer);
+            fillRandom(maskBuffer);
+            UiPixmap src = uiPixmap(srcBuffer.data(), 1 + rand() % 80, 1 + rand() % 20, formats[f][0]);
+            UiPixmap dst = uiPixmap(dstBuffer.data(), 1 + rand() % 80, 1 + rand() % 20, formats[f][1]);
+            if (rand() % 3 == 0)
+                src.stride += 3;
+            struct area rect = {rand() % 90 - 10, rand() % 24 - 4, rand() % 90, rand() % 24};
+            UiBlitContext context = {(uint8_t)(rand() % 16), (uint8_t)(rand() % 16)};
+            int options = rand() % 4;
+            if (options == 1 || options == 3)
+            {
+                context.keyed = true;
+                context.key = formats[f][0] == 1 ? rand() % 2 : rand() % 16;
+            }
+            if (options == 2 || options == 3)
+            {
+                context.mask = maskBuffer.data();
+                context.maskStride = (src.width + 7) / 8;
+            }
+            if (!blitMatches(src, rect, dst, rand() % 100 - 20, rand() % 28 - 4, context, dstBuffer))
+            {
+                snprintf(message, sizeof message, "%d->%d run %d, options %d", formats[f][0], formats[f][1], i, options);
+                TEST_FAIL_MESSAGE(message);
+            }
+        }
+    }
+}
+
+/// There is no 1-bit destination, so those blits are refused and leave the destination alone.
+void test_no_1bit_destination()
+{
+    std::vector<uint8_t> srcBuffer(64, 0xFF);
+    std::vector<uint8_t> dstBuffer(64, 0x5A);
+    UiPixmap dst = uiPixmap(dstBuffer.data(), 16, 4, 1);
+    for (int bpp : {1, 4, 8})
+    {
+        TEST_ASSERT_FALSE(uiBlitAny(uiPixmap(srcBuffer.data(), 8, 4, bpp), {0, 0, 8, 4}, dst, 0, 0));
+    }
+    TEST_ASSERT_TRUE(std::vector<uint8_t>(64, 0x5A) == dstBuffer);
+}
+
+void setUp()
+{
+}
+
+void tearDown()
+{
+}
+
+int main(int argc, char **argv)
+{
+    srand(84);
+    UNITY_BEGIN();
+    RUN_TEST(test_exhaustive_small_blits);
+    RUN_TEST(test_random_blits);
+    RUN_TEST(test_no_1bit_destination);
+    return UNITY_END();
+}
@@ -0,0 +1,121 @@
+// Host tests for UiCommandQueue and UiManager::processCommands().
+#include <unity.h>
+#include "../../src/main.cpp"
+#include "host.h"
+
+void setUp()
+{
+}
+
+void tearDown()
+{
+}
+
+/// Several std::threads post at once while the test thread takes. Every command must arrive once, in order per producer.
+void test_producers_keep_order()
+{
+    UiCommandQueue *queue = new UiCommandQueue();
+    const int producers = 4;
+    const int perProducer = 100000;
+    std::vector<std::thread> threads;
+    for (int p = 0; p < producers; p++)
+    {
+        threads.emplace_back([queue, p]()
+                             {
+            for (int i = 0; i < perProducer; i++)
+            {
+                UiCommand command;
+                command.type = UiCommand::CMD_MOVE;
+                command.x = p;
+                command.y = i;
+                while (!queue->post(command))
+                {
+                    std::this_thread::yield();
+                }
+            } });
+    }
+    std::vector<int> last(producers, -1);
+    long received = 0;
+    bool ordered = true;
+    UiCommand command;
+    while (received < (long)producers * perProducer)
+    {
+        if (queue->take(command))
+        {
+            ordered = ordered && command.y == last[command.x] + 1;
+            last[command.x] = command.y;
+            received++;
+        }
+    }
+    for (std::thread &thread : threads)
+    {
+        thread.join();
+    }
+    TEST_ASSERT_TRUE(ordered);
+    TEST_ASSERT_FALSE(queue->pending());
+    // Producers retried while the queue was full, so those posts were counted as dropped but nothing was lost.
+    TEST_ASSERT_EQUAL(producers * perProducer, received);
+    delete queue;
+}
+
+void test_full_queue_drops()
+{
+    UiCommandQueue *queue = new UiCommandQueue();
+    UiCommand command;
+    command.type = UiCommand::CMD_CALL;
+    for (uint32_t i = 0; i < commandQueueSize; i++)
+    {
+        TEST_ASSERT_TRUE(queue->post(command));
+    }
+    TEST_ASSERT_FALSE(queue->post(command));
+    TEST_ASSERT_EQUAL(1, queue->dropped.load());
+    TEST_ASSERT_TRUE(queue->take(command));
+    TEST_ASSERT_TRUE(queue->post(command));
+    delete queue;
+}
+
+void test_producers_keep_ui_awake()
+{
+    UiCommandQueue *queue = new UiCommandQueue();
+    TEST_ASSERT_FALSE(queue->hasProducers());
+    queue->addProducer();
+    queue->addProducer();
+    queue->removeProducer();
+    TEST_ASSERT_TRUE(queue->hasProducers());
+    queue->removeProducer();
+    TEST_ASSERT_FALSE(queue->hasProducers());
+    delete queue;
+}
+
+/// An invalidate posted for a child in a frame must make the frame redraw it.
+void test_invalidate_reaches_frame()
+{
+    M5EPD_Canvas *surface = new M5EPD_Canvas(&M5.EPD);
+    surface->createCanvas(540, 960);
+    UiManager *ui = new UiManager(surface);
+    UiFrame *frame = new UiFrame(20, 40, 300, 300);
+    UiLabel *label = new UiLabel(10, 10, "Label");
+    ui->add(frame);
+    frame->add(label);
+    ui->updateDisplay();
+    ui->resetStatus();
+    ui->getUpdateArea();
+    TEST_ASSERT_EQUAL(0, ui->updateArea.width);
+
+    ui->commands.postInvalidate(label);
+    TEST_ASSERT_EQUAL(1, ui->processCommands());
+    ui->getUpdateArea();
+    TEST_ASSERT_GREATER_THAN(0, ui->updateArea.width);
+    TEST_ASSERT_TRUE(areaContains(ui->updateArea, {30, 50, label->width, label->height}));
+}
+
+int main(int argc, char **argv)
+{
+    screenBuffer = (uint8_t *)calloc(screenWidth, screenHeight / 2);
+    UNITY_BEGIN();
+    RUN_TEST(test_producers_keep_order);
+    RUN_TEST(test_full_queue_drops);
+    RUN_TEST(test_producers_keep_ui_awake);
+    RUN_TEST(test_invalidate_reaches_frame);
+    return UNITY_END();
+}
@@ -0,0 +1,150 @@
+// Dashboard mode against dashboard_server.py, run on a local port, and UiJsonStream on its own.
+// Run from the project directory, with python3 on the path.
+#include <unity.h>
+#include "../../src/main.cpp"
+#include "host.h"
+#include <signal.h>
+#include <sys/wait.h>
+
+static const uint16_t port = 5152;
+
+std::vector<std::pair<String, String>> values;
+
+/// @brief Parses a document in chunks of a given size, collecting its values.
+/// @return True if the whole document was read.
+bool parse(const char *document, size_t chunk)
+{
+    values.clear();
+    UiJsonStream parser([](const String &path, const String &value)
+                        { values.push_back(std::make_pair(path, value)); });
+    size_t length = strlen(document);
+    for (size_t i = 0; i < length; i += chunk)
+    {
+        parser.feed(document + i, min(chunk, length - i));
+    }
+    parser.finish();
+    return parser.done();
+}
+
+void setUp()
+{
+}
+
+void tearDown()
+{
+}
+
+/// A document split at any point gives the same values.
+void test_chunked_document()
+{
+    const char *document = "{\"room\": \"Office\", \"temperature\": 20.5, \"ok\": true, \"forecast\": [{\"high\": 18}, {\"high\": -2}]}";
+    for (size_t chunk = 1; chunk <= strlen(document); chunk++)
+    {
+        TEST_ASSERT_TRUE(parse(document, chunk));
+        TEST_ASSERT_EQUAL(5, (int)values.size());
+        TEST_ASSERT_EQUAL_STRING("temperature", values[1].first.c_str());
+        TEST_ASSERT_EQUAL_STRING("20.5", values[1].second.c_str());
+        TEST_ASSERT_EQUAL_STRING("forecast.1.high", values[4].first.c_str());
+        TEST_ASSERT_EQUAL_STRING("-2", values[4].second.c_str());
+    }
+}
+
+/// A number or literal on its own is a whole document, though nothing closes it.
+void test_top_level_scalars()
+{
+    const char *documents[] = {"42", "true", "null", "-1.5e3", "\"text\"", " 7 "};
+    const char *expected[] = {"42", "true", "null", "-1.5e3", "text", "7"};
+    for (int i = 0; i < 6; i++)
+    {
+        TEST_ASSERT_TRUE(parse(documents[i], 1));
+        TEST_ASSERT_EQUAL(1, (int)values.size());
+        TEST_ASSERT_EQUAL_STRING(expected[i], values[0].second.c_str());
+    }
+    TEST_ASSERT_FALSE(parse("{\"a\": 1", 4));
+    TEST_ASSERT_FALSE(parse("[1, 2", 4));
+}
+
+/// The first fetch fills every bound label. After that the server changes the temperature
+/// on every request and the humidity on every third, and only those labels change.
+void test_dashboard_server()
+{
+    UiDashboard dashboard("http://127.0.0.1:" + String(port) + "/dashboard.json", 60);
+    UiLabel *room = new UiLabel(20, 20, 200, 60, "");
+    UiLabel *temperature = new UiLabel(20, 100, 200, 60, "");
+    UiLabel *humidity = new UiLabel(20, 180, 200, 60, "");
+    UiLabel *high = new UiLabel(20, 260, 200, 60, "");
+    dashboard.bind("room", room);
+    dashboard.bind("temperature", temperature, "", " C");
+    dashboard.bind("humidity", humidity, "", "%");
+    dashboard.bind("forecast.1.high", high, "High ");
+
+    TEST_ASSERT_EQUAL(4, dashboard.update());
+    TEST_ASSERT_EQUAL_STRING("Office", room->text.c_str());
+    TEST_ASSERT_EQUAL_STRING("20.0 C", temperature->text.c_str());
+    TEST_ASSERT_EQUAL_STRING("40%", humidity->text.c_str());
+    TEST_ASSERT_EQUAL_STRING("High 21", high->text.c_str());
+    TEST_ASSERT_EQUAL(1, dashboard.update());
+    TEST_ASSERT_EQUAL_STRING("20.5 C", temperature->text.c_str());
+    TEST_ASSERT_EQUAL(1, dashboard.update());
+    TEST_ASSERT_EQUAL(2, dashboard.update());
+    TEST_ASSERT_EQUAL_STRING("41%", humidity->text.c_str());
+    TEST_ASSERT_FALSE(dashboard.due());
+}
+
+/// A fetch that fails leaves the labels alone.
+void test_missing_document()
+{
+    UiDashboard dashboard("http://127.0.0.1:" + String(port) + "/missing.json", 60);
+    UiLabel *room = new UiLabel(20, 20, 200, 60, "Unchanged");
+    dashboard.bind("room", room);
+    TEST_ASSERT_EQUAL(-1, dashboard.update());
+    TEST_ASSERT_EQUAL_STRING("Unchanged", room->text.c_str());
+}
+
+/// @brief Starts dashboard_server.py and waits until it takes connections.
+/// @return The server's process ID, or 0 if it didn't start.
+pid_t startServer()
+{
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        execlp("python3", "python3", "dashboard_server.py", "--port", String(port).c_str(), (char *)NULL);
+        _exit(127);
+    }
+    for (int tries = 0; tries < 100; tries++)
+    {
+        WiFiClient client;
+        if (client.connect("127.0.0.1", port))
+        {
+            client.stop();
+            return pid;
+        }
+        if (waitpid(pid, NULL, WNOHANG) == pid)
+        {
+            return 0;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }
+    kill(pid, SIGTERM);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    screenBuffer = (uint8_t *)calloc(screenWidth, screenHeight / 2);
+    pid_t server = startServer();
+    if (server == 0)
+    {
+        printf("Couldn't start dashboard_server.py on port %d\n", port);
+        return 1;
+    }
+    UNITY_BEGIN();
+    RUN_TEST(test_chunked_document);
+    RUN_TEST(test_top_level_scalars);
+    RUN_TEST(test_dashboard_server);
+    RUN_TEST(test_missing_document);
+    int failures = UNITY_END();
+    kill(server, SIGTERM);
+    waitpid(server, NULL, 0);
+    return failures;
+}
@@ -0,0 +1,145 @@
+// Refresh scenarios run against UiEpdSimulator, on their own manager and screen buffer.
+#include <unity.h>
+#include "../../src/main.cpp"
+#include "host.h"
+
+UiEpdSimulator *simulator;
+UiManager *ui;
+UiLabel *quote;
+UiLabel *status;
+UiButton *quoteButton;
+int quoteCount;
+
+/// @brief Taps a point on the screen and waits for the resulting refresh to finish.
+/// @return The time from the tap to the panel showing the change, in microseconds.
+unsigned long simulateTap(int x, int y)
+{
+    unsigned long start = uiMicros();
+    dispatchTouch(ui, x, y, start);
+    ui->refreshQueue.waitIdle();
+    while (simulator->busy())
+    {
+        uiDelay(5);
+    }
+    ui->resetStatus();
+    return uiMicros() - start;
+}
+
+/// @brief Taps the quote button a few times.
+/// @return The total time taken, in microseconds.
+unsigned long tapQuotes(int taps)
+{
+    unsigned long start = uiMicros();
+    for (int i = 0; i < taps; i++)
+    {
+        simulateTap(quoteButton->x + quoteButton->width / 2, quoteButton->y + quoteButton->height / 2);
+    }
+    return uiMicros() - start;
+}
+
+void setUp()
+{
+    simulator = new UiEpdSimulator();
+    epdSimulator = simulator;
+    M5EPD_Canvas *surface = new M5EPD_Canvas(&M5.EPD);
+    surface->createCanvas(screenWidth, screenHeight);
+    ui = new UiManager(surface);
+    quote = new UiLabel(60, 150, 410, 400, "First quote");
+    std::function<bool(UiButton *, int)> nextQuote = [](UiButton *button, int event)
+    {
+        quote->setText("Quote " + String(++quoteCount));
+        return true;
+    };
+    quoteButton = new UiButton(175, 730, "Next Quote", nextQuote);
+    status = new UiLabel(60, 860, 410, 60, "Status");
+    ui->add(quote);
+    ui->add(quoteButton);
+    ui->add(status);
+    ui->updateDisplay();
+    ui->refreshQueue.waitIdle();
+    ui->resetStatus();
+    simulator->resetStats();
+}
+
+void tearDown()
+{
+    epdSimulator = NULL;
+    delete simulator;
+}
+
+/// Each tap refreshes the panel, and can't finish before the waveforms it runs.
+void test_quote_taps()
+{
+    int before = quoteCount;
+    unsigned long total = tapQuotes(5);
+    TEST_ASSERT_GREATER_THAN(before, quoteCount);
+    TEST_ASSERT_GREATER_OR_EQUAL(5UL, simulator->refreshCount);
+    TEST_ASSERT_GREATER_OR_EQUAL(5 * (epdModeDurations[UPDATE_MODE_INIT] + epdModeDurations[UPDATE_MODE_GC16]), total);
+    char message[120];
+    snprintf(message, sizeof message, "5 quote taps: %lums, %lu refreshes, waited %lums", total / 1000, simulator->refreshCount, simulator->waitTime / 1000);
+    TEST_MESSAGE(message);
+}
+
+/// @brief Changes two separate areas one after the other, without waiting in between.
+/// @return The time until both are on the panel, in microseconds.
+unsigned long changeTwoAreas()
+{
+    unsigned long start = uiMicros();
+    quote->setText("Quote " + String(++quoteCount));
+    ui->updateDisplay();
+    ui->resetStatus();
+    status->setText("Status " + String(quoteCount));
+    ui->updateDisplay();
+    ui->resetStatus();
+    ui->refreshQueue.waitIdle();
+    while (simulator->busy())
+    {
+        uiDelay(5);
+    }
+    return uiMicros() - start;
+}
+
+/// M5EPD's AFSR wait holds the second refresh until the first has finished. Without it they overlap.
+void test_afsr_wait_serialises_refreshes()
+{
+    unsigned long serialised = changeTwoAreas();
+    TEST_ASSERT_GREATER_THAN(0UL, simulator->waitTime);
+    simulator->waitForAllAreas = false;
+    simulator->resetStats();
+    unsigned long overlapped = changeTwoAreas();
+    TEST_ASSERT_EQUAL(0UL, simulator->waitTime);
+    TEST_ASSERT_LESS_THAN(serialised, overlapped);
+    char message[80];
+    snprintf(message, sizeof message, "Two areas: %lums with the AFSR wait, %lums without", serialised / 1000, overlapped / 1000);
+    TEST_MESSAGE(message);
+}
+
+/// The dialog opens, and tapping its close button hides it again.
+void test_modal_open_and_close()
+{
+    unsigned long start = uiMicros();
+    ui->msgbox("Simulation", "Opening and closing a dialog.");
+    ui->updateDisplay();
+    ui->refreshQueue.waitIdle();
+    ui->resetStatus();
+    unsigned long openTime = uiMicros() - start;
+    TEST_ASSERT_TRUE(ui->modal->visible);
+    // The close button sits in the modal's top right corner.
+    unsigned long closeTime = simulateTap(ui->modal->x + ui->modal->width - 25, ui->modal->y + 15);
+    TEST_ASSERT_FALSE(ui->modal->visible);
+    TEST_ASSERT_GREATER_OR_EQUAL(2UL, simulator->refreshCount);
+    TEST_ASSERT_GREATER_OR_EQUAL(epdModeDurations[UPDATE_MODE_GC16], closeTime);
+    char message[80];
+    snprintf(message, sizeof message, "Modal: open %lums, close %lums", openTime / 1000, closeTime / 1000);
+    TEST_MESSAGE(message);
+}
+
+int main(int argc, char **argv)
+{
+    screenBuffer = (uint8_t *)calloc(screenWidth, screenHeight / 2);
+    UNITY_BEGIN();
+    RUN_TEST(test_quote_taps);
+    RUN_TEST(test_afsr_wait_serialises_refreshes);
+    RUN_TEST(test_modal_open_and_close);
+    return UNITY_END();
+}
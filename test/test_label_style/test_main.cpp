@@ -0,0 +1,82 @@
+// Host tests for shared label styles.
+#include <unity.h>
+#include "../../src/main.cpp"
+#include "host.h"
+#include <type_traits>
+
+static_assert(!std::is_copy_constructible<UiLabel>::value, "a copied label would release its style twice");
+static_assert(!std::is_copy_assignable<UiLabel>::value, "an assigned label would release its style twice");
+
+void setUp()
+{
+}
+
+void tearDown()
+{
+}
+
+/// Labels with the same look share one style, and a changed label moves to its own.
+void test_labels_share_styles()
+{
+    UiLabel *a = new UiLabel(0, 0, 100, 40, "A", true);
+    UiLabel *b = new UiLabel(0, 0, 100, 40, "B", true);
+    int before = UiStyle::count();
+    TEST_ASSERT_TRUE(a->style == b->style);
+    a->setFill(3);
+    TEST_ASSERT_FALSE(a->style == b->style);
+    TEST_ASSERT_EQUAL(before + 1, UiStyle::count());
+    b->setFill(3);
+    TEST_ASSERT_TRUE(a->style == b->style);
+    delete a;
+    delete b;
+    TEST_ASSERT_EQUAL(before, UiStyle::count());
+}
+
+/// A label can be styled before init() gives it a size and text.
+void test_setters_before_init()
+{
+    UiLabel *label = new UiLabel();
+    label->setFill(5);
+    label->setTextColour(0);
+    label->setStyle(*UiStyle::button());
+    label->noBorder();
+    TEST_ASSERT_FALSE(label->style->hasOutline);
+    delete label;
+}
+
+/// Sizes past what a style can hold are clamped, so setting one again is still suppressed.
+void test_text_size_clamped()
+{
+    UiLabel *label = new UiLabel(0, 0, 100, 40, "A", true);
+    label->setTextSize(300);
+    TEST_ASSERT_EQUAL(255, label->style->textSize);
+    uint32_t suppressed = updateCounters.suppressed;
+    label->setTextSize(300);
+    TEST_ASSERT_EQUAL(suppressed + 1, updateCounters.suppressed);
+    delete label;
+}
+
+/// Text that reaches the border stays under the outline, as fill, text and outline are drawn in that order.
+void test_outline_over_text()
+{
+    UiLabel *label = new UiLabel(0, 0, 120, 40, "ABCDE");
+    label->draw();
+    uint16_t outline = label->surface.readPixel(1, 1);
+    TEST_ASSERT_FALSE(outline == label->surface.readPixel(60, 20));
+    for (int y = 0; y < label->style->outlineThickness; y++)
+    {
+        TEST_ASSERT_EQUAL(outline, label->surface.readPixel(60, y));
+        TEST_ASSERT_EQUAL(outline, label->surface.readPixel(60, 39 - y));
+    }
+    delete label;
+}
+
+int main(int argc, char **argv)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_labels_share_styles);
+    RUN_TEST(test_setters_before_init);
+    RUN_TEST(test_text_size_clamped);
+    RUN_TEST(test_outline_over_text);
+    return UNITY_END();
+}
@@ -0,0 +1,102 @@
+// Host tests for UiOverdrawStats, counted over real frames from a UiManager.
+#include <unity.h>
+#include "../../src/main.cpp"
+#include "host.h"
+
+UiManager *ui;
+UiLabel *title;
+
+/// @brief Updates the display and waits for the refresh.
+void frame()
+{
+    ui->updateDisplay();
+    ui->refreshQueue.waitIdle();
+    ui->resetStatus();
+}
+
+void setUp()
+{
+}
+
+void tearDown()
+{
+}
+
+/// Pixels the panel has never been sent all count as changed, including those at the ends of rows
+/// next to ones it has: the title starts at the left edge.
+void test_unknown_pixels_count_as_changed()
+{
+    title->setText("Partial");
+    frame();
+    uint64_t firstArea = overdrawStats.refreshed;
+    uint64_t changed = overdrawStats.changed;
+    TEST_ASSERT_LESS_THAN(screenWidth * screenHeight, firstArea);
+    ui->invalidate();
+    frame();
+    // The first area is already on the panel, and everything else is new to it.
+    TEST_ASSERT_EQUAL(screenWidth * screenHeight - firstArea, overdrawStats.changed - changed);
+}
+
+/// Refreshing the whole screen again with nothing changed changes no pixels, on every row.
+void test_unchanged_frame_changes_nothing()
+{
+    ui->invalidate();
+    frame();
+    uint64_t changed = overdrawStats.changed;
+    uint64_t refreshed = overdrawStats.refreshed;
+    ui->invalidate();
+    frame();
+    TEST_ASSERT_EQUAL(screenWidth * screenHeight, overdrawStats.refreshed - refreshed);
+    TEST_ASSERT_EQUAL(0, overdrawStats.changed - changed);
+}
+
+/// Only the part of a widget inside the update area counts as drawn.
+void test_drawn_is_clipped_to_update_area()
+{
+    UiLabel *label = new UiLabel(440, 400, 200, 80, "Off the edge");
+    ui->add(label);
+    frame();
+    uint64_t drawn = overdrawStats.drawn;
+    label->setText("Still off the edge");
+    frame();
+    TEST_ASSERT_EQUAL((screenWidth - 440) * 80, overdrawStats.drawn - drawn);
+}
+
+/// Drawing and packing each refreshed pixel once is no overdraw, and drawing it twice doubles the drawn ratio.
+void test_ratios_without_overdraw()
+{
+    UiOverdrawStats stats;
+    TEST_ASSERT_TRUE(stats.begin());
+    struct area rect = {100, 100, 40, 20};
+    std::vector<uint8_t> pixels(rect.width * rect.height / 2, 0x77);
+    stats.addDrawn(title, rect, rect.width * rect.height);
+    stats.addPacked(title, rect, rect.width * rect.height);
+    stats.endFrame(rect, pixels.data());
+    TEST_ASSERT_EQUAL_FLOAT(1.0, stats.drawnRatio());
+    TEST_ASSERT_EQUAL_FLOAT(1.0, stats.packedRatio());
+    stats.addDrawn(title, rect, rect.width * rect.height);
+    stats.addDrawn(NULL, rect, rect.width * rect.height);
+    stats.addPacked(title, rect, rect.width * rect.height);
+    stats.endFrame(rect, pixels.data());
+    TEST_ASSERT_EQUAL_FLOAT(1.5, stats.drawnRatio());
+    TEST_ASSERT_EQUAL_FLOAT(1.0, stats.packedRatio());
+}
+
+int main(int argc, char **argv)
+{
+    screenBuffer = (uint8_t *)calloc(screenWidth, screenHeight / 2);
+    M5EPD_Canvas *surface = new M5EPD_Canvas(&M5.EPD);
+    surface->createCanvas(screenWidth, screenHeight);
+    ui = new UiManager(surface);
+    title = new UiLabel(0, 60, 300, 120, "Overdraw");
+    ui->add(title);
+    ui->add(new UiButton(40, 600, "Button", NULL));
+    frame();
+    overdrawStats.begin();
+    UNITY_BEGIN();
+    RUN_TEST(test_unknown_pixels_count_as_changed);
+    RUN_TEST(test_unchanged_frame_changes_nothing);
+    RUN_TEST(test_drawn_is_clipped_to_update_area);
+    RUN_TEST(test_ratios_without_overdraw);
+    return UNITY_END();
+}
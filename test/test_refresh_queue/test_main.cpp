@@ -0,0 +1,142 @@
+// Host tests for UiRefreshQueue against a stub controller that records what it is sent.
+#include <unity.h>
+#include "../../src/main.cpp"
+#include "host.h"
+
+static uint8_t pixels[screenWidth * screenHeight / 2];
+
+/// Fills a packed 4-bit buffer for an area with one grey level.
+static std::vector<uint8_t> solid(struct area area, uint8_t grey)
+{
+    return std::vector<uint8_t>(area.width * area.height / 2, grey * 0x11);
+}
+
+void setUp()
+{
+    M5.EPD.calls.clear();
+    M5.EPD.recording = true;
+}
+
+void tearDown()
+{
+    M5.EPD.recording = false;
+}
+
+void test_separate_areas_start_together()
+{
+    UiRefreshQueue queue;
+    queue.submit({0, 0, 100, 100}, pixels, UPDATE_MODE_GC16);
+    queue.submit({200, 0, 100, 100}, pixels, UPDATE_MODE_GC16);
+    TEST_ASSERT_EQUAL(2, queue.activeCount());
+    TEST_ASSERT_EQUAL(4, (int)M5.EPD.calls.size());
+    TEST_ASSERT_EQUAL('W', M5.EPD.calls[0].type);
+    TEST_ASSERT_EQUAL('U', M5.EPD.calls[1].type);
+    TEST_ASSERT_EQUAL(200, M5.EPD.calls[3].x);
+    queue.waitIdle();
+}
+
+/// An overlapping refresh waits for the running one, with its own copy of the pixels.
+void test_overlapping_area_waits()
+{
+    UiRefreshQueue queue;
+    struct area first = {0, 0, 100, 100};
+    struct area second = {50, 50, 100, 100};
+    std::vector<uint8_t> black = solid(first, 0);
+    std::vector<uint8_t> white = solid(second, 15);
+    queue.submit(first, black.data(), UPDATE_MODE_GC16);
+    queue.submit(second, white.data(), UPDATE_MODE_GC16);
+    // The caller may reuse its buffer as soon as submit() returns.
+    std::fill(white.begin(), white.end(), 0);
+    TEST_ASSERT_EQUAL(1, queue.activeCount());
+    TEST_ASSERT_EQUAL(1, (int)queue.queued);
+    TEST_ASSERT_EQUAL(2, (int)M5.EPD.calls.size());
+
+    delay(epdModeDurations[UPDATE_MODE_GC16] / 1000 - 10);
+    queue.poll();
+    TEST_ASSERT_EQUAL(2, (int)M5.EPD.calls.size());
+    delay(20);
+    queue.poll();
+    TEST_ASSERT_EQUAL(4, (int)M5.EPD.calls.size());
+    TEST_ASSERT_EQUAL(50, M5.EPD.calls[2].x);
+    TEST_ASSERT_EQUAL(0xFF, M5.EPD.calls[2].pixels[0]);
+    queue.waitIdle();
+    TEST_ASSERT_TRUE(queue.idle());
+}
+
+/// Waiting refreshes covered by a newer one are dropped, and a newer one inside a waiting one is merged into it.
+void test_waiting_refreshes_merge()
+{
+    UiRefreshQueue queue;
+    struct area running = {0, 0, 200, 200};
+    struct area covered = {20, 20, 40, 40};
+    struct area cover = {10, 10, 100, 100};
+    struct area inside = {30, 30, 20, 20};
+    std::vector<uint8_t> grey = solid(running, 8);
+    std::vector<uint8_t> coveredPixels = solid(covered, 1);
+    std::vector<uint8_t> coverPixels = solid(cover, 2);
+    std::vector<uint8_t> insidePixels = solid(inside, 3);
+    queue.submit(running, grey.data(), UPDATE_MODE_GC16);
+    queue.submit(covered, coveredPixels.data(), UPDATE_MODE_GC16);
+    queue.submit(cover, coverPixels.data(), UPDATE_MODE_GC16);
+    queue.submit(inside, insidePixels.data(), UPDATE_MODE_GC16);
+    TEST_ASSERT_EQUAL(2, (int)queue.merged);
+    TEST_ASSERT_EQUAL(2, (int)M5.EPD.calls.size());
+
+    queue.waitIdle();
+    TEST_ASSERT_EQUAL(4, (int)M5.EPD.calls.size());
+    M5EPD_Driver::Call &write = M5.EPD.calls[2];
+    TEST_ASSERT_EQUAL(cover.x, write.x);
+    TEST_ASSERT_EQUAL(cover.width, write.w);
+    int stride = cover.width / 2;
+    // Outside the merged area the pixels are the covering refresh's, inside they are the newest.
+    TEST_ASSERT_EQUAL(0x22, write.pixels[0]);
+    TEST_ASSERT_EQUAL(0x33, write.pixels[(inside.y - cover.y) * stride + (inside.x - cover.x) / 2]);
+    TEST_ASSERT_EQUAL(0x22, write.pixels[(inside.y - cover.y + inside.height) * stride + (inside.x - cover.x) / 2]);
+}
+
+/// A follow-up waveform runs on the same area without sending the pixels again.
+void test_follow_mode_runs_after_first()
+{
+    UiRefreshQueue queue;
+    queue.submit({0, 0, 100, 100}, pixels, UPDATE_MODE_INIT, UPDATE_MODE_GC16);
+    TEST_ASSERT_EQUAL(2, (int)M5.EPD.calls.size());
+    TEST_ASSERT_EQUAL(UPDATE_MODE_INIT, M5.EPD.calls[1].mode);
+    delay(epdModeDurations[UPDATE_MODE_INIT] / 1000);
+    queue.poll();
+    TEST_ASSERT_EQUAL(3, (int)M5.EPD.calls.size());
+    TEST_ASSERT_EQUAL('U', M5.EPD.calls[2].type);
+    TEST_ASSERT_EQUAL(UPDATE_MODE_GC16, M5.EPD.calls[2].mode);
+    TEST_ASSERT_FALSE(queue.idle());
+    queue.waitIdle();
+    TEST_ASSERT_EQUAL(3, (int)M5.EPD.calls.size());
+}
+
+/// With the simulator active, a follow-up waveform starts when the simulator's first one ends.
+void test_follow_mode_uses_simulator_durations()
+{
+    UiEpdSimulator simulator;
+    simulator.durations[UPDATE_MODE_INIT] = 100000;
+    epdSimulator = &simulator;
+    UiRefreshQueue queue;
+    queue.submit({0, 0, 100, 100}, pixels, UPDATE_MODE_INIT, UPDATE_MODE_GC16);
+    TEST_ASSERT_EQUAL(1, (int)simulator.refreshCount);
+    uiDelay(90);
+    queue.poll();
+    TEST_ASSERT_EQUAL(1, (int)simulator.refreshCount);
+    uiDelay(10);
+    queue.poll();
+    TEST_ASSERT_EQUAL(2, (int)simulator.refreshCount);
+    queue.waitIdle();
+    epdSimulator = NULL;
+}
+
+int main(int argc, char **argv)
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_separate_areas_start_together);
+    RUN_TEST(test_overlapping_area_waits);
+    RUN_TEST(test_waiting_refreshes_merge);
+    RUN_TEST(test_follow_mode_runs_after_first);
+    RUN_TEST(test_follow_mode_uses_simulator_durations);
+    return UNITY_END();
+}
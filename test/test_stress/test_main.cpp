@@ -0,0 +1,447 @@
+// Randomized damage-tracking test: random changes to a random screen, each update checked against a full redraw.
+// Pass a seed count and a step count to run more, e.g. to replay a failing seed.
+#include <unity.h>
+#include "../../src/main.cpp"
+#include "host.h"
+
+static int seeds = 30;
+static int steps = 200;
+
+/**
+ * @brief Renders random changes to a random widget tree, checking each update against a full redraw.
+ * @details Each step applies one change, updates the display as normal and copies the update area
+ * into a copy of what the panel would show. The whole tree is then invalidated and drawn from scratch,
+ * and any pixel that differs is damage the normal update missed. The panel copy is then replaced with
+ * the full redraw, so one missed update is only reported once.
+ * It runs on its own manager and canvas against the EPD simulator.
+ */
+class UiStressTest
+{
+public:
+    UiStressTest(uint32_t seed)
+    {
+        this->seed = seed != 0 ? seed : 1;
+        this->firstSeed = this->seed;
+        this->panel = (uint8_t *)calloc(screenWidth * screenHeight / 2, 1);
+        this->surface = new M5EPD_Canvas(&M5.EPD);
+        this->surface->createCanvas(screenWidth, screenHeight);
+        this->steps = 0;
+        this->failures = 0;
+        this->incrementalPixels = 0;
+        this->fullPixels = 0;
+        this->incrementalTime = 0;
+        this->fullTime = 0;
+    };
+
+    ~UiStressTest()
+    {
+        free(this->panel);
+        delete this->surface;
+    };
+
+    /// @brief Builds a random screen and runs changes against it.
+    /// @param steps The number of changes.
+    /// @return The number of steps where the update missed something.
+    int run(int steps)
+    {
+        UiEpdSimulator simulator;
+        UiEpdSimulator *previousSimulator = epdSimulator;
+        epdSimulator = &simulator;
+        this->ui = new UiManager(this->surface);
+        UiShape *background = new UiShape(0, 0, screenWidth, screenHeight, UiShape::SHAPE_FILL, 15);
+        this->ui->add(background);
+        for (int i = 0; i < 12; i++)
+        {
+            this->addRandom();
+        }
+        this->fullRedraw();
+
+        for (int i = 0; i < steps; i++)
+        {
+            String change = this->mutate();
+            unsigned long start = micros();
+            this->ui->updateDisplay();
+            this->incrementalTime += micros() - start;
+            struct area area = this->ui->updateArea;
+            if (area.width > 0 && area.height > 0)
+            {
+                this->incrementalPixels += area.width * area.height;
+                for (int y = 0; y < area.height; y++)
+                {
+                    for (int x = 0; x < area.width; x++)
+                    {
+                        UiPixelFormat<4>::set(this->panel, (area.y + y) * screenWidth + area.x + x, UiPixelFormat<4>::get(screenBuffer, y * area.width + x));
+                    }
+                }
+            }
+            this->ui->refreshQueue.waitIdle();
+            this->ui->resetStatus();
+
+            struct area missed = this->fullRedraw();
+            this->steps++;
+            if (missed.width > 0)
+            {
+                this->failures++;
+                Serial.println("Step " + String(i) + " (" + change + ") missed " + String(missed.width) + "x" + String(missed.height) + " at " + String(missed.x) + ", " + String(missed.y) + ", update area was " + String(area.width) + "x" + String(area.height) + " at " + String(area.x) + ", " + String(area.y));
+            }
+        }
+
+        for (struct item &item : this->items)
+        {
+            delete item.obj;
+        }
+        this->items.clear();
+        delete this->ui->modal;
+        delete this->ui;
+        delete background;
+        epdSimulator = previousSimulator;
+        return this->failures;
+    };
+
+    void report()
+    {
+        Serial.println("Stress test (seed " + String(this->firstSeed) + "): " + String(this->steps) + " steps, " + String(this->failures) + " with missed damage");
+        char line[120];
+        snprintf(line, sizeof(line), "Incremental: %llu px refreshed, %lums. Full redraws: %llu px, %lums.", (unsigned long long)this->incrementalPixels, this->incrementalTime / 1000, (unsigned long long)this->fullPixels, this->fullTime / 1000);
+        Serial.println(line);
+    };
+
+public:
+    uint32_t firstSeed;
+    int steps;
+    int failures;
+    uint64_t incrementalPixels;
+    uint64_t fullPixels;
+    unsigned long incrementalTime;
+    unsigned long fullTime;
+
+private:
+    enum itemType
+    {
+        ITEM_LABEL,
+        ITEM_BUTTON,
+        ITEM_SHAPE,
+        ITEM_FRAME,
+        ITEM_GRID,
+        ITEM_CHART,
+        ITEM_CONSOLE,
+        ITEM_VECTOR
+    };
+
+    struct item
+    {
+        UiObj *obj;
+        UiFrame *parent;
+        enum itemType type;
+    };
+
+    uint32_t random(uint32_t range)
+    {
+        // xorshift32, so a failing seed can be replayed.
+        this->seed ^= this->seed << 13;
+        this->seed ^= this->seed >> 17;
+        this->seed ^= this->seed << 5;
+        return this->seed % range;
+    };
+
+    String randomText()
+    {
+        static const char *words[] = {"On", "Off", "Kitchen", "21.5", "Battery low", "A much longer line of text", "", "Next"};
+        String text = words[this->random(8)];
+        if (this->random(4) == 0)
+        {
+            text += "\n" + String(words[this->random(8)]);
+        }
+        return text;
+    };
+
+    const uint8_t *randomIcon()
+    {
+        static const uint8_t *icons[] = {icon_home, icon_check, icon_clock};
+        return icons[this->random(3)];
+    };
+
+    /// @brief Adds a random object to the manager or to a random frame.
+    void addRandom()
+    {
+        UiFrame *parent = this->ui;
+        std::vector<UiFrame *> frames;
+        for (struct item &item : this->items)
+        {
+            if (item.type == ITEM_FRAME)
+            {
+                frames.push_back((UiFrame *)item.obj);
+            }
+        }
+        if (!frames.empty() && this->random(2) == 0)
+        {
+            parent = frames[this->random(frames.size())];
+        }
+        int x = (int)this->random(parent->width) - 20;
+        int y = (int)this->random(parent->height) - 20;
+        struct item item = {NULL, parent, (enum itemType)this->random(8)};
+        switch (item.type)
+        {
+        case ITEM_LABEL:
+        {
+            UiLabel *label = new UiLabel(x, y, this->randomText());
+            if (this->random(3) == 0)
+            {
+                label->setFill(this->random(16), this->random(2) * 10);
+            }
+            item.obj = label;
+            break;
+        }
+        case ITEM_BUTTON:
+            item.obj = new UiButton(x, y, this->randomText(), (bool (*)(UiButton *, int))NULL);
+            break;
+        case ITEM_SHAPE:
+            item.obj = new UiShape(x, y, 10 + this->random(200), 2 + this->random(100), (enum UiShape::shapeType)this->random(4), this->random(16), 1 + this->random(5));
+            break;
+        case ITEM_FRAME:
+            item.obj = new UiFrame(x, y, 100 + this->random(200), 100 + this->random(200));
+            break;
+        case ITEM_GRID:
+        {
+            UiGrid *grid = new UiGrid(x, y, 1 + this->random(6), 1 + this->random(8), 20 + this->random(60), 20 + this->random(20));
+            for (int i = this->random(10); i > 0; i--)
+            {
+                grid->setCell(this->random(6), this->random(8), this->randomText());
+            }
+            item.obj = grid;
+            break;
+        }
+        case ITEM_CHART:
+            item.obj = new UiChart(x, y, 60 + this->random(200), 40 + this->random(100), 1 + this->random(4));
+            break;
+        case ITEM_CONSOLE:
+            item.obj = new UiConsole(x, y, 60 + this->random(200), 30 + this->random(150), 1 + this->random(3));
+            break;
+        case ITEM_VECTOR:
+            item.obj = new UiVectorImage(x, y, 8 + this->random(120), 8 + this->random(120), this->randomIcon());
+            break;
+        }
+        item.obj->layer = (enum UiObj::layer_t)this->random(UiObj::LAYER_TOP + 1);
+        parent->add(item.obj);
+        this->items.push_back(item);
+    };
+
+    /// @brief Takes an object out of the screen and deletes it, with anything inside it.
+    void removeItem(size_t index)
+    {
+        UiObj *obj = this->items[index].obj;
+        this->items[index].parent->remove(obj);
+        this->deleteItem(obj);
+    };
+
+    void deleteItem(UiObj *obj)
+    {
+        for (size_t i = 0; i < this->items.size();)
+        {
+            if (this->items[i].obj == obj)
+            {
+                this->items.erase(this->items.begin() + i);
+                continue;
+            }
+            if (this->items[i].parent == obj)
+            {
+                // Restart, since deleting the child may remove other items.
+                this->deleteItem(this->items[i].obj);
+                i = 0;
+                continue;
+            }
+            i++;
+        }
+        delete obj;
+    };
+
+    /// @brief Applies one random change.
+    /// @return A description of the change.
+    String mutate()
+    {
+        if (this->items.empty() || this->random(10) == 0)
+        {
+            this->addRandom();
+            return "add";
+        }
+        size_t index = this->random(this->items.size());
+        struct item &item = this->items[index];
+        UiObj *obj = item.obj;
+        String name = "item " + String((int)index);
+        switch (this->random(7))
+        {
+        case 0:
+            obj->move((int)this->random(item.parent->width) - 20, (int)this->random(item.parent->height) - 20);
+            return "move " + name;
+        case 1:
+            if (obj->visible)
+            {
+                obj->hide();
+                return "hide " + name;
+            }
+            obj->show();
+            return "show " + name;
+        case 2:
+            if (this->random(3) == 0)
+            {
+                this->removeItem(index);
+                return "remove " + name;
+            }
+            this->addRandom();
+            return "add";
+        default:
+            break;
+        }
+        if (item.type == ITEM_SHAPE)
+        {
+            ((UiShape *)obj)->setColour(this->random(16));
+            return "recolour " + name;
+        }
+        if (item.type == ITEM_FRAME)
+        {
+            ((UiFrame *)obj)->setFill(this->random(16));
+            return "fill " + name;
+        }
+        if (item.type == ITEM_CHART)
+        {
+            UiChart *chart = (UiChart *)obj;
+            for (int i = 1 + this->random(20); i > 0; i--)
+            {
+                chart->append((float)this->random(1000) / 10);
+            }
+            return "append " + name;
+        }
+        if (item.type == ITEM_CONSOLE)
+        {
+            UiConsole *console = (UiConsole *)obj;
+            for (int i = 1 + this->random(10); i > 0; i--)
+            {
+                console->append(this->randomText());
+            }
+            return "log " + name;
+        }
+        if (item.type == ITEM_VECTOR)
+        {
+            UiVectorImage *image = (UiVectorImage *)obj;
+            switch (this->random(3))
+            {
+            case 0:
+                image->setColours(this->random(16), this->random(16));
+                return "icon colours " + name;
+            case 1:
+                image->setSize(8 + this->random(120), 8 + this->random(120));
+                return "icon size " + name;
+            default:
+                image->setIcon(this->randomIcon());
+                return "icon " + name;
+            }
+        }
+        if (item.type == ITEM_GRID)
+        {
+            UiGrid *grid = (UiGrid *)obj;
+            switch (this->random(4))
+            {
+            case 0:
+                grid->setCellColours(this->random(6), this->random(8), this->random(16), this->random(16));
+                return "cell colours " + name;
+            case 1:
+                grid->setColumnWidth(this->random(6), 20 + this->random(60));
+                return "column width " + name;
+            default:
+                grid->setCell(this->random(6), this->random(8), this->randomText());
+                return "cell " + name;
+            }
+        }
+        UiLabel *label = (UiLabel *)obj;
+        switch (this->random(4))
+        {
+        case 0:
+            label->setTextColour(this->random(16));
+            return "text colour " + name;
+        case 1:
+            label->setFill(this->random(16), this->random(2) * 10);
+            return "fill " + name;
+        case 2:
+            // Writing the same text again must not damage anything.
+            label->setText(label->text);
+            return "same text " + name;
+        default:
+            label->setText(this->randomText());
+            return "text " + name;
+        }
+    };
+
+    /// @brief Draws everything from scratch and compares it with the panel copy.
+    /// @return The bounding box of the pixels that differed, or an empty area.
+    struct area fullRedraw()
+    {
+        this->ui->invalidate();
+        unsigned long start = micros();
+        this->ui->updateDisplay();
+        this->fullTime += micros() - start;
+        this->fullPixels += screenWidth * screenHeight;
+        int left = screenWidth;
+        int top = screenHeight;
+        int right = 0;
+        int bottom = 0;
+        for (int i = 0; i < screenWidth * screenHeight; i++)
+        {
+            uint8_t pixel = UiPixelFormat<4>::get(screenBuffer, i);
+            if (UiPixelFormat<4>::get(this->panel, i) != pixel)
+            {
+                left = min(left, i % screenWidth);
+                right = max(right, i % screenWidth + 1);
+                top = min(top, i / screenWidth);
+                bottom = max(bottom, i / screenWidth + 1);
+                UiPixelFormat<4>::set(this->panel, i, pixel);
+            }
+        }
+        this->ui->refreshQueue.waitIdle();
+        this->ui->resetStatus();
+        if (right == 0)
+        {
+            return {0, 0, 0, 0};
+        }
+        return {left, top, right - left, bottom - top};
+    };
+
+    uint32_t seed;
+    M5EPD_Canvas *surface;
+    UiManager *ui;
+    uint8_t *panel;
+    std::vector<struct item> items;
+};
+
+void setUp()
+{
+}
+
+void tearDown()
+{
+}
+
+/// No change may leave a pixel that a full redraw would draw differently.
+void test_no_missed_damage()
+{
+    int failures = 0;
+    for (int seed = 1; seed <= seeds; seed++)
+    {
+        UiStressTest test(seed);
+        failures += test.run(steps);
+        test.report();
+    }
+    TEST_ASSERT_EQUAL(0, failures);
+}
+
+int main(int argc, char **argv)
+{
+    if (argc > 2)
+    {
+        seeds = atoi(argv[1]);
+        steps = atoi(argv[2]);
+    }
+    screenBuffer = (uint8_t *)calloc(screenWidth, screenHeight / 2);
+    UNITY_BEGIN();
+    RUN_TEST(test_no_missed_damage);
+    return UNITY_END();
+}
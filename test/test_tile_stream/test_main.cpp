@@ -0,0 +1,291 @@
+// End-to-end test of thin client mode over a loopback socket, against send_tiles.py.
+// The framework renders each frame on the host, which is saved as a PGM, and send_tiles.py streams
+// the tiles that changed since its last frame to a UiTileServer feeding a UiRemoteSurface.
+// Run from the project directory, with python3 on the path.
+#include <unity.h>
+#include "../../src/main.cpp"
+#include "host.h"
+#include <signal.h>
+#include <sys/wait.h>
+
+static const uint16_t port = 5151;
+// send_tiles.py's default tile grid over the whole screen.
+static const int gridTiles = ((screenWidth + 59) / 60) * ((screenHeight + 31) / 32);
+
+/**
+ * @brief Renders frames on the host with a UiManager, and keeps the whole screen they add up to.
+ */
+class HostScreen
+{
+public:
+    HostScreen()
+    {
+        this->surface = new M5EPD_Canvas(&M5.EPD);
+        this->surface->createCanvas(screenWidth, screenHeight);
+        this->ui = new UiManager(this->surface);
+        this->frame.assign(screenWidth * screenHeight, 15);
+    };
+
+    /// @brief Renders the host screen and copies its update area into the frame.
+    /// @return The changed area, in screen coordinates.
+    struct area render()
+    {
+        this->ui->updateDisplay();
+        struct area changed = this->ui->updateArea;
+        this->ui->resetStatus();
+        UiPixmap packed = uiPixmap(screenBuffer, changed.width, changed.height, 4);
+        for (int y = 0; y < changed.height; y++)
+        {
+            for (int x = 0; x < changed.width; x++)
+            {
+                this->frame[(changed.y + y) * screenWidth + changed.x + x] = UiPixelFormat<4>::get(packed.data + y * packed.stride, x);
+            }
+        }
+        return changed;
+    };
+
+    /// @brief Saves the frame as an 8-bit binary PGM, which send_tiles.py reads.
+    String save(int index)
+    {
+        String path = "/tmp/test_tile_stream_" + String((int)getpid()) + "_" + String(index) + ".pgm";
+        FILE *file = fopen(path.c_str(), "wb");
+        fprintf(file, "P5\n%d %d\n255\n", screenWidth, screenHeight);
+        for (uint8_t grey : this->frame)
+        {
+            fputc(grey * 17, file);
+        }
+        fclose(file);
+        this->saved.push_back(path);
+        return path;
+    };
+
+    /// @brief Deletes the saved frames.
+    void clean()
+    {
+        for (const String &path : this->saved)
+        {
+            remove(path.c_str());
+        }
+        this->saved.clear();
+    };
+
+    UiManager *ui;
+    // What the panel should show, one grey value per pixel.
+    std::vector<uint8_t> frame;
+
+private:
+    M5EPD_Canvas *surface;
+    std::vector<String> saved;
+};
+
+UiManager *device;
+UiRemoteSurface *remote;
+UiTileServer *server;
+HostScreen *host;
+// The running send_tiles.py, if any.
+pid_t sender = 0;
+UiLabel *title;
+UiButton *button;
+
+/// @brief Starts send_tiles.py on a list of frames.
+void sendTiles(const std::vector<String> &frames)
+{
+    std::vector<String> args = {"python3", "send_tiles.py", "--port", String(port), "127.0.0.1"};
+    args.insert(args.end(), frames.begin(), frames.end());
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        std::vector<char *> argv;
+        for (String &arg : args)
+        {
+            argv.push_back((char *)arg.c_str());
+        }
+        argv.push_back(NULL);
+        execvp("python3", argv.data());
+        _exit(127);
+    }
+    sender = pid;
+}
+
+/// @brief Waits for the sender to exit.
+/// @return True if it sent every frame.
+bool senderFinished()
+{
+    int status = 0;
+    bool finished = waitpid(sender, &status, 0) == sender && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    sender = 0;
+    return finished;
+}
+
+/// @brief Polls the device until a frame has arrived, as processEvents() does.
+/// @return The number of frames finished.
+int receive()
+{
+    int frames = 0;
+    for (int tries = 0; tries < 50000 && frames == 0; tries++)
+    {
+        frames = server->poll();
+        if (frames == 0)
+        {
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+        }
+    }
+    return frames;
+}
+
+/// @brief Draws what has arrived on the device, and acknowledges it once the refresh has run.
+void showAndAcknowledge()
+{
+    device->updateDisplay();
+    device->resetStatus();
+    device->refreshQueue.waitIdle();
+    server->acknowledge();
+}
+
+/// @brief Checks that the device's copy of the screen matches a host frame, pixel for pixel.
+bool remoteMatches(const std::vector<uint8_t> &frame)
+{
+    UiPixmap pixels = remote->pixmap();
+    for (int y = 0; y < screenHeight; y++)
+    {
+        for (int x = 0; x < screenWidth; x++)
+        {
+            if (pixels.data[y * pixels.stride + x] != frame[y * screenWidth + x])
+            {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+void setUp()
+{
+}
+
+void tearDown()
+{
+    if (sender != 0)
+    {
+        // A failed test leaves the sender waiting for an acknowledgement.
+        kill(sender, SIGTERM);
+        waitpid(sender, NULL, 0);
+        sender = 0;
+    }
+    host->clean();
+}
+
+/// The first frame carries the whole screen, and every later frame only the tiles that changed.
+void test_frames_arrive_intact()
+{
+    std::vector<std::vector<uint8_t>> frames;
+    std::vector<String> paths;
+    for (int i = 0; i < 5; i++)
+    {
+        if (i > 0)
+        {
+            title->setText("Frame " + String(i));
+            button->move(40 + i * 70, 600 + i * 40);
+        }
+        host->render();
+        frames.push_back(host->frame);
+        paths.push_back(host->save(i));
+    }
+    sendTiles(paths);
+    for (int i = 0; i < 5; i++)
+    {
+        uint32_t tiles = server->tiles;
+        TEST_ASSERT_EQUAL(1, receive());
+        if (i == 0)
+        {
+            TEST_ASSERT_EQUAL(gridTiles, server->tiles - tiles);
+        }
+        else
+        {
+            TEST_ASSERT_GREATER_THAN(0, server->tiles - tiles);
+            TEST_ASSERT_LESS_THAN(gridTiles / 2, server->tiles - tiles);
+        }
+        device->getUpdateArea();
+        TEST_ASSERT_TRUE(i == 0 || device->updateArea.width * device->updateArea.height < screenWidth * screenHeight);
+        showAndAcknowledge();
+        TEST_ASSERT_TRUE(remoteMatches(frames[i]));
+    }
+    TEST_ASSERT_TRUE(senderFinished());
+    TEST_ASSERT_EQUAL(0, server->rejected);
+}
+
+/// The host sends its next frame only once the last one's refresh has run.
+void test_ack_follows_refresh()
+{
+    std::vector<String> paths;
+    title->setText("Waiting for the ack");
+    host->render();
+    paths.push_back(host->save(0));
+    title->setText("Acknowledged");
+    host->render();
+    paths.push_back(host->save(1));
+    sendTiles(paths);
+    TEST_ASSERT_EQUAL(1, receive());
+    for (int i = 0; i < 100; i++)
+    {
+        TEST_ASSERT_EQUAL(0, server->poll());
+        std::this_thread::sleep_for(std::chrono::microseconds(200));
+    }
+    showAndAcknowledge();
+    TEST_ASSERT_EQUAL(1, receive());
+    showAndAcknowledge();
+    TEST_ASSERT_TRUE(senderFinished());
+    TEST_ASSERT_TRUE(remoteMatches(host->frame));
+}
+
+/// Tiles are held back until the end of their frame, so a half-received frame is never shown.
+void test_tiles_wait_for_frame_end()
+{
+    WiFiClient client;
+    TEST_ASSERT_TRUE(client.connect("127.0.0.1", port));
+    // One raw 4x2 tile of black at the top left.
+    uint8_t tile[14 + 4] = {'T', 0, 0, 0, 0, 4, 0, 2, 0, UiRemoteSurface::TILE_RAW, 4, 0, 0, 0};
+    client.write(tile, sizeof tile);
+    for (int i = 0; i < 50; i++)
+    {
+        TEST_ASSERT_EQUAL(0, server->poll());
+        std::this_thread::sleep_for(std::chrono::microseconds(200));
+    }
+    device->getUpdateArea();
+    TEST_ASSERT_EQUAL(0, device->updateArea.width);
+    uint8_t end = 'F';
+    client.write(&end, 1);
+    TEST_ASSERT_EQUAL(1, receive());
+    device->getUpdateArea();
+    TEST_ASSERT_TRUE(areaContains(device->updateArea, {0, 0, 4, 2}));
+    showAndAcknowledge();
+    TEST_ASSERT_EQUAL(0, remote->pixmap().data[0]);
+    client.stop();
+}
+
+int main(int argc, char **argv)
+{
+    screenBuffer = (uint8_t *)calloc(screenWidth, screenHeight / 2);
+    M5EPD_Canvas *deviceSurface = new M5EPD_Canvas(&M5.EPD);
+    deviceSurface->createCanvas(screenWidth, screenHeight);
+    device = new UiManager(deviceSurface);
+    remote = new UiRemoteSurface(0, 0, screenWidth, screenHeight);
+    remote->layer = UiObj::LAYER_TOP;
+    device->add(remote);
+    server = new UiTileServer(port);
+    server->begin(remote);
+    device->updateDisplay();
+    device->resetStatus();
+
+    host = new HostScreen();
+    title = new UiLabel(40, 60, 460, 120, "Thin client");
+    button = new UiButton(40, 600, "Button", NULL);
+    host->ui->add(title);
+    host->ui->add(button);
+    host->ui->add(new UiLabel(40, 300, 300, 200, "Static"));
+    UNITY_BEGIN();
+    RUN_TEST(test_frames_arrive_intact);
+    RUN_TEST(test_ack_follows_refresh);
+    RUN_TEST(test_tiles_wait_for_frame_end);
+    return UNITY_END();
+}
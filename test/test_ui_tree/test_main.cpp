@@ -0,0 +1,123 @@
+// Host tests for UiTree, checking what each kind of change damages on a UiManager.
+#include <unity.h>
+#include "../../src/main.cpp"
+#include "host.h"
+
+UiManager *ui;
+
+/// @brief Updates the display and waits for the refresh.
+void frame()
+{
+    ui->updateDisplay();
+    ui->refreshQueue.waitIdle();
+    ui->resetStatus();
+}
+
+/// @brief Works out the update area the next frame would refresh.
+struct area pending()
+{
+    ui->layout();
+    ui->getUpdateArea();
+    return ui->updateArea;
+}
+
+void setUp()
+{
+}
+
+void tearDown()
+{
+}
+
+/// Updating with the same nodes calls no setters and damages nothing.
+void test_unchanged_tree_damages_nothing()
+{
+    UiTree tree(ui);
+    std::vector<UiNode> nodes = {uiLabel("a", 20, 20, 200, 80, "A"), uiFrame("f", 20, 200, 300, 200, {uiLabel("b", 10, 10, "B")})};
+    tree.update(nodes);
+    frame();
+    tree.update(nodes);
+    TEST_ASSERT_EQUAL(3, tree.unchanged);
+    TEST_ASSERT_EQUAL(0, tree.changed);
+    TEST_ASSERT_EQUAL(0, (int)ui->uncoveredAreas.size());
+    TEST_ASSERT_EQUAL(0, pending().width);
+}
+
+/// Moving a widget to another layer redraws its area, so what overlaps it is composited in the new order.
+void test_layer_change_damages_area()
+{
+    UiTree tree(ui);
+    tree.update({uiLabel("a", 20, 20, 200, 80, "A"), uiLabel("b", 100, 60, 200, 80, "B")});
+    frame();
+    tree.update({uiLabel("a", 20, 20, 200, 80, "A").onLayer(UiObj::LAYER_UPPER), uiLabel("b", 100, 60, 200, 80, "B")});
+    TEST_ASSERT_EQUAL(1, tree.changed);
+    TEST_ASSERT_TRUE(areaContains(pending(), {20, 20, 200, 80}));
+}
+
+/// Shrinking a label redraws the area it no longer covers.
+void test_shrink_damages_old_area()
+{
+    UiTree tree(ui);
+    tree.update({uiLabel("a", 20, 20, 200, 80, "A")});
+    frame();
+    tree.update({uiLabel("a", 20, 20, 100, 40, "A")});
+    TEST_ASSERT_EQUAL(1, tree.changed);
+    TEST_ASSERT_TRUE(areaContains(pending(), {20, 20, 200, 80}));
+}
+
+/// Nodes in a new order put their widgets in that order, and redraw them.
+void test_reorder_follows_nodes()
+{
+    UiTree tree(ui);
+    UiLabel *other = new UiLabel(300, 800, "Not in the tree");
+    ui->add(other);
+    size_t first = ui->objects.size();
+    tree.update({uiLabel("a", 20, 20, 200, 80, "A"), uiLabel("b", 100, 60, 200, 80, "B")});
+    frame();
+    UiObj *a = ui->objects[first];
+    UiObj *b = ui->objects[first + 1];
+    tree.update({uiLabel("b", 100, 60, 200, 80, "B"), uiLabel("a", 20, 20, 200, 80, "A")});
+    TEST_ASSERT_EQUAL(first + 2, ui->objects.size());
+    TEST_ASSERT_TRUE(ui->objects[first - 1] == other);
+    TEST_ASSERT_TRUE(ui->objects[first] == b);
+    TEST_ASSERT_TRUE(ui->objects[first + 1] == a);
+    TEST_ASSERT_TRUE(areaContains(pending(), {20, 20, 280, 120}));
+    frame();
+    ui->remove(other);
+    delete other;
+}
+
+/// New nodes create widgets, and widgets without a node are removed, with their area redrawn.
+void test_add_and_remove()
+{
+    size_t before = ui->objects.size();
+    UiTree tree(ui);
+    tree.update({uiLabel("a", 20, 20, 200, 80, "A")});
+    frame();
+    tree.update({uiLabel("a", 20, 20, 200, 80, "A"), uiLabel("c", 20, 400, 200, 80, "C")});
+    TEST_ASSERT_EQUAL(2, tree.created);
+    TEST_ASSERT_EQUAL(before + 2, ui->objects.size());
+    TEST_ASSERT_TRUE(areaContains(pending(), {20, 400, 200, 80}));
+    frame();
+    tree.update({uiLabel("c", 20, 400, 200, 80, "C")});
+    TEST_ASSERT_EQUAL(1, tree.removed);
+    TEST_ASSERT_EQUAL(before + 1, ui->objects.size());
+    TEST_ASSERT_TRUE(areaContains(pending(), {20, 20, 200, 80}));
+    frame();
+}
+
+int main(int argc, char **argv)
+{
+    screenBuffer = (uint8_t *)calloc(screenWidth, screenHeight / 2);
+    M5EPD_Canvas *surface = new M5EPD_Canvas(&M5.EPD);
+    surface->createCanvas(screenWidth, screenHeight);
+    ui = new UiManager(surface);
+    frame();
+    UNITY_BEGIN();
+    RUN_TEST(test_unchanged_tree_damages_nothing);
+    RUN_TEST(test_layer_change_damages_area);
+    RUN_TEST(test_shrink_damages_old_area);
+    RUN_TEST(test_reorder_follows_nodes);
+    RUN_TEST(test_add_and_remove);
+    return UNITY_END();
+}
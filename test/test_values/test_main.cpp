@@ -0,0 +1,85 @@
+// Host tests for UiValue and the counters behind the "Value writes" debug line.
+#include <unity.h>
+#include "../../src/main.cpp"
+#include "host.h"
+
+void setUp()
+{
+    updateCounters = {0, 0, 0, 0};
+}
+
+void tearDown()
+{
+}
+
+/// Several writes in a frame reach observers once, with the last value.
+void test_writes_coalesce()
+{
+    UiValue<int> value(1);
+    std::vector<int> seen;
+    value.observe([&](const int &v)
+                  { seen.push_back(v); });
+    value = 2;
+    value = 3;
+    value = 3;
+    UiPendingValue::flushAll();
+    TEST_ASSERT_EQUAL(2, (int)seen.size());
+    TEST_ASSERT_EQUAL(3, seen[1]);
+    TEST_ASSERT_EQUAL(1, updateCounters.applied);
+    TEST_ASSERT_EQUAL(1, updateCounters.coalesced);
+    TEST_ASSERT_EQUAL(1, updateCounters.suppressed);
+}
+
+/// A value written by another value's observer is flushed in the same frame.
+void test_derived_value_flushes()
+{
+    UiValue<int> celsius(0);
+    UiValue<int> fahrenheit(32);
+    celsius.observe([&](const int &c)
+                    { fahrenheit = c * 9 / 5 + 32; });
+    celsius = 100;
+    UiPendingValue::flushAll();
+    TEST_ASSERT_EQUAL(212, fahrenheit.get());
+}
+
+/// Observers that keep writing each other stop after a few passes, and carry on next frame.
+void test_feedback_loop_is_capped()
+{
+    UiValue<int> a(0);
+    UiValue<int> b(0);
+    a.observe([&](const int &v)
+              { b = v + 1; });
+    b.observe([&](const int &v)
+              { a = v + 1; });
+    // Each observer has already written the other once, when it was added.
+    UiPendingValue::flushAll();
+    uint32_t applied = updateCounters.applied;
+    TEST_ASSERT_GREATER_THAN(0, applied);
+    TEST_ASSERT_LESS_OR_EQUAL(2 * UiPendingValue::maxPasses, applied);
+    UiPendingValue::flushAll();
+    TEST_ASSERT_GREATER_THAN(applied, updateCounters.applied);
+}
+
+/// show(), hide() and move() calls that change nothing are counted apart from value writes.
+void test_redundant_calls_counted_separately()
+{
+    UiLabel label(10, 10, 100, 40, "Label");
+    label.show();
+    label.move(10, 10);
+    label.hide();
+    label.hide();
+    label.setText("Label");
+    TEST_ASSERT_EQUAL(3, updateCounters.redundant);
+    TEST_ASSERT_EQUAL(1, updateCounters.suppressed);
+}
+
+int main(int argc, char **argv)
+{
+    screenBuffer = (uint8_t *)calloc(screenWidth, screenHeight / 2);
+    UNITY_BEGIN();
+    RUN_TEST(test_writes_coalesce);
+    RUN_TEST(test_derived_value_flushes);
+    RUN_TEST(test_feedback_loop_is_capped);
+    RUN_TEST(test_redundant_calls_counted_separately);
+    return UNITY_END();
+}
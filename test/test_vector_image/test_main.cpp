@@ -0,0 +1,54 @@
+// Host tests for UiVectorImage and the icon cache behind it.
+#include <unity.h>
+#include "../../src/main.cpp"
+#include "host.h"
+
+void setUp()
+{
+    updateCounters = {0, 0, 0, 0};
+}
+
+void tearDown()
+{
+}
+
+/// Setting the colours or size an image already has is suppressed and doesn't redraw it.
+void test_same_value_writes_suppressed()
+{
+    UiVectorImage image(10, 10, 48, 48, icon_home);
+    image.updated = false;
+    image.setColours(15, 0);
+    image.setSize(48, 48);
+    TEST_ASSERT_FALSE(image.isUpdated());
+    TEST_ASSERT_EQUAL(2, updateCounters.suppressed);
+    image.setColours(0, 15);
+    TEST_ASSERT_TRUE(image.isUpdated());
+    image.updated = false;
+    image.setSize(64, 48);
+    TEST_ASSERT_TRUE(image.isUpdated());
+}
+
+/// Rasterizing a new icon while rendering is an expected allocation; a cache hit allocates nothing.
+void test_cache_miss_is_expected_allocation()
+{
+    iconCache.clear();
+    frameAllocations.start();
+    UiPixmap icon = iconCache.get(icon_check, 40, 40, 15, 0);
+    uint32_t unexpected = frameAllocations.stop();
+    TEST_ASSERT_NOT_NULL(icon.data);
+    TEST_ASSERT_EQUAL(0, unexpected);
+    TEST_ASSERT_GREATER_THAN(0, frameAllocations.expected);
+    frameAllocations.start();
+    iconCache.get(icon_check, 40, 40, 15, 0);
+    TEST_ASSERT_EQUAL(0, frameAllocations.stop());
+    TEST_ASSERT_EQUAL(0, frameAllocations.expected);
+}
+
+int main(int argc, char **argv)
+{
+    screenBuffer = (uint8_t *)calloc(screenWidth, screenHeight / 2);
+    UNITY_BEGIN();
+    RUN_TEST(test_same_value_writes_suppressed);
+    RUN_TEST(test_cache_miss_is_expected_allocation);
+    return UNITY_END();
+}
@@ -0,0 +1,152 @@
+// Host tests for UiWorkPool, with its workers running as std::threads.
+#include <unity.h>
+#include "../../src/main.cpp"
+#include "host.h"
+
+UiWorkPool pool;
+
+void setUp()
+{
+    renderPool.enabled = true;
+}
+
+void tearDown()
+{
+}
+
+/// Every job number must run exactly once, and run() must not return before the last one finishes.
+void test_run_covers_every_job()
+{
+    const int jobs = 97;
+    for (int round = 0; round < 2000; round++)
+    {
+        std::atomic<int> counts[jobs];
+        for (int i = 0; i < jobs; i++)
+        {
+            counts[i].store(0);
+        }
+        pool.run(jobs, [&](int i)
+                 { counts[i].fetch_add(1); });
+        for (int i = 0; i < jobs; i++)
+        {
+            TEST_ASSERT_EQUAL(1, counts[i].load());
+        }
+    }
+}
+
+void test_run_uses_workers()
+{
+    std::mutex mutex;
+    std::vector<std::thread::id> seen;
+    for (int round = 0; round < 200 && seen.size() < 2; round++)
+    {
+        pool.run(16, [&](int i)
+                 {
+            std::this_thread::sleep_for(std::chrono::microseconds(200));
+            std::lock_guard<std::mutex> lock(mutex);
+            if (std::find(seen.begin(), seen.end(), std::this_thread::get_id()) == seen.end())
+            {
+                seen.push_back(std::this_thread::get_id());
+            } });
+    }
+    TEST_ASSERT_GREATER_THAN(1, (int)seen.size());
+}
+
+void test_bands_cover_every_row()
+{
+    for (int rows = 1; rows < 300; rows += 7)
+    {
+        std::vector<std::atomic<int>> counts(rows);
+        pool.runBands(rows, 4, [&](int first, int last)
+                      {
+            for (int row = first; row < last; row++)
+            {
+                counts[row].fetch_add(1);
+            } });
+        for (int row = 0; row < rows; row++)
+        {
+            TEST_ASSERT_EQUAL(1, counts[row].load());
+        }
+    }
+}
+
+/// A screen drawn with the render pool must match one drawn on a single task, byte for byte.
+void test_parallel_render_matches_serial()
+{
+    M5EPD_Canvas *surface = new M5EPD_Canvas(&M5.EPD);
+    surface->createCanvas(screenWidth, screenHeight);
+    UiManager *ui = new UiManager(surface);
+    UiFrame *frame = new UiFrame(20, 40, 300, 500);
+    ui->add(frame);
+    for (int i = 0; i < 6; i++)
+    {
+        UiLabel *label = new UiLabel(10, 10 + i * 70, "Label " + String(i));
+        label->setFill(i % 4 * 3);
+        frame->add(label);
+    }
+    ui->add(new UiButton(340, 700, "Button", NULL));
+    std::vector<uint8_t> serial;
+    for (int parallel = 0; parallel < 2; parallel++)
+    {
+        renderPool.enabled = parallel == 1;
+        memset(screenBuffer, 0, screenWidth * screenHeight / 2);
+        ui->invalidate();
+        ui->getUpdateArea();
+        ui->render();
+        ui->resetStatus();
+        if (!parallel)
+        {
+            serial.assign(screenBuffer, screenBuffer + screenWidth * screenHeight / 2);
+        }
+    }
+    TEST_ASSERT_EQUAL_MEMORY(serial.data(), screenBuffer, serial.size());
+}
+
+/// @brief Allocates a few bytes, in a way the compiler can't leave out.
+void *allocate()
+{
+    void *volatile block = malloc(16);
+    return block;
+}
+
+/// Allocations made by jobs on the workers count towards the frame, and expected ones are set apart.
+void test_worker_allocations_counted()
+{
+    const int jobs = 64;
+    std::atomic<int> onWorkers{0};
+    std::thread::id caller = std::this_thread::get_id();
+    frameAllocations.start();
+    pool.run(jobs, [&](int i)
+             {
+        if (std::this_thread::get_id() != caller)
+        {
+            onWorkers.fetch_add(1);
+        }
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+        free(allocate()); });
+    TEST_ASSERT_GREATER_THAN(0, onWorkers.load());
+    TEST_ASSERT_EQUAL(jobs, frameAllocations.stop());
+    frameAllocations.start();
+    pool.run(jobs, [&](int i)
+             {
+        UiExpectedAllocations resizing;
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+        free(allocate()); });
+    TEST_ASSERT_EQUAL(0, frameAllocations.stop());
+    TEST_ASSERT_EQUAL(jobs, frameAllocations.expected);
+    TEST_ASSERT_EQUAL(0, frameAllocations.allowed);
+}
+
+int main(int argc, char **argv)
+{
+    screenBuffer = (uint8_t *)calloc(screenWidth, screenHeight / 2);
+    pool.begin(2);
+    renderPool.begin(1);
+    UNITY_BEGIN();
+    RUN_TEST(test_run_covers_every_job);
+    RUN_TEST(test_run_uses_workers);
+    RUN_TEST(test_bands_cover_every_row);
+    RUN_TEST(test_parallel_render_matches_serial);
+    RUN_TEST(test_worker_allocations_counted);
+    return UNITY_END();
+}